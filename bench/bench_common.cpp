@@ -0,0 +1,388 @@
+#include "bench_common.hpp"
+
+#if defined(NABTO_CLIENT_STANDIN)
+#include <nabto_client_standin.h>
+#endif
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace bench {
+
+static const size_t ioBufferSize = 64 * 1024;
+
+static void set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void set_nodelay(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+std::string ServiceServer::modeName(Mode mode)
+{
+    switch (mode) {
+        case Mode::ECHO: return "echo";
+        case Mode::SINK: return "sink";
+        case Mode::SOURCE: return "source";
+        case Mode::BANNER: return "banner";
+    }
+    return "unknown";
+}
+
+std::unique_ptr<ServiceServer> ServiceServer::start(Mode mode, uint16_t port)
+{
+    std::unique_ptr<ServiceServer> server(new ServiceServer(mode));
+    if (!server->listen(port)) {
+        return nullptr;
+    }
+    ServiceServer* s = server.get();
+    server->thread_ = std::thread([s]() { s->run(); });
+    return server;
+}
+
+ServiceServer::ServiceServer(Mode mode)
+    : mode_(mode), accepted_(0), bytesRead_(0), bytesWritten_(0)
+{
+}
+
+ServiceServer::~ServiceServer()
+{
+    if (wakeFds_[1] >= 0) {
+        char c = 0;
+        if (write(wakeFds_[1], &c, 1) < 0) {
+            // the server thread is gone already.
+        }
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    for (int fd : { listenFd_, wakeFds_[0], wakeFds_[1] }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool ServiceServer::listen(uint16_t port)
+{
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        ::listen(listenFd_, 1024) != 0 ||
+        pipe(wakeFds_) != 0)
+    {
+        std::cerr << "Could not start the " << modeName(mode_) << " server: " << strerror(errno) << std::endl;
+        return false;
+    }
+    socklen_t length = sizeof(addr);
+    getsockname(listenFd_, (struct sockaddr*)&addr, &length);
+    port_ = ntohs(addr.sin_port);
+    set_nonblocking(listenFd_);
+    return true;
+}
+
+void ServiceServer::run()
+{
+    class Peer {
+     public:
+        int fd_;
+        std::vector<uint8_t> pending_;
+    };
+    std::vector<Peer> peers;
+    std::vector<uint8_t> buffer(ioBufferSize);
+    std::vector<uint8_t> source(ioBufferSize, 0x5a);
+    const std::string banner = "bench ready\r\n";
+    std::vector<struct pollfd> fds;
+    for (;;) {
+        fds.clear();
+        fds.push_back({ wakeFds_[0], POLLIN, 0 });
+        fds.push_back({ listenFd_, POLLIN, 0 });
+        for (auto& p : peers) {
+            short events = POLLIN;
+            if (mode_ == Mode::SOURCE || !p.pending_.empty()) {
+                events |= POLLOUT;
+            }
+            if (mode_ == Mode::ECHO && !p.pending_.empty()) {
+                // Stop reading until the echo is written back.
+                events &= ~POLLIN;
+            }
+            fds.push_back({ p.fd_, events, 0 });
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            for (;;) {
+                int fd = accept(listenFd_, NULL, NULL);
+                if (fd < 0) {
+                    break;
+                }
+                set_nonblocking(fd);
+                set_nodelay(fd);
+                Peer p{fd, {}};
+                if (mode_ == Mode::BANNER) {
+                    p.pending_.assign(banner.begin(), banner.end());
+                }
+                peers.push_back(std::move(p));
+                accepted_++;
+            }
+        }
+        std::vector<Peer> alive;
+        for (size_t i = 0; i < peers.size(); i++) {
+            Peer& p = peers[i];
+            short revents = fds[i + 2].revents;
+            bool closed = false;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = recv(p.fd_, buffer.data(), buffer.size(), 0);
+                if (n > 0) {
+                    bytesRead_ += n;
+                    if (mode_ == Mode::ECHO) {
+                        p.pending_.insert(p.pending_.end(), buffer.begin(), buffer.begin() + n);
+                    }
+                } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    closed = true;
+                }
+            }
+            if (!closed && (revents & POLLOUT)) {
+                const uint8_t* data = p.pending_.data();
+                size_t length = p.pending_.size();
+                if (mode_ == Mode::SOURCE) {
+                    data = source.data();
+                    length = source.size();
+                }
+                ssize_t n = send(p.fd_, data, length, MSG_NOSIGNAL);
+                if (n > 0) {
+                    bytesWritten_ += n;
+                    if (mode_ != Mode::SOURCE) {
+                        p.pending_.erase(p.pending_.begin(), p.pending_.begin() + n);
+                    }
+                } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    closed = true;
+                }
+            }
+            if (closed) {
+                close(p.fd_);
+            } else {
+                alive.push_back(std::move(p));
+            }
+        }
+        peers.swap(alive);
+    }
+    for (auto& p : peers) {
+        close(p.fd_);
+    }
+}
+
+void add_device_options(cxxopts::Options& options)
+{
+    options.add_options("Device")
+        ("product-id", "Product id of the device", cxxopts::value<std::string>()->default_value("pr-standin"))
+        ("device-id", "Device id of the device", cxxopts::value<std::string>()->default_value("de-standin"))
+        ("sct", "Server connect token for the device", cxxopts::value<std::string>()->default_value(""))
+        ("server-url", "Server url, empty for the default", cxxopts::value<std::string>()->default_value(""))
+        ("private-key", "File with the client private key, a new key is made if empty. The key has to be paired with the device when the real SDK is used.", cxxopts::value<std::string>()->default_value(""))
+        ;
+}
+
+DeviceOptions parse_device_options(const cxxopts::ParseResult& result)
+{
+    DeviceOptions options;
+    options.productId_ = result["product-id"].as<std::string>();
+    options.deviceId_ = result["device-id"].as<std::string>();
+    options.serverConnectToken_ = result["sct"].as<std::string>();
+    options.serverUrl_ = result["server-url"].as<std::string>();
+    options.privateKeyFile_ = result["private-key"].as<std::string>();
+    return options;
+}
+
+bool is_standin()
+{
+#if defined(NABTO_CLIENT_STANDIN)
+    return true;
+#else
+    return false;
+#endif
+}
+
+static bool read_file(const std::string& path, std::string& out)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+std::string client_key(std::shared_ptr<nabto::client::Context> context, const DeviceOptions& options)
+{
+    std::string privateKey;
+    if (options.privateKeyFile_.empty()) {
+        privateKey = context->createPrivateKey();
+    } else if (!read_file(options.privateKeyFile_, privateKey)) {
+        std::cerr << "Could not read the private key " << options.privateKeyFile_ << std::endl;
+        return std::string();
+    }
+#if defined(NABTO_CLIENT_STANDIN)
+    nabto_client_standin_add_user(options.productId_.c_str(), options.deviceId_.c_str(), "bench", privateKey.c_str());
+#endif
+    return privateKey;
+}
+
+void configure_connection(std::shared_ptr<nabto::client::Connection> connection, const DeviceOptions& options, const std::string& privateKey)
+{
+    connection->setProductId(options.productId_);
+    connection->setDeviceId(options.deviceId_);
+    connection->setPrivateKey(privateKey);
+    connection->setServerConnectToken(options.serverConnectToken_);
+    if (!options.serverUrl_.empty()) {
+        connection->setServerUrl(options.serverUrl_);
+    }
+}
+
+std::shared_ptr<nabto::client::Connection> connect_device(
+    std::shared_ptr<nabto::client::Context> context,
+    const DeviceOptions& options,
+    const std::map<std::string, uint16_t>& services)
+{
+    std::string privateKey = client_key(context, options);
+    if (privateKey.empty()) {
+        return nullptr;
+    }
+
+#if defined(NABTO_CLIENT_STANDIN)
+    for (auto& s : services) {
+        nabto_client_standin_add_service(options.productId_.c_str(), options.deviceId_.c_str(), s.first.c_str(), "127.0.0.1", s.second);
+    }
+#else
+    for (auto& s : services) {
+        std::cout << "The device needs the service " << s.first << " on 127.0.0.1:" << s.second << std::endl;
+    }
+#endif
+
+    auto connection = context->createConnection();
+    configure_connection(connection, options, privateKey);
+    try {
+        connection->connect()->waitForResult();
+    } catch (nabto::client::NabtoException& e) {
+        std::cerr << "Could not connect to " << options.productId_ << "." << options.deviceId_ << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+    return connection;
+}
+
+ResourceUsage ResourceUsage::now()
+{
+    ResourceUsage usage;
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        usage.cpuSeconds_ = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+            ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        usage.maxRssBytes_ = static_cast<uint64_t>(ru.ru_maxrss) * 1024;
+    }
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size, resident;
+    if (statm >> size >> resident) {
+        usage.rssBytes_ = resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+    usage.openFds_ = count_open_fds();
+    return usage;
+}
+
+size_t count_open_fds()
+{
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return 0;
+    }
+    size_t count = 0;
+    while (readdir(dir) != NULL) {
+        count++;
+    }
+    closedir(dir);
+    // ".", ".." and the directory itself.
+    return count >= 3 ? count - 3 : 0;
+}
+
+int connect_loopback(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    set_nodelay(fd);
+    return fd;
+}
+
+std::string format_bytes(double bytes)
+{
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1f %s", bytes, units[unit]);
+    return buffer;
+}
+
+std::vector<std::string> split(const std::string& in, char delimiter)
+{
+    std::vector<std::string> out;
+    std::stringstream ss(in);
+    std::string item;
+    while (std::getline(ss, item, delimiter)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+} // namespace
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <3rdparty/cxxopts.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+/**
+ * A loopback tcp server providing the services the benchmarks tunnel
+ * to. ECHO writes back what it reads, SINK discards what it reads,
+ * SOURCE writes data until the peer closes the connection and BANNER
+ * writes a short greeting when a connection is accepted and then
+ * discards what it reads.
+ *
+ * All connections are served from a single poll thread such that the
+ * server can keep up with thousands of short lived connections.
+ */
+class ServiceServer {
+ public:
+    enum class Mode {
+        ECHO,
+        SINK,
+        SOURCE,
+        BANNER
+    };
+
+    static std::unique_ptr<ServiceServer> start(Mode mode, uint16_t port = 0);
+    ServiceServer(Mode mode);
+    ~ServiceServer();
+
+    uint16_t port() const { return port_; }
+    Mode mode() const { return mode_; }
+    uint64_t accepted() const { return accepted_; }
+    uint64_t bytesRead() const { return bytesRead_; }
+    uint64_t bytesWritten() const { return bytesWritten_; }
+
+    static std::string modeName(Mode mode);
+
+ private:
+    bool listen(uint16_t port);
+    void run();
+
+    Mode mode_;
+    uint16_t port_ = 0;
+    int listenFd_ = -1;
+    int wakeFds_[2] = { -1, -1 };
+    std::thread thread_;
+    std::atomic<uint64_t> accepted_;
+    std::atomic<uint64_t> bytesRead_;
+    std::atomic<uint64_t> bytesWritten_;
+};
+
+/**
+ * The device the benchmarks connect to. When built against the
+ * stand-in library the device is created in process and the services
+ * are registered on it, with the real SDK the device has to be
+ * configured with tcp tunnel services pointing to the ports the
+ * benchmark servers listen on.
+ */
+class DeviceOptions {
+ public:
+    std::string productId_;
+    std::string deviceId_;
+    std::string serverConnectToken_;
+    std::string privateKeyFile_;
+    std::string serverUrl_;
+};
+
+void add_device_options(cxxopts::Options& options);
+DeviceOptions parse_device_options(const cxxopts::ParseResult& result);
+
+bool is_standin();
+
+/**
+ * The private key the benchmark connects with, from the key file or a
+ * new key. On the stand-in the key is added as a user of the device.
+ * Returns an empty string on error.
+ */
+std::string client_key(std::shared_ptr<nabto::client::Context> context, const DeviceOptions& options);
+
+/**
+ * Set the device, key and server of a connection created by the
+ * caller, which then connects it.
+ */
+void configure_connection(std::shared_ptr<nabto::client::Connection> connection, const DeviceOptions& options, const std::string& privateKey);
+
+/**
+ * Connect to the device. The services are registered on the stand-in
+ * device, with the real SDK they are only printed such that the device
+ * can be configured accordingly.
+ */
+std::shared_ptr<nabto::client::Connection> connect_device(
+    std::shared_ptr<nabto::client::Context> context,
+    const DeviceOptions& options,
+    const std::map<std::string, uint16_t>& services);
+
+/**
+ * Process wide cpu and memory usage.
+ */
+class ResourceUsage {
+ public:
+    static ResourceUsage now();
+
+    double cpuSeconds_ = 0;
+    uint64_t rssBytes_ = 0;
+    uint64_t maxRssBytes_ = 0;
+    size_t openFds_ = 0;
+};
+
+size_t count_open_fds();
+
+/**
+ * Connect a blocking tcp socket to 127.0.0.1:port. Returns -1 on error.
+ */
+int connect_loopback(uint16_t port);
+
+std::string format_bytes(double bytes);
+
+std::vector<std::string> split(const std::string& in, char delimiter);
+
+} // namespace
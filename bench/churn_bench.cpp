@@ -0,0 +1,283 @@
+#include "bench_common.hpp"
+#include "hdr_histogram.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/**
+ * Measures how many short lived tcp sessions per second can be made
+ * through a local port, like http clients without keep-alive or health
+ * checks do. Each session connects, waits for the first byte of the
+ * banner the service writes when it accepts and closes the connection.
+ *
+ * The latency is measured from the start of the connect until the first
+ * byte arrives, which through a tunnel includes the local accept, the
+ * stream open to the device and the device connecting to the service.
+ *
+ * Sessions are made through:
+ *
+ *   tunnel  the local port of a TcpTunnel opened by the SDK.
+ *   direct  the banner service itself, as a baseline without a tunnel.
+ *
+ * The number of open file descriptors is sampled during each run to
+ * find the peak, and again after the run has settled to reveal leaks.
+ */
+
+using Clock = std::chrono::steady_clock;
+using Mode = bench::ServiceServer::Mode;
+
+// 60 seconds in nanoseconds, slower sessions are clamped.
+static const uint64_t highestLatency = 60ULL * 1000 * 1000 * 1000;
+
+class RunResult {
+ public:
+    RunResult() : latency_(highestLatency) {}
+    std::string path_;
+    size_t threads_ = 0;
+    uint64_t sessions_ = 0;
+    uint64_t connectFailures_ = 0;
+    uint64_t firstByteFailures_ = 0;
+    double seconds_ = 0;
+    size_t fdsBefore_ = 0;
+    size_t fdsPeak_ = 0;
+    size_t fdsAfter_ = 0;
+    bench::HdrHistogram latency_;
+
+    double sessionsPerSecond() const { return seconds_ > 0 ? sessions_ / seconds_ : 0; }
+};
+
+class WorkerResult {
+ public:
+    WorkerResult() : latency_(highestLatency) {}
+    uint64_t sessions_ = 0;
+    uint64_t connectFailures_ = 0;
+    uint64_t firstByteFailures_ = 0;
+    bench::HdrHistogram latency_;
+};
+
+static void run_worker(uint16_t port, Clock::time_point deadline, WorkerResult& result)
+{
+    while (Clock::now() < deadline) {
+        auto start = Clock::now();
+        int fd = bench::connect_loopback(port);
+        if (fd < 0) {
+            result.connectFailures_++;
+            // Do not spin when connections are refused.
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        struct timeval tv;
+        tv.tv_sec = 5;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char c;
+        ssize_t n;
+        do {
+            n = recv(fd, &c, 1, 0);
+        } while (n < 0 && errno == EINTR);
+        auto end = Clock::now();
+        close(fd);
+        if (n == 1) {
+            result.sessions_++;
+            result.latency_.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+        } else {
+            result.firstByteFailures_++;
+        }
+    }
+}
+
+static RunResult run(const std::string& path, uint16_t port, size_t threads, std::chrono::seconds duration, std::chrono::milliseconds settle)
+{
+    RunResult result;
+    result.path_ = path;
+    result.threads_ = threads;
+    result.fdsBefore_ = bench::count_open_fds();
+    result.fdsPeak_ = result.fdsBefore_;
+
+    std::vector<WorkerResult> workers(threads);
+    std::vector<std::thread> workerThreads;
+    auto start = Clock::now();
+    auto deadline = start + duration;
+    for (size_t i = 0; i < threads; i++) {
+        workerThreads.push_back(std::thread([&, i]() { run_worker(port, deadline, workers[i]); }));
+    }
+    while (Clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        size_t fds = bench::count_open_fds();
+        if (fds > result.fdsPeak_) {
+            result.fdsPeak_ = fds;
+        }
+    }
+    for (auto& t : workerThreads) {
+        t.join();
+    }
+    result.seconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Give the tunnel time to tear down the streams of the last sessions.
+    std::this_thread::sleep_for(settle);
+    result.fdsAfter_ = bench::count_open_fds();
+
+    for (auto& w : workers) {
+        result.sessions_ += w.sessions_;
+        result.connectFailures_ += w.connectFailures_;
+        result.firstByteFailures_ += w.firstByteFailures_;
+        result.latency_.add(w.latency_);
+    }
+    return result;
+}
+
+static std::string format_us(uint64_t ns)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1f", ns / 1000.0);
+    return buffer;
+}
+
+static void print_header()
+{
+    std::cout << std::left << std::setw(8) << "path"
+              << std::right << std::setw(8) << "threads"
+              << std::setw(11) << "sessions/s"
+              << std::setw(10) << "conn fail"
+              << std::setw(10) << "byte fail"
+              << std::setw(10) << "p50"
+              << std::setw(10) << "p99"
+              << std::setw(10) << "p99.9"
+              << std::setw(10) << "max"
+              << std::setw(8) << "fds"
+              << std::setw(9) << "fd peak"
+              << std::setw(9) << "fd leak"
+              << std::endl;
+}
+
+static void print_result(const RunResult& r)
+{
+    std::cout << std::left << std::setw(8) << r.path_
+              << std::right << std::setw(8) << r.threads_
+              << std::setw(11) << std::fixed << std::setprecision(0) << r.sessionsPerSecond()
+              << std::setw(10) << r.connectFailures_
+              << std::setw(10) << r.firstByteFailures_
+              << std::setw(10) << format_us(r.latency_.valueAtPercentile(50))
+              << std::setw(10) << format_us(r.latency_.valueAtPercentile(99))
+              << std::setw(10) << format_us(r.latency_.valueAtPercentile(99.9))
+              << std::setw(10) << format_us(r.latency_.max())
+              << std::setw(8) << r.fdsBefore_
+              << std::setw(9) << r.fdsPeak_
+              << std::setw(9) << static_cast<int64_t>(r.fdsAfter_) - static_cast<int64_t>(r.fdsBefore_)
+              << std::endl;
+}
+
+static nlohmann::json to_json(const RunResult& r)
+{
+    nlohmann::json j;
+    j["Path"] = r.path_;
+    j["Threads"] = r.threads_;
+    j["Sessions"] = r.sessions_;
+    j["Seconds"] = r.seconds_;
+    j["SessionsPerSecond"] = r.sessionsPerSecond();
+    j["ConnectFailures"] = r.connectFailures_;
+    j["FirstByteFailures"] = r.firstByteFailures_;
+    j["FirstByteP50Ns"] = r.latency_.valueAtPercentile(50);
+    j["FirstByteP99Ns"] = r.latency_.valueAtPercentile(99);
+    j["FirstByteP999Ns"] = r.latency_.valueAtPercentile(99.9);
+    j["FirstByteMaxNs"] = r.latency_.max();
+    j["FdsBefore"] = r.fdsBefore_;
+    j["FdsPeak"] = r.fdsPeak_;
+    j["FdsAfter"] = r.fdsAfter_;
+    return j;
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("churn_bench", "Short lived tcp sessions per second through a tunnel.");
+    options.add_options("Benchmark")
+        ("h,help", "Show help")
+        ("paths", "Comma separated paths to make sessions through (tunnel,direct)", cxxopts::value<std::string>()->default_value("tunnel,direct"))
+        ("threads", "Comma separated numbers of threads making sessions back to back", cxxopts::value<std::string>()->default_value("1,8,32"))
+        ("duration", "Seconds each run lasts", cxxopts::value<uint32_t>()->default_value("5"))
+        ("settle", "Milliseconds to wait after a run before counting file descriptors", cxxopts::value<uint32_t>()->default_value("500"))
+        ("json", "Print the results as json")
+        ("log-level", "SDK log level", cxxopts::value<std::string>()->default_value("error"))
+        ;
+    bench::add_device_options(options);
+
+    try {
+        auto result = options.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+
+        auto paths = bench::split(result["paths"].as<std::string>(), ',');
+        for (auto& p : paths) {
+            if (p != "tunnel" && p != "direct") {
+                std::cerr << "Unknown path " << p << std::endl;
+                return 1;
+            }
+        }
+        std::vector<size_t> threads;
+        for (auto& s : bench::split(result["threads"].as<std::string>(), ',')) {
+            size_t t = std::stoul(s);
+            threads.push_back(t > 0 ? t : 1);
+        }
+        auto duration = std::chrono::seconds(result["duration"].as<uint32_t>());
+        auto settle = std::chrono::milliseconds(result["settle"].as<uint32_t>());
+        bool json = result.count("json") > 0;
+
+        auto server = bench::ServiceServer::start(Mode::BANNER);
+        if (!server) {
+            return 1;
+        }
+
+        auto context = nabto::client::Context::create();
+        context->setLogLevel(result["log-level"].as<std::string>());
+        auto connection = bench::connect_device(context, bench::parse_device_options(result), { { "banner", server->port() } });
+        if (!connection) {
+            return 1;
+        }
+        auto tunnel = connection->createTcpTunnel();
+        tunnel->open("banner", 0)->waitForResult();
+
+        if (!json) {
+            std::cout << (bench::is_standin() ? "SDK: stand-in " : "SDK: ") << nabto::client::Context::version() << std::endl;
+            std::cout << "Connect to first byte latencies in microseconds." << std::endl;
+            print_header();
+        }
+
+        nlohmann::json results = nlohmann::json::array();
+        for (auto& path : paths) {
+            uint16_t port = path == "tunnel" ? tunnel->getLocalPort() : server->port();
+            for (auto t : threads) {
+                RunResult r = run(path, port, t, duration, settle);
+                if (json) {
+                    results.push_back(to_json(r));
+                } else {
+                    print_result(r);
+                }
+            }
+        }
+        if (json) {
+            std::cout << results.dump(2) << std::endl;
+        }
+        tunnel->close()->waitForResult();
+        connection->close()->waitForResult();
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Invalid option: " << e.what() << std::endl;
+        return 1;
+    } catch (nabto::client::NabtoException& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    } catch (std::logic_error& e) {
+        std::cerr << "Invalid number: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
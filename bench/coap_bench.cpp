@@ -0,0 +1,277 @@
+#include "bench_common.hpp"
+#include "hdr_histogram.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/**
+ * Measures the round trip latency of CoAP requests on one connection.
+ * For each path, rate and concurrency GET requests are issued for the
+ * duration, with at most concurrency requests outstanding at a time.
+ * Requests are completed through the future callbacks of the wrapper,
+ * which is the path the client uses when it is not blocking a thread.
+ *
+ * With a rate each request has an intended start time on a fixed
+ * schedule. When the connection falls behind the schedule a request is
+ * sent late, the service latency only counts from when it was sent
+ * while the corrected latency counts from when it should have been
+ * sent, such that stalls are not hidden by coordinated omission. A rate
+ * of 0 sends the next request as soon as a slot is free.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+// 60 seconds in nanoseconds, slower requests are clamped.
+static const uint64_t highestLatency = 60ULL * 1000 * 1000 * 1000;
+
+class RunState {
+ public:
+    RunState() : service_(highestLatency), corrected_(highestLatency) {}
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t outstanding_ = 0;
+    uint64_t errors_ = 0;
+    bench::HdrHistogram service_;
+    bench::HdrHistogram corrected_;
+};
+
+class RunResult {
+ public:
+    RunResult() : service_(highestLatency), corrected_(highestLatency) {}
+    std::string path_;
+    uint32_t rate_ = 0;
+    size_t concurrency_ = 0;
+    uint64_t requests_ = 0;
+    uint64_t errors_ = 0;
+    double seconds_ = 0;
+    bench::HdrHistogram service_;
+    bench::HdrHistogram corrected_;
+
+    double requestsPerSecond() const { return seconds_ > 0 ? requests_ / seconds_ : 0; }
+};
+
+static uint64_t nanoseconds(Clock::duration d)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+static RunResult run(std::shared_ptr<nabto::client::Connection> connection, const std::string& path, uint32_t rate, size_t concurrency, std::chrono::seconds duration)
+{
+    RunResult result;
+    result.path_ = path;
+    result.rate_ = rate;
+    result.concurrency_ = concurrency;
+
+    // Shared with the callbacks, which can outlive the run if the
+    // connection stops answering.
+    auto state = std::make_shared<RunState>();
+    Clock::duration interval = Clock::duration::zero();
+    if (rate > 0) {
+        interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    }
+    auto start = Clock::now();
+    auto deadline = start + duration;
+    for (uint64_t i = 0;; i++) {
+        Clock::time_point intended = start + interval * static_cast<Clock::rep>(i);
+        if (rate > 0) {
+            if (intended >= deadline) {
+                break;
+            }
+            std::this_thread::sleep_until(intended);
+        }
+        {
+            std::unique_lock<std::mutex> lock(state->mutex_);
+            state->cond_.wait(lock, [&]() { return state->outstanding_ < concurrency; });
+            state->outstanding_++;
+        }
+        auto sent = Clock::now();
+        if (sent >= deadline) {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            state->outstanding_--;
+            break;
+        }
+        if (rate == 0) {
+            intended = sent;
+        }
+        result.requests_++;
+
+        auto coap = connection->createCoap("GET", path);
+        // The future keeps the callback, and thereby the request, alive
+        // until it is resolved.
+        coap->execute()->callback(std::make_shared<nabto::client::CallbackFunction>([state, coap, intended, sent](nabto::client::Status status) {
+            auto done = Clock::now();
+            bool failed = !status.ok() || coap->getResponseStatusCode() / 100 != 2;
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            state->service_.record(nanoseconds(done - sent));
+            state->corrected_.record(nanoseconds(done - intended));
+            if (failed) {
+                state->errors_++;
+            }
+            state->outstanding_--;
+            state->cond_.notify_all();
+        }));
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex_);
+    if (!state->cond_.wait_for(lock, std::chrono::seconds(10), [&]() { return state->outstanding_ == 0; })) {
+        // Requests which never completed are counted as errors.
+        state->errors_ += state->outstanding_;
+    }
+    result.seconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+    result.errors_ = state->errors_;
+    result.service_.add(state->service_);
+    result.corrected_.add(state->corrected_);
+    return result;
+}
+
+static std::string format_us(uint64_t ns)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1f", ns / 1000.0);
+    return buffer;
+}
+
+static void print_header()
+{
+    std::cout << std::left << std::setw(24) << "path"
+              << std::right << std::setw(7) << "rate"
+              << std::setw(6) << "conc"
+              << std::setw(10) << "req/s"
+              << std::setw(8) << "errors"
+              << std::setw(10) << "p50"
+              << std::setw(10) << "p99"
+              << std::setw(10) << "p99.9"
+              << std::setw(10) << "max"
+              << std::setw(11) << "c.p50"
+              << std::setw(10) << "c.p99"
+              << std::setw(10) << "c.p99.9"
+              << std::setw(10) << "c.max"
+              << std::endl;
+}
+
+static void print_result(const RunResult& r)
+{
+    std::cout << std::left << std::setw(24) << r.path_
+              << std::right << std::setw(7) << (r.rate_ ? std::to_string(r.rate_) : std::string("max"))
+              << std::setw(6) << r.concurrency_
+              << std::setw(10) << std::fixed << std::setprecision(0) << r.requestsPerSecond()
+              << std::setw(8) << r.errors_
+              << std::setw(10) << format_us(r.service_.valueAtPercentile(50))
+              << std::setw(10) << format_us(r.service_.valueAtPercentile(99))
+              << std::setw(10) << format_us(r.service_.valueAtPercentile(99.9))
+              << std::setw(10) << format_us(r.service_.max())
+              << std::setw(11) << format_us(r.corrected_.valueAtPercentile(50))
+              << std::setw(10) << format_us(r.corrected_.valueAtPercentile(99))
+              << std::setw(10) << format_us(r.corrected_.valueAtPercentile(99.9))
+              << std::setw(10) << format_us(r.corrected_.max())
+              << std::endl;
+}
+
+static nlohmann::json to_json(const bench::HdrHistogram& h)
+{
+    nlohmann::json j;
+    j["Count"] = h.count();
+    j["MinNs"] = h.min();
+    j["MeanNs"] = h.mean();
+    j["P50Ns"] = h.valueAtPercentile(50);
+    j["P99Ns"] = h.valueAtPercentile(99);
+    j["P999Ns"] = h.valueAtPercentile(99.9);
+    j["MaxNs"] = h.max();
+    return j;
+}
+
+static nlohmann::json to_json(const RunResult& r)
+{
+    nlohmann::json j;
+    j["Path"] = r.path_;
+    j["Rate"] = r.rate_;
+    j["Concurrency"] = r.concurrency_;
+    j["Requests"] = r.requests_;
+    j["Errors"] = r.errors_;
+    j["Seconds"] = r.seconds_;
+    j["RequestsPerSecond"] = r.requestsPerSecond();
+    j["Service"] = to_json(r.service_);
+    j["Corrected"] = to_json(r.corrected_);
+    return j;
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("coap_bench", "Round trip latency of CoAP requests.");
+    options.add_options("Benchmark")
+        ("h,help", "Show help")
+        ("paths", "Comma separated CoAP paths to GET", cxxopts::value<std::string>()->default_value("/iam/me,/iam/pairing,/tcp-tunnels/services"))
+        ("rates", "Comma separated request rates per second, 0 sends as fast as the concurrency allows", cxxopts::value<std::string>()->default_value("100,1000"))
+        ("concurrency", "Comma separated numbers of outstanding requests", cxxopts::value<std::string>()->default_value("1,8"))
+        ("duration", "Seconds each run lasts", cxxopts::value<uint32_t>()->default_value("5"))
+        ("json", "Print the results as json")
+        ("log-level", "SDK log level", cxxopts::value<std::string>()->default_value("error"))
+        ;
+    bench::add_device_options(options);
+
+    try {
+        auto result = options.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+
+        auto paths = bench::split(result["paths"].as<std::string>(), ',');
+        std::vector<uint32_t> rates;
+        for (auto& s : bench::split(result["rates"].as<std::string>(), ',')) {
+            rates.push_back(static_cast<uint32_t>(std::stoul(s)));
+        }
+        std::vector<size_t> concurrency;
+        for (auto& s : bench::split(result["concurrency"].as<std::string>(), ',')) {
+            size_t c = std::stoul(s);
+            concurrency.push_back(c > 0 ? c : 1);
+        }
+        auto duration = std::chrono::seconds(result["duration"].as<uint32_t>());
+        bool json = result.count("json") > 0;
+
+        auto context = nabto::client::Context::create();
+        context->setLogLevel(result["log-level"].as<std::string>());
+        auto connection = bench::connect_device(context, bench::parse_device_options(result), {});
+        if (!connection) {
+            return 1;
+        }
+
+        if (!json) {
+            std::cout << (bench::is_standin() ? "SDK: stand-in " : "SDK: ") << nabto::client::Context::version() << std::endl;
+            std::cout << "Latencies in microseconds, c. is corrected for coordinated omission." << std::endl;
+            print_header();
+        }
+
+        nlohmann::json results = nlohmann::json::array();
+        for (auto& path : paths) {
+            for (auto rate : rates) {
+                for (auto c : concurrency) {
+                    RunResult r = run(connection, path, rate, c, duration);
+                    if (json) {
+                        results.push_back(to_json(r));
+                    } else {
+                        print_result(r);
+                    }
+                }
+            }
+        }
+        if (json) {
+            std::cout << results.dump(2) << std::endl;
+        }
+        connection->close()->waitForResult();
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Invalid option: " << e.what() << std::endl;
+        return 1;
+    } catch (nabto::client::NabtoException& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    } catch (std::logic_error& e) {
+        std::cerr << "Invalid number: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include "noop_client.hpp"
+
+#include <nabto_client.hpp>
+#include <nabto/nabto_client.h>
+
+#include <benchmark/benchmark.h>
+
+/**
+ * Overhead of the C++ wrapper. The wrapper is linked against a C API
+ * which resolves every future at once, so the numbers are the cost of
+ * the allocations, copies, reference counting and dispatch the wrapper
+ * adds on top of the SDK.
+ */
+
+using namespace nabto::client;
+
+class BenchFixture {
+ public:
+    BenchFixture()
+    {
+        context_ = Context::create();
+        connection_ = context_->createConnection();
+    }
+    std::shared_ptr<Context> context_;
+    std::shared_ptr<Connection> connection_;
+};
+
+// Create a future, wait for it and destroy it.
+static void BM_FutureVoidWait(benchmark::State& state)
+{
+    BenchFixture f;
+    for (auto _ : state) {
+        f.connection_->close()->waitForResult();
+    }
+}
+BENCHMARK(BM_FutureVoidWait);
+
+// Destroying a future which was never waited for hands the C future to
+// a new wrapper future which frees it from its callback.
+static void BM_FutureVoidDiscard(benchmark::State& state)
+{
+    BenchFixture f;
+    for (auto _ : state) {
+        auto future = f.connection_->close();
+        benchmark::DoNotOptimize(future);
+    }
+}
+BENCHMARK(BM_FutureVoidDiscard);
+
+// The future keeps itself alive through a self reference until the
+// callback has run.
+static void BM_FutureVoidCallback(benchmark::State& state)
+{
+    BenchFixture f;
+    int calls = 0;
+    for (auto _ : state) {
+        f.connection_->close()->callback([&calls](Status) { calls++; });
+    }
+    benchmark::DoNotOptimize(calls);
+}
+BENCHMARK(BM_FutureVoidCallback);
+
+static void BM_FutureBufferWait(benchmark::State& state)
+{
+    BenchFixture f;
+    auto stream = f.connection_->createStream();
+    for (auto _ : state) {
+        auto data = stream->readSome(1)->waitForResult();
+        benchmark::DoNotOptimize(data);
+    }
+}
+BENCHMARK(BM_FutureBufferWait);
+
+static void BM_FutureBufferCallback(benchmark::State& state)
+{
+    BenchFixture f;
+    auto stream = f.connection_->createStream();
+    int calls = 0;
+    for (auto _ : state) {
+        stream->readSome(1)->callback([&calls](Status) { calls++; });
+    }
+    benchmark::DoNotOptimize(calls);
+}
+BENCHMARK(BM_FutureBufferCallback);
+
+static void BM_CoapGetResponsePayload(benchmark::State& state)
+{
+    BenchFixture f;
+    noop_client_set_coap_response_size(static_cast<size_t>(state.range(0)));
+    auto coap = f.connection_->createCoap("GET", "/iam/me");
+    coap->execute()->waitForResult();
+    for (auto _ : state) {
+        auto payload = coap->getResponsePayload();
+        benchmark::DoNotOptimize(payload);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CoapGetResponsePayload)->RangeMultiplier(16)->Range(16, 64 * 1024);
+
+// A whole request as the client makes it, create, execute, status and
+// payload.
+static void BM_CoapRequest(benchmark::State& state)
+{
+    BenchFixture f;
+    noop_client_set_coap_response_size(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        auto coap = f.connection_->createCoap("GET", "/iam/me");
+        coap->execute()->waitForResult();
+        int status = coap->getResponseStatusCode();
+        auto payload = coap->getResponsePayload();
+        benchmark::DoNotOptimize(status);
+        benchmark::DoNotOptimize(payload);
+    }
+}
+BENCHMARK(BM_CoapRequest)->Arg(16)->Arg(1024);
+
+static void BM_StreamReadSome(benchmark::State& state)
+{
+    BenchFixture f;
+    auto stream = f.connection_->createStream();
+    size_t size = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        auto data = stream->readSome(size)->waitForResult();
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_StreamReadSome)->RangeMultiplier(16)->Range(16, 64 * 1024);
+
+static void BM_StreamReadAll(benchmark::State& state)
+{
+    BenchFixture f;
+    auto stream = f.connection_->createStream();
+    size_t size = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        auto data = stream->readAll(size)->waitForResult();
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_StreamReadAll)->RangeMultiplier(16)->Range(16, 64 * 1024);
+
+static void BM_StreamWrite(benchmark::State& state)
+{
+    BenchFixture f;
+    auto stream = f.connection_->createStream();
+    std::vector<uint8_t> buffer(static_cast<size_t>(state.range(0)), 0x42);
+    for (auto _ : state) {
+        stream->write(buffer)->waitForResult();
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_StreamWrite)->RangeMultiplier(16)->Range(16, 64 * 1024);
+
+class CountingEventsCallback : public ConnectionEventsCallback {
+ public:
+    void onEvent(int event) { events_ += event >= 0 ? 1 : 0; }
+    uint64_t events_ = 0;
+};
+
+// One event delivered from the C listener to the given number of
+// registered callbacks.
+static void BM_ConnectionNotifyEvent(benchmark::State& state)
+{
+    BenchFixture f;
+    std::vector<std::shared_ptr<CountingEventsCallback> > callbacks;
+    for (int64_t i = 0; i < state.range(0); i++) {
+        auto cb = std::make_shared<CountingEventsCallback>();
+        f.connection_->addEventsListener(cb);
+        callbacks.push_back(cb);
+    }
+    for (auto _ : state) {
+        noop_client_connection_event(NABTO_CLIENT_CONNECTION_EVENT_CHANNEL_CHANGED);
+    }
+    for (auto& cb : callbacks) {
+        f.connection_->removeEventsListener(cb);
+    }
+}
+BENCHMARK(BM_ConnectionNotifyEvent)->Arg(0)->Arg(1)->Arg(4)->Arg(16);
+
+class CountingLogger : public Logger {
+ public:
+    void log(LogMessage message) { bytes_ += message.getMessage().size(); }
+    uint64_t bytes_ = 0;
+};
+
+static void BM_LoggerDispatch(benchmark::State& state)
+{
+    BenchFixture f;
+    f.context_->setLogger(std::make_shared<CountingLogger>());
+    for (auto _ : state) {
+        noop_client_log(NABTO_CLIENT_LOG_SEVERITY_INFO, "noop", "connection 42 changed channel to 7");
+    }
+}
+BENCHMARK(BM_LoggerDispatch);
+
+// With a rate limit most messages are dropped after the pattern lookup.
+static void BM_LoggerDispatchRateLimited(benchmark::State& state)
+{
+    BenchFixture f;
+    f.context_->setLogger(std::make_shared<CountingLogger>());
+    f.context_->setLogRateLimit(10, 10, 0);
+    for (auto _ : state) {
+        noop_client_log(NABTO_CLIENT_LOG_SEVERITY_INFO, "noop", "connection 42 changed channel to 7");
+    }
+}
+BENCHMARK(BM_LoggerDispatchRateLimited);
+
+BENCHMARK_MAIN();
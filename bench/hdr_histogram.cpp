@@ -0,0 +1,148 @@
+#include "hdr_histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bench {
+
+static int bits_used(uint64_t value)
+{
+    int bits = 0;
+    while (value) {
+        bits++;
+        value >>= 1;
+    }
+    return bits;
+}
+
+HdrHistogram::HdrHistogram(uint64_t highestTrackable, int significantDigits)
+    : highestTrackable_(highestTrackable < 2 ? 2 : highestTrackable)
+{
+    // Enough sub buckets to tell 10^digits values apart within a power of two.
+    uint64_t largestSingleUnitResolution = 2 * static_cast<uint64_t>(std::pow(10, significantDigits));
+    int subBucketCountMagnitude = static_cast<int>(std::ceil(std::log2(static_cast<double>(largestSingleUnitResolution))));
+    subBucketHalfCountMagnitude_ = (subBucketCountMagnitude > 1 ? subBucketCountMagnitude : 1) - 1;
+    uint64_t subBucketCount = uint64_t(1) << (subBucketHalfCountMagnitude_ + 1);
+    subBucketHalfCount_ = subBucketCount / 2;
+    subBucketMask_ = subBucketCount - 1;
+
+    size_t bucketCount = 1;
+    uint64_t smallestUntrackable = subBucketCount;
+    while (smallestUntrackable <= highestTrackable_) {
+        if (smallestUntrackable > (UINT64_MAX >> 1)) {
+            bucketCount++;
+            break;
+        }
+        smallestUntrackable <<= 1;
+        bucketCount++;
+    }
+    counts_.resize((bucketCount + 1) * subBucketHalfCount_, 0);
+}
+
+size_t HdrHistogram::indexOf(uint64_t value) const
+{
+    int bucketIndex = bits_used(value | subBucketMask_) - (subBucketHalfCountMagnitude_ + 1);
+    uint64_t subBucketIndex = value >> bucketIndex;
+    return (static_cast<size_t>(bucketIndex + 1) << subBucketHalfCountMagnitude_) + (subBucketIndex - subBucketHalfCount_);
+}
+
+uint64_t HdrHistogram::lowestEquivalent(size_t index) const
+{
+    int bucketIndex = static_cast<int>(index >> subBucketHalfCountMagnitude_) - 1;
+    uint64_t subBucketIndex = (index & (subBucketHalfCount_ - 1)) + subBucketHalfCount_;
+    if (bucketIndex < 0) {
+        subBucketIndex -= subBucketHalfCount_;
+        bucketIndex = 0;
+    }
+    return subBucketIndex << bucketIndex;
+}
+
+uint64_t HdrHistogram::highestEquivalent(size_t index) const
+{
+    int bucketIndex = static_cast<int>(index >> subBucketHalfCountMagnitude_) - 1;
+    if (bucketIndex < 0) {
+        bucketIndex = 0;
+    }
+    return lowestEquivalent(index) + (uint64_t(1) << bucketIndex) - 1;
+}
+
+void HdrHistogram::record(uint64_t value)
+{
+    if (value > highestTrackable_) {
+        value = highestTrackable_;
+    }
+    counts_[indexOf(value)]++;
+    total_++;
+    if (value < min_) {
+        min_ = value;
+    }
+    if (value > max_) {
+        max_ = value;
+    }
+}
+
+void HdrHistogram::add(const HdrHistogram& other)
+{
+    for (size_t i = 0; i < other.counts_.size(); i++) {
+        if (other.counts_[i] == 0) {
+            continue;
+        }
+        uint64_t value = other.lowestEquivalent(i);
+        counts_[indexOf(value > highestTrackable_ ? highestTrackable_ : value)] += other.counts_[i];
+    }
+    total_ += other.total_;
+    if (other.total_ && other.min_ < min_) {
+        min_ = other.min_;
+    }
+    if (other.max_ > max_) {
+        max_ = other.max_;
+    }
+}
+
+void HdrHistogram::reset()
+{
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+}
+
+uint64_t HdrHistogram::valueAtPercentile(double percentile) const
+{
+    if (total_ == 0) {
+        return 0;
+    }
+    if (percentile > 100) {
+        percentile = 100;
+    }
+    uint64_t target = static_cast<uint64_t>(std::ceil(percentile / 100.0 * total_));
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+        seen += counts_[i];
+        if (seen >= target) {
+            uint64_t value = highestEquivalent(i);
+            return value < max_ ? value : max_;
+        }
+    }
+    return max_;
+}
+
+double HdrHistogram::mean() const
+{
+    if (total_ == 0) {
+        return 0;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+        if (counts_[i]) {
+            // the middle of the equivalent value range.
+            sum += counts_[i] * (lowestEquivalent(i) + highestEquivalent(i)) / 2.0;
+        }
+    }
+    return sum / total_;
+}
+
+} // namespace
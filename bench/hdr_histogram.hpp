@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bench {
+
+/**
+ * A histogram with the bucket layout of HdrHistogram. Values are
+ * recorded with a fixed number of significant decimal digits over the
+ * whole range up to highestTrackable, such that high percentiles keep
+ * their precision at a constant memory cost. Values above the range
+ * are clamped to highestTrackable.
+ *
+ * Not thread safe, record from one thread or merge per thread
+ * histograms with add().
+ */
+class HdrHistogram {
+ public:
+    HdrHistogram(uint64_t highestTrackable, int significantDigits = 3);
+
+    void record(uint64_t value);
+    void add(const HdrHistogram& other);
+    void reset();
+
+    // The highest value which is equivalent to the value at the
+    // percentile, percentile is in the range [0, 100].
+    uint64_t valueAtPercentile(double percentile) const;
+
+    uint64_t count() const { return total_; }
+    uint64_t min() const { return total_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const;
+
+ private:
+    size_t indexOf(uint64_t value) const;
+    uint64_t lowestEquivalent(size_t index) const;
+    uint64_t highestEquivalent(size_t index) const;
+
+    uint64_t highestTrackable_;
+    int subBucketHalfCountMagnitude_;
+    uint64_t subBucketHalfCount_;
+    uint64_t subBucketMask_;
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+} // namespace
@@ -0,0 +1,560 @@
+#include "noop_client.hpp"
+
+#include <nabto/nabto_client.h>
+#include <nabto/nabto_client_experimental.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/**
+ * A Nabto Edge Client C API which does nothing. Operations resolve
+ * their futures with ok right away and callbacks are called from the
+ * thread which set them, so the cost of the C side is a few pointer
+ * writes.
+ */
+
+const NabtoClientError NABTO_CLIENT_EC_OK = 0;
+const NabtoClientError NABTO_CLIENT_EC_ABORTED = 1;
+const NabtoClientError NABTO_CLIENT_EC_BAD_RESPONSE = 2;
+const NabtoClientError NABTO_CLIENT_EC_BAD_REQUEST = 3;
+const NabtoClientError NABTO_CLIENT_EC_CLOSED = 4;
+const NabtoClientError NABTO_CLIENT_EC_DNS = 5;
+const NabtoClientError NABTO_CLIENT_EC_EOF = 6;
+const NabtoClientError NABTO_CLIENT_EC_FORBIDDEN = 7;
+const NabtoClientError NABTO_CLIENT_EC_FUTURE_NOT_RESOLVED = 8;
+const NabtoClientError NABTO_CLIENT_EC_INVALID_ARGUMENT = 9;
+const NabtoClientError NABTO_CLIENT_EC_INVALID_STATE = 10;
+const NabtoClientError NABTO_CLIENT_EC_NOT_CONNECTED = 11;
+const NabtoClientError NABTO_CLIENT_EC_NOT_FOUND = 12;
+const NabtoClientError NABTO_CLIENT_EC_NOT_IMPLEMENTED = 13;
+const NabtoClientError NABTO_CLIENT_EC_NO_CHANNELS = 14;
+const NabtoClientError NABTO_CLIENT_EC_NO_DATA = 15;
+const NabtoClientError NABTO_CLIENT_EC_OPERATION_IN_PROGRESS = 16;
+const NabtoClientError NABTO_CLIENT_EC_PARSE = 17;
+const NabtoClientError NABTO_CLIENT_EC_PORT_IN_USE = 18;
+const NabtoClientError NABTO_CLIENT_EC_STOPPED = 1;
+const NabtoClientError NABTO_CLIENT_EC_TIMEOUT = 19;
+const NabtoClientError NABTO_CLIENT_EC_UNKNOWN = 20;
+const NabtoClientError NABTO_CLIENT_EC_NONE = 21;
+const NabtoClientError NABTO_CLIENT_EC_NOT_ATTACHED = 22;
+const NabtoClientError NABTO_CLIENT_EC_TOKEN_REJECTED = 23;
+const NabtoClientError NABTO_CLIENT_EC_COULD_BLOCK = 24;
+const NabtoClientError NABTO_CLIENT_EC_UNAUTHORIZED = 25;
+const NabtoClientError NABTO_CLIENT_EC_TOO_MANY_REQUESTS = 26;
+const NabtoClientError NABTO_CLIENT_EC_UNKNOWN_PRODUCT_ID = 27;
+const NabtoClientError NABTO_CLIENT_EC_UNKNOWN_DEVICE_ID = 28;
+const NabtoClientError NABTO_CLIENT_EC_UNKNOWN_SERVER_KEY = 29;
+const NabtoClientError NABTO_CLIENT_EC_CONNECTION_REFUSED = 30;
+const NabtoClientError NABTO_CLIENT_EC_PRIVILEGED_PORT = 31;
+const NabtoClientError NABTO_CLIENT_EC_INTERNAL_ERROR = 32;
+const NabtoClientError NABTO_CLIENT_EC_DEVICE_INTERNAL_ERROR = 32;
+
+const NabtoClientConnectionEvent NABTO_CLIENT_CONNECTION_EVENT_CONNECTED = 0;
+const NabtoClientConnectionEvent NABTO_CLIENT_CONNECTION_EVENT_CLOSED = 1;
+const NabtoClientConnectionEvent NABTO_CLIENT_CONNECTION_EVENT_CHANNEL_CHANGED = 2;
+
+struct NabtoClient_ {
+    NabtoClientLogCallback logCallback_ = NULL;
+    void* logData_ = NULL;
+};
+
+struct NabtoClientFuture_ {
+    bool resolved_ = false;
+    NabtoClientError ec_ = 0;
+    NabtoClientFutureCallback callback_ = NULL;
+    void* data_ = NULL;
+};
+
+struct NabtoClientListener_ {
+    NabtoClientFuture* future_ = NULL;
+    NabtoClientConnectionEvent* event_ = NULL;
+    bool stopped_ = false;
+};
+
+struct NabtoClientConnection_ {
+    int dummy_;
+};
+
+struct NabtoClientCoap_ {
+    int dummy_;
+};
+
+struct NabtoClientStream_ {
+    int dummy_;
+};
+
+struct NabtoClientTcpTunnel_ {
+    int dummy_;
+};
+
+struct NabtoClientMdnsResult_ {
+    int dummy_;
+};
+
+static std::vector<NabtoClient*> contexts;
+static std::vector<NabtoClientListener*> eventListeners;
+static std::vector<uint8_t> coapResponse;
+
+static void resolve(NabtoClientFuture* future, NabtoClientError ec)
+{
+    future->resolved_ = true;
+    future->ec_ = ec;
+    NabtoClientFutureCallback cb = future->callback_;
+    if (cb != NULL) {
+        future->callback_ = NULL;
+        cb(future, ec, future->data_);
+    }
+}
+
+static char* copy_string(const char* str)
+{
+    size_t length = strlen(str);
+    char* out = (char*)malloc(length + 1);
+    memcpy(out, str, length + 1);
+    return out;
+}
+
+void noop_client_set_coap_response_size(size_t size)
+{
+    coapResponse.assign(size, 0x42);
+}
+
+void noop_client_connection_event(int event)
+{
+    // The callbacks listen for the next event, which changes the list.
+    std::vector<NabtoClientListener*> listeners = eventListeners;
+    for (auto l : listeners) {
+        if (l->future_ != NULL) {
+            NabtoClientFuture* future = l->future_;
+            l->future_ = NULL;
+            *l->event_ = event;
+            resolve(future, NABTO_CLIENT_EC_OK);
+        }
+    }
+}
+
+void noop_client_log(int severity, const char* module, const char* message)
+{
+    static const char* severities[] = { "error", "warn", "info", "debug", "trace" };
+    NabtoClientLogMessage msg;
+    msg.severity = (NabtoClientLogSeverity)severity;
+    msg.severityString = severities[severity < 0 || severity > 4 ? 2 : severity];
+    msg.module = module;
+    msg.file = NULL;
+    msg.line = 0;
+    msg.message = message;
+    for (auto c : contexts) {
+        if (c->logCallback_ != NULL) {
+            c->logCallback_(&msg, c->logData_);
+        }
+    }
+}
+
+extern "C" {
+
+NabtoClient* NABTO_CLIENT_API nabto_client_new()
+{
+    NabtoClient* context = new NabtoClient();
+    contexts.push_back(context);
+    return context;
+}
+
+void NABTO_CLIENT_API nabto_client_free(NabtoClient* context)
+{
+    contexts.erase(std::remove(contexts.begin(), contexts.end(), context), contexts.end());
+    delete context;
+}
+
+void NABTO_CLIENT_API nabto_client_stop(NabtoClient* context)
+{
+    (void)context;
+}
+
+const char* NABTO_CLIENT_API nabto_client_version()
+{
+    return "0.0.0-noop";
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_set_log_callback(NabtoClient* context, NabtoClientLogCallback callback, void* data)
+{
+    context->logCallback_ = callback;
+    context->logData_ = data;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_set_log_level(NabtoClient* context, const char* level)
+{
+    (void)context; (void)level;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_create_private_key(NabtoClient* context, char** privateKey)
+{
+    (void)context;
+    *privateKey = copy_string("noop private key");
+    return NABTO_CLIENT_EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_string_free(char* str)
+{
+    free(str);
+}
+
+const char* NABTO_CLIENT_API nabto_client_error_get_message(NabtoClientError error)
+{
+    return error == NABTO_CLIENT_EC_OK ? "Ok" : "Error";
+}
+
+const char* NABTO_CLIENT_API nabto_client_error_get_string(NabtoClientError error)
+{
+    return error == NABTO_CLIENT_EC_OK ? "NABTO_CLIENT_EC_OK" : "NABTO_CLIENT_EC_UNKNOWN";
+}
+
+NabtoClientFuture* NABTO_CLIENT_API nabto_client_future_new(NabtoClient* context)
+{
+    (void)context;
+    return new NabtoClientFuture();
+}
+
+void NABTO_CLIENT_API nabto_client_future_free(NabtoClientFuture* future)
+{
+    delete future;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_future_wait(NabtoClientFuture* future)
+{
+    // Nothing can resolve a pending future while this thread waits.
+    return future->resolved_ ? future->ec_ : NABTO_CLIENT_EC_FUTURE_NOT_RESOLVED;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_future_error_code(NabtoClientFuture* future)
+{
+    return future->resolved_ ? future->ec_ : NABTO_CLIENT_EC_FUTURE_NOT_RESOLVED;
+}
+
+void NABTO_CLIENT_API nabto_client_future_set_callback(NabtoClientFuture* future, NabtoClientFutureCallback callback, void* data)
+{
+    future->callback_ = callback;
+    future->data_ = data;
+    if (future->resolved_) {
+        resolve(future, future->ec_);
+    }
+}
+
+NabtoClientListener* NABTO_CLIENT_API nabto_client_listener_new(NabtoClient* context)
+{
+    (void)context;
+    return new NabtoClientListener();
+}
+
+void NABTO_CLIENT_API nabto_client_listener_free(NabtoClientListener* listener)
+{
+    eventListeners.erase(std::remove(eventListeners.begin(), eventListeners.end(), listener), eventListeners.end());
+    delete listener;
+}
+
+void NABTO_CLIENT_API nabto_client_listener_stop(NabtoClientListener* listener)
+{
+    listener->stopped_ = true;
+    if (listener->future_ != NULL) {
+        NabtoClientFuture* future = listener->future_;
+        listener->future_ = NULL;
+        resolve(future, NABTO_CLIENT_EC_STOPPED);
+    }
+}
+
+void NABTO_CLIENT_API nabto_client_listener_connection_event(NabtoClientListener* listener, NabtoClientFuture* future, NabtoClientConnectionEvent* event)
+{
+    future->resolved_ = false;
+    if (listener->stopped_) {
+        resolve(future, NABTO_CLIENT_EC_STOPPED);
+        return;
+    }
+    listener->future_ = future;
+    listener->event_ = event;
+}
+
+void NABTO_CLIENT_API nabto_client_listener_new_mdns_result(NabtoClientListener* listener, NabtoClientFuture* future, NabtoClientMdnsResult** mdnsResult)
+{
+    (void)listener; (void)mdnsResult;
+    future->resolved_ = false;
+    resolve(future, NABTO_CLIENT_EC_STOPPED);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_mdns_resolver_init_listener(NabtoClient* client, NabtoClientListener* listener, const char* subtype)
+{
+    (void)client; (void)listener; (void)subtype;
+    return NABTO_CLIENT_EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_mdns_result_free(NabtoClientMdnsResult* result)
+{
+    delete result;
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_device_id(NabtoClientMdnsResult* result)
+{
+    (void)result;
+    return "";
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_product_id(NabtoClientMdnsResult* result)
+{
+    (void)result;
+    return "";
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_service_instance_name(NabtoClientMdnsResult* result)
+{
+    (void)result;
+    return "";
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_txt_items(NabtoClientMdnsResult* result)
+{
+    (void)result;
+    return "{}";
+}
+
+NabtoClientMdnsAction NABTO_CLIENT_API nabto_client_mdns_result_get_action(NabtoClientMdnsResult* result)
+{
+    (void)result;
+    return NABTO_CLIENT_MDNS_ACTION_ADD;
+}
+
+NabtoClientConnection* NABTO_CLIENT_API nabto_client_connection_new(NabtoClient* context)
+{
+    (void)context;
+    return new NabtoClientConnection();
+}
+
+void NABTO_CLIENT_API nabto_client_connection_free(NabtoClientConnection* connection)
+{
+    delete connection;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_events_init_listener(NabtoClientConnection* connection, NabtoClientListener* listener)
+{
+    (void)connection;
+    eventListeners.push_back(listener);
+    return NABTO_CLIENT_EC_OK;
+}
+
+#define NOOP_SETTER(name) \
+    NabtoClientError NABTO_CLIENT_API name(NabtoClientConnection* connection, const char* value) \
+    { \
+        (void)connection; (void)value; \
+        return NABTO_CLIENT_EC_OK; \
+    }
+
+NOOP_SETTER(nabto_client_connection_set_product_id)
+NOOP_SETTER(nabto_client_connection_set_device_id)
+NOOP_SETTER(nabto_client_connection_set_server_key)
+NOOP_SETTER(nabto_client_connection_set_application_name)
+NOOP_SETTER(nabto_client_connection_set_application_version)
+NOOP_SETTER(nabto_client_connection_set_server_url)
+NOOP_SETTER(nabto_client_connection_set_server_jwt_token)
+NOOP_SETTER(nabto_client_connection_set_server_connect_token)
+NOOP_SETTER(nabto_client_connection_set_private_key)
+NOOP_SETTER(nabto_client_connection_set_options)
+
+#define NOOP_STRING_GETTER(name, value) \
+    NabtoClientError NABTO_CLIENT_API name(NabtoClientConnection* connection, char** out) \
+    { \
+        (void)connection; \
+        *out = copy_string(value); \
+        return NABTO_CLIENT_EC_OK; \
+    }
+
+NOOP_STRING_GETTER(nabto_client_connection_get_options, "{}")
+NOOP_STRING_GETTER(nabto_client_connection_get_device_fingerprint, "00000000000000000000000000000000")
+NOOP_STRING_GETTER(nabto_client_connection_get_client_fingerprint, "00000000000000000000000000000000")
+NOOP_STRING_GETTER(nabto_client_connection_get_info, "{}")
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_type(NabtoClientConnection* connection, NabtoClientConnectionType* type)
+{
+    (void)connection;
+    *type = NABTO_CLIENT_CONNECTION_TYPE_DIRECT;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_local_channel_error_code(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_remote_channel_error_code(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_direct_candidates_channel_error_code(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_enable_direct_candidates(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_add_direct_candidate(NabtoClientConnection* connection, const char* hostname, uint16_t port)
+{
+    (void)connection; (void)hostname; (void)port;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_end_of_direct_candidates(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return NABTO_CLIENT_EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_connection_connect(NabtoClientConnection* connection, NabtoClientFuture* future)
+{
+    (void)connection;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_connection_close(NabtoClientConnection* connection, NabtoClientFuture* future)
+{
+    (void)connection;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_connection_password_authenticate(NabtoClientConnection* connection, const char* username, const char* password, NabtoClientFuture* future)
+{
+    (void)connection; (void)username; (void)password;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+NabtoClientCoap* NABTO_CLIENT_API nabto_client_coap_new(NabtoClientConnection* connection, const char* method, const char* path)
+{
+    (void)connection; (void)method; (void)path;
+    return new NabtoClientCoap();
+}
+
+void NABTO_CLIENT_API nabto_client_coap_free(NabtoClientCoap* coap)
+{
+    delete coap;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_set_request_payload(NabtoClientCoap* coap, uint16_t contentFormat, const void* payload, size_t payloadLength)
+{
+    (void)coap; (void)contentFormat; (void)payload; (void)payloadLength;
+    return NABTO_CLIENT_EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_coap_execute(NabtoClientCoap* coap, NabtoClientFuture* future)
+{
+    (void)coap;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_get_response_status_code(NabtoClientCoap* coap, uint16_t* statusCode)
+{
+    (void)coap;
+    *statusCode = 205;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_get_response_content_format(NabtoClientCoap* coap, uint16_t* contentType)
+{
+    (void)coap;
+    *contentType = NABTO_CLIENT_COAP_CONTENT_FORMAT_APPLICATION_OCTET_STREAM;
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_get_response_payload(NabtoClientCoap* coap, void** payload, size_t* payloadLength)
+{
+    (void)coap;
+    *payload = coapResponse.data();
+    *payloadLength = coapResponse.size();
+    return NABTO_CLIENT_EC_OK;
+}
+
+NabtoClientStream* NABTO_CLIENT_API nabto_client_stream_new(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return new NabtoClientStream();
+}
+
+void NABTO_CLIENT_API nabto_client_stream_free(NabtoClientStream* stream)
+{
+    delete stream;
+}
+
+void NABTO_CLIENT_API nabto_client_stream_open(NabtoClientStream* stream, NabtoClientFuture* future, uint32_t port)
+{
+    (void)stream; (void)port;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_read_all(NabtoClientStream* stream, NabtoClientFuture* future, void* buffer, size_t bufferLength, size_t* readLength)
+{
+    (void)stream; (void)buffer;
+    *readLength = bufferLength;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_read_some(NabtoClientStream* stream, NabtoClientFuture* future, void* buffer, size_t bufferLength, size_t* readLength)
+{
+    (void)stream; (void)buffer;
+    *readLength = bufferLength;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_write(NabtoClientStream* stream, NabtoClientFuture* future, const void* buffer, size_t bufferLength)
+{
+    (void)stream; (void)buffer; (void)bufferLength;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_close(NabtoClientStream* stream, NabtoClientFuture* future)
+{
+    (void)stream;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_abort(NabtoClientStream* stream)
+{
+    (void)stream;
+}
+
+NabtoClientTcpTunnel* NABTO_CLIENT_API nabto_client_tcp_tunnel_new(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return new NabtoClientTcpTunnel();
+}
+
+void NABTO_CLIENT_API nabto_client_tcp_tunnel_free(NabtoClientTcpTunnel* tunnel)
+{
+    delete tunnel;
+}
+
+void NABTO_CLIENT_API nabto_client_tcp_tunnel_open(NabtoClientTcpTunnel* tunnel, NabtoClientFuture* future, const char* service, uint16_t localPort)
+{
+    (void)tunnel; (void)service; (void)localPort;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+void NABTO_CLIENT_API nabto_client_tcp_tunnel_close(NabtoClientTcpTunnel* tunnel, NabtoClientFuture* future)
+{
+    (void)tunnel;
+    resolve(future, NABTO_CLIENT_EC_OK);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_tcp_tunnel_get_local_port(NabtoClientTcpTunnel* tunnel, uint16_t* localPort)
+{
+    (void)tunnel;
+    *localPort = 0;
+    return NABTO_CLIENT_EC_OK;
+}
+
+} // extern "C"
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Controls of the no-op implementation of the Nabto Edge Client C API
+ * the wrapper benchmarks link against. Every operation resolves its
+ * future immediately and nothing is sent anywhere, such that only the
+ * cost of the C++ wrapper is measured.
+ *
+ * Not thread safe, the benchmarks drive it from one thread.
+ */
+
+// Size of the payload every CoAP response has.
+void noop_client_set_coap_response_size(size_t size);
+
+// Deliver a connection event to the events listener of every connection.
+void noop_client_connection_event(int event);
+
+// Deliver a log message to the log callback of every context.
+void noop_client_log(int severity, const char* module, const char* message);
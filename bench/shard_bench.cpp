@@ -0,0 +1,340 @@
+#include "bench_common.hpp"
+#include "hdr_histogram.hpp"
+
+#include <context_shards.hpp>
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/**
+ * Measures how connecting and CoAP throughput scale with the number of
+ * client contexts the connections are sharded over.
+ *
+ * For each number of shards the connections are made with at most
+ * --parallel connects outstanding, each connection assigned to a shard
+ * by its bookmark. Then GET requests are sent round robin over all the
+ * connections with --concurrency requests outstanding for the duration.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static const uint64_t highestLatency = 60ULL * 1000 * 1000 * 1000;
+
+// Counts completions of callbacks which can outlive a run.
+class Outstanding {
+ public:
+    void acquire(size_t limit)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() { return outstanding_ < limit; });
+        outstanding_++;
+    }
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_--;
+        cond_.notify_all();
+    }
+    // Returns the number still outstanding after the timeout.
+    size_t waitForAll(std::chrono::seconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait_for(lock, timeout, [&]() { return outstanding_ == 0; });
+        return outstanding_;
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t outstanding_ = 0;
+};
+
+class RunResult {
+ public:
+    RunResult() : latency_(highestLatency) {}
+    size_t shards_ = 0;
+    size_t connections_ = 0;
+    size_t connected_ = 0;
+    double connectSeconds_ = 0;
+    uint64_t requests_ = 0;
+    uint64_t errors_ = 0;
+    double requestSeconds_ = 0;
+    size_t minLoad_ = 0;
+    size_t maxLoad_ = 0;
+    bench::HdrHistogram latency_;
+
+    double connectsPerSecond() const { return connectSeconds_ > 0 ? connected_ / connectSeconds_ : 0; }
+    double requestsPerSecond() const { return requestSeconds_ > 0 ? requests_ / requestSeconds_ : 0; }
+};
+
+class RunOptions {
+ public:
+    size_t connections_;
+    size_t parallel_;
+    size_t concurrency_;
+    std::chrono::seconds duration_;
+    std::string path_;
+    std::string logLevel_;
+    bench::DeviceOptions device_;
+};
+
+static uint64_t nanoseconds(Clock::duration d)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+static bool run(size_t shardCount, const RunOptions& options, RunResult& result)
+{
+    std::string logLevel = options.logLevel_;
+    Sharding::ContextShards shards(shardCount, [logLevel](std::shared_ptr<nabto::client::Context> context) {
+        context->setLogLevel(logLevel);
+    });
+    result.shards_ = shards.size();
+    result.connections_ = options.connections_;
+
+    std::string privateKey = bench::client_key(shards.context(0), options.device_);
+    if (privateKey.empty()) {
+        return false;
+    }
+
+    // Connect
+    class Slot {
+     public:
+        size_t shard_;
+        std::shared_ptr<nabto::client::Connection> connection_;
+        bool connected_ = false;
+    };
+    auto slots = std::make_shared<std::vector<Slot> >(options.connections_);
+    auto connecting = std::make_shared<Outstanding>();
+    auto start = Clock::now();
+    for (size_t i = 0; i < options.connections_; i++) {
+        auto assigned = shards.createConnection(Sharding::ContextShards::bookmarkKey(static_cast<uint32_t>(i)));
+        Slot& slot = (*slots)[i];
+        slot.shard_ = assigned.first;
+        slot.connection_ = assigned.second;
+        bench::configure_connection(slot.connection_, options.device_, privateKey);
+        connecting->acquire(options.parallel_);
+        slot.connection_->connect()->callback(std::make_shared<nabto::client::CallbackFunction>([slots, connecting, i](nabto::client::Status status) {
+            {
+                std::lock_guard<std::mutex> lock(connecting->mutex_);
+                (*slots)[i].connected_ = status.ok();
+            }
+            connecting->release();
+        }));
+    }
+    connecting->waitForAll(std::chrono::seconds(60));
+    result.connectSeconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<std::shared_ptr<nabto::client::Connection> > connections;
+    {
+        std::lock_guard<std::mutex> lock(connecting->mutex_);
+        for (auto& slot : *slots) {
+            if (slot.connected_) {
+                connections.push_back(slot.connection_);
+            }
+        }
+    }
+    result.connected_ = connections.size();
+    auto load = shards.load();
+    result.minLoad_ = *std::min_element(load.begin(), load.end());
+    result.maxLoad_ = *std::max_element(load.begin(), load.end());
+
+    // CoAP requests round robin over the connections.
+    if (!connections.empty()) {
+        class RequestState {
+         public:
+            RequestState() : latency_(highestLatency) {}
+            Outstanding outstanding_;
+            uint64_t errors_ = 0;
+            bench::HdrHistogram latency_;
+        };
+        auto state = std::make_shared<RequestState>();
+        start = Clock::now();
+        auto deadline = start + options.duration_;
+        for (uint64_t i = 0;; i++) {
+            state->outstanding_.acquire(options.concurrency_);
+            auto sent = Clock::now();
+            if (sent >= deadline) {
+                state->outstanding_.release();
+                break;
+            }
+            result.requests_++;
+            auto coap = connections[i % connections.size()]->createCoap("GET", options.path_);
+            coap->execute()->callback(std::make_shared<nabto::client::CallbackFunction>([state, coap, sent](nabto::client::Status status) {
+                auto done = Clock::now();
+                bool failed = !status.ok() || coap->getResponseStatusCode() / 100 != 2;
+                {
+                    std::lock_guard<std::mutex> lock(state->outstanding_.mutex_);
+                    state->latency_.record(nanoseconds(done - sent));
+                    if (failed) {
+                        state->errors_++;
+                    }
+                }
+                state->outstanding_.release();
+            }));
+        }
+        size_t lost = state->outstanding_.waitForAll(std::chrono::seconds(10));
+        result.requestSeconds_ = std::chrono::duration<double>(Clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(state->outstanding_.mutex_);
+        result.errors_ = state->errors_ + lost;
+        result.latency_.add(state->latency_);
+    }
+
+    auto closing = std::make_shared<Outstanding>();
+    for (auto& c : connections) {
+        closing->acquire(options.parallel_);
+        c->close()->callback(std::make_shared<nabto::client::CallbackFunction>([closing](nabto::client::Status) {
+            closing->release();
+        }));
+    }
+    closing->waitForAll(std::chrono::seconds(30));
+    for (auto& slot : *slots) {
+        shards.release(slot.shard_);
+    }
+    return true;
+}
+
+static std::string format_us(uint64_t ns)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1f", ns / 1000.0);
+    return buffer;
+}
+
+static void print_header()
+{
+    std::cout << std::right << std::setw(7) << "shards"
+              << std::setw(8) << "conns"
+              << std::setw(10) << "conn/s"
+              << std::setw(9) << "load"
+              << std::setw(10) << "req/s"
+              << std::setw(8) << "errors"
+              << std::setw(10) << "p50"
+              << std::setw(10) << "p99"
+              << std::setw(10) << "max"
+              << std::endl;
+}
+
+static void print_result(const RunResult& r)
+{
+    std::cout << std::right << std::setw(7) << r.shards_
+              << std::setw(8) << (std::to_string(r.connected_) + (r.connected_ < r.connections_ ? "!" : ""))
+              << std::setw(10) << std::fixed << std::setprecision(0) << r.connectsPerSecond()
+              << std::setw(9) << (std::to_string(r.minLoad_) + "-" + std::to_string(r.maxLoad_))
+              << std::setw(10) << r.requestsPerSecond()
+              << std::setw(8) << r.errors_
+              << std::setw(10) << format_us(r.latency_.valueAtPercentile(50))
+              << std::setw(10) << format_us(r.latency_.valueAtPercentile(99))
+              << std::setw(10) << format_us(r.latency_.max())
+              << std::endl;
+}
+
+static nlohmann::json to_json(const RunResult& r)
+{
+    nlohmann::json j;
+    j["Shards"] = r.shards_;
+    j["Connections"] = r.connections_;
+    j["Connected"] = r.connected_;
+    j["ConnectSeconds"] = r.connectSeconds_;
+    j["ConnectsPerSecond"] = r.connectsPerSecond();
+    j["MinLoad"] = r.minLoad_;
+    j["MaxLoad"] = r.maxLoad_;
+    j["Requests"] = r.requests_;
+    j["Errors"] = r.errors_;
+    j["RequestsPerSecond"] = r.requestsPerSecond();
+    j["P50Ns"] = r.latency_.valueAtPercentile(50);
+    j["P99Ns"] = r.latency_.valueAtPercentile(99);
+    j["MaxNs"] = r.latency_.max();
+    return j;
+}
+
+// The powers of two up to at least 4 and the number of cores, such that
+// the default run shows the scaling also on a machine with few cores.
+static std::string default_shards()
+{
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::string out = "1";
+    size_t n = 2;
+    for (; n <= std::max<size_t>(4, cores); n *= 2) {
+        out += "," + std::to_string(n);
+    }
+    if (cores > 4 && cores != n / 2) {
+        out += "," + std::to_string(cores);
+    }
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("shard_bench", "Connection and CoAP throughput against the number of client contexts.");
+    options.add_options("Benchmark")
+        ("h,help", "Show help")
+        ("shards", "Comma separated numbers of contexts", cxxopts::value<std::string>()->default_value(default_shards()))
+        ("connections", "Connections made in each run", cxxopts::value<size_t>()->default_value("256"))
+        ("parallel", "Connects outstanding at a time", cxxopts::value<size_t>()->default_value("64"))
+        ("concurrency", "CoAP requests outstanding at a time", cxxopts::value<size_t>()->default_value("64"))
+        ("duration", "Seconds of CoAP requests in each run", cxxopts::value<uint32_t>()->default_value("5"))
+        ("path", "CoAP path to GET", cxxopts::value<std::string>()->default_value("/iam/me"))
+        ("json", "Print the results as json")
+        ("log-level", "SDK log level", cxxopts::value<std::string>()->default_value("error"))
+        ;
+    bench::add_device_options(options);
+
+    try {
+        auto result = options.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+
+        std::vector<size_t> shardCounts;
+        for (auto& s : bench::split(result["shards"].as<std::string>(), ',')) {
+            size_t n = std::stoul(s);
+            shardCounts.push_back(n > 0 ? n : 1);
+        }
+        RunOptions runOptions;
+        runOptions.connections_ = std::max<size_t>(1, result["connections"].as<size_t>());
+        runOptions.parallel_ = std::max<size_t>(1, result["parallel"].as<size_t>());
+        runOptions.concurrency_ = std::max<size_t>(1, result["concurrency"].as<size_t>());
+        runOptions.duration_ = std::chrono::seconds(result["duration"].as<uint32_t>());
+        runOptions.path_ = result["path"].as<std::string>();
+        runOptions.logLevel_ = result["log-level"].as<std::string>();
+        runOptions.device_ = bench::parse_device_options(result);
+        bool json = result.count("json") > 0;
+
+        if (!json) {
+            std::cout << (bench::is_standin() ? "SDK: stand-in " : "SDK: ") << nabto::client::Context::version() << std::endl;
+            std::cout << "Latencies in microseconds, load is the least and most connections on a shard." << std::endl;
+            print_header();
+        }
+        nlohmann::json results = nlohmann::json::array();
+        for (auto n : shardCounts) {
+            RunResult r;
+            if (!run(n, runOptions, r)) {
+                return 1;
+            }
+            if (json) {
+                results.push_back(to_json(r));
+            } else {
+                print_result(r);
+            }
+        }
+        if (json) {
+            std::cout << results.dump(2) << std::endl;
+        }
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Invalid option: " << e.what() << std::endl;
+        return 1;
+    } catch (nabto::client::NabtoException& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    } catch (std::logic_error& e) {
+        std::cerr << "Invalid number: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include "bench_common.hpp"
+#include "hdr_histogram.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/**
+ * Measures the session setup time of the two ways another program,
+ * such as ssh, reaches a service through edge_tunnel_client:
+ *
+ *   port   start edge_tunnel_client --service banner:<port>, poll the
+ *          port until it accepts and connect to it.
+ *   stdio  start edge_tunnel_client --stdio banner with the program's
+ *          end of a socket pair as its stdin and stdout, as ProxyCommand.
+ *
+ * Setup is measured from starting the process until the first byte of
+ * the banner the service writes arrives, exit from closing the session
+ * until the process has exited.
+ *
+ * The client uses the bookmark of its home directory, with the stand-in
+ * the banner service is registered through NABTO_STANDIN_SERVICES.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static const uint64_t highestLatency = 60ULL * 1000 * 1000 * 1000;
+
+class RunResult {
+ public:
+    RunResult() : setup_(highestLatency), exit_(highestLatency) {}
+    std::string flow_;
+    size_t runs_ = 0;
+    size_t failures_ = 0;
+    bench::HdrHistogram setup_;
+    bench::HdrHistogram exit_;
+};
+
+class ClientOptions {
+ public:
+    std::string client_;
+    std::string home_;
+    uint32_t bookmark_;
+    bool verbose_;
+};
+
+static uint64_t nanoseconds(Clock::duration d)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+static pid_t spawn(const ClientOptions& options, std::vector<std::string> args, int in, int out)
+{
+    args.insert(args.begin(), { options.client_, "-H", options.home_, "-b", std::to_string(options.bookmark_) });
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    int null = open("/dev/null", O_RDWR);
+    dup2(in >= 0 ? in : null, STDIN_FILENO);
+    dup2(out >= 0 ? out : null, STDOUT_FILENO);
+    if (!options.verbose_) {
+        dup2(null, STDERR_FILENO);
+    }
+    std::vector<char*> argv;
+    for (auto& a : args) {
+        argv.push_back(const_cast<char*>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+}
+
+static bool wait_exit(pid_t pid)
+{
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid) {
+        return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool read_first_byte(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = 30;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char c;
+    return recv(fd, &c, 1, 0) == 1;
+}
+
+static uint16_t free_port()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    uint16_t port = 0;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (struct sockaddr*)&addr, &length) == 0)
+    {
+        port = ntohs(addr.sin_port);
+    }
+    close(fd);
+    return port;
+}
+
+static bool run_port(const ClientOptions& options, RunResult& result)
+{
+    uint16_t port = free_port();
+    auto start = Clock::now();
+    pid_t pid = spawn(options, { "--service", "banner:" + std::to_string(port) }, -1, -1);
+    if (pid < 0) {
+        return false;
+    }
+    int fd = -1;
+    while (fd < 0 && Clock::now() - start < std::chrono::seconds(30)) {
+        fd = bench::connect_loopback(port);
+        if (fd < 0) {
+            if (waitpid(pid, NULL, WNOHANG) == pid) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    bool ok = fd >= 0 && read_first_byte(fd);
+    auto ready = Clock::now();
+    if (fd >= 0) {
+        close(fd);
+    }
+    kill(pid, SIGINT);
+    wait_exit(pid);
+    if (ok) {
+        result.setup_.record(nanoseconds(ready - start));
+        result.exit_.record(nanoseconds(Clock::now() - ready));
+    }
+    return ok;
+}
+
+static bool run_stdio(const ClientOptions& options, RunResult& result)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        return false;
+    }
+    auto start = Clock::now();
+    pid_t pid = spawn(options, { "--stdio", "banner" }, sv[1], sv[1]);
+    close(sv[1]);
+    if (pid < 0) {
+        close(sv[0]);
+        return false;
+    }
+    bool ok = read_first_byte(sv[0]);
+    auto ready = Clock::now();
+    // The end of file on stdin ends the session, then read until the
+    // client closes stdout as ssh does.
+    shutdown(sv[0], SHUT_WR);
+    char buffer[1024];
+    while (recv(sv[0], buffer, sizeof(buffer), 0) > 0) {
+    }
+    close(sv[0]);
+    ok = wait_exit(pid) && ok;
+    if (ok) {
+        result.setup_.record(nanoseconds(ready - start));
+        result.exit_.record(nanoseconds(Clock::now() - ready));
+    }
+    return ok;
+}
+
+static std::string format_ms(uint64_t ns)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1f", ns / 1e6);
+    return buffer;
+}
+
+static void print_result(const RunResult& r)
+{
+    std::cout << std::left << std::setw(8) << r.flow_
+              << std::right << std::setw(6) << r.runs_
+              << std::setw(8) << r.failures_
+              << std::setw(12) << format_ms(r.setup_.valueAtPercentile(50))
+              << std::setw(12) << format_ms(r.setup_.valueAtPercentile(99))
+              << std::setw(12) << format_ms(static_cast<uint64_t>(r.setup_.mean()))
+              << std::setw(12) << format_ms(r.exit_.valueAtPercentile(50))
+              << std::endl;
+}
+
+static nlohmann::json to_json(const RunResult& r)
+{
+    nlohmann::json j;
+    j["Flow"] = r.flow_;
+    j["Runs"] = r.runs_;
+    j["Failures"] = r.failures_;
+    j["SetupP50Ns"] = r.setup_.valueAtPercentile(50);
+    j["SetupP99Ns"] = r.setup_.valueAtPercentile(99);
+    j["SetupMeanNs"] = r.setup_.mean();
+    j["ExitP50Ns"] = r.exit_.valueAtPercentile(50);
+    return j;
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("stdio_bench", "Session setup time of --stdio against --service and connecting to the port.");
+    options.add_options("Benchmark")
+        ("h,help", "Show help")
+        ("client", "The edge_tunnel_client executable", cxxopts::value<std::string>()->default_value(EDGE_TUNNEL_CLIENT_PATH))
+        ("H,home", "Home directory of the client with a bookmark of the device", cxxopts::value<std::string>())
+        ("b,bookmark", "Bookmark of the device", cxxopts::value<uint32_t>()->default_value("0"))
+        ("flows", "Comma separated flows to measure (port,stdio)", cxxopts::value<std::string>()->default_value("port,stdio"))
+        ("runs", "Sessions set up per flow", cxxopts::value<size_t>()->default_value("20"))
+        ("json", "Print the results as json")
+        ("verbose", "Show the output of the client on stderr")
+        ;
+
+    try {
+        auto result = options.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+        if (!result.count("home")) {
+            std::cerr << "--home is required" << std::endl;
+            return 1;
+        }
+        ClientOptions clientOptions;
+        clientOptions.client_ = result["client"].as<std::string>();
+        clientOptions.home_ = result["home"].as<std::string>();
+        clientOptions.bookmark_ = result["bookmark"].as<uint32_t>();
+        clientOptions.verbose_ = result.count("verbose") > 0;
+        std::vector<std::string> flows = bench::split(result["flows"].as<std::string>(), ',');
+        for (auto& f : flows) {
+            if (f != "port" && f != "stdio") {
+                std::cerr << "Unknown flow " << f << std::endl;
+                return 1;
+            }
+        }
+        size_t runs = std::max<size_t>(1, result["runs"].as<size_t>());
+        bool json = result.count("json") > 0;
+
+        auto server = bench::ServiceServer::start(bench::ServiceServer::Mode::BANNER);
+        if (!server) {
+            return 1;
+        }
+        std::string service = "banner=127.0.0.1:" + std::to_string(server->port());
+        if (bench::is_standin()) {
+            const char* services = getenv("NABTO_STANDIN_SERVICES");
+            setenv("NABTO_STANDIN_SERVICES", (services && *services ? std::string(services) + "," + service : service).c_str(), 1);
+        } else if (!json) {
+            std::cout << "Configure the device with the tcp tunnel service " << service << std::endl;
+        }
+
+        if (!json) {
+            std::cout << (bench::is_standin() ? "SDK: stand-in " : "SDK: ") << nabto::client::Context::version() << std::endl;
+            std::cout << "Times in milliseconds." << std::endl;
+            std::cout << std::left << std::setw(8) << "flow"
+                      << std::right << std::setw(6) << "runs"
+                      << std::setw(8) << "failed"
+                      << std::setw(12) << "setup p50"
+                      << std::setw(12) << "setup p99"
+                      << std::setw(12) << "setup mean"
+                      << std::setw(12) << "exit p50"
+                      << std::endl;
+        }
+        nlohmann::json results = nlohmann::json::array();
+        for (auto& f : flows) {
+            RunResult r;
+            r.flow_ = f;
+            for (size_t i = 0; i < runs; i++) {
+                bool ok = f == "port" ? run_port(clientOptions, r) : run_stdio(clientOptions, r);
+                r.runs_++;
+                if (!ok) {
+                    r.failures_++;
+                }
+            }
+            if (json) {
+                results.push_back(to_json(r));
+            } else {
+                print_result(r);
+            }
+        }
+        if (json) {
+            std::cout << results.dump(2) << std::endl;
+        }
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Invalid option: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#include "timestamp.hpp"
+
+#include <benchmark/benchmark.h>
+
+static void BM_TimestampString(benchmark::State& state)
+{
+    for (auto _ : state) {
+        std::string ts = time_in_HH_MM_SS_MMM();
+        benchmark::DoNotOptimize(ts);
+    }
+}
+BENCHMARK(BM_TimestampString)->ThreadRange(1, 4);
+
+static void BM_TimestampCached(benchmark::State& state)
+{
+    char ts[16];
+    for (auto _ : state) {
+        size_t length = time_in_HH_MM_SS_MMM(ts, sizeof(ts));
+        benchmark::DoNotOptimize(length);
+        benchmark::DoNotOptimize(ts);
+    }
+}
+BENCHMARK(BM_TimestampCached)->ThreadRange(1, 4);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,384 @@
+#include "bench_common.hpp"
+#include "hdr_histogram.hpp"
+
+#include <local_relay.hpp>
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/**
+ * Measures the throughput of tcp tunnels. For each service and each
+ * number of parallel sessions a tunnel is opened and the sessions
+ * drive the service for the duration:
+ *
+ *   echo    writes a message and waits for the echo before writing the next.
+ *   sink    writes messages as fast as the tunnel accepts them.
+ *   source  reads as fast as the tunnel delivers.
+ *
+ * The sessions connect to the tcp port of the tunnel, or with the uds
+ * transport to a unix socket relayed to the tunnel as with
+ * edge_tunnel_client --uds-dir. Echo also reports the round trip time.
+ *
+ * CPU is measured for the whole process, which with the stand-in also
+ * includes the device side of the tunnel and the benchmark servers.
+ */
+
+using Clock = std::chrono::steady_clock;
+using Mode = bench::ServiceServer::Mode;
+
+static const uint64_t highestLatency = 60ULL * 1000 * 1000 * 1000;
+
+class RunResult {
+ public:
+    RunResult() : latency_(highestLatency) {}
+    std::string service_;
+    std::string transport_;
+    size_t sessions_ = 0;
+    size_t messageSize_ = 0;
+    size_t failedSessions_ = 0;
+    uint64_t bytes_ = 0;
+    double seconds_ = 0;
+    double cpuSeconds_ = 0;
+    int64_t memoryPerSession_ = 0;
+    // Echo round trips in nanoseconds.
+    bench::HdrHistogram latency_;
+
+    double bytesPerSecond() const { return seconds_ > 0 ? bytes_ / seconds_ : 0; }
+    double cpuSecondsPerGB() const { return bytes_ > 0 ? cpuSeconds_ / (bytes_ / 1e9) : 0; }
+};
+
+static bool send_all(int fd, const uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static void set_timeouts(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 200 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static bool would_block()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static int connect_unix(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns the number of payload bytes moved through the tunnel.
+static uint64_t run_session(Mode mode, int fd, size_t messageSize, Clock::time_point deadline, bench::HdrHistogram& latency, bool& failed)
+{
+    std::vector<uint8_t> message(messageSize, 0xa5);
+    std::vector<uint8_t> in(messageSize);
+    uint64_t bytes = 0;
+    while (Clock::now() < deadline) {
+        if (mode == Mode::ECHO) {
+            auto sent = Clock::now();
+            if (!send_all(fd, message.data(), message.size())) {
+                failed = true;
+                break;
+            }
+            size_t got = 0;
+            while (got < messageSize) {
+                ssize_t n = recv(fd, in.data() + got, messageSize - got, 0);
+                if (n > 0) {
+                    got += n;
+                } else if (n < 0 && would_block() && Clock::now() < deadline + std::chrono::seconds(5)) {
+                    continue;
+                } else {
+                    failed = true;
+                    return bytes;
+                }
+            }
+            latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count()));
+            bytes += messageSize;
+        } else if (mode == Mode::SINK) {
+            ssize_t n = send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                bytes += n;
+            } else if (n < 0 && !would_block()) {
+                failed = true;
+                break;
+            }
+        } else {
+            ssize_t n = recv(fd, in.data(), in.size(), 0);
+            if (n > 0) {
+                bytes += n;
+            } else if (n == 0 || !would_block()) {
+                failed = true;
+                break;
+            }
+        }
+    }
+    return bytes;
+}
+
+static RunResult run(Mode mode, const std::string& transport, std::function<int ()> connectSession, size_t sessions, size_t messageSize, std::chrono::seconds duration)
+{
+    RunResult result;
+    result.service_ = bench::ServiceServer::modeName(mode);
+    result.transport_ = transport;
+    result.sessions_ = sessions;
+    result.messageSize_ = messageSize;
+
+    auto before = bench::ResourceUsage::now();
+    std::vector<int> fds;
+    for (size_t i = 0; i < sessions; i++) {
+        int fd = connectSession();
+        if (fd < 0) {
+            result.failedSessions_++;
+            continue;
+        }
+        set_timeouts(fd);
+        fds.push_back(fd);
+    }
+
+    std::vector<uint64_t> bytes(fds.size(), 0);
+    std::vector<char> failed(fds.size(), 0);
+    std::vector<bench::HdrHistogram> latencies(fds.size(), bench::HdrHistogram(highestLatency));
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto deadline = start + duration;
+    for (size_t i = 0; i < fds.size(); i++) {
+        threads.push_back(std::thread([&, i]() {
+            bool f = false;
+            bytes[i] = run_session(mode, fds[i], messageSize, deadline, latencies[i], f);
+            failed[i] = f;
+        }));
+    }
+    // Sample the memory while all the sessions are active.
+    std::this_thread::sleep_for(duration / 2);
+    auto during = bench::ResourceUsage::now();
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = Clock::now();
+    auto after = bench::ResourceUsage::now();
+    for (int fd : fds) {
+        close(fd);
+    }
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        result.bytes_ += bytes[i];
+        result.failedSessions_ += failed[i] ? 1 : 0;
+        result.latency_.add(latencies[i]);
+    }
+    result.seconds_ = std::chrono::duration<double>(end - start).count();
+    result.cpuSeconds_ = after.cpuSeconds_ - before.cpuSeconds_;
+    if (!fds.empty()) {
+        result.memoryPerSession_ = (static_cast<int64_t>(during.rssBytes_) - static_cast<int64_t>(before.rssBytes_)) / static_cast<int64_t>(fds.size());
+    }
+    return result;
+}
+
+static std::string format_us(uint64_t ns)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1f", ns / 1000.0);
+    return buffer;
+}
+
+static void print_result(const RunResult& r)
+{
+    bool echo = r.latency_.count() > 0;
+    std::cout << std::left << std::setw(8) << r.service_
+              << std::setw(10) << r.transport_
+              << std::right << std::setw(9) << r.sessions_
+              << std::setw(10) << r.messageSize_
+              << std::setw(14) << bench::format_bytes(r.bytesPerSecond()) + "/s"
+              << std::setw(14) << std::fixed << std::setprecision(2) << r.cpuSecondsPerGB()
+              << std::setw(14) << bench::format_bytes(static_cast<double>(r.memoryPerSession_ > 0 ? r.memoryPerSession_ : 0))
+              << std::setw(8) << r.failedSessions_
+              << std::setw(10) << (echo ? format_us(r.latency_.valueAtPercentile(50)) : "-")
+              << std::setw(10) << (echo ? format_us(r.latency_.valueAtPercentile(99)) : "-")
+              << std::endl;
+}
+
+static nlohmann::json to_json(const RunResult& r)
+{
+    nlohmann::json j;
+    j["Service"] = r.service_;
+    j["Transport"] = r.transport_;
+    j["Sessions"] = r.sessions_;
+    j["MessageSize"] = r.messageSize_;
+    j["Bytes"] = r.bytes_;
+    j["Seconds"] = r.seconds_;
+    j["BytesPerSecond"] = r.bytesPerSecond();
+    j["CpuSeconds"] = r.cpuSeconds_;
+    j["CpuSecondsPerGB"] = r.cpuSecondsPerGB();
+    j["MemoryPerSession"] = r.memoryPerSession_;
+    j["FailedSessions"] = r.failedSessions_;
+    if (r.latency_.count() > 0) {
+        j["RoundTripP50Ns"] = r.latency_.valueAtPercentile(50);
+        j["RoundTripP99Ns"] = r.latency_.valueAtPercentile(99);
+    }
+    return j;
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("tunnel_bench", "Throughput of tcp tunnels to echo, sink and source services.");
+    options.add_options("Benchmark")
+        ("h,help", "Show help")
+        ("services", "Comma separated services to benchmark (echo,sink,source)", cxxopts::value<std::string>()->default_value("echo,sink,source"))
+        ("sessions", "Comma separated numbers of parallel tcp sessions", cxxopts::value<std::string>()->default_value("1,4,16"))
+        ("transports", "Comma separated ways to reach the tunnel (tcp,uds)", cxxopts::value<std::string>()->default_value("tcp"))
+        ("message-size", "Bytes written or read per call", cxxopts::value<size_t>()->default_value("16384"))
+        ("duration", "Seconds each run lasts", cxxopts::value<uint32_t>()->default_value("5"))
+        ("json", "Print the results as json")
+        ("log-level", "SDK log level", cxxopts::value<std::string>()->default_value("error"))
+        ;
+    bench::add_device_options(options);
+
+    try {
+        auto result = options.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+
+        std::vector<Mode> modes;
+        for (auto& s : bench::split(result["services"].as<std::string>(), ',')) {
+            if (s == "echo") {
+                modes.push_back(Mode::ECHO);
+            } else if (s == "sink") {
+                modes.push_back(Mode::SINK);
+            } else if (s == "source") {
+                modes.push_back(Mode::SOURCE);
+            } else {
+                std::cerr << "Unknown service " << s << std::endl;
+                return 1;
+            }
+        }
+        std::vector<size_t> sessions;
+        for (auto& s : bench::split(result["sessions"].as<std::string>(), ',')) {
+            sessions.push_back(std::stoul(s));
+        }
+        std::vector<std::string> transports = bench::split(result["transports"].as<std::string>(), ',');
+        for (auto& t : transports) {
+            if (t != "tcp" && t != "uds") {
+                std::cerr << "Unknown transport " << t << std::endl;
+                return 1;
+            }
+        }
+        size_t messageSize = result["message-size"].as<size_t>();
+        auto duration = std::chrono::seconds(result["duration"].as<uint32_t>());
+        bool json = result.count("json") > 0;
+
+        std::map<Mode, std::unique_ptr<bench::ServiceServer> > servers;
+        std::map<std::string, uint16_t> services;
+        for (auto m : modes) {
+            auto server = bench::ServiceServer::start(m);
+            if (!server) {
+                return 1;
+            }
+            services[bench::ServiceServer::modeName(m)] = server->port();
+            servers[m] = std::move(server);
+        }
+
+        auto context = nabto::client::Context::create();
+        context->setLogLevel(result["log-level"].as<std::string>());
+        auto connection = bench::connect_device(context, bench::parse_device_options(result), services);
+        if (!connection) {
+            return 1;
+        }
+
+        if (!json) {
+            std::cout << (bench::is_standin() ? "SDK: stand-in " : "SDK: ") << nabto::client::Context::version() << std::endl;
+            std::cout << "Round trip times of echo in microseconds." << std::endl;
+            std::cout << std::left << std::setw(8) << "service"
+                      << std::setw(10) << "transport"
+                      << std::right << std::setw(9) << "sessions"
+                      << std::setw(10) << "msg size"
+                      << std::setw(14) << "throughput"
+                      << std::setw(14) << "cpu s/GB"
+                      << std::setw(14) << "mem/session"
+                      << std::setw(8) << "failed"
+                      << std::setw(10) << "p50 rtt"
+                      << std::setw(10) << "p99 rtt"
+                      << std::endl;
+        }
+
+        nlohmann::json results = nlohmann::json::array();
+        for (auto m : modes) {
+            auto tunnel = connection->createTcpTunnel();
+            tunnel->open(bench::ServiceServer::modeName(m), 0)->waitForResult();
+            uint16_t port = tunnel->getLocalPort();
+            for (auto& t : transports) {
+                std::function<int ()> connectSession = [port]() { return bench::connect_loopback(port); };
+                std::unique_ptr<Relay::UnixSocketRelay> relay;
+                if (t == "uds") {
+                    std::string path = "/tmp/tunnel_bench_" + std::to_string(getpid()) + ".sock";
+                    relay = Relay::UnixSocketRelay::start(path, port);
+                    if (!relay) {
+                        return 1;
+                    }
+                    connectSession = [path]() { return connect_unix(path); };
+                }
+                for (auto n : sessions) {
+                    RunResult r = run(m, t, connectSession, n, messageSize, duration);
+                    if (json) {
+                        results.push_back(to_json(r));
+                    } else {
+                        print_result(r);
+                    }
+                }
+            }
+            tunnel->close()->waitForResult();
+        }
+        if (json) {
+            std::cout << results.dump(2) << std::endl;
+        }
+        connection->close()->waitForResult();
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Invalid option: " << e.what() << std::endl;
+        return 1;
+    } catch (nabto::client::NabtoException& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    } catch (std::logic_error& e) {
+        std::cerr << "Invalid number: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include <vector>
 #include <exception>
 #include <cstdint>
+#include <chrono>
 
 namespace nabto {
 namespace client {
@@ -94,17 +95,22 @@ class NabtoException : public std::exception
 
 class LogMessage {
  protected:
-    LogMessage(const std::string& message, const std::string& severity)
-        : message_(message), severity_(severity)
+    LogMessage(const std::string& message, const std::string& severity, const std::string& module = "")
+        : message_(message), severity_(severity), module_(module)
     {
     }
  public:
     virtual ~LogMessage() {}
     virtual std::string getMessage() { return message_; }
     virtual std::string getSeverity() { return severity_; }
+    /**
+     * The SDK module which logged the message, empty if not known.
+     */
+    virtual std::string getModule() { return module_; }
  protected:
     std::string message_;
     std::string severity_;
+    std::string module_;
 };
 
 class Logger {
@@ -113,6 +119,84 @@ class Logger {
     virtual void log(LogMessage message) = 0;
 };
 
+class LogStatistics {
+ public:
+    // Messages passed on to the logger.
+    uint64_t passed_ = 0;
+    // Messages dropped by the rate limit.
+    uint64_t suppressed_ = 0;
+    // Messages passed on by sampling while their pattern was rate limited.
+    uint64_t sampled_ = 0;
+    // Error and warning messages, counted whether or not they are passed on.
+    uint64_t errors_ = 0;
+    uint64_t warnings_ = 0;
+};
+
+/**
+ * Process wide counters of the futures and CoAP requests made through
+ * the wrapper.
+ */
+class WrapperStatistics {
+ public:
+    // Futures created for operations and futures freed again.
+    uint64_t futuresCreated_ = 0;
+    uint64_t futuresFreed_ = 0;
+    // Futures resolved through waitForResult or through a callback.
+    uint64_t futuresWaited_ = 0;
+    uint64_t callbacksRun_ = 0;
+
+    // Futures which have not resolved yet, per type. A future dropped
+    // before it resolved stays pending, and keeps its SDK resources,
+    // until the operation ends.
+    uint64_t pendingVoidFutures_ = 0;
+    uint64_t pendingBufferFutures_ = 0;
+    uint64_t pendingMdnsFutures_ = 0;
+    // Pending futures which were dropped.
+    uint64_t abandonedFutures_ = 0;
+    // Age of the oldest pending future, 0 if none are pending.
+    double oldestPendingSeconds_ = 0;
+
+    uint64_t coapRequests_ = 0;
+    // Requests which failed without a response.
+    uint64_t coapFailures_ = 0;
+    // Requests per latency bucket. coapLatencyBounds() has the upper
+    // bound in seconds of each bucket, the last bucket is unbounded.
+    std::vector<uint64_t> coapLatencyCounts_;
+    double coapLatencySeconds_ = 0;
+
+    static const std::vector<double>& coapLatencyBounds();
+};
+
+/**
+ * A future which has not resolved yet, as listed by
+ * Context::outstandingFutures().
+ */
+class OutstandingFuture {
+ public:
+    // "void", "buffer" or "mdns".
+    std::string type_;
+    // The operation which created the future, e.g. "coap GET /iam/me".
+    std::string operation_;
+    double ageSeconds_ = 0;
+    // Dropped by the application before it resolved.
+    bool abandoned_ = false;
+};
+
+/**
+ * Is told about the round trips made through the wrapper, such as
+ * connect, CoAP requests and opening tunnels, for tracing them.
+ *
+ * begin is called on the thread starting the operation, the id it
+ * returns is passed to end when the operation has completed, which may
+ * be on the SDK thread.
+ */
+class OperationTracer {
+ public:
+    virtual ~OperationTracer() {}
+    virtual uint64_t begin(const std::string& operation, const std::string& detail) = 0;
+    virtual void end(uint64_t id, Status status) = 0;
+};
+
 class FutureCallback {
  public:
     virtual ~FutureCallback() { }
@@ -270,8 +354,31 @@ class Context {
     virtual std::shared_ptr<MdnsResolver> createMdnsResolver(const std::string& subtype) = 0;
     virtual void setLogger(std::shared_ptr<Logger> logger) = 0;
     virtual void setLogLevel(const std::string& level) = 0;
+
+    /**
+     * Set the log level for a period after which the level set with
+     * setLogLevel is restored.
+     */
+    virtual void setLogLevelFor(const std::string& level, std::chrono::seconds duration) = 0;
+
+    /**
+     * Rate limit info, debug and trace messages per message pattern
+     * with a token bucket of the given burst size refilled with
+     * messagesPerSecond. While a pattern is limited every
+     * sampleEvery'th message is still passed on, 0 disables sampling.
+     * Errors and warnings are never limited. A messagesPerSecond of 0
+     * disables the rate limit.
+     */
+    virtual void setLogRateLimit(double messagesPerSecond, size_t burst, size_t sampleEvery) = 0;
+    virtual LogStatistics getLogStatistics() = 0;
+
     virtual std::string createPrivateKey() = 0;
     static std::string version();
+    static WrapperStatistics wrapperStatistics();
+    // The pending futures of the process, oldest first.
+    static std::vector<OutstandingFuture> outstandingFutures();
+    // Process wide, nullptr stops tracing.
+    static void setOperationTracer(std::shared_ptr<OperationTracer> tracer);
 #ifdef __ANDROID__
     virtual void setAndroidWifiNetworkHandle(uint64_t handle) = 0;
 #endif
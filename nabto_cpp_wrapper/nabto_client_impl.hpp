@@ -1,5 +1,6 @@
 #pragma once
 #include "nabto_client.hpp"
+#include "nabto_client_probes.hpp"
 #include <nabto/nabto_client.h>
 #include <nabto/nabto_client_experimental.h>
 
@@ -10,6 +11,12 @@
 #include <thread>
 #include <mutex>
 #include <set>
+#include <map>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <cctype>
+#include <algorithm>
 
 namespace nabto {
 namespace client {
@@ -60,12 +67,320 @@ bool Status::ok() const {
     return errorCode_ == 0;
 }
 
+const std::vector<double>& WrapperStatistics::coapLatencyBounds()
+{
+    static const std::vector<double> bounds = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+    return bounds;
+}
+
+/**
+ * A future's place in the process wide list of pending futures, from
+ * when the future is created until it resolves or is freed.
+ */
+class PendingFuture {
+ public:
+    enum Type { FUTURE_VOID, FUTURE_BUFFER, FUTURE_MDNS };
+
+    PendingFuture() {}
+    ~PendingFuture();
+
+    void link(Type type, const char* operation, const std::string& detail);
+    void unlink();
+    // Take the place of a future which is dropped before it resolved.
+    void takeOver(PendingFuture& dropped);
+
+    Type type_ = FUTURE_VOID;
+    const char* operation_ = "";
+    std::string detail_;
+    std::chrono::steady_clock::time_point created_;
+    bool abandoned_ = false;
+    bool linked_ = false;
+    size_t shard_ = 0;
+    PendingFuture* prev_ = nullptr;
+    PendingFuture* next_ = nullptr;
+
+ private:
+    PendingFuture(const PendingFuture&) = delete;
+    PendingFuture& operator=(const PendingFuture&) = delete;
+};
+
+/**
+ * The pending futures. The lists are sharded by the thread creating the
+ * future such that creating, resolving and freeing futures on different
+ * threads does not contend on one mutex, each shard is in creation
+ * order. The counts are atomics, only reading the ages and the list of
+ * outstanding futures walks all the shards.
+ */
+class PendingFutures {
+ public:
+    static PendingFutures& instance()
+    {
+        static PendingFutures futures;
+        return futures;
+    }
+
+    PendingFutures()
+    {
+        for (auto& c : counts_) {
+            c = 0;
+        }
+        abandoned_ = 0;
+        nextShard_ = 0;
+    }
+
+    void link(PendingFuture* f)
+    {
+        static thread_local size_t shard = nextShard_.fetch_add(1, std::memory_order_relaxed) % shardCount;
+        f->shard_ = shard;
+        Shard& s = shards_[shard];
+        std::lock_guard<std::mutex> lock(s.mutex_);
+        f->prev_ = s.tail_;
+        f->next_ = nullptr;
+        if (s.tail_) {
+            s.tail_->next_ = f;
+        } else {
+            s.head_ = f;
+        }
+        s.tail_ = f;
+        f->linked_ = true;
+        counts_[f->type_].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unlink(PendingFuture* f)
+    {
+        Shard& s = shards_[f->shard_];
+        std::lock_guard<std::mutex> lock(s.mutex_);
+        remove(s, f);
+    }
+
+    void replace(PendingFuture* dropped, PendingFuture* f)
+    {
+        Shard& s = shards_[dropped->shard_];
+        std::lock_guard<std::mutex> lock(s.mutex_);
+        if (!dropped->linked_) {
+            return;
+        }
+        f->type_ = dropped->type_;
+        f->operation_ = dropped->operation_;
+        f->detail_ = dropped->detail_;
+        f->created_ = dropped->created_;
+        f->abandoned_ = true;
+        f->shard_ = dropped->shard_;
+        // Insert in the place of the dropped future to keep the creation order.
+        f->prev_ = dropped;
+        f->next_ = dropped->next_;
+        if (dropped->next_) {
+            dropped->next_->prev_ = f;
+        } else {
+            s.tail_ = f;
+        }
+        dropped->next_ = f;
+        f->linked_ = true;
+        counts_[f->type_].fetch_add(1, std::memory_order_relaxed);
+        abandoned_.fetch_add(1, std::memory_order_relaxed);
+        remove(s, dropped);
+    }
+
+    void statistics(WrapperStatistics& s)
+    {
+        s.pendingVoidFutures_ = counts_[PendingFuture::FUTURE_VOID].load(std::memory_order_relaxed);
+        s.pendingBufferFutures_ = counts_[PendingFuture::FUTURE_BUFFER].load(std::memory_order_relaxed);
+        s.pendingMdnsFutures_ = counts_[PendingFuture::FUTURE_MDNS].load(std::memory_order_relaxed);
+        s.abandonedFutures_ = abandoned_.load(std::memory_order_relaxed);
+        auto now = std::chrono::steady_clock::now();
+        auto oldest = now;
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex_);
+            if (shard.head_ && shard.head_->created_ < oldest) {
+                oldest = shard.head_->created_;
+            }
+        }
+        s.oldestPendingSeconds_ = std::chrono::duration<double>(now - oldest).count();
+    }
+
+    std::vector<OutstandingFuture> outstanding()
+    {
+        static const char* typeNames[] = { "void", "buffer", "mdns" };
+        auto now = std::chrono::steady_clock::now();
+        std::vector<std::pair<std::chrono::steady_clock::time_point, OutstandingFuture> > all;
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex_);
+            for (PendingFuture* f = shard.head_; f != nullptr; f = f->next_) {
+                OutstandingFuture o;
+                o.type_ = typeNames[f->type_];
+                o.operation_ = f->operation_;
+                if (!f->detail_.empty()) {
+                    o.operation_ += " " + f->detail_;
+                }
+                o.ageSeconds_ = std::chrono::duration<double>(now - f->created_).count();
+                o.abandoned_ = f->abandoned_;
+                all.push_back(std::make_pair(f->created_, o));
+            }
+        }
+        // The oldest first as when there was one list.
+        std::stable_sort(all.begin(), all.end(), [](const std::pair<std::chrono::steady_clock::time_point, OutstandingFuture>& a,
+                                                    const std::pair<std::chrono::steady_clock::time_point, OutstandingFuture>& b) {
+                             return a.first < b.first;
+                         });
+        std::vector<OutstandingFuture> out;
+        for (auto& a : all) {
+            out.push_back(a.second);
+        }
+        return out;
+    }
+
+ private:
+    static const size_t shardCount = 16;
+
+    class Shard {
+     public:
+        std::mutex mutex_;
+        PendingFuture* head_ = nullptr;
+        PendingFuture* tail_ = nullptr;
+    };
+
+    void remove(Shard& s, PendingFuture* f)
+    {
+        if (!f->linked_) {
+            return;
+        }
+        if (f->prev_) {
+            f->prev_->next_ = f->next_;
+        } else {
+            s.head_ = f->next_;
+        }
+        if (f->next_) {
+            f->next_->prev_ = f->prev_;
+        } else {
+            s.tail_ = f->prev_;
+        }
+        f->prev_ = f->next_ = nullptr;
+        f->linked_ = false;
+        counts_[f->type_].fetch_sub(1, std::memory_order_relaxed);
+        if (f->abandoned_) {
+            abandoned_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    Shard shards_[shardCount];
+    std::atomic<uint64_t> counts_[3];
+    std::atomic<uint64_t> abandoned_;
+    std::atomic<size_t> nextShard_;
+};
+
+PendingFuture::~PendingFuture()
+{
+    unlink();
+}
+
+void PendingFuture::link(Type type, const char* operation, const std::string& detail)
+{
+    type_ = type;
+    operation_ = operation;
+    detail_ = detail;
+    created_ = std::chrono::steady_clock::now();
+    PendingFutures::instance().link(this);
+}
+
+void PendingFuture::unlink()
+{
+    PendingFutures::instance().unlink(this);
+}
+
+void PendingFuture::takeOver(PendingFuture& dropped)
+{
+    PendingFutures::instance().replace(&dropped, this);
+}
+
+/**
+ * The counters behind WrapperStatistics. Updated with relaxed atomics
+ * from the SDK thread and the threads waiting on futures.
+ */
+class WrapperCounters {
+ public:
+    static WrapperCounters& instance()
+    {
+        static WrapperCounters counters;
+        return counters;
+    }
+
+    WrapperCounters()
+        : futuresCreated_(0), futuresFreed_(0), futuresWaited_(0), callbacksRun_(0),
+          coapRequests_(0), coapFailures_(0), coapLatencyNanoseconds_(0)
+    {
+        for (auto& c : coapLatencyCounts_) {
+            c = 0;
+        }
+    }
+
+    void coapDone(bool ok, std::chrono::steady_clock::duration latency)
+    {
+        if (!ok) {
+            coapFailures_.fetch_add(1, std::memory_order_relaxed);
+        }
+        double seconds = std::chrono::duration<double>(latency).count();
+        const auto& bounds = WrapperStatistics::coapLatencyBounds();
+        size_t i = 0;
+        while (i < bounds.size() && seconds > bounds[i]) {
+            i++;
+        }
+        coapLatencyCounts_[i].fetch_add(1, std::memory_order_relaxed);
+        coapLatencyNanoseconds_.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()), std::memory_order_relaxed);
+    }
+
+    WrapperStatistics statistics()
+    {
+        WrapperStatistics s;
+        s.futuresCreated_ = futuresCreated_.load(std::memory_order_relaxed);
+        s.futuresFreed_ = futuresFreed_.load(std::memory_order_relaxed);
+        s.futuresWaited_ = futuresWaited_.load(std::memory_order_relaxed);
+        s.callbacksRun_ = callbacksRun_.load(std::memory_order_relaxed);
+        s.coapRequests_ = coapRequests_.load(std::memory_order_relaxed);
+        s.coapFailures_ = coapFailures_.load(std::memory_order_relaxed);
+        for (auto& c : coapLatencyCounts_) {
+            s.coapLatencyCounts_.push_back(c.load(std::memory_order_relaxed));
+        }
+        s.coapLatencySeconds_ = coapLatencyNanoseconds_.load(std::memory_order_relaxed) / 1e9;
+        PendingFutures::instance().statistics(s);
+        return s;
+    }
+
+    static void count(std::atomic<uint64_t>& counter)
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<OperationTracer> tracer()
+    {
+        return std::atomic_load(&tracer_);
+    }
+
+    void setTracer(std::shared_ptr<OperationTracer> tracer)
+    {
+        std::atomic_store(&tracer_, tracer);
+    }
+
+    std::atomic<uint64_t> futuresCreated_;
+    std::atomic<uint64_t> futuresFreed_;
+    std::atomic<uint64_t> futuresWaited_;
+    std::atomic<uint64_t> callbacksRun_;
+    std::atomic<uint64_t> coapRequests_;
+    std::atomic<uint64_t> coapFailures_;
+    // One more than the number of bounds for the unbounded bucket.
+    std::atomic<uint64_t> coapLatencyCounts_[14];
+    std::atomic<uint64_t> coapLatencyNanoseconds_;
+    std::shared_ptr<OperationTracer> tracer_;
+};
+
 class FutureBufferImpl : public FutureBuffer, public std::enable_shared_from_this<FutureBufferImpl>
 {
  public:
-    FutureBufferImpl(NabtoClient* context, std::shared_ptr<std::vector<uint8_t> > data, std::shared_ptr<size_t> transferred)
+    FutureBufferImpl(NabtoClient* context, std::shared_ptr<std::vector<uint8_t> > data, std::shared_ptr<size_t> transferred, const char* operation)
         : future_(nabto_client_future_new(context)), data_(data), transferred_(transferred)
     {
+        WrapperCounters::count(WrapperCounters::instance().futuresCreated_);
+        pending_.link(PendingFuture::FUTURE_BUFFER, operation, std::string());
+        NABTO_CLIENT_PROBE2(future_create, future_, operation);
     }
     FutureBufferImpl(NabtoClientFuture* future, std::shared_ptr<std::vector<uint8_t> > data, std::shared_ptr<size_t> transferred)
         : future_(future), data_(data), transferred_(transferred)
@@ -75,22 +390,26 @@ class FutureBufferImpl : public FutureBuffer, public std::enable_shared_from_thi
     {
         if (!ended_) {
             auto c = std::make_shared<FutureBufferImpl>(future_, data_, transferred_);
+            c->pending_.takeOver(pending_);
             c->callback(std::make_shared<CallbackFunction>([](Status){ /* do nothing */ }));
         } else {
             nabto_client_future_free(future_);
+            WrapperCounters::count(WrapperCounters::instance().futuresFreed_);
         }
     }
 
     std::vector<uint8_t> waitForResult()
     {
-        nabto_client_future_wait(future_);
-        ended_ = true;
+        NabtoClientError ec = nabto_client_future_wait(future_);
+        ended(ec);
+        WrapperCounters::count(WrapperCounters::instance().futuresWaited_);
         return getResult();
     }
     static void doCallback(NabtoClientFuture* future, NabtoClientError ec, void* data)
     {
         FutureBufferImpl* self = (FutureBufferImpl*)data;
-        self->ended_ = true;
+        self->ended(ec);
+        WrapperCounters::count(WrapperCounters::instance().callbacksRun_);
         self->cb_->run(Status(ec));
         self->selfReference_ = nullptr;
     }
@@ -114,12 +433,23 @@ class FutureBufferImpl : public FutureBuffer, public std::enable_shared_from_thi
         return future_;
     }
   private:
+    void ended(NabtoClientError ec)
+    {
+        if (!ended_) {
+            NABTO_CLIENT_PROBE2(future_resolve, future_, ec);
+            NABTO_CLIENT_PROBE2(stream_read_done, future_, *transferred_);
+        }
+        ended_ = true;
+        pending_.unlink();
+    }
+
     NabtoClientFuture* future_;
     std::shared_ptr<std::vector<uint8_t> > data_;
     std::shared_ptr<size_t> transferred_;
     std::shared_ptr<FutureBufferImpl> selfReference_;
     std::shared_ptr<FutureCallback> cb_;
     bool ended_ = false;
+    PendingFuture pending_;
 };
 
 
@@ -176,9 +506,12 @@ class MdnsResultImpl : public MdnsResult {
 class FutureMdnsResultImpl : public FutureMdnsResult, public std::enable_shared_from_this<FutureMdnsResultImpl>
 {
  public:
-    FutureMdnsResultImpl(NabtoClient* context)
+    FutureMdnsResultImpl(NabtoClient* context, const char* operation)
         : future_(nabto_client_future_new(context))
     {
+        WrapperCounters::count(WrapperCounters::instance().futuresCreated_);
+        pending_.link(PendingFuture::FUTURE_MDNS, operation, std::string());
+        NABTO_CLIENT_PROBE2(future_create, future_, operation);
     }
     FutureMdnsResultImpl(NabtoClientFuture* future)
         : future_(future)
@@ -188,22 +521,26 @@ class FutureMdnsResultImpl : public FutureMdnsResult, public std::enable_shared_
     {
         if (!ended_) {
             auto c = std::make_shared<FutureMdnsResultImpl>(future_);
+            c->pending_.takeOver(pending_);
             c->callback(std::make_shared<CallbackFunction>([](Status){ /* do nothing */ }));
         } else {
             nabto_client_future_free(future_);
+            WrapperCounters::count(WrapperCounters::instance().futuresFreed_);
         }
     }
 
     std::shared_ptr<MdnsResult> waitForResult()
     {
-        nabto_client_future_wait(future_);
-        ended_ = true;
+        NabtoClientError ec = nabto_client_future_wait(future_);
+        ended(ec);
+        WrapperCounters::count(WrapperCounters::instance().futuresWaited_);
         return getResult();
     }
     static void doCallback(NabtoClientFuture* future, NabtoClientError ec, void* data)
     {
         FutureMdnsResultImpl* self = (FutureMdnsResultImpl*)data;
-        self->ended_ = true;
+        self->ended(ec);
+        WrapperCounters::count(WrapperCounters::instance().callbacksRun_);
         self->cb_->run(Status(ec));
         self->selfReference_ = nullptr;
     }
@@ -230,22 +567,38 @@ class FutureMdnsResultImpl : public FutureMdnsResult, public std::enable_shared_
     NabtoClientMdnsResult* result_;
 
   private:
+    void ended(NabtoClientError ec)
+    {
+        if (!ended_) {
+            NABTO_CLIENT_PROBE2(future_resolve, future_, ec);
+        }
+        ended_ = true;
+        pending_.unlink();
+    }
+
     NabtoClientFuture* future_;
     std::shared_ptr<FutureMdnsResultImpl> selfReference_;
     std::shared_ptr<FutureCallback> cb_;
     bool ended_ = false;
+    PendingFuture pending_;
 };
 
 class FutureVoidImpl : public FutureVoid, public std::enable_shared_from_this<FutureVoidImpl> {
  public:
-    FutureVoidImpl(NabtoClient* context)
+    FutureVoidImpl(NabtoClient* context, const char* operation, const std::string& detail = std::string())
         : future_(nabto_client_future_new(context))
     {
+        WrapperCounters::count(WrapperCounters::instance().futuresCreated_);
+        pending_.link(PendingFuture::FUTURE_VOID, operation, detail);
+        NABTO_CLIENT_PROBE2(future_create, future_, operation);
     }
 
-    FutureVoidImpl(NabtoClient* context,  std::shared_ptr<std::vector<uint8_t> > data)
+    FutureVoidImpl(NabtoClient* context,  std::shared_ptr<std::vector<uint8_t> > data, const char* operation)
         : future_(nabto_client_future_new(context)), data_(data)
     {
+        WrapperCounters::count(WrapperCounters::instance().futuresCreated_);
+        pending_.link(PendingFuture::FUTURE_VOID, operation, std::string());
+        NABTO_CLIENT_PROBE2(future_create, future_, operation);
     }
 
     FutureVoidImpl(NabtoClientFuture* future, std::shared_ptr<std::vector<uint8_t> > data)
@@ -260,22 +613,50 @@ class FutureVoidImpl : public FutureVoid, public std::enable_shared_from_this<Fu
     {
         if (!ended_) {
             auto c = std::make_shared<FutureVoidImpl>(future_, data_);
+            c->pending_.takeOver(pending_);
+            // The copy resolves the future, it ends the trace and records
+            // the CoAP latency in the place of this one.
+            c->coap_ = coap_;
+            c->coapStart_ = coapStart_;
+            c->tracer_ = tracer_;
+            c->traceId_ = traceId_;
             c->callback(std::make_shared<CallbackFunction>([](Status){ /* do nothing */ }));
         } else {
             nabto_client_future_free(future_);
+            WrapperCounters::count(WrapperCounters::instance().futuresFreed_);
         }
     }
+
+    // Measure the latency of the CoAP request this future belongs to.
+    void startCoap()
+    {
+        coap_ = true;
+        coapStart_ = std::chrono::steady_clock::now();
+        WrapperCounters::count(WrapperCounters::instance().coapRequests_);
+    }
+
+    // Tell the operation tracer, if any, about the operation this future belongs to.
+    void trace(const std::string& operation, const std::string& detail)
+    {
+        tracer_ = WrapperCounters::instance().tracer();
+        if (tracer_) {
+            traceId_ = tracer_->begin(operation, detail);
+        }
+    }
+
     // waitForResult for result.
     void waitForResult() {
-        nabto_client_future_wait(future_);
-        ended_ = true;
+        NabtoClientError ec = nabto_client_future_wait(future_);
+        ended(ec);
+        WrapperCounters::count(WrapperCounters::instance().futuresWaited_);
         return getResult();
     }
 
     static void doCallback(NabtoClientFuture* future, NabtoClientError ec, void* data)
     {
         FutureVoidImpl* self = (FutureVoidImpl*)data;
-        self->ended_ = true;
+        self->ended(ec);
+        WrapperCounters::count(WrapperCounters::instance().callbacksRun_);
         self->cb_->run(Status(ec));
         self->selfReference_ = nullptr;
     }
@@ -300,11 +681,34 @@ class FutureVoidImpl : public FutureVoid, public std::enable_shared_from_this<Fu
         return future_;
     }
  private:
+    void ended(NabtoClientError ec)
+    {
+        if (!ended_) {
+            NABTO_CLIENT_PROBE2(future_resolve, future_, ec);
+        }
+        if (!ended_ && coap_) {
+            auto latency = std::chrono::steady_clock::now() - coapStart_;
+            WrapperCounters::instance().coapDone(ec == NABTO_CLIENT_EC_OK, latency);
+            NABTO_CLIENT_PROBE3(coap_response, pending_.detail_.c_str(), ec,
+                                std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+        }
+        if (!ended_ && tracer_) {
+            tracer_->end(traceId_, Status(ec));
+        }
+        ended_ = true;
+        pending_.unlink();
+    }
+
     NabtoClientFuture* future_;
     std::shared_ptr<std::vector<uint8_t> > data_;
     std::shared_ptr<FutureVoidImpl> selfReference_;
     std::shared_ptr<FutureCallback> cb_;
     bool ended_ = false;
+    bool coap_ = false;
+    std::chrono::steady_clock::time_point coapStart_;
+    std::shared_ptr<OperationTracer> tracer_;
+    uint64_t traceId_ = 0;
+    PendingFuture pending_;
 };
 
 
@@ -322,7 +726,7 @@ class MdnsResolverImpl : public MdnsResolver {
     }
     virtual std::shared_ptr<FutureMdnsResult> getResult()
     {
-        auto future = std::make_shared<FutureMdnsResultImpl>(context_);
+        auto future = std::make_shared<FutureMdnsResultImpl>(context_, "mdns result");
         nabto_client_listener_new_mdns_result(resolver_, future->getFuture(), &future->result_);
         return future;
     }
@@ -336,8 +740,8 @@ class MdnsResolverImpl : public MdnsResolver {
 
 class CoapImpl : public Coap {
  public:
-    CoapImpl(NabtoClient* context, NabtoClientCoap* coap)
-        : context_(context)
+    CoapImpl(NabtoClient* context, NabtoClientCoap* coap, const std::string& method, const std::string& path)
+        : context_(context), method_(method), path_(path)
     {
         request_ = coap;
     }
@@ -351,7 +755,7 @@ class CoapImpl : public Coap {
         if (!request_) {
             return nullptr;
         }
-        return std::make_shared<CoapImpl>(context, request_);
+        return std::make_shared<CoapImpl>(context, request_, method, path);
     }
 
     void setRequestPayload(int contentFormat, const std::vector<uint8_t>& payload)
@@ -366,7 +770,10 @@ class CoapImpl : public Coap {
 
     std::shared_ptr<FutureVoid> execute()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "coap", method_ + " " + path_);
+        future->startCoap();
+        future->trace("coap", method_ + " " + path_);
+        NABTO_CLIENT_PROBE2(coap_execute, method_.c_str(), path_.c_str());
         nabto_client_coap_execute(request_, future->getFuture());
         return future;
     }
@@ -379,6 +786,7 @@ class CoapImpl : public Coap {
         if (ec) {
             throw NabtoException(ec);
         }
+        NABTO_CLIENT_PROBE2(coap_status, path_.c_str(), statusCode);
         return statusCode;
     }
     int getResponseContentFormat() {
@@ -408,6 +816,8 @@ class CoapImpl : public Coap {
  private:
     NabtoClientCoap* request_;
     NabtoClient* context_;
+    std::string method_;
+    std::string path_;
 };
 
 
@@ -423,7 +833,7 @@ class StreamImpl : public Stream {
     }
     std::shared_ptr<FutureVoid> open(uint32_t contentType)
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "stream open");
         nabto_client_stream_open(stream_, future->getFuture(), contentType);
         return future;
     }
@@ -431,7 +841,8 @@ class StreamImpl : public Stream {
     {
         auto data = std::make_shared<std::vector<uint8_t> >(n);
         auto transferred = std::make_shared<size_t>();
-        auto future = std::make_shared<FutureBufferImpl>(context_,data, transferred);
+        auto future = std::make_shared<FutureBufferImpl>(context_, data, transferred, "stream read all");
+        NABTO_CLIENT_PROBE2(stream_read, stream_, n);
         nabto_client_stream_read_all(stream_, future->getFuture(), data->data(), data->size(), transferred.get());
         return future;
     }
@@ -439,20 +850,22 @@ class StreamImpl : public Stream {
     {
         auto data = std::make_shared<std::vector<uint8_t> >(max);
         auto transferred = std::make_shared<size_t>();
-        auto future = std::make_shared<FutureBufferImpl>(context_, data, transferred);
+        auto future = std::make_shared<FutureBufferImpl>(context_, data, transferred, "stream read some");
+        NABTO_CLIENT_PROBE2(stream_read, stream_, max);
         nabto_client_stream_read_some(stream_, future->getFuture(), data->data(), data->size(), transferred.get());
         return future;
     }
     std::shared_ptr<FutureVoid> write(const std::vector<uint8_t>& buffer)
     {
         auto data = std::make_shared<std::vector<uint8_t> >(buffer.begin(), buffer.end());
-        auto future = std::make_shared<FutureVoidImpl>(context_, data);
+        auto future = std::make_shared<FutureVoidImpl>(context_, data, "stream write");
+        NABTO_CLIENT_PROBE2(stream_write, stream_, data->size());
         nabto_client_stream_write(stream_, future->getFuture(), data->data(), data->size());
         return future;
     }
     std::shared_ptr<FutureVoid> close()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "stream close");
         nabto_client_stream_close(stream_, future->getFuture());
         return future;
     }
@@ -477,14 +890,17 @@ class TcpTunnelImpl : public TcpTunnel {
     };
     virtual std::shared_ptr<FutureVoid> open(const std::string& service, uint16_t localPort)
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "tunnel open", service);
+        future->trace("tunnel open", service);
+        NABTO_CLIENT_PROBE3(tunnel_open, tcpTunnel_, service.c_str(), localPort);
         nabto_client_tcp_tunnel_open(tcpTunnel_, future->getFuture(), service.c_str(), localPort);
         return future;
     }
 
     virtual std::shared_ptr<FutureVoid> close()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "tunnel close");
+        NABTO_CLIENT_PROBE1(tunnel_close, tcpTunnel_);
         nabto_client_tcp_tunnel_close(tcpTunnel_, future->getFuture());
         return future;
     }
@@ -741,7 +1157,8 @@ class ConnectionImpl : public Connection, public std::enable_shared_from_this<Co
 
     std::shared_ptr<FutureVoid> connect()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "connect");
+        future->trace("connect", "");
         nabto_client_connection_connect(connection_, future->getFuture());
         return future;
     }
@@ -751,7 +1168,7 @@ class ConnectionImpl : public Connection, public std::enable_shared_from_this<Co
     }
     std::shared_ptr<FutureVoid> close()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "connection close");
         nabto_client_connection_close(connection_, future->getFuture());
         return future;
     }
@@ -768,12 +1185,14 @@ class ConnectionImpl : public Connection, public std::enable_shared_from_this<Co
 
     std::shared_ptr<FutureVoid> passwordAuthenticate(const std::string& username, const std::string& password)
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = std::make_shared<FutureVoidImpl>(context_, "password authenticate", username);
+        future->trace("password authenticate", username);
         nabto_client_connection_password_authenticate(connection_, username.c_str(), password.c_str(), future->getFuture());
         return future;
     }
 
     void notifyEvent(int event) {
+        NABTO_CLIENT_PROBE2(connection_event, connection_, event);
         std::lock_guard<std::mutex> lock(mutex_);
         for (auto cb : eventsCallbacks_) {
             cb->onEvent(event);
@@ -804,16 +1223,159 @@ class LogMessageImpl : public LogMessage {
  public:
     ~LogMessageImpl() {
     }
-    LogMessageImpl(const std::string& message, const std::string& severity)
-        : LogMessage(message, severity)
+    LogMessageImpl(const std::string& message, const std::string& severity, const std::string& module)
+        : LogMessage(message, severity, module)
     {
     }
 };
 
+/**
+ * Token bucket rate limit of log messages per message pattern. The
+ * pattern is the source location of the message if the SDK provides
+ * it, otherwise the module and the message with numbers masked out.
+ */
+class LogRateLimiter {
+ public:
+    LogRateLimiter()
+        : passed_(0), suppressed_(0), sampled_(0), errors_(0), warnings_(0)
+    {
+    }
+
+    void configure(double messagesPerSecond, size_t burst, size_t sampleEvery)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        messagesPerSecond_ = messagesPerSecond;
+        burst_ = burst;
+        sampleEvery_ = sampleEvery;
+        buckets_.clear();
+    }
+
+    // suppressed is set to the number of messages of the same pattern
+    // which was suppressed since the last message which was passed on.
+    bool allow(const NabtoClientLogMessage* message, uint64_t& suppressed)
+    {
+        suppressed = 0;
+        if (message->severity == NABTO_CLIENT_LOG_SEVERITY_ERROR ||
+            message->severity == NABTO_CLIENT_LOG_SEVERITY_WARN)
+        {
+            if (message->severity == NABTO_CLIENT_LOG_SEVERITY_ERROR) {
+                errors_++;
+            } else {
+                warnings_++;
+            }
+            passed_++;
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (messagesPerSecond_ <= 0) {
+            passed_++;
+            return true;
+        }
+
+        std::string key = pattern(message);
+        auto it = buckets_.find(key);
+        auto now = std::chrono::steady_clock::now();
+        if (it == buckets_.end()) {
+            if (buckets_.size() >= maxPatterns) {
+                buckets_.clear();
+            }
+            Bucket b;
+            b.tokens_ = static_cast<double>(burst_);
+            b.last_ = now;
+            it = buckets_.insert(std::make_pair(key, b)).first;
+        }
+
+        Bucket& b = it->second;
+        double elapsed = std::chrono::duration<double>(now - b.last_).count();
+        b.last_ = now;
+        b.tokens_ = std::min(static_cast<double>(burst_), b.tokens_ + elapsed * messagesPerSecond_);
+        if (b.tokens_ >= 1.0) {
+            b.tokens_ -= 1.0;
+            suppressed = b.suppressed_;
+            b.suppressed_ = 0;
+            passed_++;
+            return true;
+        }
+
+        if (sampleEvery_ > 0 && ++b.sinceSample_ >= sampleEvery_) {
+            b.sinceSample_ = 0;
+            suppressed = b.suppressed_;
+            b.suppressed_ = 0;
+            sampled_++;
+            return true;
+        }
+        b.suppressed_++;
+        suppressed_++;
+        return false;
+    }
+
+    LogStatistics statistics()
+    {
+        LogStatistics s;
+        s.passed_ = passed_;
+        s.suppressed_ = suppressed_;
+        s.sampled_ = sampled_;
+        s.errors_ = errors_;
+        s.warnings_ = warnings_;
+        return s;
+    }
+
+ private:
+    static std::string pattern(const NabtoClientLogMessage* message)
+    {
+        std::string key;
+        if (message->file != NULL) {
+            key.append(message->file);
+            key.push_back(':');
+            key.append(std::to_string(message->line));
+            return key;
+        }
+        if (message->module != NULL) {
+            key.append(message->module);
+        }
+        key.push_back('|');
+        bool inNumber = false;
+        for (const char* c = message->message; c != NULL && *c != 0; c++) {
+            if (std::isdigit(static_cast<unsigned char>(*c))) {
+                if (!inNumber) {
+                    key.push_back('#');
+                }
+                inNumber = true;
+            } else {
+                key.push_back(*c);
+                inNumber = false;
+            }
+        }
+        return key;
+    }
+
+    class Bucket {
+     public:
+        double tokens_ = 0;
+        std::chrono::steady_clock::time_point last_;
+        uint64_t suppressed_ = 0;
+        size_t sinceSample_ = 0;
+    };
+
+    static const size_t maxPatterns = 1024;
+
+    std::mutex mutex_;
+    double messagesPerSecond_ = 0;
+    size_t burst_ = 0;
+    size_t sampleEvery_ = 0;
+    std::map<std::string, Bucket> buckets_;
+    std::atomic<uint64_t> passed_;
+    std::atomic<uint64_t> suppressed_;
+    std::atomic<uint64_t> sampled_;
+    std::atomic<uint64_t> errors_;
+    std::atomic<uint64_t> warnings_;
+};
+
 class LoggerProxy {
  public:
-    LoggerProxy(std::shared_ptr<Logger> logger, NabtoClient* context)
-        : logger_(logger), context_(context)
+    LoggerProxy(std::shared_ptr<Logger> logger, NabtoClient* context, std::shared_ptr<LogRateLimiter> rateLimiter)
+        : logger_(logger), context_(context), rateLimiter_(rateLimiter)
     {
         nabto_client_set_log_callback(context, &LoggerProxy::cLogCallback, this);
     }
@@ -824,9 +1386,18 @@ class LoggerProxy {
 
     static void cLogCallback(const NabtoClientLogMessage* message, void* userData) {
         LoggerProxy *proxy = (LoggerProxy *) userData;
+        NABTO_CLIENT_PROBE2(log_message, message->severityString, message->message);
+        uint64_t suppressed;
+        if (!proxy->rateLimiter_->allow(message, suppressed)) {
+            return;
+        }
         std::shared_ptr<Logger> logger = proxy->logger_;
         if (logger) {
-            LogMessageImpl msg = LogMessageImpl(message->message, message->severityString);
+            std::string text(message->message);
+            if (suppressed > 0) {
+                text.append(" (" + std::to_string(suppressed) + " similar messages suppressed)");
+            }
+            LogMessageImpl msg = LogMessageImpl(text, message->severityString, message->module ? message->module : "");
             logger->log(msg);
         }
     }
@@ -834,14 +1405,85 @@ class LoggerProxy {
  private:
     std::shared_ptr<Logger> logger_;
     NabtoClient* context_;
+    std::shared_ptr<LogRateLimiter> rateLimiter_;
+};
+
+/**
+ * Restores the log level after a temporary change of it. The SDK
+ * functions cannot be called from the log callback, so the level is
+ * restored from a thread of its own.
+ */
+class LogLevelReverter {
+ public:
+    LogLevelReverter(NabtoClient* context)
+        : context_(context)
+    {
+    }
+    ~LogLevelReverter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        cond_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void setBaseLevel(const std::string& level)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        baseLevel_ = level;
+        pending_ = false;
+    }
+
+    void revertAt(std::chrono::steady_clock::time_point deadline)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            deadline_ = deadline;
+            pending_ = true;
+            if (!thread_.joinable()) {
+                thread_ = std::thread([this]() { run(); });
+            }
+        }
+        cond_.notify_one();
+    }
+
+ private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopped_) {
+            if (!pending_) {
+                cond_.wait(lock);
+            } else if (cond_.wait_until(lock, deadline_) == std::cv_status::timeout && pending_ && std::chrono::steady_clock::now() >= deadline_) {
+                pending_ = false;
+                nabto_client_set_log_level(context_, baseLevel_.c_str());
+            }
+        }
+    }
+
+    NabtoClient* context_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+    // The SDK default level.
+    std::string baseLevel_ = "info";
+    std::chrono::steady_clock::time_point deadline_;
+    bool pending_ = false;
+    bool stopped_ = false;
 };
 
 class ContextImpl : public Context {
  public:
     ContextImpl() {
         context_ = nabto_client_new();
+        rateLimiter_ = std::make_shared<LogRateLimiter>();
+        logLevelReverter_ = std::make_shared<LogLevelReverter>(context_);
     }
     ~ContextImpl() {
+        logLevelReverter_.reset();
         nabto_client_stop(context_);
         loggerProxy_.reset();
         nabto_client_free(context_);
@@ -859,7 +1501,7 @@ class ContextImpl : public Context {
 
     void setLogger(std::shared_ptr<Logger> logger) {
         // todo test return value.
-        loggerProxy_ = std::make_shared<LoggerProxy>(logger, context_);
+        loggerProxy_ = std::make_shared<LoggerProxy>(logger, context_, rateLimiter_);
     }
 
     void setLogLevel(const std::string& level) {
@@ -867,6 +1509,23 @@ class ContextImpl : public Context {
         if (ec) {
             throw NabtoException(ec);
         }
+        logLevelReverter_->setBaseLevel(level);
+    }
+
+    void setLogLevelFor(const std::string& level, std::chrono::seconds duration) {
+        NabtoClientError ec = nabto_client_set_log_level(context_, level.c_str());
+        if (ec) {
+            throw NabtoException(ec);
+        }
+        logLevelReverter_->revertAt(std::chrono::steady_clock::now() + duration);
+    }
+
+    void setLogRateLimit(double messagesPerSecond, size_t burst, size_t sampleEvery) {
+        rateLimiter_->configure(messagesPerSecond, burst, sampleEvery);
+    }
+
+    LogStatistics getLogStatistics() {
+        return rateLimiter_->statistics();
     }
 
     std::string createPrivateKey() {
@@ -889,6 +1548,8 @@ class ContextImpl : public Context {
  private:
     NabtoClient* context_;
     std::shared_ptr<LoggerProxy> loggerProxy_;
+    std::shared_ptr<LogRateLimiter> rateLimiter_;
+    std::shared_ptr<LogLevelReverter> logLevelReverter_;
 
 };
 
@@ -896,6 +1557,18 @@ std::string Context::version() {
     return std::string(nabto_client_version());
 }
 
+WrapperStatistics Context::wrapperStatistics() {
+    return WrapperCounters::instance().statistics();
+}
+
+std::vector<OutstandingFuture> Context::outstandingFutures() {
+    return PendingFutures::instance().outstanding();
+}
+
+void Context::setOperationTracer(std::shared_ptr<OperationTracer> tracer) {
+    WrapperCounters::instance().setTracer(tracer);
+}
+
 std::shared_ptr<Context> Context::create()
 {
     return std::make_shared<ContextImpl>();
@@ -0,0 +1,44 @@
+#pragma once
+
+/**
+ * USDT probes of the nabto_client provider, for bpftrace and perf, e.g.
+ *
+ *   bpftrace -e 'usdt:./edge_tunnel_client:nabto_client:coap_response { printf("%s %d\n", str(arg0), arg1); }'
+ *
+ * The probes are compiled in when NABTO_CLIENT_USDT is defined, which
+ * the build does when sys/sdt.h is available. A probe is a nop until a
+ * tracer attaches to it. Without NABTO_CLIENT_USDT the macros compile to
+ * nothing and their arguments are not evaluated.
+ *
+ * Probes and their arguments:
+ *   future_create(future, operation)
+ *   future_resolve(future, error)
+ *   coap_execute(method, path)
+ *   coap_response(request, error, microseconds)  request is "METHOD path"
+ *   coap_status(path, status)
+ *   stream_read(stream, size)
+ *   stream_read_done(future, transferred)
+ *   stream_write(stream, size)
+ *   tunnel_open(tunnel, service, local port)
+ *   tunnel_close(tunnel)
+ *   connection_event(connection, event)
+ *   log_message(severity, message)
+ */
+
+#if defined(NABTO_CLIENT_USDT)
+
+#include <sys/sdt.h>
+
+#define NABTO_CLIENT_PROBE1(name, a) DTRACE_PROBE1(nabto_client, name, a)
+#define NABTO_CLIENT_PROBE2(name, a, b) DTRACE_PROBE2(nabto_client, name, a, b)
+#define NABTO_CLIENT_PROBE3(name, a, b, c) DTRACE_PROBE3(nabto_client, name, a, b, c)
+
+#else
+
+// The arguments are named in sizeof such that they count as used
+// without being evaluated.
+#define NABTO_CLIENT_PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define NABTO_CLIENT_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define NABTO_CLIENT_PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+
+#endif
@@ -0,0 +1,177 @@
+#include "nabto_client_reactor.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+namespace nabto {
+namespace client {
+
+class ReactorEventsCallback : public ConnectionEventsCallback {
+ public:
+    ReactorEventsCallback(std::weak_ptr<ReactorBridge> bridge, std::function<void (int event)> handler)
+        : bridge_(bridge), handler_(handler)
+    {
+    }
+    void onEvent(int event)
+    {
+        auto bridge = bridge_.lock();
+        if (bridge) {
+            auto handler = handler_;
+            bridge->post([handler, event]() { handler(event); });
+        }
+    }
+ private:
+    std::weak_ptr<ReactorBridge> bridge_;
+    std::function<void (int event)> handler_;
+};
+
+std::shared_ptr<ReactorBridge> ReactorBridge::create()
+{
+#if defined(__linux__)
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return std::shared_ptr<ReactorBridge>(new ReactorBridge(fd, fd));
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return nullptr;
+    }
+    for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return std::shared_ptr<ReactorBridge>(new ReactorBridge(fds[0], fds[1]));
+#endif
+}
+
+ReactorBridge::ReactorBridge(int readFd, int writeFd)
+    : readFd_(readFd), writeFd_(writeFd), head_(&stub_), tail_(&stub_), signalled_(false)
+{
+    stub_.next_.store(nullptr, std::memory_order_relaxed);
+}
+
+ReactorBridge::~ReactorBridge()
+{
+    Node* node;
+    while ((node = pop()) != nullptr) {
+        delete node;
+    }
+    close(readFd_);
+    if (writeFd_ != readFd_) {
+        close(writeFd_);
+    }
+}
+
+void ReactorBridge::watch(std::shared_ptr<Future> future, std::function<void (Status status)> handler)
+{
+    // The future holds its callback, keep only a weak reference to it
+    // there. The future keeps itself alive while its callback runs.
+    std::weak_ptr<ReactorBridge> weakBridge = shared_from_this();
+    std::weak_ptr<Future> weakFuture = future;
+    future->callback([weakBridge, weakFuture, handler](Status status) {
+        auto bridge = weakBridge.lock();
+        if (bridge) {
+            auto future = weakFuture.lock();
+            bridge->post([future, handler, status]() { handler(status); });
+        }
+    });
+}
+
+std::shared_ptr<ConnectionEventsCallback> ReactorBridge::connectionEvents(std::function<void (int event)> handler)
+{
+    return std::make_shared<ReactorEventsCallback>(shared_from_this(), handler);
+}
+
+void ReactorBridge::post(std::function<void ()> fn)
+{
+    Node* node = new Node();
+    node->fn_ = std::move(fn);
+    push(node);
+    signal();
+}
+
+size_t ReactorBridge::dispatch()
+{
+    // Empty the fd before clearing the flag and clear the flag before
+    // popping. A producer signalling before the flag is cleared has its
+    // node popped below, one signalling after it writes to the fd again.
+    // The exchange synchronizes with the producer's exchange in signal(),
+    // such that its node is visible to pop().
+    drain();
+    signalled_.exchange(false);
+    size_t n = 0;
+    Node* node;
+    while ((node = pop()) != nullptr) {
+        node->fn_();
+        delete node;
+        n++;
+    }
+    return n;
+}
+
+void ReactorBridge::push(Node* node)
+{
+    node->next_.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next_.store(node, std::memory_order_release);
+}
+
+// Only called from the consumer. Returns nullptr when empty, and also
+// while a producer is between exchanging head_ and linking its node,
+// that producer signals the fd after linking.
+ReactorBridge::Node* ReactorBridge::pop()
+{
+    Node* tail = tail_;
+    Node* next = tail->next_.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+        if (next == nullptr) {
+            return nullptr;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next_.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    push(&stub_);
+    next = tail->next_.load(std::memory_order_acquire);
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void ReactorBridge::signal()
+{
+    if (signalled_.exchange(true)) {
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t r;
+    do {
+        r = write(writeFd_, &one, (writeFd_ == readFd_) ? sizeof(one) : 1);
+    } while (r < 0 && errno == EINTR);
+}
+
+void ReactorBridge::drain()
+{
+    uint8_t buffer[64];
+    ssize_t r;
+    do {
+        r = read(readFd_, buffer, sizeof(buffer));
+    } while (r > 0 || (r < 0 && errno == EINTR));
+}
+
+} } // namespace
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "nabto_client.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace nabto {
+namespace client {
+
+/**
+ * Hands completions of futures and connection events over to a single
+ * threaded event loop, such as an epoll reactor, instead of blocking a
+ * thread in waitForResult or running on the SDK thread.
+ *
+ * The SDK threads push the completions onto a lock free multiple
+ * producer, single consumer queue and make fd() readable. The event
+ * loop registers fd() for reading and calls dispatch() when it is
+ * readable, which runs the handlers queued so far on the loop thread.
+ *
+ *   auto bridge = ReactorBridge::create();
+ *   epoll_event ev = { EPOLLIN, { 0 } };
+ *   epoll_ctl(epfd, EPOLL_CTL_ADD, bridge->fd(), &ev);
+ *   auto coap = connection->createCoap("GET", "/iam/me");
+ *   bridge->watch(coap->execute(), [coap](Status status) { ... });
+ *   connection->addEventsListener(bridge->connectionEvents([](int event) { ... }));
+ *   ... epoll_wait, then bridge->dispatch();
+ *
+ * The fd is an eventfd on Linux and a pipe on other POSIX systems.
+ */
+class ReactorBridge : public std::enable_shared_from_this<ReactorBridge> {
+ public:
+    // nullptr if the fd could not be created.
+    static std::shared_ptr<ReactorBridge> create();
+    ~ReactorBridge();
+
+    int fd() const { return readFd_; }
+
+    // Run the handler on the loop thread when the future resolves. The
+    // future is kept alive until then, the result is retrieved with
+    // getResult() in the handler.
+    void watch(std::shared_ptr<Future> future, std::function<void (Status status)> handler);
+
+    // A listener to add to connections whose events are handled on the
+    // loop thread.
+    std::shared_ptr<ConnectionEventsCallback> connectionEvents(std::function<void (int event)> handler);
+
+    // Run a function on the loop thread, callable from any thread.
+    void post(std::function<void ()> fn);
+
+    // Run the queued handlers, including handlers queued while it
+    // runs, returns the number run.
+    size_t dispatch();
+
+ private:
+    class Node {
+     public:
+        std::atomic<Node*> next_;
+        std::function<void ()> fn_;
+    };
+
+    ReactorBridge(int readFd, int writeFd);
+    void push(Node* node);
+    Node* pop();
+    void signal();
+    void drain();
+
+    int readFd_;
+    int writeFd_;
+
+    // Vyukov's intrusive MPSC queue, producers exchange head_ and the
+    // consumer follows the next_ links from tail_.
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+
+    // Set while the fd is readable, such that a burst of completions
+    // costs one write.
+    std::atomic<bool> signalled_;
+};
+
+} } // namespace
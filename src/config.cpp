@@ -1,4 +1,5 @@
 #include "config.hpp"
+#include "mdns_presence.hpp"
 
 #include <nabto_client.hpp>
 
@@ -9,8 +10,12 @@
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <memory>
 #include <list>
+#include <mutex>
+#include <atomic>
 
 #if defined(_WIN32)
 #include <direct.h>
@@ -30,12 +35,54 @@ static struct
     string ConfigFilePath;
     string StateFilePath;
     string KeyFilePath;
-    std::map<int, DeviceInfo> Bookmarks;
+    // The current snapshot, read and replaced with std::atomic_load and
+    // std::atomic_store only, and published with PublishBookmarks.
+    BookmarkSnapshot Bookmarks = std::make_shared<const BookmarkMap>();
 
     bool HasLoadedConfigFile;
     string ServerUrl;
 } Configuration;
 
+// Orders the writers of the bookmarks and the state file, readers never
+// take it.
+static std::mutex WriterMutex;
+
+// Incremented after each snapshot is published. std::atomic_load of a
+// shared_ptr takes a lock in libstdc++, readers only do it when the
+// generation has moved on from the snapshot they hold.
+static std::atomic<uint64_t> BookmarksGeneration(1);
+
+static void PublishBookmarks(BookmarkSnapshot Bookmarks)
+{
+    std::atomic_store(&Configuration.Bookmarks, std::move(Bookmarks));
+    BookmarksGeneration.fetch_add(1, std::memory_order_release);
+}
+
+BookmarkSnapshot GetBookmarks()
+{
+    // A snapshot loaded after reading the generation is at least as new
+    // as the generation, at worst it is loaded again on the next call.
+    static thread_local BookmarkSnapshot Cached;
+    static thread_local uint64_t CachedGeneration = 0;
+    uint64_t Generation = BookmarksGeneration.load(std::memory_order_acquire);
+    if (Generation != CachedGeneration) {
+        Cached = std::atomic_load(&Configuration.Bookmarks);
+        CachedGeneration = Generation;
+    }
+    return Cached;
+}
+
+// Copy the current snapshot, change the copy and publish it. Readers
+// holding the previous snapshot keep it until they let go of it.
+template <typename Update>
+static void UpdateBookmarks(Update update)
+{
+    std::lock_guard<std::mutex> lock(WriterMutex);
+    auto next = std::make_shared<BookmarkMap>(*GetBookmarks());
+    update(*next);
+    PublishBookmarks(std::move(next));
+}
+
 void to_json(json& j, const DeviceInfo& d)
 {
     j = json({
@@ -47,6 +94,15 @@ void to_json(json& j, const DeviceInfo& d)
     if (!d.directCandidate_.empty()) {
         j["DirectCandidate"] = d.directCandidate_;
     }
+    if (d.metadata_.fetched()) {
+        j["Metadata"] = json({
+                {"FriendlyName", d.metadata_.friendlyName_},
+                {"AppName", d.metadata_.appName_},
+                {"AppVersion", d.metadata_.appVersion_},
+                {"NabtoVersion", d.metadata_.nabtoVersion_},
+                {"FetchedAt", d.metadata_.fetchedAt_}
+            });
+    }
 }
 
 void from_json(const json& j, DeviceInfo& d)
@@ -60,6 +116,14 @@ void from_json(const json& j, DeviceInfo& d)
     } catch (const std::exception& e) {
         // no direct candidate, fine
     }
+    auto metadata = j.find("Metadata");
+    if (metadata != j.end() && metadata->is_object()) {
+        d.metadata_.friendlyName_ = metadata->value("FriendlyName", "");
+        d.metadata_.appName_ = metadata->value("AppName", "");
+        d.metadata_.appVersion_ = metadata->value("AppVersion", "");
+        d.metadata_.nabtoVersion_ = metadata->value("NabtoVersion", "");
+        d.metadata_.fetchedAt_ = metadata->value("FetchedAt", static_cast<int64_t>(0));
+    }
 }
 
 bool WriteStringToFile(const string& String, const string& Filename)
@@ -141,12 +205,13 @@ void CommonInit()
         // NOTE(as): State file wasn't found, it'll probably be created later.
     }
 
+    auto Bookmarks = std::make_shared<BookmarkMap>();
     try
     {
         for(auto Device : StateContents["devices"])
         {
             DeviceInfo Info = Device.get<DeviceInfo>();
-            Configuration.Bookmarks[Configuration.Bookmarks.size()] = Info;
+            (*Bookmarks)[Bookmarks->size()] = Info;
         }
     }
     catch (...)
@@ -155,8 +220,9 @@ void CommonInit()
         // TODO(as): Analyze the file and let the user know where exactly it went wrong?
         std::cerr << "IMPORTANT: Your state file (" << Configuration.StateFilePath << ") seems to be incorrect.\n" <<
             "As a result no paired devices were loaded from it." << std::endl;
-        Configuration.Bookmarks.clear();
+        Bookmarks->clear();
     }
+    PublishBookmarks(std::move(Bookmarks));
 }
 
 string NormalizePath(const char *Path)
@@ -237,8 +303,11 @@ const char* GetStateFilePath()
 
 bool WriteStateFile()
 {
+    // The snapshot is taken under the writer lock such that a slower
+    // writer cannot replace the file with older bookmarks.
+    std::lock_guard<std::mutex> lock(WriterMutex);
     json BookmarksArray = json::array();
-    for (auto Bookmark : Configuration.Bookmarks) {
+    for (const auto& Bookmark : *GetBookmarks()) {
         BookmarksArray.push_back(Bookmark.second);
     }
     json Contents = { {"devices", BookmarksArray} };
@@ -248,9 +317,11 @@ bool WriteStateFile()
 
 std::unique_ptr<DeviceInfo> GetPairedDevice(int index)
 {
-    if (index >= 0 && Configuration.Bookmarks.size() > static_cast<unsigned int>(index))
+    auto Bookmarks = GetBookmarks();
+    auto it = Bookmarks->find(index);
+    if (it != Bookmarks->end())
     {
-        auto device = std::make_unique<DeviceInfo>(Configuration.Bookmarks[index]);
+        auto device = std::make_unique<DeviceInfo>(it->second);
         device->index_ = index;
         return device;
     }
@@ -262,7 +333,7 @@ std::unique_ptr<DeviceInfo> GetPairedDevice(int index)
 
 std::unique_ptr<DeviceInfo> GetPairedDevice(const std::string& deviceFingerprint)
 {
-    for (auto& bookmark : Configuration.Bookmarks) {
+    for (auto& bookmark : *GetBookmarks()) {
         if (bookmark.second.getDeviceFingerprint() == deviceFingerprint ) {
             auto device = std::make_unique<DeviceInfo>(bookmark.second);
             device->index_ = bookmark.first;
@@ -272,25 +343,61 @@ std::unique_ptr<DeviceInfo> GetPairedDevice(const std::string& deviceFingerprint
     return nullptr;
 }
 
+std::vector<DeviceInfo> GetPairedDevices()
+{
+    std::vector<DeviceInfo> devices;
+    for (const auto& bookmark : *GetBookmarks()) {
+        devices.push_back(bookmark.second);
+        devices.back().index_ = bookmark.first;
+    }
+    return devices;
+}
+
+bool SetDeviceMetadata(int Index, const DeviceMetadata& Metadata)
+{
+    bool found = false;
+    UpdateBookmarks([&](BookmarkMap& Bookmarks) {
+        auto it = Bookmarks.find(Index);
+        if (it != Bookmarks.end()) {
+            it->second.metadata_ = Metadata;
+            found = true;
+        }
+    });
+    return found;
+}
+
+void SetDeviceMetadata(const std::map<int, DeviceMetadata>& Metadata)
+{
+    UpdateBookmarks([&](BookmarkMap& Bookmarks) {
+        for (const auto& m : Metadata) {
+            auto it = Bookmarks.find(m.first);
+            if (it != Bookmarks.end()) {
+                it->second.metadata_ = m.second;
+            }
+        }
+    });
+}
+
 bool HasNoBookmarks()
 {
-    return Configuration.Bookmarks.empty();
+    return GetBookmarks()->empty();
 }
 
 void AddPairedDeviceToBookmarks(DeviceInfo& Info)
 {
-    for (auto b : Configuration.Bookmarks) {
-        if (b.second.getDeviceId() == Info.getDeviceId() && b.second.getProductId() == Info.getProductId()) {
-            Configuration.Bookmarks[b.first] = Info;
-            Info.index_ = b.first;
-            return;
+    UpdateBookmarks([&](BookmarkMap& Bookmarks) {
+        for (const auto& b : Bookmarks) {
+            if (b.second.getDeviceId() == Info.getDeviceId() && b.second.getProductId() == Info.getProductId()) {
+                Info.index_ = b.first;
+                Bookmarks[b.first] = Info;
+                return;
+            }
         }
-    }
 
-    size_t index = Configuration.Bookmarks.size();
-    Configuration.Bookmarks[index] = Info;
-    Info.index_ = index;
-    return;
+        size_t index = Bookmarks.size();
+        Info.index_ = index;
+        Bookmarks[index] = Info;
+    });
 }
 
 bool CreatePrivateKeyFile(std::shared_ptr<nabto::client::Context> Context)
@@ -310,31 +417,90 @@ bool GetPrivateKey(std::shared_ptr<nabto::client::Context> Context, string& Out)
     return ReadEntireFileZeroTerminated(Configuration.KeyFilePath, Out);
 }
 
-void PrintBookmarks()
+static string lower(const string& in)
 {
-    if (Configuration.Bookmarks.empty())
+    string out = in;
+    std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return out;
+}
+
+static bool MatchesFilter(const DeviceInfo& Device, const string& Filter)
+{
+    string filter = lower(Filter);
+    for (const string* field : { &Device.productId_, &Device.deviceId_, &Device.metadata_.friendlyName_, &Device.metadata_.appName_ }) {
+        if (lower(*field).find(filter) != string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static string FormatAge(int64_t Seconds)
+{
+    std::stringstream ss;
+    if (Seconds < 120) {
+        ss << Seconds << "s";
+    } else if (Seconds < 2 * 3600) {
+        ss << Seconds / 60 << "m";
+    } else if (Seconds < 48 * 3600) {
+        ss << Seconds / 3600 << "h";
+    } else {
+        ss << Seconds / 86400 << "d";
+    }
+    return ss.str();
+}
+
+void PrintBookmarks(const nabto::examples::common::MdnsPresence* presence, const string& filter)
+{
+    auto Bookmarks = GetBookmarks();
+    if (Bookmarks->empty())
     {
         std::cout << "No bookmarked devices were found. Maybe you should pair with a few devices?" << std::endl;
         return;
     }
 
-    int index = 0;
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
     std::cout << "The following devices are saved in your bookmarks:" << std::endl;
-    for (auto Bookmark : Configuration.Bookmarks)
+    for (const auto& Bookmark : *Bookmarks)
     {
-        std::cout << "[" << index << "] ProductId: " << Bookmark.second.getProductId() << " DeviceId: " << Bookmark.second.getDeviceId() << std::endl;
-        index++;
+        const DeviceInfo& Device = Bookmark.second;
+        if (!filter.empty() && !MatchesFilter(Device, filter)) {
+            continue;
+        }
+        std::cout << "[" << Bookmark.first << "] ProductId: " << Device.getProductId() << " DeviceId: " << Device.getDeviceId();
+        const DeviceMetadata& metadata = Device.metadata_;
+        if (metadata.fetched()) {
+            if (!metadata.friendlyName_.empty()) {
+                std::cout << " Name: " << metadata.friendlyName_;
+            }
+            if (!metadata.appName_.empty()) {
+                std::cout << " App: " << metadata.appName_ << " " << metadata.appVersion_;
+            }
+            std::cout << " (fetched " << FormatAge(std::max<int64_t>(0, now - metadata.fetchedAt_)) << " ago)";
+        }
+        if (presence) {
+            auto local = presence->presence(Device.getProductId(), Device.getDeviceId());
+            if (local == nabto::examples::common::MdnsPresence::Presence::PRESENT) {
+                std::cout << " (local)";
+            } else if (local == nabto::examples::common::MdnsPresence::Presence::UNKNOWN) {
+                std::cout << " (local: not yet known)";
+            }
+        }
+        std::cout << std::endl;
     }
 }
 
 
 bool DeleteBookmark(const uint32_t& bookmark)
 {
-    if (Configuration.Bookmarks.find(bookmark) == Configuration.Bookmarks.end()) {
+    bool found = false;
+    UpdateBookmarks([&](BookmarkMap& Bookmarks) {
+        found = Bookmarks.erase(bookmark) > 0;
+    });
+    if (!found) {
         std::cerr << "The bookmark " << bookmark << " does not exist" << std::endl;
         return false;
     }
-    Configuration.Bookmarks.erase(bookmark);
     return WriteStateFile();
 }
 
@@ -1,6 +1,9 @@
 #pragma once
+#include <cstdint>
+#include <map>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include <sstream>
 
@@ -11,6 +14,14 @@ class Context;
 
 } }
 
+namespace nabto {
+namespace examples {
+namespace common {
+
+class MdnsPresence;
+
+} } }
+
 
 
 namespace Configuration
@@ -29,9 +40,28 @@ const std::string StateFileName = "state/tcp_tunnel_client_state.json";
 const std::string KeyFileName = "keys/client.key";
 
 
+/**
+ * Information about a device fetched from its /iam/pairing endpoint,
+ * kept in the state file such that bookmarks can be listed and filtered
+ * without connecting. fetchedAt_ is in seconds since the epoch, 0 if it
+ * was never fetched.
+ */
+class DeviceMetadata
+{
+ public:
+    bool fetched() const { return fetchedAt_ != 0; }
+
+    std::string friendlyName_;
+    std::string appName_;
+    std::string appVersion_;
+    std::string nabtoVersion_;
+    int64_t fetchedAt_ = 0;
+};
+
 class DeviceInfo
 {
  public:
+    DeviceInfo() : index_(0) {}
 
     std::string getFriendlyName() const
     {
@@ -40,12 +70,12 @@ class DeviceInfo
         return ss.str();
     }
 
-    std::string getDeviceId() { return deviceId_; }
-    std::string getProductId() { return productId_; }
-    std::string getDeviceFingerprint() { return deviceFingerprint_; }
-    std::string getSct() { return sct_; }
-    std::string getDirectCandidate() { return directCandidate_; }
-    int getIndex() { return index_; }
+    const std::string& getDeviceId() const { return deviceId_; }
+    const std::string& getProductId() const { return productId_; }
+    const std::string& getDeviceFingerprint() const { return deviceFingerprint_; }
+    const std::string& getSct() const { return sct_; }
+    const std::string& getDirectCandidate() const { return directCandidate_; }
+    int getIndex() const { return index_; }
 
     int index_;
     std::string deviceId_;
@@ -53,6 +83,7 @@ class DeviceInfo
     std::string deviceFingerprint_;
     std::string sct_;
     std::string directCandidate_;
+    DeviceMetadata metadata_;
 };
 
 class ClientConfiguration {
@@ -66,6 +97,9 @@ class ClientConfiguration {
     std::string serverUrl_;
 };
 
+typedef std::map<int, DeviceInfo> BookmarkMap;
+typedef std::shared_ptr<const BookmarkMap> BookmarkSnapshot;
+
 void InitializeWithDirectory(const std::string &HomePath);
 std::unique_ptr<ClientConfiguration> GetConfigInfo();
 const char* GetConfigFilePath();
@@ -73,11 +107,32 @@ const char* GetStateFilePath();
 bool WriteStateFile();
 std::unique_ptr<DeviceInfo> GetPairedDevice(int Index);
 std::unique_ptr<DeviceInfo> GetPairedDevice(const std::string& fingerprint);
+// All bookmarks with their index set.
+std::vector<DeviceInfo> GetPairedDevices();
+// Replace the cached metadata of a bookmark, write the state file to keep it.
+bool SetDeviceMetadata(int Index, const DeviceMetadata& Metadata);
+// As above for many bookmarks, publishing one snapshot.
+void SetDeviceMetadata(const std::map<int, DeviceMetadata>& Metadata);
+/**
+ * The bookmarks as of now. A snapshot never changes, pairing, deleting
+ * and refreshing publish a new snapshot instead, such that threads can
+ * look up bookmarks while others change them. Each thread keeps the
+ * snapshot it got last and reuses it until a new one is published, so
+ * in the steady state a call reads one atomic counter and copies the
+ * pointer. Only the first call after a change goes through
+ * std::atomic_load, which takes a lock in libstdc++. Hold on to one snapshot for a consistent view
+ * across several lookups.
+ */
+BookmarkSnapshot GetBookmarks();
 bool HasNoBookmarks();
 // insert info into bookmarks, and set the index into the info
 void AddPairedDeviceToBookmarks(DeviceInfo& Info);
 bool GetPrivateKey(std::shared_ptr<nabto::client::Context> Context, std::string& PrivateKey);
-void PrintBookmarks();
+// Bookmarks found in the presence table are annotated as local, or as
+// not yet known while the table cannot tell. With a
+// filter only the bookmarks whose ids or cached names contain it, ignoring
+// case, are printed.
+void PrintBookmarks(const nabto::examples::common::MdnsPresence* presence = nullptr, const std::string& filter = "");
 bool DeleteBookmark(const uint32_t& bookmark);
 
 bool makeDirectories(const std::string& in);
@@ -0,0 +1,133 @@
+#include "connect_timings.hpp"
+#include "trace.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <iomanip>
+
+namespace Timing {
+
+static double milliseconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+void ConnectTimings::begin(const std::string& phase)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (running_) {
+        endPhase(true);
+    }
+    if (phases_.empty()) {
+        first_ = now;
+    }
+    Phase p;
+    p.name_ = phase;
+    p.start_ = now - first_;
+    p.duration_ = std::chrono::steady_clock::duration::zero();
+    phases_.push_back(p);
+    current_ = now;
+    running_ = true;
+}
+
+void ConnectTimings::end()
+{
+    if (running_) {
+        endPhase(true);
+    }
+}
+
+void ConnectTimings::fail()
+{
+    if (running_) {
+        endPhase(false);
+    }
+}
+
+void ConnectTimings::endPhase(bool ok)
+{
+    auto now = std::chrono::steady_clock::now();
+    phases_.back().duration_ = now - current_;
+    phases_.back().ok_ = ok;
+    running_ = false;
+    Tracing::record("phase " + phases_.back().name_, current_, now, { { "status", ok ? "ok" : "failed" } });
+}
+
+void ConnectTimings::setChannel(std::shared_ptr<nabto::client::Connection> connection)
+{
+    hasChannel_ = true;
+    try {
+        channel_ = connection->getType() == nabto::client::Connection::Type::DIRECT ? "direct" : "relay";
+    } catch (nabto::client::NabtoException&) {
+        // Not connected.
+        channel_.clear();
+    }
+    localError_ = connection->getLocalChannelErrorCode();
+    remoteError_ = connection->getRemoteChannelErrorCode();
+    directError_ = connection->getDirectCandidatesChannelErrorCode();
+}
+
+std::chrono::steady_clock::duration ConnectTimings::total() const
+{
+    if (phases_.empty()) {
+        return std::chrono::steady_clock::duration::zero();
+    }
+    return phases_.back().start_ + phases_.back().duration_;
+}
+
+void ConnectTimings::print(std::ostream& out) const
+{
+    out << "Connection timings:" << std::endl;
+    out << std::fixed << std::setprecision(1);
+    for (auto& p : phases_) {
+        out << "  " << std::left << std::setw(14) << p.name_
+            << std::right << std::setw(10) << milliseconds(p.duration_) << " ms"
+            << (p.ok_ ? "" : "  failed") << std::endl;
+    }
+    out << "  " << std::left << std::setw(14) << "total"
+        << std::right << std::setw(10) << milliseconds(total()) << " ms" << std::endl;
+    if (hasChannel_) {
+        out << "  " << std::left << std::setw(14) << "channel" << (channel_.empty() ? "none" : channel_) << std::endl;
+        out << "  " << std::left << std::setw(14) << "local" << nabto::client::Status(localError_).getDescription() << std::endl;
+        out << "  " << std::left << std::setw(14) << "remote" << nabto::client::Status(remoteError_).getDescription() << std::endl;
+        out << "  " << std::left << std::setw(14) << "direct" << nabto::client::Status(directError_).getDescription() << std::endl;
+    }
+    out << std::right << std::defaultfloat;
+}
+
+static nlohmann::json error_json(int ec)
+{
+    nlohmann::json j;
+    j["Code"] = ec;
+    j["Name"] = nabto::client::Status(ec).getName();
+    return j;
+}
+
+std::string ConnectTimings::toJson() const
+{
+    nlohmann::json j;
+    nlohmann::json phases = nlohmann::json::array();
+    for (auto& p : phases_) {
+        nlohmann::json phase;
+        phase["Name"] = p.name_;
+        phase["StartMs"] = milliseconds(p.start_);
+        phase["DurationMs"] = milliseconds(p.duration_);
+        phase["Ok"] = p.ok_;
+        phases.push_back(phase);
+    }
+    j["Phases"] = phases;
+    j["TotalMs"] = milliseconds(total());
+    if (hasChannel_) {
+        if (channel_.empty()) {
+            j["Channel"] = nullptr;
+        } else {
+            j["Channel"] = channel_;
+        }
+        j["LocalChannelError"] = error_json(localError_);
+        j["RemoteChannelError"] = error_json(remoteError_);
+        j["DirectCandidatesChannelError"] = error_json(directError_);
+    }
+    return j.dump();
+}
+
+} // namespace
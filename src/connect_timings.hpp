@@ -0,0 +1,59 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Timing {
+
+class Phase {
+ public:
+    std::string name_;
+    // Offset of the start from the first phase.
+    std::chrono::steady_clock::duration start_;
+    std::chrono::steady_clock::duration duration_;
+    bool ok_ = true;
+};
+
+/**
+ * Monotonic timestamps of the sequential phases of setting up a
+ * connection, and the channel it ended up on.
+ *
+ * begin() ends the running phase and starts the next, fail() and end()
+ * end the running phase as failed or succeeded.
+ */
+class ConnectTimings {
+ public:
+    void begin(const std::string& phase);
+    void end();
+    void fail();
+
+    // Record the channel type and the error codes of the local, remote
+    // and direct candidate channels once connect has completed.
+    void setChannel(std::shared_ptr<nabto::client::Connection> connection);
+
+    std::chrono::steady_clock::duration total() const;
+
+    void print(std::ostream& out) const;
+    std::string toJson() const;
+
+ private:
+    void endPhase(bool ok);
+
+    std::vector<Phase> phases_;
+    std::chrono::steady_clock::time_point first_;
+    std::chrono::steady_clock::time_point current_;
+    bool running_ = false;
+
+    bool hasChannel_ = false;
+    // Empty if the connection did not reach a channel.
+    std::string channel_;
+    int localError_ = 0;
+    int remoteError_ = 0;
+    int directError_ = 0;
+};
+
+} // namespace
@@ -0,0 +1,257 @@
+#include "connection_info.hpp"
+#include "metrics.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <ctime>
+
+namespace Sampling {
+
+ConnectionInfo ConnectionInfo::parse(const std::string& str)
+{
+    ConnectionInfo info;
+    auto j = nlohmann::json::parse(str, nullptr, false);
+    if (!j.is_object()) {
+        return info;
+    }
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        if (it.key() == "MdnsError" && it.value().is_string()) {
+            info.mdnsError_ = it.value().get<std::string>();
+        } else if (it.key() == "UdpRelayError" && it.value().is_string()) {
+            info.udpRelayError_ = it.value().get<std::string>();
+        } else {
+            info.other_[it.key()] = it.value().dump();
+        }
+    }
+    return info;
+}
+
+ConnectionInfo ConnectionInfo::sample(std::shared_ptr<nabto::client::Connection> connection)
+{
+    ConnectionInfo info;
+    try {
+        info = parse(connection->getInfo());
+    } catch (nabto::client::NabtoException&) {
+        // Older SDKs do not report any info.
+    }
+    try {
+        info.channel_ = connection->getType() == nabto::client::Connection::Type::DIRECT ? "direct" : "relay";
+    } catch (nabto::client::NabtoException&) {
+        info.channel_.clear();
+    }
+    info.localError_ = connection->getLocalChannelErrorCode();
+    info.remoteError_ = connection->getRemoteChannelErrorCode();
+    info.directError_ = connection->getDirectCandidatesChannelErrorCode();
+    return info;
+}
+
+bool ConnectionInfo::operator==(const ConnectionInfo& other) const
+{
+    return channel_ == other.channel_ &&
+        mdnsError_ == other.mdnsError_ &&
+        udpRelayError_ == other.udpRelayError_ &&
+        localError_ == other.localError_ &&
+        remoteError_ == other.remoteError_ &&
+        directError_ == other.directError_ &&
+        other_ == other.other_;
+}
+
+InfoSampler::InfoSampler(std::chrono::milliseconds interval, size_t history)
+    : interval_(interval), history_(history > 0 ? history : 1)
+{
+}
+
+InfoSampler::~InfoSampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cond_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void InfoSampler::add(uint32_t bookmark, const std::string& productId, const std::string& deviceId, std::shared_ptr<nabto::client::Connection> connection)
+{
+    auto s = std::make_shared<Series>();
+    s->bookmark_ = bookmark;
+    s->productId_ = productId;
+    s->deviceId_ = deviceId;
+    s->connection_ = connection;
+    std::lock_guard<std::mutex> lock(mutex_);
+    series_.push_back(s);
+}
+
+void InfoSampler::setChangeCallback(ChangeCallback cb)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    changeCallback_ = cb;
+}
+
+void InfoSampler::start()
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+void InfoSampler::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_) {
+        lock.unlock();
+        sampleAll();
+        lock.lock();
+        cond_.wait_for(lock, interval_, [this]() { return stopped_; });
+    }
+}
+
+void InfoSampler::sampleAll()
+{
+    std::vector<std::shared_ptr<Series> > series;
+    ChangeCallback cb;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        series = series_;
+        cb = changeCallback_;
+    }
+    for (auto& s : series) {
+        auto connection = s->connection_.lock();
+        if (!connection) {
+            continue;
+        }
+        InfoSample sample;
+        sample.time_ = std::chrono::system_clock::now();
+        sample.info_ = ConnectionInfo::sample(connection);
+
+        bool changed = false;
+        ConnectionInfo before;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!s->samples_.empty() && s->samples_.back().info_ != sample.info_) {
+                changed = true;
+                before = s->samples_.back().info_;
+                s->changes_++;
+            }
+            s->samples_.push_back(sample);
+            while (s->samples_.size() > history_) {
+                s->samples_.pop_front();
+            }
+        }
+        if (changed && cb) {
+            cb(s->bookmark_, before, sample.info_);
+        }
+    }
+}
+
+static std::string iso_time(std::chrono::system_clock::time_point t)
+{
+    std::time_t seconds = std::chrono::system_clock::to_time_t(t);
+    struct tm tm;
+#if defined(_WIN32)
+    gmtime_s(&tm, &seconds);
+#else
+    gmtime_r(&seconds, &tm);
+#endif
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buffer;
+}
+
+static nlohmann::json info_json(const ConnectionInfo& info)
+{
+    nlohmann::json j;
+    if (info.channel_.empty()) {
+        j["ChannelType"] = nullptr;
+    } else {
+        j["ChannelType"] = info.channel_;
+    }
+    j["MdnsError"] = info.mdnsError_;
+    j["UdpRelayError"] = info.udpRelayError_;
+    j["LocalChannelError"] = nabto::client::Status(info.localError_).getName();
+    j["RemoteChannelError"] = nabto::client::Status(info.remoteError_).getName();
+    j["DirectCandidatesChannelError"] = nabto::client::Status(info.directError_).getName();
+    for (auto& o : info.other_) {
+        j[o.first] = nlohmann::json::parse(o.second, nullptr, false);
+    }
+    return j;
+}
+
+std::string InfoSampler::statusJson()
+{
+    std::vector<Series> series;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& s : series_) {
+            series.push_back(*s);
+        }
+    }
+    nlohmann::json connections = nlohmann::json::array();
+    for (auto& s : series) {
+        nlohmann::json c;
+        c["Bookmark"] = s.bookmark_;
+        c["ProductId"] = s.productId_;
+        c["DeviceId"] = s.deviceId_;
+        c["Changes"] = s.changes_;
+        nlohmann::json samples = nlohmann::json::array();
+        for (auto& sample : s.samples_) {
+            nlohmann::json j = info_json(sample.info_);
+            j["Time"] = iso_time(sample.time_);
+            samples.push_back(j);
+        }
+        c["Samples"] = samples;
+        connections.push_back(c);
+    }
+    nlohmann::json root;
+    root["IntervalSeconds"] = std::chrono::duration<double>(interval_).count();
+    root["Connections"] = connections;
+    return root.dump(2);
+}
+
+void InfoSampler::renderMetrics(std::ostream& out)
+{
+    class Latest {
+     public:
+        std::string labels_;
+        bool sampled_;
+        ConnectionInfo info_;
+        uint64_t changes_;
+    };
+    std::vector<Latest> latest;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& s : series_) {
+            Latest l;
+            l.labels_ = "bookmark=\"" + std::to_string(s->bookmark_) + "\",product_id=\"" + Metrics::escapeLabel(s->productId_) + "\",device_id=\"" + Metrics::escapeLabel(s->deviceId_) + "\"";
+            l.sampled_ = !s->samples_.empty();
+            if (l.sampled_) {
+                l.info_ = s->samples_.back().info_;
+            }
+            l.changes_ = s->changes_;
+            latest.push_back(l);
+        }
+    }
+
+    out << "# TYPE edge_tunnel_connection_sdk info\n";
+    out << "# HELP edge_tunnel_connection_sdk The latest connection info sampled from the SDK.\n";
+    for (auto& l : latest) {
+        if (!l.sampled_) {
+            continue;
+        }
+        out << "edge_tunnel_connection_sdk_info{" << l.labels_
+            << ",channel=\"" << (l.info_.channel_.empty() ? "none" : l.info_.channel_)
+            << "\",mdns_error=\"" << Metrics::escapeLabel(l.info_.mdnsError_)
+            << "\",udp_relay_error=\"" << Metrics::escapeLabel(l.info_.udpRelayError_)
+            << "\",local_error=\"" << nabto::client::Status(l.info_.localError_).getName()
+            << "\",remote_error=\"" << nabto::client::Status(l.info_.remoteError_).getName()
+            << "\",direct_error=\"" << nabto::client::Status(l.info_.directError_).getName()
+            << "\"} 1\n";
+    }
+    out << "# TYPE edge_tunnel_connection_info_changes counter\n";
+    out << "# HELP edge_tunnel_connection_info_changes Samples of the connection info which differed from the previous sample.\n";
+    for (auto& l : latest) {
+        out << "edge_tunnel_connection_info_changes_total{" << l.labels_ << "} " << l.changes_ << "\n";
+    }
+}
+
+} // namespace
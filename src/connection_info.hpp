@@ -0,0 +1,104 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Sampling {
+
+/**
+ * What the SDK reports about a connection, from getInfo() and the
+ * channel getters.
+ */
+class ConnectionInfo {
+ public:
+    static ConnectionInfo sample(std::shared_ptr<nabto::client::Connection> connection);
+
+    // Parse the json of Connection::getInfo(), fields which are not
+    // known here are kept in other_.
+    static ConnectionInfo parse(const std::string& json);
+
+    bool operator==(const ConnectionInfo& other) const;
+    bool operator!=(const ConnectionInfo& other) const { return !(*this == other); }
+
+    // Empty if the connection is not connected.
+    std::string channel_;
+    // Error names as reported by the SDK, empty if not reported.
+    std::string mdnsError_;
+    std::string udpRelayError_;
+    int localError_ = 0;
+    int remoteError_ = 0;
+    int directError_ = 0;
+    // Other fields of the info, the values as json text.
+    std::map<std::string, std::string> other_;
+};
+
+class InfoSample {
+ public:
+    std::chrono::system_clock::time_point time_;
+    ConnectionInfo info_;
+};
+
+/**
+ * Samples the info of each added connection at an interval from a
+ * thread of its own and keeps the latest samples of each connection.
+ *
+ * The SDK is only called without the lock held, readers of the series
+ * hold it just long enough to copy them.
+ */
+class InfoSampler {
+ public:
+    typedef std::function<void (uint32_t bookmark, const ConnectionInfo& before, const ConnectionInfo& after)> ChangeCallback;
+
+    InfoSampler(std::chrono::milliseconds interval, size_t history);
+    ~InfoSampler();
+
+    void add(uint32_t bookmark, const std::string& productId, const std::string& deviceId, std::shared_ptr<nabto::client::Connection> connection);
+
+    // Called from the sampler thread when the info of a connection differs from the previous sample.
+    void setChangeCallback(ChangeCallback cb);
+
+    void start();
+
+    // The samples of all connections as json.
+    std::string statusJson();
+
+    // The latest sample of each connection in the OpenMetrics text format.
+    void renderMetrics(std::ostream& out);
+
+ private:
+    class Series {
+     public:
+        uint32_t bookmark_;
+        std::string productId_;
+        std::string deviceId_;
+        std::weak_ptr<nabto::client::Connection> connection_;
+        std::deque<InfoSample> samples_;
+        uint64_t changes_ = 0;
+    };
+
+    void run();
+    void sampleAll();
+
+    std::chrono::milliseconds interval_;
+    size_t history_;
+    ChangeCallback changeCallback_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<std::shared_ptr<Series> > series_;
+    bool stopped_ = false;
+    std::thread thread_;
+};
+
+} // namespace
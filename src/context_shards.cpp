@@ -0,0 +1,103 @@
+#include "context_shards.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace Sharding {
+
+static const size_t virtualNodes = 64;
+
+// FNV-1a followed by the splitmix64 finalizer, which spreads the short
+// and similar keys of bookmarks and virtual nodes over the ring.
+static uint64_t hash_key(const std::string& key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+ContextShards::ContextShards(size_t shards, ContextSetup setup, double loadFactor)
+    : loadFactor_(loadFactor < 1 ? 1 : loadFactor)
+{
+    if (shards == 0) {
+        shards = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < shards; i++) {
+        auto context = nabto::client::Context::create();
+        if (setup) {
+            setup(context);
+        }
+        contexts_.push_back(context);
+        for (size_t v = 0; v < virtualNodes; v++) {
+            ring_.push_back(std::make_pair(hash_key("shard-" + std::to_string(i) + "-" + std::to_string(v)), i));
+        }
+    }
+    std::sort(ring_.begin(), ring_.end());
+    load_.resize(shards, 0);
+}
+
+size_t ContextShards::ringIndex(uint64_t hash) const
+{
+    auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(hash, static_cast<size_t>(0)));
+    if (it == ring_.end()) {
+        return 0;
+    }
+    return it - ring_.begin();
+}
+
+size_t ContextShards::shardFor(const std::string& key) const
+{
+    return ring_[ringIndex(hash_key(key))].second;
+}
+
+size_t ContextShards::acquire(const std::string& key)
+{
+    size_t start = ringIndex(hash_key(key));
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t capacity = static_cast<size_t>(std::ceil(loadFactor_ * (total_ + 1) / load_.size()));
+    size_t shard = ring_[start].second;
+    // Walk the ring to the first shard below the bound, one always is
+    // as the bound is above the average.
+    for (size_t i = 0; i < ring_.size(); i++) {
+        size_t candidate = ring_[(start + i) % ring_.size()].second;
+        if (load_[candidate] < capacity) {
+            shard = candidate;
+            break;
+        }
+    }
+    load_[shard]++;
+    total_++;
+    return shard;
+}
+
+void ContextShards::release(size_t shard)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shard < load_.size() && load_[shard] > 0) {
+        load_[shard]--;
+        total_--;
+    }
+}
+
+std::pair<size_t, std::shared_ptr<nabto::client::Connection> > ContextShards::createConnection(const std::string& key)
+{
+    size_t shard = acquire(key);
+    return std::make_pair(shard, contexts_[shard]->createConnection());
+}
+
+std::vector<size_t> ContextShards::load()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return load_;
+}
+
+} // namespace
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Sharding {
+
+/**
+ * A number of client contexts, each with its own SDK threads, over
+ * which many connections are spread such that one process is not
+ * limited by the threads of a single context.
+ *
+ * Connections are assigned to a shard by consistent hashing of a key,
+ * normally the bookmark, such that the same device lands on the same
+ * shard when shards are added or removed. The hash ring has a number
+ * of virtual nodes per shard, and a shard holding more than
+ * loadFactor times the average number of connections is skipped in
+ * favour of the next shard on the ring (consistent hashing with
+ * bounded loads).
+ *
+ * The edge_tunnel_client commands connect to one device at a time and
+ * use a single context, only shard_bench uses ContextShards. An
+ * application holding many DeviceSessions passes the context of
+ * acquire(key) to DeviceSession::open.
+ */
+class ContextShards {
+ public:
+    typedef std::function<void (std::shared_ptr<nabto::client::Context> context)> ContextSetup;
+
+    // 0 shards uses the number of cores.
+    ContextShards(size_t shards, ContextSetup setup = nullptr, double loadFactor = 1.25);
+
+    size_t size() const { return contexts_.size(); }
+    std::shared_ptr<nabto::client::Context> context(size_t shard) { return contexts_[shard]; }
+
+    // The shard the key hashes to, ignoring the load of the shards.
+    size_t shardFor(const std::string& key) const;
+
+    // Assign a connection for the key to a shard and count it in the
+    // load of the shard until release() is called.
+    size_t acquire(const std::string& key);
+    void release(size_t shard);
+
+    // Create a connection in the context of the shard assigned to the key.
+    std::pair<size_t, std::shared_ptr<nabto::client::Connection> > createConnection(const std::string& key);
+
+    // The number of acquired connections per shard.
+    std::vector<size_t> load();
+
+    static std::string bookmarkKey(uint32_t bookmark) { return "bookmark-" + std::to_string(bookmark); }
+
+ private:
+    size_t ringIndex(uint64_t hash) const;
+
+    std::vector<std::shared_ptr<nabto::client::Context> > contexts_;
+    // Sorted by the hash of the virtual node.
+    std::vector<std::pair<uint64_t, size_t> > ring_;
+    double loadFactor_;
+
+    std::mutex mutex_;
+    std::vector<size_t> load_;
+    size_t total_ = 0;
+};
+
+} // namespace
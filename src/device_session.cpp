@@ -0,0 +1,289 @@
+#include "device_session.hpp"
+
+#include "iam.hpp"
+#include "trace.hpp"
+#include "version.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <sstream>
+
+namespace EdgeTunnel {
+
+const char* sessionStateAsString(SessionState state)
+{
+    switch (state) {
+        case SessionState::CONNECTED: return "connected";
+        case SessionState::CHANNEL_CHANGED: return "channel changed";
+        case SessionState::CLOSED: return "closed";
+    }
+    return "unknown";
+}
+
+class DeviceSession::EventsListener : public nabto::client::ConnectionEventsCallback {
+ public:
+    EventsListener(std::weak_ptr<DeviceSession> session) : session_(session) {}
+    void onEvent(int event)
+    {
+        auto session = session_.lock();
+        if (session) {
+            session->onEvent(event);
+        }
+    }
+ private:
+    std::weak_ptr<DeviceSession> session_;
+};
+
+static std::string missing_client_config(const std::string& filename)
+{
+    std::stringstream ss;
+    ss << "The example is missing the client configuration file (" << filename << ")." << std::endl
+       << "The client configuration file is a json file which can be" << std::endl
+       << "used to change the server URL used for remote connections." << std::endl
+       << "In normal scenarios, the file should simply contain an" << std::endl
+       << "empty json document:"
+       << "{" << std::endl
+       << "}";
+    return ss.str();
+}
+
+static std::string fingerprint_mismatch(std::shared_ptr<nabto::client::Connection> connection, const Configuration::DeviceInfo& device)
+{
+    IAM::IAMError ec;
+    std::unique_ptr<IAM::PairingInfo> pairingInfo;
+    std::tie(ec, pairingInfo) = IAM::get_pairing_info(connection);
+    if (!ec.ok()) {
+        // should not happen
+        return "The fingerprint of the device does not match the pairing and its pairing info could not be retrieved";
+    }
+    if (pairingInfo->getProductId() != device.getProductId()) {
+        return "The Product ID of the connected device (" + pairingInfo->getProductId() + ") does not match the Product ID for the bookmark " + device.getFriendlyName();
+    } else if (pairingInfo->getDeviceId() != device.getDeviceId()) {
+        return "The Device ID of the connected device (" + pairingInfo->getDeviceId() + ") does not match the Device ID for the bookmark " + device.getFriendlyName();
+    }
+    return "The public key of the device does not match the public key in the pairing. Repair the device with the client.";
+}
+
+std::pair<SessionError, std::shared_ptr<DeviceSession> > DeviceSession::open(std::shared_ptr<nabto::client::Context> context, uint32_t bookmark,
+                                                                             const SessionOptions& options)
+{
+    if (Configuration::HasNoBookmarks()) {
+        return std::make_pair(SessionError("No devices have been paired, start by pairing the client with a device."), nullptr);
+    }
+    auto device = Configuration::GetPairedDevice(bookmark);
+    if (!device) {
+        return std::make_pair(SessionError("The bookmark " + std::to_string(bookmark) + " does not exist"), nullptr);
+    }
+    return open(context, *device, options);
+}
+
+std::pair<SessionError, std::shared_ptr<DeviceSession> > DeviceSession::open(std::shared_ptr<nabto::client::Context> context, const Configuration::DeviceInfo& device,
+                                                                             const SessionOptions& options)
+{
+    Timing::ConnectTimings timings;
+    return open(context, device, options, timings);
+}
+
+std::pair<SessionError, std::shared_ptr<nabto::client::Connection> > DeviceSession::createConnection(std::shared_ptr<nabto::client::Context> context, const Configuration::DeviceInfo& device,
+                                                                                                    const SessionOptions& options, Timing::ConnectTimings& timings)
+{
+    timings.begin("config");
+    auto config = Configuration::GetConfigInfo();
+    if (!config) {
+        timings.fail();
+        return std::make_pair(SessionError(missing_client_config(Configuration::GetConfigFilePath())), nullptr);
+    }
+
+    auto connection = context->createConnection();
+    connection->setProductId(device.getProductId());
+    connection->setDeviceId(device.getDeviceId());
+    connection->setApplicationName(options.applicationName_);
+    connection->setApplicationVersion(edge_tunnel_client_version());
+
+    auto presence = options.presence_;
+    if (!device.getDirectCandidate().empty()) {
+        connection->enableDirectCandidates();
+        connection->addDirectCandidate(device.getDirectCandidate(), 5592);
+        connection->endOfDirectCandidates();
+    } else if (presence && presence->presence(device.getProductId(), device.getDeviceId()) == nabto::examples::common::MdnsPresence::Presence::ABSENT) {
+        // The presence table has been listening long enough to know the
+        // device is not on the local network, skip the local channel.
+        nlohmann::json connectionOptions;
+        connectionOptions["Local"] = false;
+        connection->setOptions(connectionOptions.dump());
+    }
+
+    timings.begin("key");
+    std::string privateKey;
+    if (!Configuration::GetPrivateKey(context, privateKey)) {
+        timings.fail();
+        return std::make_pair(SessionError("Could not read the private key of the client"), nullptr);
+    }
+    connection->setPrivateKey(privateKey);
+
+    if (!config->getServerUrl().empty()) {
+        connection->setServerUrl(config->getServerUrl());
+    }
+
+    connection->setServerConnectToken(device.getSct());
+    return std::make_pair(SessionError(), connection);
+}
+
+std::pair<SessionError, std::shared_ptr<DeviceSession> > DeviceSession::open(std::shared_ptr<nabto::client::Context> context, const Configuration::DeviceInfo& device,
+                                                                             const SessionOptions& options, Timing::ConnectTimings& timings)
+{
+    Tracing::Span span("createConnection");
+    span.setAttribute("product_id", device.getProductId());
+    span.setAttribute("device_id", device.getDeviceId());
+    SessionError error;
+    std::shared_ptr<nabto::client::Connection> connection;
+    std::tie(error, connection) = createConnection(context, device, options, timings);
+    if (!connection) {
+        return std::make_pair(error, nullptr);
+    }
+
+    timings.begin("connect");
+    try {
+        connection->connect()->waitForResult();
+    } catch (nabto::client::NabtoException& e) {
+        timings.fail();
+        timings.setChannel(connection);
+        if (e.status().getErrorCode() == nabto::client::Status::NO_CHANNELS) {
+            auto localStatus = nabto::client::Status(connection->getLocalChannelErrorCode());
+            auto remoteStatus = nabto::client::Status(connection->getRemoteChannelErrorCode());
+            std::stringstream ss;
+            ss << "Not Connected." << std::endl
+               << " The Local status is: " << localStatus.getDescription() << std::endl
+               << " The Remote status is: " << remoteStatus.getDescription();
+            return std::make_pair(SessionError(ss.str()), nullptr);
+        }
+        return std::make_pair(SessionError(std::string("Connect failed ") + e.what()), nullptr);
+    }
+    timings.setChannel(connection);
+
+    timings.begin("fingerprint");
+    try {
+        if (connection->getDeviceFingerprint() != device.getDeviceFingerprint()) {
+            timings.fail();
+            return std::make_pair(SessionError(fingerprint_mismatch(connection, device)), nullptr);
+        }
+    } catch (...) {
+        timings.fail();
+        return std::make_pair(SessionError("Missing device fingerprint in state, pair with the device again"), nullptr);
+    }
+
+    // we are paired if the connection has a user in the device
+    timings.begin("get_me");
+    IAM::IAMError ec;
+    std::unique_ptr<IAM::User> user;
+    std::tie(ec, user) = IAM::get_me(connection);
+
+    if (!user) {
+        timings.fail();
+        return std::make_pair(SessionError("The client is not paired with device, do the pairing again"), nullptr);
+    }
+    timings.end();
+
+    std::shared_ptr<DeviceSession> session(new DeviceSession(connection, device));
+    session->listener_ = std::make_shared<EventsListener>(session);
+    connection->addEventsListener(session->listener_);
+    return std::make_pair(SessionError(), session);
+}
+
+DeviceSession::DeviceSession(std::shared_ptr<nabto::client::Connection> connection, const Configuration::DeviceInfo& device)
+    : connection_(connection), device_(device)
+{
+}
+
+DeviceSession::~DeviceSession()
+{
+    if (listener_) {
+        connection_->removeEventsListener(listener_);
+    }
+}
+
+std::pair<SessionError, uint16_t> DeviceSession::openTunnel(const std::string& service, uint16_t localPort)
+{
+    Tracing::Span span("open tunnel");
+    span.setAttribute("service", service);
+    std::shared_ptr<nabto::client::TcpTunnel> tunnel;
+    try {
+        tunnel = connection_->createTcpTunnel();
+        tunnel->open(service, localPort)->waitForResult();
+    } catch (std::exception& e) {
+        span.setAttribute("status", e.what());
+        return std::make_pair(SessionError(e.what()), 0);
+    }
+    Tunnel t;
+    t.service_ = service;
+    t.localPort_ = tunnel->getLocalPort();
+    t.tunnel_ = tunnel;
+    span.setAttribute("local_port", t.localPort_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    tunnels_.push_back(t);
+    return std::make_pair(SessionError(), t.localPort_);
+}
+
+std::vector<Tunnel> DeviceSession::tunnels()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tunnels_;
+}
+
+void DeviceSession::closeTunnels()
+{
+    std::vector<Tunnel> tunnels;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tunnels.swap(tunnels_);
+    }
+    for (auto& t : tunnels) {
+        try {
+            t.tunnel_->close()->waitForResult();
+        } catch (nabto::client::NabtoException& e) {
+            // The tunnel is gone with the connection.
+        }
+    }
+}
+
+void DeviceSession::subscribe(StateCallback callback)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    subscribers_.push_back(callback);
+}
+
+void DeviceSession::close()
+{
+    closeTunnels();
+    try {
+        connection_->close()->waitForResult();
+    } catch (nabto::client::NabtoException& e) {
+        if (e.status().getErrorCode() != nabto::client::Status::STOPPED) {
+            throw;
+        }
+    }
+}
+
+void DeviceSession::onEvent(int event)
+{
+    SessionState state;
+    if (event == nabto::client::ConnectionEventsCallback::CLOSED()) {
+        state = SessionState::CLOSED;
+    } else if (event == nabto::client::ConnectionEventsCallback::CHANNEL_CHANGED()) {
+        state = SessionState::CHANNEL_CHANGED;
+    } else if (event == nabto::client::ConnectionEventsCallback::CONNECTED()) {
+        state = SessionState::CONNECTED;
+    } else {
+        return;
+    }
+    std::vector<StateCallback> subscribers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscribers = subscribers_;
+    }
+    for (auto& s : subscribers) {
+        s(state);
+    }
+}
+
+} // namespace
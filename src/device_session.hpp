@@ -0,0 +1,125 @@
+#pragma once
+
+#include "config.hpp"
+#include "connect_timings.hpp"
+#include "mdns_presence.hpp"
+
+#include <nabto_client.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace EdgeTunnel {
+
+/**
+ * Why a session could not be opened or a tunnel could not be created,
+ * ok() if it succeeded.
+ */
+class SessionError {
+ public:
+    SessionError() {}
+    SessionError(const std::string& message) : message_(message) {}
+
+    bool ok() const { return message_.empty(); }
+    const std::string& message() const { return message_; }
+
+ private:
+    std::string message_;
+};
+
+enum class SessionState {
+    CONNECTED,
+    CHANNEL_CHANGED,
+    CLOSED
+};
+
+const char* sessionStateAsString(SessionState state);
+
+class Tunnel {
+ public:
+    std::string service_;
+    uint16_t localPort_;
+    std::shared_ptr<nabto::client::TcpTunnel> tunnel_;
+};
+
+class SessionOptions {
+ public:
+    std::string applicationName_ = "edge_tunnel_client";
+    // Skip the local channel for devices the presence table knows are
+    // not on the local network. Devices it does not know about are
+    // tried locally as without a table.
+    std::shared_ptr<nabto::examples::common::MdnsPresence> presence_;
+};
+
+/**
+ * A connection to a paired device and the tunnels opened on it, the
+ * programmatic interface to what the edge_tunnel_client commands do.
+ *
+ *   Configuration::InitializeWithDirectory(home);
+ *   auto context = nabto::client::Context::create();
+ *   EdgeTunnel::SessionError ec;
+ *   std::shared_ptr<EdgeTunnel::DeviceSession> session;
+ *   std::tie(ec, session) = EdgeTunnel::DeviceSession::open(context, 0);
+ *   uint16_t port;
+ *   std::tie(ec, port) = session->openTunnel("ssh");
+ *
+ * The pairing and IAM functions take the connection of the session.
+ * Open blocks until the connection is established and the device has
+ * been verified to be the paired one.
+ */
+class DeviceSession : public std::enable_shared_from_this<DeviceSession> {
+ public:
+    typedef std::function<void (SessionState state)> StateCallback;
+
+    static std::pair<SessionError, std::shared_ptr<DeviceSession> > open(std::shared_ptr<nabto::client::Context> context, uint32_t bookmark,
+                                                                         const SessionOptions& options = SessionOptions());
+    static std::pair<SessionError, std::shared_ptr<DeviceSession> > open(std::shared_ptr<nabto::client::Context> context, const Configuration::DeviceInfo& device,
+                                                                         const SessionOptions& options = SessionOptions());
+    // As open, recording the phases of connecting in timings.
+    static std::pair<SessionError, std::shared_ptr<DeviceSession> > open(std::shared_ptr<nabto::client::Context> context, const Configuration::DeviceInfo& device,
+                                                                         const SessionOptions& options, Timing::ConnectTimings& timings);
+
+    // A connection to the device configured with the key of the client
+    // and the bookmark, not yet connected.
+    static std::pair<SessionError, std::shared_ptr<nabto::client::Connection> > createConnection(std::shared_ptr<nabto::client::Context> context, const Configuration::DeviceInfo& device,
+                                                                                                 const SessionOptions& options, Timing::ConnectTimings& timings);
+
+    ~DeviceSession();
+
+    // Open a tunnel to the service listening on the local port, 0
+    // picks an ephemeral port. Returns the port listened on.
+    std::pair<SessionError, uint16_t> openTunnel(const std::string& service, uint16_t localPort = 0);
+    std::vector<Tunnel> tunnels();
+    void closeTunnels();
+
+    // The callback is invoked on an SDK thread when the connection
+    // changes channel or is closed.
+    void subscribe(StateCallback callback);
+
+    // Close the tunnels and the connection.
+    void close();
+
+    std::shared_ptr<nabto::client::Connection> connection() { return connection_; }
+    const Configuration::DeviceInfo& device() const { return device_; }
+
+ private:
+    class EventsListener;
+
+    DeviceSession(std::shared_ptr<nabto::client::Connection> connection, const Configuration::DeviceInfo& device);
+    void onEvent(int event);
+
+    std::shared_ptr<nabto::client::Connection> connection_;
+    Configuration::DeviceInfo device_;
+    std::shared_ptr<EventsListener> listener_;
+
+    std::mutex mutex_;
+    std::vector<Tunnel> tunnels_;
+    std::vector<StateCallback> subscribers_;
+};
+
+} // namespace
@@ -6,11 +6,32 @@
 #include "timestamp.hpp"
 #include "iam.hpp"
 #include "iam_interactive.hpp"
+#include "mdns_presence.hpp"
+#include "structured_log.hpp"
+#include "connect_timings.hpp"
+#include "metrics.hpp"
+#include "connection_info.hpp"
+#include "trace.hpp"
+#include "device_session.hpp"
+#include "metadata_refresh.hpp"
+#include "fleet_scan.hpp"
+#if !defined(_WIN32)
+#include "metrics_server.hpp"
+#include "local_relay.hpp"
+#include "shaping.hpp"
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "version.hpp"
 
 #include <3rdparty/cxxopts.hpp>
 #include <3rdparty/nlohmann/json.hpp>
 
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -54,40 +75,74 @@ void PrintGeneralHelp()
 class MyLogger : public nabto::client::Logger
 {
  public:
+    MyLogger(std::shared_ptr<Logging::StructuredLogSink> sink = nullptr, std::ostream& out = std::cout)
+        : sink_(sink), out_(out)
+    {
+    }
     void log(nabto::client::LogMessage message) {
-        std::cout << time_in_HH_MM_SS_MMM() << " [" << message.getSeverity() << "] - " << message.getMessage() << std::endl;
+        if (sink_) {
+            Logging::Record record;
+            record.timestamp_ = std::chrono::system_clock::now();
+            record.severity_ = message.getSeverity();
+            record.module_ = message.getModule();
+            record.message_ = message.getMessage();
+            sink_->write(std::move(record));
+            return;
+        }
+        char timestamp[16];
+        time_in_HH_MM_SS_MMM(timestamp, sizeof(timestamp));
+        out_ << timestamp << " [" << message.getSeverity() << "] - " << message.getMessage() << std::endl;
     }
+ private:
+    std::shared_ptr<Logging::StructuredLogSink> sink_;
+    std::ostream& out_;
 };
 
 std::shared_ptr<nabto::client::Connection> connection_;
 
+// Close the connection on SIGINT. Closing waits for the SDK, which
+// can deadlock inside the signal handler, so it is done by the thread
+// waiting for the connection to close.
+static volatile sig_atomic_t closeRequested_ = 0;
+
 void signalHandler(int s){
-    printf("Caught signal %d\n",s);
-    if (connection_) {
-        connection_->close()->waitForResult();
-    }
+    closeRequested_ = s;
 }
 
-static void printMissingClientConfig(const std::string& filename)
-{
-    std::cerr
-        << "The example is missing the client configuration file (" << filename << ")." << std::endl
-        << "The client configuration file is a json file which can be" << std::endl
-        << "used to change the server URL used for remote connections." << std::endl
-        << "In normal scenarios, the file should simply contain an" << std::endl
-        << "empty json document:"
-        << "{" << std::endl
-        << "}" <<std::endl;
+// Raise the log level for a while, requested with SIGUSR1 and handled
+// outside of the signal handler.
+static volatile sig_atomic_t logBoostRequested_ = 0;
+std::function<void ()> logBoost_;
+
+void logBoostSignalHandler(int) {
+    logBoostRequested_ = 1;
+}
+
+// Print the outstanding futures of the client library, requested with
+// SIGUSR2.
+static volatile sig_atomic_t futureDumpRequested_ = 0;
 
+void futureDumpSignalHandler(int) {
+    futureDumpRequested_ = 1;
 }
 
-class CloseListener : public nabto::client::ConnectionEventsCallback {
+static void dumpOutstandingFutures()
+{
+    auto futures = nabto::client::Context::outstandingFutures();
+    std::cerr << time_in_HH_MM_SS_MMM() << " " << futures.size() << " outstanding futures" << std::endl;
+    for (auto& f : futures) {
+        std::cerr << "  " << std::fixed << std::setprecision(3) << f.ageSeconds_ << "s " << f.type_ << " " << f.operation_
+                  << (f.abandoned_ ? " (abandoned)" : "") << std::endl;
+    }
+}
+
+class CloseListener {
  public:
 
     CloseListener() {
     }
-    void onEvent(int event) {
-        if (event == NABTO_CLIENT_CONNECTION_EVENT_CLOSED) {
+    void onState(EdgeTunnel::SessionState state) {
+        if (state == EdgeTunnel::SessionState::CLOSED) {
             std::cout << "Connection closed, closing application" << std::endl;
             promise_.set_value();
             return;
@@ -96,6 +151,25 @@ class CloseListener : public nabto::client::ConnectionEventsCallback {
 
     void waitForClose() {
         auto future = promise_.get_future();
+        while (future.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready) {
+            if (closeRequested_) {
+                printf("Caught signal %d\n", closeRequested_);
+                closeRequested_ = 0;
+                if (connection_) {
+                    connection_->close()->waitForResult();
+                }
+            }
+            if (logBoostRequested_) {
+                logBoostRequested_ = 0;
+                if (logBoost_) {
+                    logBoost_();
+                }
+            }
+            if (futureDumpRequested_) {
+                futureDumpRequested_ = 0;
+                dumpOutstandingFutures();
+            }
+        }
         future.get();
     }
 
@@ -103,102 +177,15 @@ class CloseListener : public nabto::client::ConnectionEventsCallback {
     std::promise<void> promise_;
 };
 
-void handleFingerprintMismatch(std::shared_ptr<nabto::client::Connection> connection, Configuration::DeviceInfo device)
-{
-    IAM::IAMError ec;
-    std::unique_ptr<IAM::PairingInfo> pairingInfo;
-    std::tie(ec, pairingInfo) = IAM::get_pairing_info(connection);
-    if (ec.ok()) {
-        if (pairingInfo->getProductId() != device.getProductId()) {
-            std::cerr << "The Product ID of the connected device (" <<  pairingInfo->getProductId() << ") does not match the Product ID for the bookmark " << device.getFriendlyName() << std::endl;
-        } else if (pairingInfo->getDeviceId() != device.getDeviceId()) {
-            std::cerr << "The Device ID of the connected device (" <<  pairingInfo->getDeviceId() << ") does not match the Device ID for the bookmark " << device.getFriendlyName() << std::endl;
-        } else {
-            std::cerr << "The public key of the device does not match the public key in the pairing. Repair the device with the client." << std::endl;
-        }
-    } else {
-        // should not happen
-        ec.printError();
-    }
-}
-
-std::shared_ptr<nabto::client::Connection> createConnection(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo device)
-{
-    auto Config = Configuration::GetConfigInfo();
-    if (!Config) {
-        printMissingClientConfig(Configuration::GetConfigFilePath());
-        return nullptr;
-    }
-
-    auto connection = context->createConnection();
-    connection->setProductId(device.getProductId());
-    connection->setDeviceId(device.getDeviceId());
-    connection->setApplicationName(appName);
-    connection->setApplicationVersion(edge_tunnel_client_version());
-
-    if (!device.getDirectCandidate().empty()) {
-        connection->enableDirectCandidates();
-        connection->addDirectCandidate(device.getDirectCandidate(), 5592);
-        connection->endOfDirectCandidates();
-    }
-
-    std::string privateKey;
-    if(!Configuration::GetPrivateKey(context, privateKey)) {
-        return nullptr;
-    }
-    connection->setPrivateKey(privateKey);
-
-
-    if (!Config->getServerUrl().empty()) {
-        connection->setServerUrl(Config->getServerUrl());
-    }
-
-    connection->setServerConnectToken(device.getSct());
-
-    try {
-        connection->connect()->waitForResult();
-    } catch (nabto::client::NabtoException& e) {
-        if (e.status().getErrorCode() == nabto::client::Status::NO_CHANNELS) {
-            auto localStatus = nabto::client::Status(connection->getLocalChannelErrorCode());
-            auto remoteStatus = nabto::client::Status(connection->getRemoteChannelErrorCode());
-            std::cerr << "Not Connected." << std::endl;
-            std::cerr << " The Local status is: " << localStatus.getDescription() << std::endl;
-            std::cerr << " The Remote status is: " << remoteStatus.getDescription() << std::endl;
-        } else {
-            std::cerr << "Connect failed " << e.what() << std::endl;
-        }
-        return nullptr;
-    }
-
-    try {
-        if (connection->getDeviceFingerprint() != device.getDeviceFingerprint()) {
-            handleFingerprintMismatch(connection, device);
-            return nullptr;
-        }
-    } catch (...) {
-        std::cerr << "Missing device fingerprint in state, pair with the device again" << std::endl;
-        return nullptr;
-    }
-
-    // we are paired if the connection has a user in the device
-    IAM::IAMError ec;
-    std::unique_ptr<IAM::User> user;
-    std::tie(ec, user) = IAM::get_me(connection);
-
-    if (!user) {
-        std::cerr << "The client is not paired with device, do the pairing again" << std::endl;
-        return nullptr;
-    }
-    return connection;
-}
-
 static void get_service(std::shared_ptr<nabto::client::Connection> connection, const std::string& service);
 static void print_service(const nlohmann::json& service);
 
 bool list_services(std::shared_ptr<nabto::client::Connection> connection)
 {
+    Tracing::Span span("list_services");
     auto coap = connection->createCoap("GET", "/tcp-tunnels/services");
     coap->execute()->waitForResult();
+    span.setAttribute("status", coap->getResponseStatusCode());
     if (coap->getResponseStatusCode() == 205 &&
         coap->getResponseContentFormat() == COAP_CONTENT_FORMAT_APPLICATION_CBOR)
     {
@@ -273,43 +260,308 @@ bool split_in_service_and_port(const std::string& in, std::string& service, uint
     return true;
 }
 
-bool tcptunnel(std::shared_ptr<nabto::client::Connection> connection, std::vector<std::string> services)
+static std::string info_channel(const Sampling::ConnectionInfo& info)
+{
+    return info.channel_.empty() ? "none" : info.channel_;
+}
+
+void print_info_change(const Sampling::ConnectionInfo& before, const Sampling::ConnectionInfo& after)
+{
+    std::cout << time_in_HH_MM_SS_MMM() << " Connection info changed:";
+    if (before.channel_ != after.channel_) {
+        std::cout << " channel " << info_channel(before) << " -> " << info_channel(after);
+    }
+    if (before.mdnsError_ != after.mdnsError_) {
+        std::cout << " mdns " << before.mdnsError_ << " -> " << after.mdnsError_;
+    }
+    if (before.udpRelayError_ != after.udpRelayError_) {
+        std::cout << " udp relay " << before.udpRelayError_ << " -> " << after.udpRelayError_;
+    }
+    if (before.localError_ != after.localError_) {
+        std::cout << " local " << nabto::client::Status(after.localError_).getName();
+    }
+    if (before.remoteError_ != after.remoteError_) {
+        std::cout << " remote " << nabto::client::Status(after.remoteError_).getName();
+    }
+    if (before.directError_ != after.directError_) {
+        std::cout << " direct candidates " << nabto::client::Status(after.directError_).getName();
+    }
+    std::cout << std::endl;
+}
+
+#if !defined(_WIN32)
+// Create the directory accessible only to the user, or check that an
+// existing directory is, such that the sockets in it are private.
+static bool private_directory(const std::string& dir)
+{
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        std::cerr << "Could not create the directory " << dir << " for the unix sockets: " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        std::cerr << "The path " << dir << " for the unix sockets is not a directory" << std::endl;
+        return false;
+    }
+    if (st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+        std::cerr << "The directory " << dir << " for the unix sockets must be owned by the user and not accessible to others (mode 0700)" << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool tcptunnel(std::shared_ptr<EdgeTunnel::DeviceSession> session, std::vector<std::string> services, std::shared_ptr<Metrics::Registry> metrics, const std::string& udsDir, double linkRate)
 {
-    std::vector<std::shared_ptr<nabto::client::TcpTunnel> > tunnels;
+#if !defined(_WIN32)
+    std::vector<std::unique_ptr<Relay::UnixSocketRelay> > relays;
+    if (!udsDir.empty() && !private_directory(udsDir)) {
+        return false;
+    }
 
-    for (auto serviceAndPort : services) {
+    // The shaping options follow the service as /weight=8/rate=1M.
+    std::vector<Shaping::ClassConfig> classes;
+    bool shaped = linkRate > 0;
+    for (auto& serviceAndPort : services) {
+        Shaping::ClassConfig config;
+        size_t slash = serviceAndPort.find('/');
+        if (slash != std::string::npos) {
+            std::string error;
+            if (!Shaping::parseClassOptions(serviceAndPort.substr(slash + 1), config, error)) {
+                std::cerr << "Invalid --service " << serviceAndPort << ": " << error << std::endl;
+                return false;
+            }
+            serviceAndPort = serviceAndPort.substr(0, slash);
+        }
+        shaped = shaped || config.shaped();
+        classes.push_back(config);
+    }
+    // Shared with the metrics collector which may outlive the tunnels.
+    std::shared_ptr<Shaping::Forwarder> forwarder;
+    if (shaped) {
+        forwarder = std::make_shared<Shaping::Forwarder>(linkRate);
+    }
+#endif
+    for (size_t i = 0; i < services.size(); i++) {
+        const std::string& serviceAndPort = services[i];
         std::string service;
         uint16_t localPort;
         if (!split_in_service_and_port(serviceAndPort, service, localPort)) {
             return false;
         }
+        uint16_t tunnelPort = localPort;
+#if !defined(_WIN32)
+        // The forwarder listens on the requested port in front of the
+        // SDK tunnel.
+        if (forwarder) {
+            tunnelPort = 0;
+        }
+#endif
 
-        std::shared_ptr<nabto::client::TcpTunnel> tunnel;
-        try {
-            tunnel = connection->createTcpTunnel();
-            tunnel->open(service, localPort)->waitForResult();
-        } catch (std::exception& e) {
-            std::cout << "Failed to open a tunnel to " << serviceAndPort << " error: " << e.what() << std::endl;
+        std::shared_ptr<Metrics::TunnelMetrics> tunnelMetrics;
+        if (metrics) {
+            tunnelMetrics = metrics->addTunnel(service);
+        }
+        auto openStart = std::chrono::steady_clock::now();
+        EdgeTunnel::SessionError ec;
+        uint16_t port;
+        std::tie(ec, port) = session->openTunnel(service, tunnelPort);
+        if (!ec.ok()) {
+            if (tunnelMetrics) {
+                tunnelMetrics->failed(std::chrono::steady_clock::now() - openStart);
+            }
+            std::cout << "Failed to open a tunnel to " << serviceAndPort << " error: " << ec.message() << std::endl;
             return false;
         }
+        if (tunnelMetrics) {
+            tunnelMetrics->opened(std::chrono::steady_clock::now() - openStart);
+        }
+#if !defined(_WIN32)
+        if (forwarder) {
+            classes[i].service_ = service;
+            port = forwarder->addTunnel(classes[i], localPort, port);
+            if (port == 0) {
+                return false;
+            }
+        }
+#endif
 
-        std::cout << "TCP Tunnel opened for the service " << service << " listening on the local port " << tunnel->getLocalPort() << std::endl;
-        tunnels.push_back(tunnel);
+        std::cout << "TCP Tunnel opened for the service " << service << " listening on the local port " << port << std::endl;
+#if !defined(_WIN32)
+        if (!udsDir.empty()) {
+            if (service.find('/') != std::string::npos) {
+                std::cerr << "The service " << service << " cannot be exposed as a unix socket, its name contains a /" << std::endl;
+                return false;
+            }
+            auto relay = Relay::UnixSocketRelay::start(udsDir + "/" + service + ".sock", port);
+            if (!relay) {
+                return false;
+            }
+            std::cout << "Unix socket for the service " << service << " at " << relay->path() << std::endl;
+            relays.push_back(std::move(relay));
+        }
+#endif
     }
 
+#if !defined(_WIN32)
+    if (forwarder) {
+        if (!forwarder->start()) {
+            std::cerr << "Could not start the shaping of the tunnels" << std::endl;
+            return false;
+        }
+        if (metrics) {
+            metrics->addCollector([forwarder](std::ostream& out) { forwarder->renderMetrics(out); });
+        }
+    }
+#endif
+
     // wait for ctrl c
     signal(SIGINT, &signalHandler);
+#if !defined(_WIN32)
+    signal(SIGUSR1, &logBoostSignalHandler);
+    signal(SIGUSR2, &futureDumpSignalHandler);
+#endif
 
     auto closeListener = std::make_shared<CloseListener>();
-    connection->addEventsListener(closeListener);
-    connection_ = connection;
+    session->subscribe([closeListener](EdgeTunnel::SessionState state) { closeListener->onState(state); });
+    connection_ = session->connection();
 
     closeListener->waitForClose();
-    connection->removeEventsListener(closeListener);
     connection_.reset();
     return true;
 }
 
+#if !defined(_WIN32)
+// Tunnel stdin and stdout to the service, stdout carries only the data
+// of the tunnel.
+bool stdio_tunnel(std::shared_ptr<EdgeTunnel::DeviceSession> session, const std::string& service)
+{
+    EdgeTunnel::SessionError ec;
+    uint16_t port;
+    std::tie(ec, port) = session->openTunnel(service, 0);
+    if (!ec.ok()) {
+        std::cerr << "Failed to open a tunnel to " << service << " error: " << ec.message() << std::endl;
+        return false;
+    }
+    // The SDK only exposes tunnels as local tcp ports, which other local
+    // users can connect to as well. Stop if a connection to the port
+    // other than ours appears.
+    int fd = Relay::connect_loopback(port);
+    if (fd < 0) {
+        std::cerr << "Could not connect to the tunnel on the local port " << port << std::endl;
+        return false;
+    }
+    if (!Relay::is_only_loopback_client(fd, port)) {
+        std::cerr << "Another connection was made to the tunnel on the local port " << port << ", closing it" << std::endl;
+        close(fd);
+        return false;
+    }
+    int stopFds[2];
+    if (pipe(stopFds) != 0) {
+        close(fd);
+        return false;
+    }
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+    bool intruded = false;
+    std::thread watcher([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cond.wait_for(lock, std::chrono::seconds(1), [&]() { return done; })) {
+            if (!Relay::is_only_loopback_client(fd, port)) {
+                intruded = true;
+                char c = 0;
+                if (write(stopFds[1], &c, 1) < 0) {
+                    // The pump is stopped by the session closing instead.
+                }
+                return;
+            }
+        }
+    });
+    signal(SIGPIPE, SIG_IGN);
+    bool ok = Relay::pump(STDIN_FILENO, STDOUT_FILENO, fd, fd, stopFds[0]);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cond.notify_one();
+    watcher.join();
+    if (intruded) {
+        std::cerr << "Another connection was made to the tunnel on the local port " << port << ", closing it" << std::endl;
+        ok = false;
+    }
+    close(stopFds[0]);
+    close(stopFds[1]);
+    close(fd);
+    return ok;
+}
+#endif
+
+// Fetch the metadata of all bookmarks and keep it in the state file.
+bool refresh_metadata(std::shared_ptr<nabto::client::Context> context, size_t concurrency,
+                      std::shared_ptr<nabto::examples::common::MdnsPresence> presence)
+{
+    auto devices = Configuration::GetPairedDevices();
+    if (devices.empty()) {
+        std::cerr << "No devices have been paired, start by pairing the client with a device." << std::endl;
+        return false;
+    }
+    EdgeTunnel::SessionOptions options;
+    options.applicationName_ = appName;
+    options.presence_ = presence;
+    auto start = std::chrono::steady_clock::now();
+    auto results = EdgeTunnel::refreshMetadata(context, devices, concurrency, options);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    size_t failed = 0;
+    std::map<int, Configuration::DeviceMetadata> metadata;
+    for (auto& r : results) {
+        if (!r.error_.ok()) {
+            failed++;
+            std::cout << "[" << r.index_ << "] failed: " << r.error_.message() << std::endl;
+            continue;
+        }
+        metadata[r.index_] = r.metadata_;
+        std::cout << "[" << r.index_ << "] " << r.metadata_.friendlyName_;
+        if (!r.metadata_.appName_.empty()) {
+            std::cout << " App: " << r.metadata_.appName_ << " " << r.metadata_.appVersion_;
+        }
+        std::cout << std::endl;
+    }
+    Configuration::SetDeviceMetadata(metadata);
+    std::cout << "Refreshed " << results.size() - failed << " of " << results.size() << " devices in " << elapsed.count() << " ms" << std::endl;
+    if (!Configuration::WriteStateFile()) {
+        std::cerr << "Failed to write state to " << Configuration::GetStateFilePath() << std::endl;
+        return false;
+    }
+    return failed == 0;
+}
+
+// Connect to all bookmarks, report how they were reached and append the
+// report to the history file.
+bool fleet_scan(std::shared_ptr<nabto::client::Context> context, const Fleet::ScanOptions& options, const std::string& historyPath)
+{
+    auto devices = Configuration::GetPairedDevices();
+    if (devices.empty()) {
+        std::cerr << "No devices have been paired, start by pairing the client with a device." << std::endl;
+        return false;
+    }
+    std::cout << "Scanning " << devices.size() << " devices, " << options.concurrency_ << " at a time with a deadline of "
+              << options.deadline_.count() << " ms" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    auto results = Fleet::scan(context, devices, options);
+    Fleet::ScanReport report(results, std::chrono::steady_clock::now() - start);
+    report.print(std::cout);
+
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!Fleet::appendHistory(historyPath, report.toJson(now))) {
+        std::cerr << "Could not append the report to " << historyPath << std::endl;
+        return false;
+    }
+    Fleet::printHistory(historyPath, 10, std::cout);
+    return true;
+}
+
 void printDeviceInfo(std::shared_ptr<IAM::PairingInfo> pi)
 {
     auto ms = pi->getModes();
@@ -341,11 +593,29 @@ int main(int argc, char** argv)
         ("version", "Show version")
         ("H,home", "Override the directory in which configuration files are saved to.", cxxopts::value<std::string>())
         ("log-level", "Log level (none|error|info|trace)", cxxopts::value<std::string>()->default_value("error"))
+        ("log-file", "Write structured log records to this file instead of stdout.", cxxopts::value<std::string>())
+        ("log-format", "Format of the log file (json|binary)", cxxopts::value<std::string>()->default_value("json"))
+        ("log-max-size", "Rotate the log file when it exceeds this many bytes, 0 disables size rotation.", cxxopts::value<uint64_t>()->default_value("10485760"))
+        ("log-max-age", "Rotate the log file when it is older than this many seconds, 0 disables time rotation.", cxxopts::value<uint32_t>()->default_value("0"))
+        ("log-max-files", "Number of rotated log files to keep.", cxxopts::value<int>()->default_value("5"))
+        ("log-rate-limit", "Limit info, debug and trace messages to this many per second for each message pattern, 0 disables the limit.", cxxopts::value<double>()->default_value("0"))
+        ("log-burst", "Number of messages of a pattern logged before the rate limit applies.", cxxopts::value<size_t>()->default_value("100"))
+        ("log-sample", "Log every n'th message of a rate limited pattern, 0 disables sampling.", cxxopts::value<size_t>()->default_value("100"))
+        ("log-boost-seconds", "When a tunnel receives SIGUSR1 the log level is raised to trace for this many seconds.", cxxopts::value<uint32_t>()->default_value("60"))
+        ("timings", "Print how long each phase of connecting to the device took to stderr, --timings=json prints it as json", cxxopts::value<std::string>()->implicit_value("text"))
+        ("trace", "Write spans of connecting, pairing, CoAP requests and tunnels to this Chrome trace event file, which can be opened in Perfetto", cxxopts::value<std::string>())
         ;
     options.add_options("Bookmarks")
         ("bookmarks", "List bookmarked devices")
         ("b,bookmark", "Select a bookmarked device to use with other commands.", cxxopts::value<uint32_t>()->default_value("0"))
         ("delete-bookmark", "Delete a pairing with a device")
+        ("filter", "With --bookmarks list only the devices whose product id, device id, name or app name contains this text", cxxopts::value<std::string>())
+        ("refresh-metadata", "Connect to all bookmarked devices and cache their name, app and versions in the state file, such that --bookmarks shows them")
+        ("refresh-concurrency", "Devices connected to at a time by --refresh-metadata", cxxopts::value<size_t>()->default_value("16"))
+        ("scan", "Connect to all bookmarked devices, report the time to connect, the channels reached and why devices could not be reached, and append the report to the scan history")
+        ("scan-concurrency", "Connects in flight at a time during --scan", cxxopts::value<size_t>()->default_value("32"))
+        ("scan-deadline", "Seconds a device gets to connect during --scan", cxxopts::value<double>()->default_value("10"))
+        ("scan-history", "File the --scan reports are appended to, one json object per line. The default is scan_history.jsonl next to the state file", cxxopts::value<std::string>())
         ;
 
     options.add_options("Pairing")
@@ -370,6 +640,16 @@ int main(int argc, char** argv)
     options.add_options("TCP Tunnelling")
         ("services", "List available services on the device")
         ("service", "Create a tunnel to this service. The default local port is an ephemeral port. A specific local port can be used using the syntax --service <service>:<port> e.g. --service ssh:4242 to establish a tunnel to the ssh service and listen for connections to it on the local TCP port 4242", cxxopts::value<std::vector<std::string> >(services))
+#if !defined(_WIN32)
+        ("link-rate", "Share this many bytes per second in each direction between the tunnels by the weights given as --service <service>[:<port>]/weight=<w>/rate=<bytes/s>/session-rate=<bytes/s>, e.g. --service ssh/weight=8 --service http/rate=1M. Rates take the suffixes k, M and G", cxxopts::value<std::string>())
+#endif
+        ("info-interval", "Seconds between samples of the connection info while the tunnels are open, changes are printed. 0 disables sampling", cxxopts::value<double>()->default_value("10"))
+        ("info-history", "Number of connection info samples kept", cxxopts::value<size_t>()->default_value("60"))
+#if !defined(_WIN32)
+        ("stdio", "Tunnel stdin and stdout to this service and exit when either reaches end of file, e.g. ssh -o ProxyCommand='edge_tunnel_client --stdio ssh' user@device. The SDK only exposes tunnels as local ports, the data passes an ephemeral loopback port and the client exits if another connection to it appears", cxxopts::value<std::string>())
+        ("uds-dir", "Also expose each tunnel as the unix socket <dir>/<service>.sock, accessible only to the user. The directory is created if missing. This restricts access to the tunnel, it is not faster: the socket is relayed to the tcp port, which costs throughput and latency", cxxopts::value<std::string>())
+        ("metrics-port", "Serve OpenMetrics of the connection and tunnels on http://127.0.0.1:<port>/metrics and the sampled connection info on /status while the tunnels are open", cxxopts::value<uint16_t>())
+#endif
         ;
 
     try {
@@ -404,7 +684,7 @@ int main(int argc, char** argv)
 
         if (result.count("bookmarks"))
         {
-            Configuration::PrintBookmarks();
+            Configuration::PrintBookmarks(nullptr, result.count("filter") ? result["filter"].as<std::string>() : "");
             return 0;
         }
 
@@ -417,10 +697,54 @@ int main(int argc, char** argv)
             return 0;
         }
 
+        std::shared_ptr<Logging::StructuredLogSink> logSink;
+        if (result.count("log-file")) {
+            Logging::SinkOptions sinkOptions;
+            sinkOptions.path_ = result["log-file"].as<std::string>();
+            sinkOptions.format_ = Logging::StructuredLogSink::parseFormat(result["log-format"].as<std::string>());
+            sinkOptions.maxFileSize_ = result["log-max-size"].as<uint64_t>();
+            sinkOptions.maxFileAge_ = std::chrono::seconds(result["log-max-age"].as<uint32_t>());
+            sinkOptions.maxFiles_ = result["log-max-files"].as<int>();
+            logSink = std::make_shared<Logging::StructuredLogSink>(sinkOptions);
+            if (!logSink->open()) {
+                return 1;
+            }
+        }
+
+        std::unique_ptr<Tracing::Session> traceSession;
+        if (result.count("trace")) {
+            traceSession = Tracing::Session::start(result["trace"].as<std::string>());
+            if (!traceSession) {
+                return 1;
+            }
+        }
+
         auto context = nabto::client::Context::create();
 
-        context->setLogger(std::make_shared<MyLogger>());
+        // In stdio mode stdout is the tunnel.
+        std::ostream& out = result.count("stdio") ? std::cerr : std::cout;
+        context->setLogger(std::make_shared<MyLogger>(logSink, out));
         context->setLogLevel(result["log-level"].as<std::string>());
+        context->setLogRateLimit(result["log-rate-limit"].as<double>(), result["log-burst"].as<size_t>(), result["log-sample"].as<size_t>());
+
+        auto logBoostSeconds = std::chrono::seconds(result["log-boost-seconds"].as<uint32_t>());
+        std::weak_ptr<nabto::client::Context> weakContext = context;
+        logBoost_ = [weakContext, logBoostSeconds]() {
+            auto context = weakContext.lock();
+            if (context) {
+                std::cout << "Raising the log level to trace for " << logBoostSeconds.count() << " seconds" << std::endl;
+                context->setLogLevelFor("trace", logBoostSeconds);
+            }
+        };
+
+        // Tunnels keep the process running and the fleet commands connect
+        // to many devices, keep a presence table of the local devices for
+        // the lifetime of the process such that connects made once it is
+        // warm skip the local channel for devices not on the local network.
+        std::shared_ptr<nabto::examples::common::MdnsPresence> presence;
+        if (result.count("service") || result.count("scan") || result.count("refresh-metadata")) {
+            presence = nabto::examples::common::MdnsPresence::create(context, "tcptunnel");
+        }
 
         if (result.count("pair-local")) {
             if (!interactive_pair(context)) {
@@ -440,9 +764,34 @@ int main(int argc, char** argv)
             }
             return 0;
         }
+        else if (result.count("scan")) {
+            Fleet::ScanOptions scanOptions;
+            scanOptions.concurrency_ = result["scan-concurrency"].as<size_t>();
+            scanOptions.deadline_ = std::chrono::milliseconds(static_cast<int64_t>(result["scan-deadline"].as<double>() * 1000));
+            scanOptions.session_.applicationName_ = appName;
+            scanOptions.session_.presence_ = presence;
+            std::string historyPath;
+            if (result.count("scan-history")) {
+                historyPath = result["scan-history"].as<std::string>();
+            } else {
+                std::string statePath = Configuration::GetStateFilePath();
+                historyPath = statePath.substr(0, statePath.find_last_of('/') + 1) + "scan_history.jsonl";
+            }
+            if (!fleet_scan(context, scanOptions, historyPath)) {
+                return 1;
+            }
+            return 0;
+        }
+        else if (result.count("refresh-metadata")) {
+            if (!refresh_metadata(context, result["refresh-concurrency"].as<size_t>(), presence)) {
+                return 1;
+            }
+            return 0;
+        }
 
         else if (result.count("services") ||
                  result.count("service") ||
+                 result.count("stdio") ||
                  result.count("users") ||
                  result.count("roles") ||
                  result.count("set-role") ||
@@ -470,17 +819,82 @@ int main(int argc, char** argv)
                 return 1;
             }
 
-            auto connection = createConnection(context, *Device);
-            if (!connection) {
+            Timing::ConnectTimings timings;
+            EdgeTunnel::SessionOptions sessionOptions;
+            sessionOptions.applicationName_ = appName;
+            sessionOptions.presence_ = presence;
+            EdgeTunnel::SessionError sessionError;
+            std::shared_ptr<EdgeTunnel::DeviceSession> session;
+            std::tie(sessionError, session) = EdgeTunnel::DeviceSession::open(context, *Device, sessionOptions, timings);
+            if (result.count("timings")) {
+                if (result["timings"].as<std::string>() == "json") {
+                    std::cerr << timings.toJson() << std::endl;
+                } else {
+                    timings.print(std::cerr);
+                }
+            }
+            if (!session) {
+                std::cerr << sessionError.message() << std::endl;
                 return 1;
             }
-            std::cout << "Connected to the device " << Device->getFriendlyName() << std::endl;
+            auto connection = session->connection();
+            out << "Connected to the device " << Device->getFriendlyName() << std::endl;
+
+            std::shared_ptr<Sampling::InfoSampler> sampler;
+            double infoInterval = result["info-interval"].as<double>();
+            if (result.count("service") && infoInterval > 0) {
+                sampler = std::make_shared<Sampling::InfoSampler>(
+                    std::chrono::milliseconds(static_cast<int64_t>(infoInterval * 1000)), result["info-history"].as<size_t>());
+                sampler->add(SelectedBookmark, Device->getProductId(), Device->getDeviceId(), connection);
+                sampler->setChangeCallback([](uint32_t, const Sampling::ConnectionInfo& before, const Sampling::ConnectionInfo& after) {
+                    print_info_change(before, after);
+                });
+                sampler->start();
+            }
+
+            std::shared_ptr<Metrics::Registry> metrics;
+#if !defined(_WIN32)
+            std::unique_ptr<Metrics::MetricsServer> metricsServer;
+            if (result.count("service") && result.count("metrics-port")) {
+                metrics = std::make_shared<Metrics::Registry>(context);
+                auto connectionMetrics = metrics->addConnection(SelectedBookmark, Device->getProductId(), Device->getDeviceId());
+                connectionMetrics->connected(connection);
+                connection->addEventsListener(connectionMetrics);
+                std::vector<Metrics::Route> routes;
+                if (sampler) {
+                    metrics->addCollector([sampler](std::ostream& out) { sampler->renderMetrics(out); });
+                    routes.push_back(Metrics::Route{ "/status", "application/json", [sampler]() { return sampler->statusJson(); } });
+                }
+                metricsServer = Metrics::MetricsServer::start(result["metrics-port"].as<uint16_t>(), [metrics]() { return metrics->render(); }, routes);
+                if (!metricsServer) {
+                    return 1;
+                }
+                std::cout << "Serving metrics on http://127.0.0.1:" << metricsServer->port() << "/metrics" << (sampler ? " and connection info on /status" : "") << std::endl;
+            }
+#endif
 
             bool status = false;
             if (result.count("services")) {
                 status = list_services(connection);
             } else if (result.count("service")) {
-                status = tcptunnel(connection, services);
+                std::string udsDir;
+#if !defined(_WIN32)
+                if (result.count("uds-dir")) {
+                    udsDir = result["uds-dir"].as<std::string>();
+                }
+#endif
+                double linkRate = 0;
+#if !defined(_WIN32)
+                if (result.count("link-rate") && !Shaping::parseRate(result["link-rate"].as<std::string>(), linkRate)) {
+                    std::cerr << "Invalid --link-rate " << result["link-rate"].as<std::string>() << std::endl;
+                    return 1;
+                }
+#endif
+                status = tcptunnel(session, services, metrics, udsDir, linkRate);
+#if !defined(_WIN32)
+            } else if (result.count("stdio")) {
+                status = stdio_tunnel(session, result["stdio"].as<std::string>());
+#endif
             } else if (result.count("users")) {
                 status = IAM::list_users(connection);
             } else if (result.count("roles")) {
@@ -520,13 +934,7 @@ int main(int argc, char** argv)
                     status = true;
                 }
             }
-            try {
-                connection->close()->waitForResult();
-            } catch(nabto::client::NabtoException& e) {
-                if (e.status().getErrorCode() != nabto::client::Status::STOPPED) {
-                    throw(e);
-                }
-            }
+            session->close();
             return status ? 0 : 1;
         } else {
             std::cout << options.help() << std::endl;
@@ -0,0 +1,359 @@
+#include "fleet_scan.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace Fleet {
+
+typedef std::chrono::steady_clock Clock;
+
+std::string outcomeAsString(Outcome outcome)
+{
+    switch (outcome) {
+        case Outcome::REACHED: return "reached";
+        case Outcome::FAILED: return "failed";
+        case Outcome::DEADLINE: return "deadline";
+    }
+    return "unknown";
+}
+
+// Completed connects, pushed from the SDK thread and taken by the scan.
+// Shared with the callbacks, which may run after the scan has returned
+// for connects that missed their deadline.
+class Completions {
+ public:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::pair<size_t, int> > done_;
+};
+
+class Attempt {
+ public:
+    std::shared_ptr<nabto::client::Connection> connection_;
+    Clock::time_point start_;
+    Clock::time_point deadline_;
+};
+
+static void sample_channels(std::shared_ptr<nabto::client::Connection> connection, ScanResult& r)
+{
+    r.localError_ = connection->getLocalChannelErrorCode();
+    r.remoteError_ = connection->getRemoteChannelErrorCode();
+    r.directError_ = connection->getDirectCandidatesChannelErrorCode();
+}
+
+std::vector<ScanResult> scan(std::shared_ptr<nabto::client::Context> context,
+                             const std::vector<Configuration::DeviceInfo>& devices,
+                             const ScanOptions& options)
+{
+    std::vector<ScanResult> results(devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        results[i].index_ = devices[i].index_;
+        results[i].productId_ = devices[i].getProductId();
+        results[i].deviceId_ = devices[i].getDeviceId();
+    }
+    // Create the key file, if missing, before it is read for each device.
+    std::string privateKey;
+    Configuration::GetPrivateKey(context, privateKey);
+
+    auto completions = std::make_shared<Completions>();
+    std::map<size_t, Attempt> inFlight;
+    size_t concurrency = std::max<size_t>(1, options.concurrency_);
+    size_t next = 0;
+
+    auto finish = [&](size_t i, Outcome outcome, const std::string& error) {
+        Attempt& a = inFlight[i];
+        ScanResult& r = results[i];
+        r.outcome_ = outcome;
+        r.error_ = error;
+        r.connectTime_ = Clock::now() - a.start_;
+        sample_channels(a.connection_, r);
+        // The close is not waited for, the future frees itself.
+        a.connection_->close();
+        inFlight.erase(i);
+    };
+
+    while (next < devices.size() || !inFlight.empty()) {
+        while (next < devices.size() && inFlight.size() < concurrency) {
+            size_t i = next++;
+            Timing::ConnectTimings timings;
+            EdgeTunnel::SessionError error;
+            std::shared_ptr<nabto::client::Connection> connection;
+            std::tie(error, connection) = EdgeTunnel::DeviceSession::createConnection(context, devices[i], options.session_, timings);
+            if (!connection) {
+                results[i].outcome_ = Outcome::FAILED;
+                results[i].error_ = error.message();
+                continue;
+            }
+            Attempt& a = inFlight[i];
+            a.connection_ = connection;
+            a.start_ = Clock::now();
+            a.deadline_ = a.start_ + options.deadline_;
+            connection->connect()->callback([completions, i](nabto::client::Status status) {
+                std::lock_guard<std::mutex> lock(completions->mutex_);
+                completions->done_.push_back(std::make_pair(i, status.getErrorCode()));
+                completions->cond_.notify_one();
+            });
+        }
+        if (inFlight.empty()) {
+            continue;
+        }
+
+        Clock::time_point deadline = Clock::time_point::max();
+        for (auto& a : inFlight) {
+            deadline = std::min(deadline, a.second.deadline_);
+        }
+        std::deque<std::pair<size_t, int> > done;
+        {
+            std::unique_lock<std::mutex> lock(completions->mutex_);
+            completions->cond_.wait_until(lock, deadline, [&]() { return !completions->done_.empty(); });
+            done.swap(completions->done_);
+        }
+        for (auto& d : done) {
+            size_t i = d.first;
+            if (inFlight.count(i) == 0) {
+                // Completed after its deadline.
+                continue;
+            }
+            auto connection = inFlight[i].connection_;
+            if (d.second != nabto::client::Status::OK) {
+                finish(i, Outcome::FAILED, nabto::client::Status(d.second).getName());
+                continue;
+            }
+            try {
+                results[i].channel_ = connection->getType() == nabto::client::Connection::Type::DIRECT ? "direct" : "relay";
+            } catch (nabto::client::NabtoException&) {
+                results[i].channel_.clear();
+            }
+            bool sameDevice = false;
+            try {
+                sameDevice = connection->getDeviceFingerprint() == devices[i].getDeviceFingerprint();
+            } catch (nabto::client::NabtoException&) {
+            }
+            if (sameDevice) {
+                finish(i, Outcome::REACHED, "");
+            } else {
+                finish(i, Outcome::FAILED, "FINGERPRINT_MISMATCH");
+            }
+        }
+        auto now = Clock::now();
+        std::vector<size_t> expired;
+        for (auto& a : inFlight) {
+            if (a.second.deadline_ <= now) {
+                expired.push_back(a.first);
+            }
+        }
+        for (size_t i : expired) {
+            finish(i, Outcome::DEADLINE, "DEADLINE");
+        }
+    }
+    return results;
+}
+
+static double milliseconds(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static std::string format_duration(Clock::duration d)
+{
+    std::stringstream ss;
+    double ms = milliseconds(d);
+    if (ms < 1000) {
+        ss << std::fixed << std::setprecision(0) << ms << " ms";
+    } else {
+        ss << std::fixed << std::setprecision(2) << ms / 1000 << " s";
+    }
+    return ss.str();
+}
+
+// The failure as the SDK describes it, the errors of the channels which
+// were tried and failed.
+static std::string failure_key(const ScanResult& r)
+{
+    std::string key = r.error_;
+    const char* names[3] = { "local", "remote", "direct" };
+    int codes[3] = { r.localError_, r.remoteError_, r.directError_ };
+    for (int i = 0; i < 3; i++) {
+        if (codes[i] != nabto::client::Status::OK && codes[i] != nabto::client::Status::NONE) {
+            key += std::string(" ") + names[i] + "=" + nabto::client::Status(codes[i]).getName();
+        }
+    }
+    return key;
+}
+
+ScanReport::ScanReport(const std::vector<ScanResult>& results, Clock::duration elapsed)
+    : results_(results), elapsed_(elapsed)
+{
+    for (auto& r : results_) {
+        if (r.outcome_ == Outcome::REACHED) {
+            connectTimes_.push_back(r.connectTime_);
+        }
+    }
+    std::sort(connectTimes_.begin(), connectTimes_.end());
+}
+
+// Nearest rank percentile of the sorted times.
+static Clock::duration percentile(const std::vector<Clock::duration>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return Clock::duration::zero();
+    }
+    size_t rank = static_cast<size_t>(std::ceil(p / 100 * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static std::map<std::string, size_t> count_by(const std::vector<ScanResult>& results, std::function<std::string (const ScanResult&)> key)
+{
+    std::map<std::string, size_t> counts;
+    for (auto& r : results) {
+        std::string k = key(r);
+        if (!k.empty()) {
+            counts[k]++;
+        }
+    }
+    return counts;
+}
+
+void ScanReport::print(std::ostream& out) const
+{
+    auto outcomes = count_by(results_, [](const ScanResult& r) { return outcomeAsString(r.outcome_); });
+    auto channels = count_by(results_, [](const ScanResult& r) { return r.outcome_ == Outcome::REACHED ? r.channel_ : ""; });
+    out << "Scanned " << results_.size() << " devices in " << format_duration(elapsed_) << std::endl;
+    out << "  reached  " << outcomes["reached"];
+    if (!channels.empty()) {
+        out << " (";
+        bool first = true;
+        for (auto& c : channels) {
+            out << (first ? "" : ", ") << c.first << " " << c.second;
+            first = false;
+        }
+        out << ")";
+    }
+    out << std::endl;
+    out << "  failed   " << outcomes["failed"] << std::endl;
+    out << "  deadline " << outcomes["deadline"] << std::endl;
+
+    if (!connectTimes_.empty()) {
+        out << "Time to connect: p50 " << format_duration(percentile(connectTimes_, 50))
+            << " p90 " << format_duration(percentile(connectTimes_, 90))
+            << " p99 " << format_duration(percentile(connectTimes_, 99))
+            << " max " << format_duration(connectTimes_.back()) << std::endl;
+        const double bounds[] = { 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+        const size_t buckets = sizeof(bounds) / sizeof(bounds[0]) + 1;
+        size_t counts[buckets] = { 0 };
+        for (auto& t : connectTimes_) {
+            size_t b = 0;
+            while (b < buckets - 1 && milliseconds(t) > bounds[b]) {
+                b++;
+            }
+            counts[b]++;
+        }
+        size_t most = *std::max_element(counts, counts + buckets);
+        for (size_t b = 0; b < buckets; b++) {
+            std::stringstream label;
+            if (b < buckets - 1) {
+                label << "<= " << bounds[b] << " ms";
+            } else {
+                label << " > " << bounds[b - 1] << " ms";
+            }
+            size_t width = most > 0 ? (counts[b] * 40 + most - 1) / most : 0;
+            out << "  " << std::left << std::setw(12) << label.str() << std::right << std::setw(7) << counts[b] << " " << std::string(width, '#') << std::endl;
+        }
+    }
+
+    auto failures = count_by(results_, [](const ScanResult& r) { return r.outcome_ == Outcome::REACHED ? "" : failure_key(r); });
+    if (!failures.empty()) {
+        std::vector<std::pair<std::string, size_t> > sorted(failures.begin(), failures.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, size_t>& a, const std::pair<std::string, size_t>& b) { return a.second > b.second; });
+        out << "Failures:" << std::endl;
+        for (auto& f : sorted) {
+            out << "  " << std::setw(7) << f.second << " " << f.first << std::endl;
+        }
+        out << "Unreachable devices:" << std::endl;
+        for (auto& r : results_) {
+            if (r.outcome_ != Outcome::REACHED) {
+                out << "  [" << r.index_ << "] " << r.productId_ << "." << r.deviceId_ << " " << failure_key(r) << std::endl;
+            }
+        }
+    }
+}
+
+nlohmann::json ScanReport::toJson(int64_t time) const
+{
+    auto outcomes = count_by(results_, [](const ScanResult& r) { return outcomeAsString(r.outcome_); });
+    auto channels = count_by(results_, [](const ScanResult& r) { return r.outcome_ == Outcome::REACHED ? r.channel_ : ""; });
+    auto failures = count_by(results_, [](const ScanResult& r) { return r.outcome_ == Outcome::REACHED ? "" : failure_key(r); });
+    nlohmann::json j;
+    j["Time"] = time;
+    j["DurationMs"] = milliseconds(elapsed_);
+    j["Devices"] = results_.size();
+    j["Reached"] = outcomes["reached"];
+    j["Failed"] = outcomes["failed"];
+    j["Deadline"] = outcomes["deadline"];
+    j["Channels"] = channels;
+    j["ConnectP50Ms"] = milliseconds(percentile(connectTimes_, 50));
+    j["ConnectP90Ms"] = milliseconds(percentile(connectTimes_, 90));
+    j["ConnectP99Ms"] = milliseconds(percentile(connectTimes_, 99));
+    j["Failures"] = failures;
+    return j;
+}
+
+bool appendHistory(const std::string& path, const nlohmann::json& report)
+{
+    std::ofstream f(path, std::ios::app);
+    if (!f) {
+        return false;
+    }
+    f << report.dump() << std::endl;
+    return static_cast<bool>(f);
+}
+
+void printHistory(const std::string& path, size_t count, std::ostream& out)
+{
+    std::ifstream f(path);
+    std::deque<nlohmann::json> runs;
+    std::string line;
+    while (std::getline(f, line)) {
+        try {
+            runs.push_back(nlohmann::json::parse(line));
+        } catch (nlohmann::json::exception&) {
+            // A line cut short by a crash, skip it.
+            continue;
+        }
+        if (runs.size() > count) {
+            runs.pop_front();
+        }
+    }
+    if (runs.empty()) {
+        return;
+    }
+    out << "Recent scans:" << std::endl;
+    out << std::left << std::setw(18) << "  time" << std::right
+        << std::setw(8) << "devices" << std::setw(9) << "reached"
+        << std::setw(8) << "failed" << std::setw(10) << "deadline"
+        << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms" << std::endl;
+    for (auto& r : runs) {
+        std::time_t t = r.value("Time", static_cast<int64_t>(0));
+        char time[32];
+        std::strftime(time, sizeof(time), "%Y-%m-%d %H:%M", std::localtime(&t));
+        out << "  " << std::left << std::setw(16) << time << std::right
+            << std::setw(8) << r.value("Devices", 0)
+            << std::setw(9) << r.value("Reached", 0)
+            << std::setw(8) << r.value("Failed", 0)
+            << std::setw(10) << r.value("Deadline", 0)
+            << std::fixed << std::setprecision(0)
+            << std::setw(10) << r.value("ConnectP50Ms", 0.0)
+            << std::setw(10) << r.value("ConnectP90Ms", 0.0) << std::endl;
+    }
+}
+
+} // namespace
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "config.hpp"
+#include "device_session.hpp"
+
+#include <nabto_client.hpp>
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Fleet {
+
+enum class Outcome {
+    REACHED,
+    FAILED,
+    DEADLINE
+};
+
+std::string outcomeAsString(Outcome outcome);
+
+class ScanResult {
+ public:
+    int index_ = 0;
+    std::string productId_;
+    std::string deviceId_;
+    Outcome outcome_ = Outcome::FAILED;
+    // The status name of a failed connect, FINGERPRINT_MISMATCH if
+    // another device answered or the reason the connection could not be
+    // set up.
+    std::string error_;
+    // direct or relay if reached.
+    std::string channel_;
+    int localError_ = 0;
+    int remoteError_ = 0;
+    int directError_ = 0;
+    std::chrono::steady_clock::duration connectTime_ = std::chrono::steady_clock::duration::zero();
+};
+
+class ScanOptions {
+ public:
+    size_t concurrency_ = 32;
+    std::chrono::milliseconds deadline_ = std::chrono::milliseconds(10000);
+    EdgeTunnel::SessionOptions session_;
+};
+
+/**
+ * Connect to every device, with at most concurrency connects in flight,
+ * record how long each took, the channel reached and the errors of the
+ * local, remote and direct candidate channels, and close again.
+ *
+ * A device which has not connected within the deadline is recorded as
+ * DEADLINE and its connection is closed, which frees its slot even if
+ * the SDK still has to wind the connect down. The results are in the
+ * order of the devices.
+ */
+std::vector<ScanResult> scan(std::shared_ptr<nabto::client::Context> context,
+                             const std::vector<Configuration::DeviceInfo>& devices,
+                             const ScanOptions& options);
+
+/**
+ * The summary of a scan: outcomes, channels, the distribution of the
+ * time to connect of the reached devices and the failures grouped by
+ * their errors.
+ */
+class ScanReport {
+ public:
+    ScanReport(const std::vector<ScanResult>& results, std::chrono::steady_clock::duration elapsed);
+
+    void print(std::ostream& out) const;
+    // One line of the history file.
+    nlohmann::json toJson(int64_t time) const;
+
+ private:
+    std::vector<ScanResult> results_;
+    std::chrono::steady_clock::duration elapsed_;
+    // Sorted times to connect of the reached devices.
+    std::vector<std::chrono::steady_clock::duration> connectTimes_;
+};
+
+/**
+ * The history is a file with a json report per line, appended after
+ * each scan such that the trend across runs can be followed.
+ */
+bool appendHistory(const std::string& path, const nlohmann::json& report);
+// Print the last count runs of the history.
+void printHistory(const std::string& path, size_t count, std::ostream& out);
+
+} // namespace
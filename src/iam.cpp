@@ -1,4 +1,5 @@
 #include "iam.hpp"
+#include "trace.hpp"
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -55,6 +56,14 @@ uint16_t IAMError::statusCode() {
     return statusCode_;
 }
 
+std::string IAMError::message()
+{
+    if (!message_.empty() || ok_) {
+        return message_;
+    }
+    return "CoAP request failed with status code " + std::to_string(statusCode_);
+}
+
 void IAMError::printError()
 {
     if (ok_) {
@@ -143,10 +152,12 @@ std::unique_ptr<User> User::create(const nlohmann::json& in)
 
 std::pair<IAMError, std::set<std::string> > get_users(std::shared_ptr<nabto::client::Connection> connection)
 {
+    Tracing::Span span("IAM::get_users");
     try {
         auto coap = connection->createCoap("GET", "/iam/users");
         coap->execute()->waitForResult();
         int responseCode = coap->getResponseStatusCode();
+        span.setAttribute("status", responseCode);
         if (responseCode == 205) {
             auto cbor = coap->getResponsePayload();
             std::set<std::string> users;
@@ -164,10 +175,13 @@ std::pair<IAMError, std::set<std::string> > get_users(std::shared_ptr<nabto::cli
 }
 std::pair<IAMError, std::unique_ptr<User> > get_user_path(std::shared_ptr<nabto::client::Connection> connection, const std::string& path)
 {
+    Tracing::Span span("IAM::get_user_path");
+    span.setAttribute("path", path);
     try {
         auto coap = connection->createCoap("GET", path);
         coap->execute()->waitForResult();
         int responseCode = coap->getResponseStatusCode();
+        span.setAttribute("status", responseCode);
         if (responseCode == 205) {
             auto cbor = coap->getResponsePayload();
 
@@ -197,10 +211,12 @@ std::pair<IAMError, std::unique_ptr<User> > get_me(std::shared_ptr<nabto::client
 std::pair<IAMError, std::set<std::string> > get_roles(
     std::shared_ptr<nabto::client::Connection> connection)
 {
+    Tracing::Span span("IAM::get_roles");
     auto coap = connection->createCoap("GET", "/iam/roles");
     try {
         coap->execute()->waitForResult();
         int responseCode = coap->getResponseStatusCode();
+        span.setAttribute("status", responseCode);
         if (responseCode == 205) {
             auto cbor = coap->getResponsePayload();
             json role_list = json::from_cbor(cbor);
@@ -218,6 +234,7 @@ std::pair<IAMError, std::set<std::string> > get_roles(
 
 IAMError set_role(std::shared_ptr<nabto::client::Connection> connection, const std::string &user, const std::string &role)
 {
+    Tracing::Span span("IAM::set_role");
     std::stringstream path;
     path << "/iam/users/" << user << "/role";
     nlohmann::json root;
@@ -229,6 +246,7 @@ IAMError set_role(std::shared_ptr<nabto::client::Connection> connection, const s
         coap->setRequestPayload(CONTENT_FORMAT_APPLICATION_CBOR, cbor);
         coap->execute()->waitForResult();
         int responseCode = coap->getResponseStatusCode();
+        span.setAttribute("status", responseCode);
         if(responseCode == 204) {
             return IAMError();
         }
@@ -240,6 +258,7 @@ IAMError set_role(std::shared_ptr<nabto::client::Connection> connection, const s
 
 IAMError set_password(std::shared_ptr<nabto::client::Connection> connection, const std::string& user, const std::string& password)
 {
+    Tracing::Span span("IAM::set_password");
     std::stringstream path;
     path << "/iam/users/" << user << "/password";
     try {
@@ -250,6 +269,7 @@ IAMError set_password(std::shared_ptr<nabto::client::Connection> connection, con
         coap->setRequestPayload(CONTENT_FORMAT_APPLICATION_CBOR, cbor);
         coap->execute()->waitForResult();
         int responseCode = coap->getResponseStatusCode();
+        span.setAttribute("status", responseCode);
         if(responseCode == 204) {
             return IAMError();
         }
@@ -263,6 +283,7 @@ IAMError set_password(std::shared_ptr<nabto::client::Connection> connection, con
 std::pair<IAMError, std::unique_ptr<User> > create_user(
     std::shared_ptr<nabto::client::Connection> connection,
     const std::string &username) {
+    Tracing::Span span("IAM::create_user");
     auto coap = connection->createCoap("POST", "/iam/users");
     nlohmann::json root;
     root["Username"] = username;
@@ -271,6 +292,7 @@ std::pair<IAMError, std::unique_ptr<User> > create_user(
 
     coap->execute()->waitForResult();
     uint16_t statusCode = coap->getResponseStatusCode();
+    span.setAttribute("status", statusCode);
     if (statusCode == 201) {
         auto cbor = coap->getResponsePayload();
 
@@ -345,13 +367,26 @@ void from_json(const json& j, Settings& s)
     } catch (std::exception& e) {}
 }
 
+Configuration::DeviceMetadata PairingInfo::toMetadata(int64_t fetchedAt) const
+{
+    Configuration::DeviceMetadata m;
+    m.friendlyName_ = friendlyName_;
+    m.appName_ = appName_;
+    m.appVersion_ = appVersion_;
+    m.nabtoVersion_ = nabtoVersion_;
+    m.fetchedAt_ = fetchedAt;
+    return m;
+}
+
 std::pair<IAMError, std::unique_ptr<PairingInfo> > get_pairing_info(
     std::shared_ptr<nabto::client::Connection> connection)
 {
+    Tracing::Span span("IAM::get_pairing_info");
     auto coap = connection->createCoap("GET", "/iam/pairing");
     try {
         coap->execute()->waitForResult();
         int statusCode = coap->getResponseStatusCode();
+        span.setAttribute("status", statusCode);
         int contentFormat = coap->getResponseContentFormat();
         if (statusCode == 205 &&
             contentFormat == CONTENT_FORMAT_APPLICATION_CBOR) {
@@ -385,6 +420,7 @@ std::string pairingModeAsString(PairingMode mode)
 
 IAMError set_settings_password_open_pairing(std::shared_ptr<nabto::client::Connection> connection, bool enabled)
 {
+    Tracing::Span span("IAM::set_settings_password_open_pairing");
     auto coap = connection->createCoap("PUT", "/iam/settings/password-open-pairing");
     try {
         nlohmann::json root;
@@ -393,6 +429,7 @@ IAMError set_settings_password_open_pairing(std::shared_ptr<nabto::client::Conne
         coap->setRequestPayload(CONTENT_FORMAT_APPLICATION_CBOR, cbor);
         coap->execute()->waitForResult();
         int statusCode = coap->getResponseStatusCode();
+        span.setAttribute("status", statusCode);
         if (statusCode == 204) {
             return IAMError();
         }
@@ -404,6 +441,7 @@ IAMError set_settings_password_open_pairing(std::shared_ptr<nabto::client::Conne
 
 IAMError set_settings_local_open_pairing(std::shared_ptr<nabto::client::Connection> connection, bool enabled)
 {
+    Tracing::Span span("IAM::set_settings_local_open_pairing");
     auto coap = connection->createCoap("PUT", "/iam/settings/local-open-pairing");
     try {
         nlohmann::json root;
@@ -412,6 +450,7 @@ IAMError set_settings_local_open_pairing(std::shared_ptr<nabto::client::Connecti
         coap->setRequestPayload(CONTENT_FORMAT_APPLICATION_CBOR, cbor);
         coap->execute()->waitForResult();
         int statusCode = coap->getResponseStatusCode();
+        span.setAttribute("status", statusCode);
         if (statusCode == 204) {
             return IAMError();
         }
@@ -423,10 +462,12 @@ IAMError set_settings_local_open_pairing(std::shared_ptr<nabto::client::Connecti
 
 std::pair<IAMError, std::unique_ptr<Settings> > get_settings(std::shared_ptr<nabto::client::Connection> connection)
 {
+    Tracing::Span span("IAM::get_settings");
     auto coap = connection->createCoap("GET", "/iam/settings");
     try {
         coap->execute()->waitForResult();
         int statusCode = coap->getResponseStatusCode();
+        span.setAttribute("status", statusCode);
         int contentFormat = coap->getResponseContentFormat();
         if (statusCode == 205 &&
             contentFormat == CONTENT_FORMAT_APPLICATION_CBOR) {
@@ -445,6 +486,7 @@ std::pair<IAMError, std::unique_ptr<Settings> > get_settings(std::shared_ptr<nab
 
 IAMError set_friendly_name(std::shared_ptr<nabto::client::Connection> connection, const std::string& friendlyName)
 {
+    Tracing::Span span("IAM::set_friendly_name");
     std::string path = "/iam/device-info/friendly-name";
     nlohmann::json root;
     root = friendlyName;
@@ -455,6 +497,7 @@ IAMError set_friendly_name(std::shared_ptr<nabto::client::Connection> connection
         coap->setRequestPayload(CONTENT_FORMAT_APPLICATION_CBOR, cbor);
         coap->execute()->waitForResult();
         int responseCode = coap->getResponseStatusCode();
+        span.setAttribute("status", responseCode);
         if(responseCode == 204) {
             return IAMError();
         }
@@ -22,6 +22,7 @@ class IAMError {
 
     bool ok();
     uint16_t statusCode();
+    std::string message();
     void printError();
     void printError(const std::string& action);
 
@@ -78,6 +79,8 @@ class PairingInfo {
     std::string getDeviceId() { return deviceId_; }
     std::string getFriendlyName() { return friendlyName_; }
     std::set<PairingMode> getModes() { return modes_; }
+    // The fields cached with the bookmark, fetched at now.
+    Configuration::DeviceMetadata toMetadata(int64_t fetchedAt) const;
     std::string nabtoVersion_;
     std::string appVersion_;
     std::string appName_;
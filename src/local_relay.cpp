@@ -0,0 +1,419 @@
+#include "local_relay.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace Relay {
+
+static const size_t chunkSize = 65536;
+
+// One direction of a pump. Bytes read from in_ are pending until they
+// have been written to out_, in the pipe when splicing and in buffer_
+// otherwise.
+class Direction {
+ public:
+    Direction(int in, int out)
+        : in_(in), out_(out)
+    {
+#if defined(__linux__)
+        splice_ = pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) == 0;
+#endif
+    }
+    Direction(const Direction&) = delete;
+    Direction& operator=(const Direction&) = delete;
+    ~Direction()
+    {
+        for (int fd : pipe_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    bool done() const { return eof_ && pending_ == 0; }
+
+    // Returns false on errors other than would block.
+    bool fill()
+    {
+        ssize_t n;
+#if defined(__linux__)
+        if (splice_) {
+            n = splice(in_, NULL, pipe_[1], NULL, chunkSize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINVAL) {
+                splice_ = false;
+                return fill();
+            }
+            return received(n);
+        }
+#endif
+        buffer_.resize(chunkSize);
+        offset_ = 0;
+        n = read(in_, buffer_.data(), buffer_.size());
+        return received(n);
+    }
+
+    bool flush()
+    {
+        ssize_t n;
+#if defined(__linux__)
+        if (splice_) {
+            n = splice(pipe_[0], NULL, out_, NULL, pending_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINVAL) {
+                // Move what is in the pipe to the buffer and write
+                // from there from now on.
+                buffer_.resize(pending_);
+                offset_ = 0;
+                size_t got = 0;
+                while (got < pending_) {
+                    ssize_t r = read(pipe_[0], buffer_.data() + got, pending_ - got);
+                    if (r <= 0) {
+                        return false;
+                    }
+                    got += r;
+                }
+                splice_ = false;
+                return flush();
+            }
+            return sent(n);
+        }
+#endif
+        n = write(out_, buffer_.data() + offset_, pending_);
+        if (n > 0) {
+            offset_ += n;
+        }
+        return sent(n);
+    }
+
+    int in_;
+    int out_;
+    size_t pending_ = 0;
+    bool eof_ = false;
+    bool shutdown_ = false;
+
+ private:
+    bool received(ssize_t n)
+    {
+        if (n > 0) {
+            pending_ += n;
+        } else if (n == 0) {
+            eof_ = true;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return false;
+        }
+        return true;
+    }
+    bool sent(ssize_t n)
+    {
+        if (n > 0) {
+            pending_ -= n;
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return false;
+        }
+        return true;
+    }
+
+    int pipe_[2] = { -1, -1 };
+    bool splice_ = false;
+    std::vector<uint8_t> buffer_;
+    size_t offset_ = 0;
+};
+
+bool pump(int aIn, int aOut, int bIn, int bOut, int stopFd)
+{
+    std::vector<std::pair<int, int> > flags;
+    for (int fd : { aIn, aOut, bIn, bOut }) {
+        int f = fcntl(fd, F_GETFL);
+        if (f >= 0) {
+            flags.push_back(std::make_pair(fd, f));
+            fcntl(fd, F_SETFL, f | O_NONBLOCK);
+        }
+    }
+
+    Direction forward(aIn, bOut);
+    Direction backward(bIn, aOut);
+    Direction* directions[2] = { &forward, &backward };
+    bool ok = true;
+    bool halfClosed = true;
+    while (ok && !(forward.done() && backward.done())) {
+        struct pollfd fds[5];
+        // The direction and whether it is the in or out fd.
+        std::pair<Direction*, bool> owners[5];
+        nfds_t n = 0;
+        for (Direction* d : directions) {
+            if (d->pending_ > 0) {
+                fds[n] = { d->out_, POLLOUT, 0 };
+                owners[n++] = std::make_pair(d, false);
+            } else if (!d->eof_) {
+                fds[n] = { d->in_, POLLIN, 0 };
+                owners[n++] = std::make_pair(d, true);
+            }
+        }
+        if (stopFd >= 0) {
+            fds[n] = { stopFd, POLLIN, 0 };
+            owners[n++] = std::make_pair(nullptr, true);
+        }
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        for (nfds_t i = 0; i < n && ok; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            Direction* d = owners[i].first;
+            if (d == nullptr) {
+                ok = false;
+                break;
+            }
+            ok = owners[i].second ? d->fill() : d->flush();
+            if (d->done() && !d->shutdown_) {
+                d->shutdown_ = true;
+                if (shutdown(d->out_, SHUT_WR) != 0 && errno == ENOTSOCK) {
+                    halfClosed = false;
+                }
+            }
+        }
+        if (!halfClosed) {
+            // A pipe or terminal sees the end of file only when it is
+            // closed, which the caller does when the pump returns.
+            break;
+        }
+    }
+
+    for (auto& f : flags) {
+        fcntl(f.first, F_SETFL, f.second);
+    }
+    return ok;
+}
+
+int connect_loopback(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The local ports of the established connections to 127.0.0.1:port in
+// one of the /proc/net/tcp files, in which addresses are hex in host
+// byte order followed by the port in hex.
+static bool loopback_clients(const char* file, const char* loopback, uint16_t port, std::vector<uint16_t>& clients)
+{
+    std::ifstream in(file);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string slot, local, remote, state;
+        fields >> slot >> local >> remote >> state;
+        size_t localColon = local.find(':');
+        size_t remoteColon = remote.find(':');
+        if (localColon == std::string::npos || remoteColon == std::string::npos || state != "01") {
+            continue;
+        }
+        if (remote.substr(0, remoteColon) != loopback || std::stoul(remote.substr(remoteColon + 1), nullptr, 16) != port) {
+            continue;
+        }
+        clients.push_back(static_cast<uint16_t>(std::stoul(local.substr(localColon + 1), nullptr, 16)));
+    }
+    return true;
+}
+
+bool is_only_loopback_client(int fd, uint16_t port)
+{
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr*)&addr, &length) != 0) {
+        return true;
+    }
+    uint16_t own = ntohs(addr.sin_port);
+    std::vector<uint16_t> clients;
+    if (!loopback_clients("/proc/net/tcp", "0100007F", port, clients)) {
+        return true;
+    }
+    // IPv4 clients of a dual stack listener show up as mapped addresses.
+    loopback_clients("/proc/net/tcp6", "0000000000000000FFFF00000100007F", port, clients);
+    for (auto client : clients) {
+        if (client != own) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<UnixSocketRelay> UnixSocketRelay::start(const std::string& path, uint16_t tcpPort, mode_t mode)
+{
+    // Writing to a socket closed by the peer fails with EPIPE instead
+    // of terminating the process.
+    signal(SIGPIPE, SIG_IGN);
+    std::unique_ptr<UnixSocketRelay> relay(new UnixSocketRelay(path, tcpPort));
+    if (!relay->listen(mode)) {
+        return nullptr;
+    }
+    UnixSocketRelay* r = relay.get();
+    relay->thread_ = std::thread([r]() { r->run(); });
+    return relay;
+}
+
+UnixSocketRelay::UnixSocketRelay(const std::string& path, uint16_t tcpPort)
+    : path_(path), tcpPort_(tcpPort), accepted_(0)
+{
+}
+
+UnixSocketRelay::~UnixSocketRelay()
+{
+    if (stopFds_[1] >= 0) {
+        char c = 0;
+        if (write(stopFds_[1], &c, 1) < 0) {
+            // the relay thread is gone already.
+        }
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    reap(true);
+    if (listenFd_ >= 0) {
+        unlink(path_.c_str());
+    }
+    for (int fd : { listenFd_, stopFds_[0], stopFds_[1] }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool UnixSocketRelay::listen(mode_t mode)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "The unix socket path " << path_ << " is too long" << std::endl;
+        return false;
+    }
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+
+    // Replace the socket of a previous run, but nothing else.
+    struct stat st;
+    if (lstat(path_.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << "Could not create the unix socket " << path_ << ": the path exists and is not a socket" << std::endl;
+            return false;
+        }
+        unlink(path_.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || pipe(stopFds_) != 0) {
+        std::cerr << "Could not create the unix socket " << path_ << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    // Create the socket with the permissions rather than changing them
+    // after others could have connected. Linux creates the socket file
+    // with the mode of the socket, other systems ignore it and rely on
+    // the directory until the chmod below. The umask is process wide and
+    // is left alone.
+    fchmod(fd, mode);
+    int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    if (bound != 0 || chmod(path_.c_str(), mode) != 0 || ::listen(fd, 64) != 0) {
+        std::cerr << "Could not create the unix socket " << path_ << ": " << strerror(errno) << std::endl;
+        close(fd);
+        if (bound == 0) {
+            unlink(path_.c_str());
+        }
+        return false;
+    }
+    listenFd_ = fd;
+    return true;
+}
+
+void UnixSocketRelay::run()
+{
+    for (;;) {
+        struct pollfd fds[2] = { { stopFds_[0], POLLIN, 0 }, { listenFd_, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[0].revents) {
+            return;
+        }
+        if (!(fds[1].revents & POLLIN)) {
+            continue;
+        }
+        int fd = accept(listenFd_, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        accepted_++;
+        reap(false);
+        int tcp = connect_loopback(tcpPort_);
+        if (tcp < 0) {
+            close(fd);
+            continue;
+        }
+        std::unique_ptr<Session> session(new Session());
+        session->done_ = false;
+        Session* s = session.get();
+        int stopFd = stopFds_[0];
+        session->thread_ = std::thread([s, fd, tcp, stopFd]() {
+            pump(fd, fd, tcp, tcp, stopFd);
+            close(fd);
+            close(tcp);
+            s->done_ = true;
+        });
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_.push_back(std::move(session));
+    }
+}
+
+// Join the finished sessions, or all of them when stopping.
+void UnixSocketRelay::reap(bool all)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+        if (all || (*it)->done_) {
+            (*it)->thread_.join();
+            it = sessions_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Relay {
+
+/**
+ * Copy bytes in both directions, from aIn to bOut and from bIn to aOut,
+ * until both directions have reached end of file, either side fails or
+ * stopFd becomes readable. For a socket the in and out fd are the same.
+ *
+ * On Linux the bytes are moved with splice through a pipe such that
+ * they are not copied to user space, with read and write as the
+ * fallback for fds splice does not support. When a direction reaches
+ * end of file the writing side of its destination is shut down. A
+ * destination which is not a socket cannot be half closed, then the
+ * pump returns such that the caller can close it.
+ *
+ * The fds are made non blocking while pumping. Returns false if a side
+ * failed.
+ */
+bool pump(int aIn, int aOut, int bIn, int bOut, int stopFd = -1);
+
+// A blocking tcp socket connected to 127.0.0.1:port, -1 on error.
+int connect_loopback(uint16_t port);
+
+/**
+ * Whether fd, a socket connected to 127.0.0.1:port, is the only tcp
+ * connection to that port on the host, from /proc/net/tcp. Returns true
+ * where the connections cannot be listed.
+ */
+bool is_only_loopback_client(int fd, uint16_t port);
+
+/**
+ * A Unix domain socket which relays each accepted connection to the
+ * local tcp port of a tunnel, for local consumers which talk to a
+ * socket path rather than a port.
+ *
+ * The socket is created with the given permissions, by default only
+ * accessible to the owner, and removed again when the relay stops.
+ * The relay restricts who can reach the tunnel, the extra copy through
+ * the tcp port makes it slower than connecting to the port directly.
+ */
+class UnixSocketRelay {
+ public:
+    static std::unique_ptr<UnixSocketRelay> start(const std::string& path, uint16_t tcpPort, mode_t mode = 0600);
+    ~UnixSocketRelay();
+
+    const std::string& path() const { return path_; }
+    uint64_t accepted() const { return accepted_; }
+
+ private:
+    class Session {
+     public:
+        std::thread thread_;
+        std::atomic<bool> done_;
+    };
+
+    UnixSocketRelay(const std::string& path, uint16_t tcpPort);
+    bool listen(mode_t mode);
+    void run();
+    void reap(bool all);
+
+    std::string path_;
+    uint16_t tcpPort_;
+    int listenFd_ = -1;
+    int stopFds_[2] = { -1, -1 };
+    std::thread thread_;
+    std::atomic<uint64_t> accepted_;
+
+    std::mutex mutex_;
+    std::list<std::unique_ptr<Session> > sessions_;
+};
+
+} // namespace
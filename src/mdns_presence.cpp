@@ -0,0 +1,148 @@
+#include "mdns_presence.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <algorithm>
+
+namespace nabto {
+namespace examples {
+namespace common {
+
+// The same time the interactive pairing scans for local devices.
+static const std::chrono::milliseconds warmUpTime = std::chrono::milliseconds(2000);
+
+std::shared_ptr<MdnsPresence> MdnsPresence::create(std::shared_ptr<nabto::client::Context> context, const std::string& subtype, std::chrono::milliseconds ttl)
+{
+    return std::make_shared<MdnsPresence>(context, subtype, ttl);
+}
+
+MdnsPresence::MdnsPresence(std::shared_ptr<nabto::client::Context> context, const std::string& subtype, std::chrono::milliseconds ttl)
+    : resolver_(context->createMdnsResolver(subtype)), ttl_(ttl), started_(Clock::now())
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+MdnsPresence::~MdnsPresence()
+{
+    stop();
+}
+
+void MdnsPresence::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+    }
+    resolver_->stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void MdnsPresence::run()
+{
+    try {
+        for (;;) {
+            auto result = resolver_->getResult()->waitForResult();
+            handleResult(result);
+        }
+    } catch (...) {
+        // The resolver has been stopped.
+    }
+}
+
+void MdnsPresence::handleResult(std::shared_ptr<nabto::client::MdnsResult> result)
+{
+    std::string instanceName = result->getServiceInstanceName();
+    auto now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (result->getAction() == nabto::client::MdnsResult::Action::REMOVE) {
+        auto instance = instances_.find(instanceName);
+        if (instance == instances_.end()) {
+            return;
+        }
+        auto device = devices_.find(instance->second);
+        instances_.erase(instance);
+        if (device == devices_.end()) {
+            return;
+        }
+        auto& names = device->second.serviceInstanceNames_;
+        names.erase(std::remove(names.begin(), names.end(), instanceName), names.end());
+        // The same device is announced once per interface, it is only
+        // gone when the last of its service instances is removed.
+        if (names.empty()) {
+            devices_.erase(device);
+        }
+        return;
+    }
+
+    auto key = std::make_pair(result->getProductId(), result->getDeviceId());
+    auto it = devices_.find(key);
+    if (it == devices_.end()) {
+        Device device;
+        device.productId_ = key.first;
+        device.deviceId_ = key.second;
+        device.firstSeen_ = now;
+        it = devices_.insert(std::make_pair(key, device)).first;
+    }
+    Device& device = it->second;
+    device.lastSeen_ = now;
+    device.updates_++;
+    device.txtItems_ = result->getTxtItems();
+    try {
+        auto txtItems = nlohmann::json::parse(device.txtItems_);
+        device.friendlyName_ = txtItems["fn"].get<std::string>();
+    } catch (std::exception& e) { }
+
+    auto& names = device.serviceInstanceNames_;
+    if (std::find(names.begin(), names.end(), instanceName) == names.end()) {
+        names.push_back(instanceName);
+    }
+    instances_[instanceName] = key;
+}
+
+bool MdnsPresence::isWarm() const
+{
+    return Clock::now() - started_ >= warmUpTime;
+}
+
+MdnsPresence::Presence MdnsPresence::presence(const std::string& productId, const std::string& deviceId) const
+{
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = devices_.find(std::make_pair(productId, deviceId));
+    if (it == devices_.end()) {
+        return now - started_ >= warmUpTime ? Presence::ABSENT : Presence::UNKNOWN;
+    }
+    return now - it->second.lastSeen_ < ttl_ ? Presence::PRESENT : Presence::UNKNOWN;
+}
+
+bool MdnsPresence::lookup(const std::string& productId, const std::string& deviceId, Device& out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = devices_.find(std::make_pair(productId, deviceId));
+    if (it == devices_.end() || Clock::now() - it->second.lastSeen_ >= ttl_) {
+        return false;
+    }
+    out = it->second;
+    return true;
+}
+
+std::vector<MdnsPresence::Device> MdnsPresence::devices() const
+{
+    std::vector<Device> ret;
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& d : devices_) {
+        if (now - d.second.lastSeen_ < ttl_) {
+            ret.push_back(d.second);
+        }
+    }
+    return ret;
+}
+
+} } } // namespace
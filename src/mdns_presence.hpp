@@ -0,0 +1,96 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nabto {
+namespace examples {
+namespace common {
+
+/**
+ * A long lived mDNS resolver which keeps a presence table of the
+ * devices on the local network. Where the Scanner does a one-shot
+ * scan and throws the resolver away, the presence table is kept
+ * up to date from the ADD/UPDATE/REMOVE results for as long as the
+ * process runs, such that lookups are answered without scanning.
+ *
+ * A device is present until the last of its service instances has been
+ * removed or it has not been announced within the ttl. A device which
+ * disappeared without a REMOVE cannot be told from one which has not
+ * announced itself again, so an expired entry makes the device UNKNOWN
+ * rather than ABSENT.
+ *
+ * The SDK does not expose the addresses of mDNS results, the service
+ * instance names are kept instead as they are what correlates the
+ * results.
+ */
+class MdnsPresence {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum class Presence {
+        PRESENT,
+        // Removed, or not announced since the table became warm.
+        ABSENT,
+        // The table is not warm yet or the device was last seen longer
+        // than the ttl ago.
+        UNKNOWN
+    };
+
+    class Device {
+     public:
+        std::string productId_;
+        std::string deviceId_;
+        std::string friendlyName_;
+        std::string txtItems_;
+        std::vector<std::string> serviceInstanceNames_;
+        Clock::time_point firstSeen_;
+        Clock::time_point lastSeen_;
+        size_t updates_ = 0;
+    };
+
+    /**
+     * Create and start a presence table for the given mDNS subtype.
+     */
+    static std::shared_ptr<MdnsPresence> create(std::shared_ptr<nabto::client::Context> context, const std::string& subtype, std::chrono::milliseconds ttl = std::chrono::minutes(2));
+
+    MdnsPresence(std::shared_ptr<nabto::client::Context> context, const std::string& subtype, std::chrono::milliseconds ttl);
+    ~MdnsPresence();
+
+    void stop();
+
+    /**
+     * The table is warm when the resolver has been running long enough
+     * for a missing device to mean that it is not on the local network.
+     */
+    bool isWarm() const;
+
+    Presence presence(const std::string& productId, const std::string& deviceId) const;
+    // The device if it is PRESENT.
+    bool lookup(const std::string& productId, const std::string& deviceId, Device& out) const;
+    // The PRESENT devices.
+    std::vector<Device> devices() const;
+
+ private:
+    void run();
+    void handleResult(std::shared_ptr<nabto::client::MdnsResult> result);
+
+    std::shared_ptr<nabto::client::MdnsResolver> resolver_;
+    std::chrono::milliseconds ttl_;
+    Clock::time_point started_;
+
+    mutable std::mutex mutex_;
+    std::map<std::pair<std::string, std::string>, Device> devices_;
+    std::map<std::string, std::pair<std::string, std::string> > instances_;
+    std::thread thread_;
+    bool stopped_ = false;
+};
+
+} } } // namespace
@@ -0,0 +1,67 @@
+#include "metadata_refresh.hpp"
+#include "iam.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace EdgeTunnel {
+
+static MetadataResult fetch(std::shared_ptr<nabto::client::Context> context, const Configuration::DeviceInfo& device, const SessionOptions& options)
+{
+    MetadataResult result;
+    result.index_ = device.index_;
+    // Runs on a worker thread, where an exception escaping would
+    // terminate the whole refresh.
+    try {
+        std::shared_ptr<DeviceSession> session;
+        std::tie(result.error_, session) = DeviceSession::open(context, device, options);
+        if (!session) {
+            return result;
+        }
+        IAM::IAMError ec;
+        std::unique_ptr<IAM::PairingInfo> pi;
+        std::tie(ec, pi) = IAM::get_pairing_info(session->connection());
+        if (!ec.ok()) {
+            result.error_ = SessionError(ec.message());
+        } else {
+            int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            result.metadata_ = pi->toMetadata(now);
+        }
+        session->close();
+    } catch (std::exception& e) {
+        result.error_ = SessionError(e.what());
+    }
+    return result;
+}
+
+std::vector<MetadataResult> refreshMetadata(std::shared_ptr<nabto::client::Context> context,
+                                            const std::vector<Configuration::DeviceInfo>& devices,
+                                            size_t concurrency, const SessionOptions& options)
+{
+    // Create the key file, if missing, before the workers read it.
+    std::string privateKey;
+    Configuration::GetPrivateKey(context, privateKey);
+
+    std::vector<MetadataResult> results(devices.size());
+    std::atomic<size_t> next(0);
+    // Each worker takes the next device until all have been fetched,
+    // and writes only the results of the devices it took.
+    auto worker = [&]() {
+        for (size_t i = next++; i < devices.size(); i = next++) {
+            results[i] = fetch(context, devices[i], options);
+        }
+    };
+    std::vector<std::thread> threads;
+    size_t n = std::min(std::max<size_t>(1, concurrency), devices.size());
+    for (size_t i = 0; i < n; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    return results;
+}
+
+} // namespace
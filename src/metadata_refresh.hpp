@@ -0,0 +1,30 @@
+#pragma once
+
+#include "config.hpp"
+#include "device_session.hpp"
+
+#include <nabto_client.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace EdgeTunnel {
+
+class MetadataResult {
+ public:
+    int index_;
+    SessionError error_;
+    Configuration::DeviceMetadata metadata_;
+};
+
+/**
+ * Connect to each device and fetch its metadata from /iam/pairing, with
+ * up to concurrency connections open at a time such that refreshing a
+ * fleet takes about as long as its slowest devices rather than the sum.
+ * The results are in the order of the devices.
+ */
+std::vector<MetadataResult> refreshMetadata(std::shared_ptr<nabto::client::Context> context,
+                                            const std::vector<Configuration::DeviceInfo>& devices,
+                                            size_t concurrency, const SessionOptions& options = SessionOptions());
+
+} // namespace
@@ -0,0 +1,272 @@
+#include "metrics.hpp"
+
+#include <sstream>
+
+namespace Metrics {
+
+static const std::vector<double> tunnelOpenBounds = { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+static int64_t steady_nanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Histogram::Histogram(const std::vector<double>& bounds)
+    : bounds_(bounds), counts_(new std::atomic<uint64_t>[bounds.size() + 1]), sumNanoseconds_(0)
+{
+    for (size_t i = 0; i <= bounds_.size(); i++) {
+        counts_[i] = 0;
+    }
+}
+
+void Histogram::observe(std::chrono::steady_clock::duration d)
+{
+    double seconds = std::chrono::duration<double>(d).count();
+    size_t i = 0;
+    while (i < bounds_.size() && seconds > bounds_[i]) {
+        i++;
+    }
+    counts_[i].fetch_add(1, std::memory_order_relaxed);
+    sumNanoseconds_.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()), std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> Histogram::counts() const
+{
+    std::vector<uint64_t> out;
+    for (size_t i = 0; i <= bounds_.size(); i++) {
+        out.push_back(counts_[i].load(std::memory_order_relaxed));
+    }
+    return out;
+}
+
+double Histogram::sumSeconds() const
+{
+    return sumNanoseconds_.load(std::memory_order_relaxed) / 1e9;
+}
+
+ConnectionMetrics::ConnectionMetrics(uint32_t bookmark, const std::string& productId, const std::string& deviceId)
+    : bookmark_(bookmark), productId_(productId), deviceId_(deviceId),
+      up_(false), connectedAt_(0), channelChanges_(0), closes_(0)
+{
+}
+
+void ConnectionMetrics::connected(std::shared_ptr<nabto::client::Connection> connection)
+{
+    connection_ = connection;
+    onEvent(CONNECTED());
+}
+
+void ConnectionMetrics::onEvent(int event)
+{
+    if (event == CONNECTED()) {
+        connectedAt_ = steady_nanoseconds();
+        up_ = true;
+    } else if (event == CLOSED()) {
+        up_ = false;
+        closes_++;
+    } else if (event == CHANNEL_CHANGED()) {
+        channelChanges_++;
+    }
+}
+
+TunnelMetrics::TunnelMetrics(const std::string& service)
+    : service_(service), opens_(0), failures_(0), openLatency_(tunnelOpenBounds)
+{
+}
+
+void TunnelMetrics::opened(std::chrono::steady_clock::duration latency)
+{
+    opens_++;
+    openLatency_.observe(latency);
+}
+
+void TunnelMetrics::failed(std::chrono::steady_clock::duration latency)
+{
+    failures_++;
+    openLatency_.observe(latency);
+}
+
+Registry::Registry(std::shared_ptr<nabto::client::Context> context)
+    : context_(context)
+{
+}
+
+std::shared_ptr<ConnectionMetrics> Registry::addConnection(uint32_t bookmark, const std::string& productId, const std::string& deviceId)
+{
+    auto c = std::make_shared<ConnectionMetrics>(bookmark, productId, deviceId);
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.push_back(c);
+    return c;
+}
+
+std::shared_ptr<TunnelMetrics> Registry::addTunnel(const std::string& service)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& t : tunnels_) {
+        if (t->service_ == service) {
+            return t;
+        }
+    }
+    auto t = std::make_shared<TunnelMetrics>(service);
+    tunnels_.push_back(t);
+    return t;
+}
+
+void Registry::addCollector(std::function<void (std::ostream& out)> collector)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    collectors_.push_back(collector);
+}
+
+std::string escapeLabel(const std::string& in)
+{
+    std::string out;
+    for (char c : in) {
+        if (c == '\\' || c == '"') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c == '\n') {
+            out.append("\\n");
+        } else {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+static std::string connection_labels(const ConnectionMetrics& c)
+{
+    return "bookmark=\"" + std::to_string(c.bookmark_) + "\",product_id=\"" + escapeLabel(c.productId_) + "\",device_id=\"" + escapeLabel(c.deviceId_) + "\"";
+}
+
+static void family(std::ostream& out, const std::string& name, const std::string& type, const std::string& help)
+{
+    out << "# TYPE " << name << " " << type << "\n";
+    out << "# HELP " << name << " " << help << "\n";
+}
+
+static void histogram(std::ostream& out, const std::string& name, const std::string& labels,
+                      const std::vector<double>& bounds, const std::vector<uint64_t>& counts, double sum)
+{
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        cumulative += counts[i];
+        out << name << "_bucket{" << prefix << "le=\"";
+        if (i < bounds.size()) {
+            out << bounds[i];
+        } else {
+            out << "+Inf";
+        }
+        out << "\"} " << cumulative << "\n";
+    }
+    std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    out << name << "_count" << braces << " " << cumulative << "\n";
+    out << name << "_sum" << braces << " " << sum << "\n";
+}
+
+void writeHistogram(std::ostream& out, const std::string& name, const std::string& labels, const Histogram& h)
+{
+    histogram(out, name, labels, h.bounds(), h.counts(), h.sumSeconds());
+}
+
+std::string Registry::render()
+{
+    std::vector<std::shared_ptr<ConnectionMetrics> > connections;
+    std::vector<std::shared_ptr<TunnelMetrics> > tunnels;
+    std::vector<std::function<void (std::ostream& out)> > collectors;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections = connections_;
+        tunnels = tunnels_;
+        collectors = collectors_;
+    }
+
+    std::ostringstream out;
+    out.precision(10);
+    int64_t now = steady_nanoseconds();
+
+    family(out, "edge_tunnel_connection_up", "gauge", "Whether the connection to the device is up.");
+    for (auto& c : connections) {
+        out << "edge_tunnel_connection_up{" << connection_labels(*c) << "} " << (c->up_ ? 1 : 0) << "\n";
+    }
+    family(out, "edge_tunnel_connection_channel", "gauge", "The channel type of the connection to the device.");
+    for (auto& c : connections) {
+        auto connection = c->connection_.lock();
+        if (!c->up_ || !connection) {
+            continue;
+        }
+        try {
+            bool direct = connection->getType() == nabto::client::Connection::Type::DIRECT;
+            out << "edge_tunnel_connection_channel{" << connection_labels(*c) << ",channel=\"" << (direct ? "direct" : "relay") << "\"} 1\n";
+        } catch (nabto::client::NabtoException&) {
+            // closed since it was checked.
+        }
+    }
+    family(out, "edge_tunnel_connection_uptime_seconds", "gauge", "Seconds since the connection to the device was made.");
+    for (auto& c : connections) {
+        double uptime = c->up_ ? (now - c->connectedAt_) / 1e9 : 0;
+        out << "edge_tunnel_connection_uptime_seconds{" << connection_labels(*c) << "} " << uptime << "\n";
+    }
+    family(out, "edge_tunnel_connection_channel_changes", "counter", "Changes of the channel of the connection.");
+    for (auto& c : connections) {
+        out << "edge_tunnel_connection_channel_changes_total{" << connection_labels(*c) << "} " << c->channelChanges_ << "\n";
+    }
+
+    family(out, "edge_tunnel_tunnel_opens", "counter", "Tunnels opened.");
+    for (auto& t : tunnels) {
+        out << "edge_tunnel_tunnel_opens_total{service=\"" << escapeLabel(t->service_) << "\"} " << t->opens_ << "\n";
+    }
+    family(out, "edge_tunnel_tunnel_open_failures", "counter", "Tunnels which failed to open.");
+    for (auto& t : tunnels) {
+        out << "edge_tunnel_tunnel_open_failures_total{service=\"" << escapeLabel(t->service_) << "\"} " << t->failures_ << "\n";
+    }
+    family(out, "edge_tunnel_tunnel_open_seconds", "histogram", "Time to open a tunnel.");
+    for (auto& t : tunnels) {
+        histogram(out, "edge_tunnel_tunnel_open_seconds", "service=\"" + escapeLabel(t->service_) + "\"",
+                  t->openLatency_.bounds(), t->openLatency_.counts(), t->openLatency_.sumSeconds());
+    }
+
+    auto wrapper = nabto::client::Context::wrapperStatistics();
+    family(out, "edge_tunnel_coap_requests", "counter", "CoAP requests made.");
+    out << "edge_tunnel_coap_requests_total " << wrapper.coapRequests_ << "\n";
+    family(out, "edge_tunnel_coap_failures", "counter", "CoAP requests which failed without a response.");
+    out << "edge_tunnel_coap_failures_total " << wrapper.coapFailures_ << "\n";
+    family(out, "edge_tunnel_coap_request_seconds", "histogram", "Round trip time of CoAP requests.");
+    histogram(out, "edge_tunnel_coap_request_seconds", "", nabto::client::WrapperStatistics::coapLatencyBounds(),
+              wrapper.coapLatencyCounts_, wrapper.coapLatencySeconds_);
+
+    family(out, "edge_tunnel_wrapper_futures_created", "counter", "Futures created by the client library.");
+    out << "edge_tunnel_wrapper_futures_created_total " << wrapper.futuresCreated_ << "\n";
+    family(out, "edge_tunnel_wrapper_futures_freed", "counter", "Futures freed by the client library.");
+    out << "edge_tunnel_wrapper_futures_freed_total " << wrapper.futuresFreed_ << "\n";
+    family(out, "edge_tunnel_wrapper_futures_waited", "counter", "Futures resolved by waiting for them.");
+    out << "edge_tunnel_wrapper_futures_waited_total " << wrapper.futuresWaited_ << "\n";
+    family(out, "edge_tunnel_wrapper_callbacks", "counter", "Future callbacks run.");
+    out << "edge_tunnel_wrapper_callbacks_total " << wrapper.callbacksRun_ << "\n";
+    family(out, "edge_tunnel_wrapper_futures_pending", "gauge", "Futures which have not resolved yet.");
+    out << "edge_tunnel_wrapper_futures_pending{type=\"void\"} " << wrapper.pendingVoidFutures_ << "\n";
+    out << "edge_tunnel_wrapper_futures_pending{type=\"buffer\"} " << wrapper.pendingBufferFutures_ << "\n";
+    out << "edge_tunnel_wrapper_futures_pending{type=\"mdns\"} " << wrapper.pendingMdnsFutures_ << "\n";
+    family(out, "edge_tunnel_wrapper_futures_abandoned", "gauge", "Pending futures which were dropped before they resolved.");
+    out << "edge_tunnel_wrapper_futures_abandoned " << wrapper.abandonedFutures_ << "\n";
+    family(out, "edge_tunnel_wrapper_oldest_pending_future_seconds", "gauge", "Age of the oldest pending future.");
+    out << "edge_tunnel_wrapper_oldest_pending_future_seconds " << wrapper.oldestPendingSeconds_ << "\n";
+
+    auto context = context_.lock();
+    if (context) {
+        auto log = context->getLogStatistics();
+        family(out, "edge_tunnel_sdk_log_messages", "counter", "Error and warning messages logged by the SDK.");
+        out << "edge_tunnel_sdk_log_messages_total{severity=\"error\"} " << log.errors_ << "\n";
+        out << "edge_tunnel_sdk_log_messages_total{severity=\"warn\"} " << log.warnings_ << "\n";
+        family(out, "edge_tunnel_sdk_log_suppressed", "counter", "SDK log messages dropped by the rate limit.");
+        out << "edge_tunnel_sdk_log_suppressed_total " << log.suppressed_ << "\n";
+    }
+    for (auto& collector : collectors) {
+        collector(out);
+    }
+    out << "# EOF\n";
+    return out.str();
+}
+
+} // namespace
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Metrics {
+
+/**
+ * A histogram with fixed bucket bounds in seconds which can be
+ * observed from any thread without locking.
+ */
+class Histogram {
+ public:
+    Histogram(const std::vector<double>& bounds);
+
+    void observe(std::chrono::steady_clock::duration d);
+
+    const std::vector<double>& bounds() const { return bounds_; }
+    // Per bucket counts, the last bucket is unbounded.
+    std::vector<uint64_t> counts() const;
+    double sumSeconds() const;
+
+ private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> sumNanoseconds_;
+};
+
+// Write the samples of a histogram, the family is declared by the caller.
+void writeHistogram(std::ostream& out, const std::string& name, const std::string& labels, const Histogram& h);
+
+// Escape a value for use inside the quotes of an OpenMetrics label.
+std::string escapeLabel(const std::string& in);
+
+/**
+ * The state of the connection to a bookmarked device. Updated from the
+ * connection events callback on the SDK thread with atomic stores only.
+ */
+class ConnectionMetrics : public nabto::client::ConnectionEventsCallback {
+ public:
+    ConnectionMetrics(uint32_t bookmark, const std::string& productId, const std::string& deviceId);
+
+    void connected(std::shared_ptr<nabto::client::Connection> connection);
+    void onEvent(int event);
+
+    uint32_t bookmark_;
+    std::string productId_;
+    std::string deviceId_;
+
+    std::atomic<bool> up_;
+    // Nanoseconds on the steady clock when the connection was made.
+    std::atomic<int64_t> connectedAt_;
+    std::atomic<uint64_t> channelChanges_;
+    std::atomic<uint64_t> closes_;
+    // The channel type is read when scraped, as the SDK should not be
+    // called from its own event callback.
+    std::weak_ptr<nabto::client::Connection> connection_;
+};
+
+class TunnelMetrics {
+ public:
+    TunnelMetrics(const std::string& service);
+
+    void opened(std::chrono::steady_clock::duration latency);
+    void failed(std::chrono::steady_clock::duration latency);
+
+    std::string service_;
+    std::atomic<uint64_t> opens_;
+    std::atomic<uint64_t> failures_;
+    Histogram openLatency_;
+};
+
+/**
+ * The metrics of the process, rendered in the OpenMetrics text format.
+ *
+ * The mutex only guards adding connections and tunnels, render copies
+ * the lists and reads everything else from atomics, such that a scrape
+ * never holds up the SDK thread.
+ */
+class Registry {
+ public:
+    Registry(std::shared_ptr<nabto::client::Context> context);
+
+    std::shared_ptr<ConnectionMetrics> addConnection(uint32_t bookmark, const std::string& productId, const std::string& deviceId);
+    std::shared_ptr<TunnelMetrics> addTunnel(const std::string& service);
+
+    // Metric families rendered by others, written before the end of the exposition.
+    void addCollector(std::function<void (std::ostream& out)> collector);
+
+    std::string render();
+
+ private:
+    std::weak_ptr<nabto::client::Context> context_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<ConnectionMetrics> > connections_;
+    std::vector<std::shared_ptr<TunnelMetrics> > tunnels_;
+    std::vector<std::function<void (std::ostream& out)> > collectors_;
+};
+
+} // namespace
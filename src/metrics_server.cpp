@@ -0,0 +1,169 @@
+#include "metrics_server.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace Metrics {
+
+static const size_t maxRequestSize = 8192;
+static const int requestTimeoutMs = 2000;
+
+std::unique_ptr<MetricsServer> MetricsServer::start(uint16_t port, std::function<std::string ()> render, std::vector<Route> routes)
+{
+    routes.insert(routes.begin(), Route{ "/metrics", "application/openmetrics-text; version=1.0.0; charset=utf-8", render });
+    std::unique_ptr<MetricsServer> server(new MetricsServer(routes));
+    if (!server->listen(port)) {
+        return nullptr;
+    }
+    MetricsServer* s = server.get();
+    server->thread_ = std::thread([s]() { s->run(); });
+    return server;
+}
+
+MetricsServer::MetricsServer(std::vector<Route> routes)
+    : routes_(routes)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    if (wakeFds_[1] >= 0) {
+        char c = 0;
+        if (write(wakeFds_[1], &c, 1) < 0) {
+            // the server thread is gone already.
+        }
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    for (int fd : { listenFd_, wakeFds_[0], wakeFds_[1] }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool MetricsServer::listen(uint16_t port)
+{
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        ::listen(listenFd_, 16) != 0 ||
+        pipe(wakeFds_) != 0)
+    {
+        std::cerr << "Could not serve metrics on 127.0.0.1:" << port << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    socklen_t length = sizeof(addr);
+    getsockname(listenFd_, (struct sockaddr*)&addr, &length);
+    port_ = ntohs(addr.sin_port);
+    return true;
+}
+
+void MetricsServer::run()
+{
+    for (;;) {
+        struct pollfd fds[2] = { { wakeFds_[0], POLLIN, 0 }, { listenFd_, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[0].revents) {
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(listenFd_, NULL, NULL);
+            if (fd >= 0) {
+                // One thread serves all scrapes, a scraper which stops
+                // reading must not stall the next ones.
+                struct timeval timeout;
+                timeout.tv_sec = requestTimeoutMs / 1000;
+                timeout.tv_usec = (requestTimeoutMs % 1000) * 1000;
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                serve(fd);
+                close(fd);
+            }
+        }
+    }
+}
+
+static bool send_all(int fd, const std::string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+void MetricsServer::serve(int fd)
+{
+    // Read the request line and headers, the body of a GET is ignored.
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < maxRequestSize) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, requestTimeoutMs) <= 0) {
+            return;
+        }
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return;
+        }
+        request.append(buffer, n);
+    }
+
+    std::string status;
+    std::string contentType = "text/plain; charset=utf-8";
+    std::string body;
+    if (request.compare(0, 4, "GET ") == 0) {
+        std::string path = request.substr(4, request.find_first_of(" ?\r\n", 4) - 4);
+        status = "404 Not Found";
+        body = "Not found, metrics are served on /metrics\n";
+        for (auto& route : routes_) {
+            if (route.path_ == path) {
+                status = "200 OK";
+                contentType = route.contentType_;
+                body = route.render_();
+                break;
+            }
+        }
+    } else {
+        status = "405 Method Not Allowed";
+        body = "Only GET is supported\n";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n" +
+        "Content-Type: " + contentType + "\r\n" +
+        "Content-Length: " + std::to_string(body.size()) + "\r\n" +
+        "Connection: close\r\n\r\n" + body;
+    send_all(fd, response);
+}
+
+} // namespace
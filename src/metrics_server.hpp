@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Metrics {
+
+class Route {
+ public:
+    std::string path_;
+    std::string contentType_;
+    std::function<std::string ()> render_;
+};
+
+/**
+ * A minimal HTTP server on 127.0.0.1 serving GET /metrics, and any
+ * further routes, from its own thread. Requests are served one at a
+ * time, which is plenty for a scraper.
+ */
+class MetricsServer {
+ public:
+    static std::unique_ptr<MetricsServer> start(uint16_t port, std::function<std::string ()> render, std::vector<Route> routes = {});
+    ~MetricsServer();
+
+    uint16_t port() const { return port_; }
+
+ private:
+    MetricsServer(std::vector<Route> routes);
+    bool listen(uint16_t port);
+    void run();
+    void serve(int fd);
+
+    std::vector<Route> routes_;
+    uint16_t port_ = 0;
+    int listenFd_ = -1;
+    int wakeFds_[2] = { -1, -1 };
+    std::thread thread_;
+};
+
+} // namespace
@@ -4,8 +4,10 @@
 #include "scanner.hpp"
 #include "iam.hpp"
 #include "iam_interactive.hpp"
+#include "trace.hpp"
 
 #include <3rdparty/nlohmann/json.hpp>
+#include <chrono>
 #include <iostream>
 #include <sstream>
 
@@ -154,6 +156,7 @@ static bool password_invite_pair(std::shared_ptr<nabto::client::Connection> conn
 
 bool interactive_pair(std::shared_ptr<nabto::client::Context> Context)
 {
+    Tracing::Span span("interactive_pair");
     std::cout << "Scanning for local devices for 2 seconds." << std::endl;
     auto devices = nabto::examples::common::Scanner::scan(Context, std::chrono::milliseconds(2000), "tcptunnel");
     if (devices.size() == 0) {
@@ -220,6 +223,7 @@ bool interactive_pair(std::shared_ptr<nabto::client::Context> Context)
 
 bool interactive_pair_connection(std::shared_ptr<nabto::client::Connection> connection, const std::string& usernameInvite, const std::string& password)
 {
+    Tracing::Span span("interactive_pair_connection");
     {
         IAM::IAMError ec;
         std::unique_ptr<IAM::User> user;
@@ -260,6 +264,7 @@ bool interactive_pair_connection(std::shared_ptr<nabto::client::Connection> conn
         }
     }
 
+    span.setAttribute("mode", IAM::pairingModeAsString(mode));
     if (mode == IAM::PairingMode::LOCAL_INITIAL) {
          if (!local_pair_initial(connection)) {
             return false;
@@ -328,6 +333,9 @@ bool string_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string&
 
 bool param_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string& productId, const std::string& deviceId, const std::string& usernameInvite, const std::string& pairingPassword, const std::string& sct)
 {
+    Tracing::Span span("param_pair");
+    span.setAttribute("product_id", productId);
+    span.setAttribute("device_id", deviceId);
     auto Config = Configuration::GetConfigInfo();
     if (!Config) {
         return false;
@@ -373,6 +381,8 @@ bool param_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string&
 
 bool direct_pair(std::shared_ptr<nabto::client::Context> Context, const std::string& host)
 {
+    Tracing::Span span("direct_pair");
+    span.setAttribute("host", host);
     auto connection = Context->createConnection();
     std::string privateKey;
 
@@ -415,6 +425,7 @@ bool direct_pair(std::shared_ptr<nabto::client::Context> Context, const std::str
 
 bool write_config(std::shared_ptr<nabto::client::Connection> connection, const std::string& host)
 {
+    Tracing::Span span("write_config");
     Configuration::DeviceInfo device;
 
     IAM::IAMError ec;
@@ -428,6 +439,7 @@ bool write_config(std::shared_ptr<nabto::client::Connection> connection, const s
     device.productId_ = pi->getProductId();
     device.deviceId_ = pi->getDeviceId();
     device.deviceFingerprint_ = connection->getDeviceFingerprint();
+    device.metadata_ = pi->toMetadata(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
     if (!host.empty()) {
         device.directCandidate_ = host;
     }
@@ -0,0 +1,574 @@
+#include "shaping.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+
+namespace Shaping {
+
+static const size_t chunkSize = 16384;
+// Smallest write made while a bucket is short of tokens.
+static const size_t minimumWrite = 4096;
+// Reading from a session stops while this much is queued.
+static const size_t queueLimit = 262144;
+// Writes made before the sockets are polled again.
+static const int writesPerRound = 64;
+
+static const char* directionNames[2] = { "upload", "download" };
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate_(rate), burst_(std::max(burst, static_cast<double>(2 * chunkSize))), tokens_(burst_), last_(Clock::now())
+{
+}
+
+void TokenBucket::refill(Clock::time_point now)
+{
+    double elapsed = std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+    tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+}
+
+size_t TokenBucket::available(Clock::time_point now)
+{
+    if (unlimited()) {
+        return std::numeric_limits<size_t>::max();
+    }
+    refill(now);
+    return tokens_ > 0 ? static_cast<size_t>(tokens_) : 0;
+}
+
+void TokenBucket::consume(size_t n)
+{
+    if (!unlimited()) {
+        tokens_ -= n;
+    }
+}
+
+Clock::duration TokenBucket::wait(size_t n, Clock::time_point now)
+{
+    if (unlimited()) {
+        return Clock::duration::zero();
+    }
+    refill(now);
+    double missing = std::min(static_cast<double>(n), burst_) - tokens_;
+    if (missing <= 0) {
+        return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(missing / rate_));
+}
+
+bool parseRate(const std::string& in, double& rate)
+{
+    if (in.empty()) {
+        return false;
+    }
+    double multiplier = 1;
+    std::string number = in;
+    switch (in.back()) {
+        case 'k': case 'K': multiplier = 1e3; break;
+        case 'M': multiplier = 1e6; break;
+        case 'G': multiplier = 1e9; break;
+        default: break;
+    }
+    if (multiplier != 1) {
+        number = in.substr(0, in.size() - 1);
+    }
+    try {
+        size_t used;
+        rate = std::stod(number, &used) * multiplier;
+        return used == number.size() && rate >= 0;
+    } catch (std::logic_error&) {
+        return false;
+    }
+}
+
+bool parseClassOptions(const std::string& options, ClassConfig& config, std::string& error)
+{
+    size_t start = 0;
+    while (start <= options.size()) {
+        size_t end = options.find('/', start);
+        if (end == std::string::npos) {
+            end = options.size();
+        }
+        std::string item = options.substr(start, end - start);
+        start = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+        double v;
+        if (!parseRate(value, v)) {
+            error = "the value of " + key + " in " + options + " is not a number";
+            return false;
+        }
+        if (key == "weight") {
+            if (v <= 0) {
+                error = "the weight in " + options + " must be above 0";
+                return false;
+            }
+            config.weight_ = v;
+        } else if (key == "rate") {
+            config.rate_ = v;
+        } else if (key == "session-rate") {
+            config.sessionRate_ = v;
+        } else {
+            error = "unknown shaping option " + key + ", the options are weight, rate and session-rate";
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<double> queueDelayBounds()
+{
+    return { 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5 };
+}
+
+class Forwarder::Class {
+ public:
+    Class(const ClassConfig& config)
+        : config_(config), queueDelay_{ { queueDelayBounds() }, { queueDelayBounds() } }
+    {
+        for (int d = 0; d < 2; d++) {
+            bucket_[d] = TokenBucket(config.rate_, config.rate_ / 10);
+            bytes_[d] = 0;
+            queued_[d] = 0;
+        }
+        sessions_ = 0;
+    }
+
+    ClassConfig config_;
+    size_t index_ = 0;
+    int listenFd_ = -1;
+    uint16_t tunnelPort_ = 0;
+    TokenBucket bucket_[2];
+    // Start tag of the next write of the class and the session it was
+    // made for last, such that its sessions are served round robin.
+    double start_[2] = { 0, 0 };
+    uint64_t lastServed_[2] = { 0, 0 };
+
+    std::atomic<uint64_t> sessions_;
+    std::atomic<uint64_t> bytes_[2];
+    std::atomic<uint64_t> queued_[2];
+    Metrics::Histogram queueDelay_[2];
+};
+
+class Chunk {
+ public:
+    std::vector<uint8_t> data_;
+    size_t offset_ = 0;
+    Clock::time_point queued_;
+};
+
+class Forwarder::Flow {
+ public:
+    bool done() const { return eof_ && queue_.empty(); }
+
+    int in_ = -1;
+    int out_ = -1;
+    TokenBucket bucket_;
+    std::deque<Chunk> queue_;
+    size_t queued_ = 0;
+    bool eof_ = false;
+    bool blocked_ = false;
+    bool shutdown_ = false;
+};
+
+class Forwarder::Session {
+ public:
+    Session(uint64_t id, Class* c, int local, int remote)
+        : id_(id), class_(c), local_(local), remote_(remote)
+    {
+        flows_[0].in_ = local;
+        flows_[0].out_ = remote;
+        flows_[1].in_ = remote;
+        flows_[1].out_ = local;
+        for (auto& f : flows_) {
+            f.bucket_ = TokenBucket(c->config_.sessionRate_, c->config_.sessionRate_ / 10);
+        }
+    }
+    ~Session()
+    {
+        for (int d = 0; d < 2; d++) {
+            class_->queued_[d] -= flows_[d].queued_;
+        }
+        close(local_);
+        close(remote_);
+    }
+    bool done() const { return failed_ || (flows_[0].done() && flows_[1].done()); }
+
+    // Increasing in the order the sessions are accepted.
+    uint64_t id_;
+    Class* class_;
+    int local_;
+    int remote_;
+    Flow flows_[2];
+    bool failed_ = false;
+};
+
+static bool would_block()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+Forwarder::Forwarder(double linkRate)
+{
+    for (auto& l : link_) {
+        l = TokenBucket(linkRate, linkRate / 10);
+    }
+}
+
+Forwarder::~Forwarder()
+{
+    if (stopFds_[1] >= 0) {
+        char c = 0;
+        if (write(stopFds_[1], &c, 1) < 0) {
+            // the forwarder thread is gone already.
+        }
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    sessions_.clear();
+    for (auto& c : classes_) {
+        if (c->listenFd_ >= 0) {
+            close(c->listenFd_);
+        }
+    }
+    for (int fd : stopFds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+uint16_t Forwarder::addTunnel(const ClassConfig& config, uint16_t localPort, uint16_t tunnelPort)
+{
+    std::unique_ptr<Class> c(new Class(config));
+    c->index_ = classes_.size();
+    c->tunnelPort_ = tunnelPort;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(localPort);
+    socklen_t length = sizeof(addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 64) != 0 ||
+        getsockname(fd, (struct sockaddr*)&addr, &length) != 0)
+    {
+        std::cerr << "Could not listen on 127.0.0.1:" << localPort << " for the service " << config.service_ << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return 0;
+    }
+    set_nonblocking(fd);
+    c->listenFd_ = fd;
+    classes_.push_back(std::move(c));
+    return ntohs(addr.sin_port);
+}
+
+bool Forwarder::start()
+{
+    if (pipe(stopFds_) != 0) {
+        return false;
+    }
+    thread_ = std::thread([this]() { run(); });
+    return true;
+}
+
+void Forwarder::accept(Class& c)
+{
+    for (;;) {
+        int local = ::accept(c.listenFd_, NULL, NULL);
+        if (local < 0) {
+            return;
+        }
+        int remote = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(c.tunnelPort_);
+        if (remote < 0 || connect(remote, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(local);
+            if (remote >= 0) {
+                close(remote);
+            }
+            continue;
+        }
+        int one = 1;
+        for (int fd : { local, remote }) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            set_nonblocking(fd);
+        }
+        c.sessions_++;
+        sessions_.push_back(std::unique_ptr<Session>(new Session(nextSessionId_++, &c, local, remote)));
+    }
+}
+
+// Make the write of the class with the smallest start tag among the
+// classes with a session which has tokens, for the session following the
+// one the class served last. Returns false when nothing could be written,
+// wait is lowered to when a session short of tokens can be served.
+bool Forwarder::serve(int direction, Clock::time_point now, Clock::duration& wait)
+{
+    class Candidate {
+     public:
+        // The first session which can be served and the first after the
+        // one served last.
+        Session* first_ = nullptr;
+        Session* next_ = nullptr;
+        size_t firstSize_ = 0;
+        size_t nextSize_ = 0;
+    };
+    std::vector<Candidate> candidates(classes_.size());
+    for (auto& s : sessions_) {
+        Flow& f = s->flows_[direction];
+        if (s->failed_ || f.queue_.empty() || f.blocked_) {
+            continue;
+        }
+        Class& c = *s->class_;
+        const Chunk& chunk = f.queue_.front();
+        size_t want = std::min(chunkSize, chunk.data_.size() - chunk.offset_);
+        size_t tokens = std::min(link_[direction].available(now), std::min(c.bucket_[direction].available(now), f.bucket_.available(now)));
+        size_t n = std::min(want, tokens);
+        if (n < std::min(want, minimumWrite)) {
+            size_t need = std::min(want, minimumWrite);
+            Clock::duration w = std::max(link_[direction].wait(need, now), std::max(c.bucket_[direction].wait(need, now), f.bucket_.wait(need, now)));
+            wait = std::min(wait, w);
+            continue;
+        }
+        Candidate& candidate = candidates[c.index_];
+        if (candidate.first_ == nullptr) {
+            candidate.first_ = s.get();
+            candidate.firstSize_ = n;
+        }
+        if (candidate.next_ == nullptr && s->id_ > c.lastServed_[direction]) {
+            candidate.next_ = s.get();
+            candidate.nextSize_ = n;
+        }
+    }
+
+    double& vt = virtualTime_[direction];
+    Session* best = nullptr;
+    double bestTag = 0;
+    size_t bestSize = 0;
+    for (size_t i = 0; i < classes_.size(); i++) {
+        Candidate& candidate = candidates[i];
+        Session* s = candidate.next_ ? candidate.next_ : candidate.first_;
+        if (s == nullptr) {
+            continue;
+        }
+        // A class which has been idle, or could not be served, starts at
+        // the virtual time rather than catching up.
+        double tag = std::max(classes_[i]->start_[direction], vt);
+        if (best == nullptr || tag < bestTag) {
+            best = s;
+            bestTag = tag;
+            bestSize = candidate.next_ ? candidate.nextSize_ : candidate.firstSize_;
+        }
+    }
+    if (best == nullptr) {
+        return false;
+    }
+
+    Flow& f = best->flows_[direction];
+    Class& c = *best->class_;
+    Chunk& chunk = f.queue_.front();
+    ssize_t written = send(f.out_, chunk.data_.data() + chunk.offset_, bestSize, MSG_NOSIGNAL);
+    if (written < 0) {
+        if (would_block()) {
+            f.blocked_ = true;
+        } else {
+            best->failed_ = true;
+        }
+        return true;
+    }
+    size_t n = static_cast<size_t>(written);
+    link_[direction].consume(n);
+    c.bucket_[direction].consume(n);
+    f.bucket_.consume(n);
+    vt = bestTag;
+    c.start_[direction] = bestTag + n / c.config_.weight_;
+    c.lastServed_[direction] = best->id_;
+    c.bytes_[direction] += n;
+    c.queued_[direction] -= n;
+    f.queued_ -= n;
+    chunk.offset_ += n;
+    if (chunk.offset_ == chunk.data_.size()) {
+        c.queueDelay_[direction].observe(now - chunk.queued_);
+        f.queue_.pop_front();
+    }
+    return true;
+}
+
+void Forwarder::reap()
+{
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+        Session& s = **it;
+        for (auto& f : s.flows_) {
+            if (f.done() && !f.shutdown_) {
+                f.shutdown_ = true;
+                shutdown(f.out_, SHUT_WR);
+            }
+        }
+        if (s.done()) {
+            it = sessions_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Forwarder::run()
+{
+    class Owner {
+     public:
+        Session* session_;
+        int direction_;
+        bool read_;
+    };
+    for (;;) {
+        auto now = Clock::now();
+        Clock::duration wait = Clock::duration::max();
+        // A direction which made writesPerRound writes may have more to
+        // write without any socket becoming ready, poll without waiting.
+        bool more = false;
+        for (int d = 0; d < 2; d++) {
+            int i = 0;
+            while (i < writesPerRound && serve(d, now, wait)) {
+                i++;
+            }
+            if (i == writesPerRound) {
+                more = true;
+            }
+        }
+        reap();
+
+        std::vector<struct pollfd> fds;
+        std::vector<Owner> owners;
+        fds.push_back({ stopFds_[0], POLLIN, 0 });
+        for (auto& c : classes_) {
+            fds.push_back({ c->listenFd_, POLLIN, 0 });
+        }
+        for (auto& s : sessions_) {
+            for (int d = 0; d < 2; d++) {
+                Flow& f = s->flows_[d];
+                if (!f.eof_ && f.queued_ < queueLimit) {
+                    fds.push_back({ f.in_, POLLIN, 0 });
+                    owners.push_back(Owner{ s.get(), d, true });
+                }
+                if (f.blocked_) {
+                    fds.push_back({ f.out_, POLLOUT, 0 });
+                    owners.push_back(Owner{ s.get(), d, false });
+                }
+            }
+        }
+        int timeout = -1;
+        if (more) {
+            timeout = 0;
+        } else if (wait != Clock::duration::max()) {
+            timeout = std::max(1, static_cast<int>(std::ceil(std::chrono::duration<double, std::milli>(wait).count())));
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[0].revents) {
+            return;
+        }
+        for (size_t i = 0; i < classes_.size(); i++) {
+            if (fds[1 + i].revents & POLLIN) {
+                accept(*classes_[i]);
+            }
+        }
+        now = Clock::now();
+        size_t base = 1 + classes_.size();
+        for (size_t i = 0; i < owners.size(); i++) {
+            if (fds[base + i].revents == 0) {
+                continue;
+            }
+            Session& s = *owners[i].session_;
+            Flow& f = s.flows_[owners[i].direction_];
+            if (!owners[i].read_) {
+                f.blocked_ = false;
+                continue;
+            }
+            Chunk chunk;
+            chunk.data_.resize(chunkSize);
+            ssize_t n = recv(f.in_, chunk.data_.data(), chunk.data_.size(), 0);
+            if (n > 0) {
+                chunk.data_.resize(n);
+                chunk.queued_ = now;
+                f.queued_ += n;
+                s.class_->queued_[owners[i].direction_] += n;
+                f.queue_.push_back(std::move(chunk));
+            } else if (n == 0) {
+                f.eof_ = true;
+            } else if (!would_block()) {
+                s.failed_ = true;
+            }
+        }
+    }
+}
+
+void Forwarder::renderMetrics(std::ostream& out)
+{
+    out << "# TYPE edge_tunnel_shaping_sessions counter\n";
+    out << "# HELP edge_tunnel_shaping_sessions Tcp sessions accepted on the shaped tunnels.\n";
+    for (auto& c : classes_) {
+        out << "edge_tunnel_shaping_sessions_total{service=\"" << Metrics::escapeLabel(c->config_.service_) << "\"} " << c->sessions_ << "\n";
+    }
+    out << "# TYPE edge_tunnel_shaping_bytes counter\n";
+    out << "# HELP edge_tunnel_shaping_bytes Bytes forwarded through the shaped tunnels.\n";
+    for (auto& c : classes_) {
+        for (int d = 0; d < 2; d++) {
+            out << "edge_tunnel_shaping_bytes_total{service=\"" << Metrics::escapeLabel(c->config_.service_) << "\",direction=\"" << directionNames[d] << "\"} " << c->bytes_[d] << "\n";
+        }
+    }
+    out << "# TYPE edge_tunnel_shaping_queued_bytes gauge\n";
+    out << "# HELP edge_tunnel_shaping_queued_bytes Bytes read and waiting to be forwarded.\n";
+    for (auto& c : classes_) {
+        for (int d = 0; d < 2; d++) {
+            out << "edge_tunnel_shaping_queued_bytes{service=\"" << Metrics::escapeLabel(c->config_.service_) << "\",direction=\"" << directionNames[d] << "\"} " << c->queued_[d] << "\n";
+        }
+    }
+    out << "# TYPE edge_tunnel_shaping_queue_delay_seconds histogram\n";
+    out << "# HELP edge_tunnel_shaping_queue_delay_seconds Time from reading data until it has been forwarded.\n";
+    for (auto& c : classes_) {
+        for (int d = 0; d < 2; d++) {
+            Metrics::writeHistogram(out, "edge_tunnel_shaping_queue_delay_seconds",
+                                    "service=\"" + Metrics::escapeLabel(c->config_.service_) + "\",direction=\"" + directionNames[d] + "\"",
+                                    c->queueDelay_[d]);
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "metrics.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Shaping {
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Allows rate bytes per second on average and bursts of up to burst
+ * bytes. A rate of 0 is unlimited.
+ */
+class TokenBucket {
+ public:
+    TokenBucket(double rate = 0, double burst = 0);
+
+    bool unlimited() const { return rate_ <= 0; }
+    size_t available(Clock::time_point now);
+    void consume(size_t n);
+    // Time until n bytes are available.
+    Clock::duration wait(size_t n, Clock::time_point now);
+
+ private:
+    void refill(Clock::time_point now);
+
+    double rate_;
+    double burst_;
+    double tokens_;
+    Clock::time_point last_;
+};
+
+/**
+ * How the sessions of a tunnel are shaped. The weight is the share of
+ * the link the tunnel gets when tunnels compete, however many tcp
+ * sessions it has, rate limits the tunnel and sessionRate each of its
+ * sessions, in bytes per second in each direction, 0 is unlimited.
+ */
+class ClassConfig {
+ public:
+    std::string service_;
+    double weight_ = 1;
+    double rate_ = 0;
+    double sessionRate_ = 0;
+
+    bool shaped() const { return weight_ != 1 || rate_ > 0 || sessionRate_ > 0; }
+};
+
+// Parse "weight=8/rate=1M/session-rate=256k", the suffixes k, M and G
+// are powers of 1000. Returns false with a message on errors.
+bool parseClassOptions(const std::string& options, ClassConfig& config, std::string& error);
+bool parseRate(const std::string& in, double& rate);
+
+/**
+ * The forwarding path of shaped tunnels. The forwarder listens on the
+ * local port of each tunnel and relays accepted connections to the
+ * port of the SDK tunnel, one thread serves all of them.
+ *
+ * Read data is queued per session and direction. The tunnels share the
+ * link in weighted fair queueing order (start-time fair queueing): a
+ * write of n bytes by a tunnel starts at max(virtual time, the tunnel's
+ * start tag) and moves its start tag n / weight further. The tunnel
+ * with the smallest start tag is served next, and the virtual time is
+ * the start tag being served. Within a tunnel its sessions take turns.
+ *
+ * Writes are limited by the link rate shared by all tunnels and by the
+ * token buckets of the tunnel and the session. Without a link rate the
+ * order only matters while the tunnels are rate limited or their
+ * sockets are full.
+ */
+class Forwarder {
+ public:
+    Forwarder(double linkRate);
+    ~Forwarder();
+
+    // Listen on 127.0.0.1:localPort, 0 is an ephemeral port, and forward
+    // to the SDK tunnel on tunnelPort. Returns the port listened on, 0 on
+    // errors. Call before start.
+    uint16_t addTunnel(const ClassConfig& config, uint16_t localPort, uint16_t tunnelPort);
+    bool start();
+
+    // Bytes forwarded, queued and the queueing delay of each tunnel.
+    void renderMetrics(std::ostream& out);
+
+ private:
+    class Class;
+    class Flow;
+    class Session;
+
+    void run();
+    void accept(Class& c);
+    bool serve(int direction, Clock::time_point now, Clock::duration& wait);
+    void reap();
+
+    TokenBucket link_[2];
+    // Virtual time of each direction.
+    double virtualTime_[2] = { 0, 0 };
+    uint64_t nextSessionId_ = 1;
+    std::vector<std::unique_ptr<Class> > classes_;
+    std::list<std::unique_ptr<Session> > sessions_;
+    int stopFds_[2] = { -1, -1 };
+    std::thread thread_;
+};
+
+} // namespace
@@ -0,0 +1,209 @@
+#include "structured_log.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace Logging {
+
+static const char binaryMagic[4] = { 'N', 'T', 'L', '1' };
+
+static bool utc_time(std::time_t timer, std::tm& bt)
+{
+#if defined(_WIN32)
+    return gmtime_s(&bt, &timer) == 0;
+#else
+    return gmtime_r(&timer, &bt) != NULL;
+#endif
+}
+
+// 2006-01-02T15:04:05.000Z
+static std::string rfc3339(std::chrono::system_clock::time_point tp)
+{
+    using namespace std::chrono;
+    std::time_t timer = system_clock::to_time_t(tp);
+    unsigned ms = static_cast<unsigned>(duration_cast<milliseconds>(tp.time_since_epoch()).count() % 1000);
+    std::tm bt;
+    if (!utc_time(timer, bt)) {
+        return "";
+    }
+    char buffer[32];
+    size_t n = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &bt);
+    std::snprintf(buffer + n, sizeof(buffer) - n, ".%03uZ", ms);
+    return std::string(buffer);
+}
+
+static void put_uint(std::vector<char>& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+static void put_string(std::vector<char>& out, const std::string& str, size_t lengthBytes)
+{
+    uint64_t maxLength = (lengthBytes >= 8) ? UINT64_MAX : ((uint64_t)1 << (8 * lengthBytes)) - 1;
+    size_t length = str.size() > maxLength ? static_cast<size_t>(maxLength) : str.size();
+    put_uint(out, length, lengthBytes);
+    out.insert(out.end(), str.begin(), str.begin() + length);
+}
+
+Format StructuredLogSink::parseFormat(const std::string& format)
+{
+    if (format == "json") {
+        return Format::JSON_LINES;
+    } else if (format == "binary") {
+        return Format::BINARY;
+    }
+    throw std::invalid_argument("unknown log format " + format + " expected json or binary");
+}
+
+StructuredLogSink::StructuredLogSink(const SinkOptions& options)
+    : options_(options), written_(0), dropped_(0), rotations_(0)
+{
+}
+
+StructuredLogSink::~StructuredLogSink()
+{
+    stop();
+}
+
+bool StructuredLogSink::open()
+{
+    if (!openFile()) {
+        return false;
+    }
+    thread_ = std::thread([this]() { run(); });
+    return true;
+}
+
+void StructuredLogSink::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cond_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (file_.is_open()) {
+        file_.close();
+    }
+}
+
+bool StructuredLogSink::write(Record record)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_ || queue_.size() >= options_.queueCapacity_) {
+            dropped_++;
+            return false;
+        }
+        queue_.push_back(std::move(record));
+    }
+    cond_.notify_one();
+    return true;
+}
+
+void StructuredLogSink::run()
+{
+    std::deque<Record> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stopped_ || !queue_.empty(); });
+            if (queue_.empty() && stopped_) {
+                return;
+            }
+            batch.swap(queue_);
+        }
+        for (auto& r : batch) {
+            rotateIfNeeded();
+            writeRecord(r);
+        }
+        batch.clear();
+        file_.flush();
+    }
+}
+
+void StructuredLogSink::writeRecord(const Record& record)
+{
+    if (!file_.is_open()) {
+        dropped_++;
+        return;
+    }
+    if (options_.format_ == Format::JSON_LINES) {
+        nlohmann::json j;
+        j["timestamp"] = rfc3339(record.timestamp_);
+        j["severity"] = record.severity_;
+        if (!record.module_.empty()) {
+            j["module"] = record.module_;
+        }
+        j["message"] = record.message_;
+        // Replace invalid utf-8 from the SDK rather than throwing.
+        std::string line = j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        line.push_back('\n');
+        file_.write(line.data(), line.size());
+        fileSize_ += line.size();
+    } else {
+        std::vector<char> body;
+        uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(record.timestamp_.time_since_epoch()).count();
+        put_uint(body, ms, 8);
+        put_string(body, record.severity_, 2);
+        put_string(body, record.module_, 2);
+        put_string(body, record.message_, 4);
+        std::vector<char> out;
+        put_uint(out, body.size(), 4);
+        out.insert(out.end(), body.begin(), body.end());
+        file_.write(out.data(), out.size());
+        fileSize_ += out.size();
+    }
+    written_++;
+}
+
+void StructuredLogSink::rotateIfNeeded()
+{
+    bool tooLarge = options_.maxFileSize_ > 0 && fileSize_ >= options_.maxFileSize_;
+    bool tooOld = options_.maxFileAge_.count() > 0 && std::chrono::steady_clock::now() - fileOpened_ >= options_.maxFileAge_;
+    if (!tooLarge && !tooOld) {
+        return;
+    }
+
+    file_.close();
+    const std::string& path = options_.path_;
+    if (options_.maxFiles_ > 0) {
+        std::remove((path + "." + std::to_string(options_.maxFiles_)).c_str());
+        for (int i = options_.maxFiles_ - 1; i >= 1; i--) {
+            std::rename((path + "." + std::to_string(i)).c_str(), (path + "." + std::to_string(i + 1)).c_str());
+        }
+        std::rename(path.c_str(), (path + ".1").c_str());
+    } else {
+        std::remove(path.c_str());
+    }
+    rotations_++;
+    openFile();
+}
+
+bool StructuredLogSink::openFile()
+{
+    file_.open(options_.path_, std::ios::binary | std::ios::app);
+    if (!file_) {
+        std::cerr << "Could not open the log file " << options_.path_ << std::endl;
+        return false;
+    }
+    file_.seekp(0, std::ios::end);
+    fileSize_ = static_cast<uint64_t>(file_.tellp());
+    fileOpened_ = std::chrono::steady_clock::now();
+    if (options_.format_ == Format::BINARY && fileSize_ == 0) {
+        file_.write(binaryMagic, sizeof(binaryMagic));
+        fileSize_ += sizeof(binaryMagic);
+    }
+    return true;
+}
+
+} // namespace
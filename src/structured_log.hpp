@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <atomic>
+
+namespace Logging {
+
+enum class Format {
+    JSON_LINES,
+    BINARY
+};
+
+class Record {
+ public:
+    std::chrono::system_clock::time_point timestamp_;
+    std::string severity_;
+    std::string module_;
+    std::string message_;
+};
+
+class SinkOptions {
+ public:
+    std::string path_;
+    Format format_ = Format::JSON_LINES;
+    // Rotate when the current file exceeds this size, 0 disables size rotation.
+    uint64_t maxFileSize_ = 10 * 1024 * 1024;
+    // Rotate when the current file is older than this, 0 disables time rotation.
+    std::chrono::seconds maxFileAge_ = std::chrono::seconds(0);
+    // Number of rotated files kept as path.1 ... path.N.
+    int maxFiles_ = 5;
+    // Records queued for the writer thread before new records are dropped.
+    size_t queueCapacity_ = 4096;
+};
+
+/**
+ * A log sink which writes structured records as JSON lines or in a
+ * compact binary format with size and time based rotation.
+ *
+ * write() only appends to a bounded in memory queue, all formatting
+ * and file I/O happens on the sink's own thread. When the queue is
+ * full the record is dropped and counted, such that the SDK thread
+ * logging through the sink never waits on the disk.
+ *
+ * The binary format starts each file with the 4 byte magic "NTL1"
+ * followed by records of little endian fields:
+ *   u32 record length (excluding this field)
+ *   u64 milliseconds since the unix epoch
+ *   u16 severity length, severity
+ *   u16 module length, module
+ *   u32 message length, message
+ */
+class StructuredLogSink {
+ public:
+    StructuredLogSink(const SinkOptions& options);
+    ~StructuredLogSink();
+
+    bool open();
+    void stop();
+
+    // Returns false if the record was dropped.
+    bool write(Record record);
+
+    uint64_t written() const { return written_; }
+    uint64_t dropped() const { return dropped_; }
+    uint64_t rotations() const { return rotations_; }
+
+    static Format parseFormat(const std::string& format);
+
+ private:
+    void run();
+    void writeRecord(const Record& record);
+    void rotateIfNeeded();
+    bool openFile();
+
+    SinkOptions options_;
+    std::ofstream file_;
+    uint64_t fileSize_ = 0;
+    std::chrono::steady_clock::time_point fileOpened_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Record> queue_;
+    bool stopped_ = false;
+    std::thread thread_;
+
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> rotations_;
+};
+
+} // namespace
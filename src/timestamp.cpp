@@ -1,6 +1,8 @@
 #include "timestamp.hpp"
 #include <chrono>
 
+#include <ctime>
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 
@@ -28,3 +30,49 @@ std::string time_in_HH_MM_SS_MMM()
 
     return oss.str();
 }
+
+static const size_t timestampLength = 12; // HH:MM:SS.MMM
+
+static bool local_time(std::time_t timer, std::tm& bt)
+{
+#if defined(_WIN32)
+    return localtime_s(&bt, &timer) == 0;
+#else
+    return localtime_r(&timer, &bt) != NULL;
+#endif
+}
+
+size_t time_in_HH_MM_SS_MMM(char* buffer, size_t size)
+{
+    using namespace std::chrono;
+
+    // The cache is per thread so no locking is needed.
+    thread_local std::time_t cachedSecond = -1;
+    thread_local char cachedPrefix[9] = { 0 }; // HH:MM:SS
+
+    if (size < timestampLength + 1) {
+        return 0;
+    }
+
+    auto now = system_clock::now();
+    auto second = system_clock::to_time_t(now);
+    unsigned ms = static_cast<unsigned>(duration_cast<milliseconds>(now.time_since_epoch()).count() % 1000);
+
+    if (second != cachedSecond) {
+        std::tm bt;
+        if (!local_time(second, bt) ||
+            std::strftime(cachedPrefix, sizeof(cachedPrefix), "%H:%M:%S", &bt) != 8)
+        {
+            return 0;
+        }
+        cachedSecond = second;
+    }
+
+    std::memcpy(buffer, cachedPrefix, 8);
+    buffer[8] = '.';
+    buffer[9] = static_cast<char>('0' + ms / 100);
+    buffer[10] = static_cast<char>('0' + (ms / 10) % 10);
+    buffer[11] = static_cast<char>('0' + ms % 10);
+    buffer[timestampLength] = 0;
+    return timestampLength;
+}
@@ -1,5 +1,16 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
 
 std::string time_in_HH_MM_SS_MMM();
+
+/**
+ * Write the current local time as HH:MM:SS.MMM into buffer, which
+ * should hold at least 13 bytes including the zero termination. The
+ * HH:MM:SS part is cached per thread and only reformatted when the
+ * second changes, such that most calls only patch in the
+ * milliseconds. Returns the number of characters written excluding
+ * the zero termination, or 0 if the buffer is too small.
+ */
+size_t time_in_HH_MM_SS_MMM(char* buffer, size_t size);
@@ -0,0 +1,235 @@
+#include "trace.hpp"
+
+#include <nabto_client.hpp>
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace Tracing {
+
+static std::atomic<bool> enabled_(false);
+static std::atomic<uint64_t> nextId_(1);
+static std::atomic<uint64_t> nextThread_(1);
+
+// The span open on this thread, 0 if none.
+static thread_local uint64_t currentSpan_ = 0;
+
+static uint64_t thread_id()
+{
+    static thread_local uint64_t tid = nextThread_.fetch_add(1);
+    return tid;
+}
+
+class PendingOperation {
+ public:
+    std::string name_;
+    std::string detail_;
+    uint64_t parentId_;
+    uint64_t tid_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class Collector {
+ public:
+    static Collector& instance()
+    {
+        static Collector c;
+        return c;
+    }
+
+    void add(const std::string& name, const std::string& category, uint64_t id, uint64_t parentId, uint64_t tid,
+             std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, nlohmann::json args)
+    {
+        args["span_id"] = id;
+        if (parentId != 0) {
+            args["parent_id"] = parentId;
+        }
+        nlohmann::json e;
+        e["name"] = name;
+        e["cat"] = category;
+        e["ph"] = "X";
+        e["pid"] = 1;
+        e["tid"] = tid;
+        std::lock_guard<std::mutex> lock(mutex_);
+        e["ts"] = std::chrono::duration<double, std::micro>(start - origin_).count();
+        e["dur"] = std::chrono::duration<double, std::micro>(end - start).count();
+        e["args"] = args;
+        events_.push_back(e);
+    }
+
+    std::mutex mutex_;
+    std::chrono::steady_clock::time_point origin_;
+    std::vector<nlohmann::json> events_;
+    std::map<uint64_t, PendingOperation> pending_;
+};
+
+/**
+ * Turns the operations reported by the client library into spans,
+ * parented by the span open on the thread which started them.
+ */
+class WrapperTracer : public nabto::client::OperationTracer {
+ public:
+    uint64_t begin(const std::string& operation, const std::string& detail)
+    {
+        PendingOperation op;
+        op.name_ = operation;
+        op.detail_ = detail;
+        op.parentId_ = currentSpan_;
+        op.tid_ = thread_id();
+        op.start_ = std::chrono::steady_clock::now();
+        uint64_t id = nextId_.fetch_add(1);
+        auto& c = Collector::instance();
+        std::lock_guard<std::mutex> lock(c.mutex_);
+        c.pending_[id] = op;
+        return id;
+    }
+
+    void end(uint64_t id, nabto::client::Status status)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto& c = Collector::instance();
+        PendingOperation op;
+        {
+            std::lock_guard<std::mutex> lock(c.mutex_);
+            auto it = c.pending_.find(id);
+            if (it == c.pending_.end()) {
+                return;
+            }
+            op = it->second;
+            c.pending_.erase(it);
+        }
+        nlohmann::json args;
+        if (!op.detail_.empty()) {
+            args["detail"] = op.detail_;
+        }
+        args["status"] = status.getName();
+        std::string name = op.detail_.empty() ? op.name_ : op.name_ + " " + op.detail_;
+        c.add(name, "nabto_client", id, op.parentId_, op.tid_, op.start_, now, args);
+    }
+};
+
+Span::Span(const std::string& name)
+    : active_(enabled_.load(std::memory_order_relaxed))
+{
+    if (!active_) {
+        return;
+    }
+    name_ = name;
+    id_ = nextId_.fetch_add(1);
+    parentId_ = currentSpan_;
+    currentSpan_ = id_;
+    start_ = std::chrono::steady_clock::now();
+}
+
+Span::~Span()
+{
+    end();
+}
+
+void Span::setAttribute(const std::string& key, const std::string& value)
+{
+    if (active_) {
+        attributes_[key] = nlohmann::json(value).dump();
+    }
+}
+
+void Span::setAttribute(const std::string& key, int64_t value)
+{
+    if (active_) {
+        attributes_[key] = std::to_string(value);
+    }
+}
+
+void Span::end()
+{
+    if (!active_) {
+        return;
+    }
+    active_ = false;
+    auto now = std::chrono::steady_clock::now();
+    if (currentSpan_ == id_) {
+        currentSpan_ = parentId_;
+    }
+    nlohmann::json args = nlohmann::json::object();
+    for (auto& a : attributes_) {
+        args[a.first] = nlohmann::json::parse(a.second);
+    }
+    Collector::instance().add(name_, "edge_tunnel", id_, parentId_, thread_id(), start_, now, args);
+}
+
+void record(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+            const std::map<std::string, std::string>& attributes)
+{
+    if (!enabled_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    nlohmann::json args = nlohmann::json::object();
+    for (auto& a : attributes) {
+        args[a.first] = a.second;
+    }
+    Collector::instance().add(name, "edge_tunnel", nextId_.fetch_add(1), currentSpan_, thread_id(), start, end, args);
+}
+
+std::unique_ptr<Session> Session::start(const std::string& path)
+{
+    // Fail early rather than after the traced command has run.
+    std::ofstream probe(path);
+    if (!probe) {
+        std::cerr << "Could not open the trace file " << path << std::endl;
+        return nullptr;
+    }
+    std::unique_ptr<Session> session(new Session(path));
+    auto& c = Collector::instance();
+    {
+        std::lock_guard<std::mutex> lock(c.mutex_);
+        c.origin_ = std::chrono::steady_clock::now();
+        c.events_.clear();
+        c.pending_.clear();
+    }
+    enabled_ = true;
+    nabto::client::Context::setOperationTracer(std::make_shared<WrapperTracer>());
+    return session;
+}
+
+Session::Session(const std::string& path)
+    : path_(path)
+{
+}
+
+Session::~Session()
+{
+    nabto::client::Context::setOperationTracer(nullptr);
+    enabled_ = false;
+
+    auto& c = Collector::instance();
+    nlohmann::json events = nlohmann::json::array();
+    nlohmann::json process;
+    process["name"] = "process_name";
+    process["ph"] = "M";
+    process["pid"] = 1;
+    process["args"]["name"] = "edge_tunnel_client";
+    events.push_back(process);
+    {
+        std::lock_guard<std::mutex> lock(c.mutex_);
+        for (auto& e : c.events_) {
+            events.push_back(e);
+        }
+        c.events_.clear();
+        c.pending_.clear();
+    }
+    nlohmann::json root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+    std::ofstream out(path_);
+    out << root.dump() << std::endl;
+    if (!out) {
+        std::cerr << "Could not write the trace file " << path_ << std::endl;
+    }
+}
+
+} // namespace
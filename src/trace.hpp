@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace Tracing {
+
+/**
+ * A traced operation on the current thread. Spans created while
+ * another span is open on the same thread become its children. The
+ * span ends when end() is called or when it goes out of scope.
+ *
+ * Spans are only recorded while a Session is open, otherwise they cost
+ * a check of a flag.
+ */
+class Span {
+ public:
+    Span(const std::string& name);
+    ~Span();
+
+    void setAttribute(const std::string& key, const std::string& value);
+    void setAttribute(const std::string& key, int64_t value);
+    void end();
+
+ private:
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    bool active_;
+    std::string name_;
+    uint64_t id_ = 0;
+    uint64_t parentId_ = 0;
+    std::chrono::steady_clock::time_point start_;
+    // Values are json text.
+    std::map<std::string, std::string> attributes_;
+};
+
+// Record an operation timed elsewhere as a child of the open span of
+// the current thread, with string attributes.
+void record(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+            const std::map<std::string, std::string>& attributes = {});
+
+/**
+ * Collects the spans of the process, including the connects, CoAP
+ * requests and tunnel opens made through the client library, and
+ * writes them as a Chrome trace event file when it is destroyed. The
+ * file can be opened in Perfetto or chrome://tracing.
+ */
+class Session {
+ public:
+    static std::unique_ptr<Session> start(const std::string& path);
+    ~Session();
+
+ private:
+    Session(const std::string& path);
+    std::string path_;
+};
+
+} // namespace
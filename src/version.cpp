@@ -0,0 +1,5 @@
+#include "version.hpp"
+
+static const char* version_str = "1.0.0-master.46+fa8e979.dirty"
+;
+const char* edge_tunnel_client_version() { return version_str; }
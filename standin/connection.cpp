@@ -0,0 +1,890 @@
+#include "standin.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace standin;
+
+namespace standin {
+
+// A request and its response each cross the network once.
+static std::chrono::milliseconds round_trip()
+{
+    return Registry::instance().latency() * 2;
+}
+
+ConnectionState::ConnectionState(std::shared_ptr<Core> core)
+    : core_(core)
+{
+}
+
+void ConnectionState::connect(NabtoClientFuture* future)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ != SETUP) {
+        core_->resolve(future, op, EC_INVALID_STATE);
+        return;
+    }
+    if (productId_.empty() || deviceId_.empty() || privateKey_.empty()) {
+        core_->resolve(future, op, EC_INVALID_STATE);
+        return;
+    }
+    state_ = CONNECTING;
+    future_ = future;
+    op_ = op;
+    auto self = shared_from_this();
+    core_->executor_->post([self, future, op]() {
+        auto device = Registry::instance().find(self->productId_, self->deviceId_, true);
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (self->state_ != CONNECTING || self->op_ != op) {
+                return;
+            }
+            self->device_ = device;
+            self->state_ = CONNECTED;
+            self->connectedAt_ = std::chrono::steady_clock::now();
+            self->localError_ = EC_OK;
+            self->channel_ = "local";
+            self->future_ = nullptr;
+            self->pushEvent(EVENT_CONNECTED);
+        }
+        self->core_->log(NABTO_CLIENT_LOG_SEVERITY_INFO, "standin", "Connected to " + self->productId_ + "." + self->deviceId_);
+        self->core_->resolve(future, op, EC_OK);
+    }, round_trip());
+}
+
+void ConnectionState::close(NabtoClientFuture* future)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == CLOSED) {
+        core_->resolve(future, op, EC_STOPPED);
+        return;
+    }
+    if (state_ != CONNECTED) {
+        core_->resolve(future, op, EC_NOT_CONNECTED);
+        return;
+    }
+    if (future_ != nullptr) {
+        core_->resolve(future, op, EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+    future_ = future;
+    op_ = op;
+    auto self = shared_from_this();
+    core_->executor_->post([self, future, op]() {
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (self->op_ != op || self->state_ == CLOSED) {
+                return;
+            }
+            self->state_ = CLOSED;
+            self->future_ = nullptr;
+            self->pushEvent(EVENT_CLOSED);
+        }
+        self->closeChildren();
+        self->core_->resolve(future, op, EC_OK);
+    }, round_trip());
+}
+
+void ConnectionState::passwordAuthenticate(const std::string& username, const std::string& password, NabtoClientFuture* future)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ != CONNECTED) {
+        core_->resolve(future, op, state_ == CLOSED ? EC_STOPPED : EC_NOT_CONNECTED);
+        return;
+    }
+    if (future_ != nullptr) {
+        core_->resolve(future, op, EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+    future_ = future;
+    op_ = op;
+    auto self = shared_from_this();
+    auto device = device_;
+    core_->executor_->post([self, device, username, password, future, op]() {
+        bool ok = device->passwordAuthenticate(username, password);
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (self->op_ != op || self->future_ != future) {
+                return;
+            }
+            self->future_ = nullptr;
+            if (ok) {
+                self->passwordAuthenticated_ = true;
+                self->passwordUsername_ = username;
+            }
+        }
+        self->core_->resolve(future, op, ok ? EC_OK : EC_UNAUTHORIZED);
+    }, round_trip());
+}
+
+void ConnectionState::addListener(std::weak_ptr<ListenerState> listener)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    listeners_.push_back(listener);
+}
+
+void ConnectionState::addTunnel(std::weak_ptr<TunnelState> tunnel)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    tunnels_.push_back(tunnel);
+}
+
+void ConnectionState::addStream(std::weak_ptr<StreamState> stream)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.push_back(stream);
+}
+
+void ConnectionState::stop()
+{
+    NabtoClientFuture* future;
+    uint64_t op;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (state_ == CLOSED) {
+            return;
+        }
+        if (state_ == CONNECTED) {
+            pushEvent(EVENT_CLOSED);
+        }
+        state_ = CLOSED;
+        future = future_;
+        op = op_;
+        future_ = nullptr;
+    }
+    closeChildren();
+    if (future) {
+        core_->resolve(future, op, EC_STOPPED);
+    }
+}
+
+bool ConnectionState::isConnected()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return state_ == CONNECTED;
+}
+
+std::shared_ptr<Device> ConnectionState::device()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return device_;
+}
+
+ClientAuth ConnectionState::clientAuth()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ClientAuth auth;
+    auth.fingerprint_ = fingerprint_of(privateKey_);
+    auth.passwordAuthenticated_ = passwordAuthenticated_;
+    auth.passwordUsername_ = passwordUsername_;
+    return auth;
+}
+
+std::string ConnectionState::info()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    nlohmann::json root;
+    root["MdnsError"] = nabto_client_error_get_string(localError_);
+    root["UdpRelayError"] = nabto_client_error_get_string(remoteError_);
+    root["Channel"] = channel_;
+    root["Standin"] = true;
+    return root.dump();
+}
+
+// The caller holds the lock.
+void ConnectionState::pushEvent(int event)
+{
+    for (auto& l : listeners_) {
+        auto listener = l.lock();
+        if (listener) {
+            listener->pushEvent(event);
+        }
+    }
+}
+
+void ConnectionState::closeChildren()
+{
+    std::vector<std::weak_ptr<TunnelState> > tunnels;
+    std::vector<std::weak_ptr<StreamState> > streams;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tunnels.swap(tunnels_);
+        streams.swap(streams_);
+    }
+    for (auto& t : tunnels) {
+        auto tunnel = t.lock();
+        if (tunnel) {
+            tunnel->stop();
+        }
+    }
+    for (auto& s : streams) {
+        auto stream = s.lock();
+        if (stream) {
+            stream->stop();
+        }
+    }
+}
+
+StreamState::StreamState(std::shared_ptr<ConnectionState> connection)
+    : connection_(connection), core_(connection->core_)
+{
+}
+
+void StreamState::open(NabtoClientFuture* future, uint32_t port)
+{
+    (void)port;
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    if (!connection_->isConnected()) {
+        core_->resolve(future, op, EC_NOT_CONNECTED);
+        return;
+    }
+    auto self = shared_from_this();
+    core_->executor_->post([self, future, op]() {
+        NabtoClientError ec;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (self->stopped_) {
+                ec = EC_STOPPED;
+            } else if (self->opened_) {
+                ec = EC_INVALID_STATE;
+            } else {
+                self->opened_ = true;
+                ec = EC_OK;
+            }
+        }
+        self->core_->resolve(future, op, ec);
+    }, round_trip());
+}
+
+void StreamState::read(NabtoClientFuture* future, void* buffer, size_t length, size_t* readLength, bool all)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) {
+        core_->resolve(future, op, EC_STOPPED);
+        return;
+    }
+    if (!opened_) {
+        core_->resolve(future, op, EC_INVALID_STATE);
+        return;
+    }
+    if (readFuture_ != nullptr) {
+        core_->resolve(future, op, EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+    readFuture_ = future;
+    readOp_ = op;
+    readBuffer_ = static_cast<uint8_t*>(buffer);
+    readLength_ = length;
+    readTransferred_ = readLength;
+    readAll_ = all;
+    tryRead();
+}
+
+void StreamState::write(NabtoClientFuture* future, const void* buffer, size_t length)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            core_->resolve(future, op, EC_STOPPED);
+            return;
+        }
+        if (!opened_ || writeClosed_) {
+            core_->resolve(future, op, EC_INVALID_STATE);
+            return;
+        }
+    }
+    auto self = shared_from_this();
+    const uint8_t* begin = static_cast<const uint8_t*>(buffer);
+    auto data = std::make_shared<std::vector<uint8_t> >(begin, begin + length);
+    // The write completes once the data is sent, the echo arrives one
+    // round trip later.
+    core_->executor_->post([self, future, op]() {
+        self->core_->resolve(future, op, EC_OK);
+    }, Registry::instance().latency());
+    core_->executor_->post([self, data]() {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        if (self->stopped_) {
+            return;
+        }
+        self->echo_.insert(self->echo_.end(), data->begin(), data->end());
+        self->tryRead();
+    }, round_trip());
+}
+
+void StreamState::close(NabtoClientFuture* future)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            core_->resolve(future, op, EC_STOPPED);
+            return;
+        }
+        if (!opened_ || writeClosed_) {
+            core_->resolve(future, op, EC_INVALID_STATE);
+            return;
+        }
+        writeClosed_ = true;
+    }
+    auto self = shared_from_this();
+    core_->executor_->post([self, future, op]() {
+        self->core_->resolve(future, op, EC_OK);
+    }, Registry::instance().latency());
+    // The echoing device closes its end after the data written before
+    // the close.
+    core_->executor_->post([self]() {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        self->echoClosed_ = true;
+        self->tryRead();
+    }, round_trip());
+}
+
+void StreamState::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    tryRead();
+}
+
+// The caller holds the lock.
+void StreamState::tryRead()
+{
+    if (readFuture_ == nullptr) {
+        return;
+    }
+    NabtoClientFuture* future = readFuture_;
+    uint64_t op = readOp_;
+    if (stopped_) {
+        readFuture_ = nullptr;
+        core_->resolve(future, op, EC_STOPPED);
+        return;
+    }
+    size_t available = echo_.size();
+    if (available == 0 && echoClosed_) {
+        readFuture_ = nullptr;
+        core_->resolve(future, op, EC_EOF);
+        return;
+    }
+    if (available == 0 || (readAll_ && available < readLength_ && !echoClosed_)) {
+        return;
+    }
+    if (readAll_ && available < readLength_) {
+        // The device closed before all the data arrived.
+        readFuture_ = nullptr;
+        core_->resolve(future, op, EC_EOF);
+        return;
+    }
+    size_t n = std::min(available, readLength_);
+    uint8_t* out = readBuffer_;
+    size_t* transferred = readTransferred_;
+    readFuture_ = nullptr;
+    bool delivered = false;
+    core_->resolve(future, op, EC_OK, [this, out, transferred, n, &delivered]() {
+        std::copy(echo_.begin(), echo_.begin() + n, out);
+        if (transferred) {
+            *transferred = n;
+        }
+        delivered = true;
+    });
+    if (delivered) {
+        echo_.erase(echo_.begin(), echo_.begin() + n);
+    }
+}
+
+} // namespace
+
+extern "C" {
+
+NabtoClientConnection* NABTO_CLIENT_API nabto_client_connection_new(NabtoClient* context)
+{
+    NabtoClientConnection* connection = new NabtoClientConnection_();
+    connection->state_ = std::make_shared<ConnectionState>(context->core_);
+    context->core_->addStoppable(connection->state_);
+    return connection;
+}
+
+void NABTO_CLIENT_API nabto_client_connection_free(NabtoClientConnection* connection)
+{
+    if (connection == NULL) {
+        return;
+    }
+    connection->state_->stop();
+    delete connection;
+}
+
+void NABTO_CLIENT_API nabto_client_connection_stop(NabtoClientConnection* connection)
+{
+    connection->state_->stop();
+}
+
+#define STANDIN_SETUP_PHASE(connection) \
+    std::lock_guard<std::mutex> lock((connection)->state_->mutex_); \
+    if ((connection)->state_->state_ != ConnectionState::SETUP) { \
+        return EC_INVALID_STATE; \
+    }
+
+static NabtoClientError set_string(NabtoClientConnection* connection, std::string ConnectionState::* field, const char* value)
+{
+    STANDIN_SETUP_PHASE(connection);
+    if (value == NULL) {
+        return EC_INVALID_ARGUMENT;
+    }
+    (*connection->state_).*field = value;
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_options(NabtoClientConnection* connection, const char* json)
+{
+    STANDIN_SETUP_PHASE(connection);
+    nlohmann::json options = nlohmann::json::parse(json ? json : "", nullptr, false);
+    if (!options.is_object()) {
+        return EC_INVALID_ARGUMENT;
+    }
+    auto state = connection->state_;
+    nlohmann::json current = nlohmann::json::parse(state->options_, nullptr, false);
+    current.update(options);
+    state->options_ = current.dump();
+    if (options.contains("ProductId") && options["ProductId"].is_string()) {
+        state->productId_ = options["ProductId"].get<std::string>();
+    }
+    if (options.contains("DeviceId") && options["DeviceId"].is_string()) {
+        state->deviceId_ = options["DeviceId"].get<std::string>();
+    }
+    if (options.contains("PrivateKey") && options["PrivateKey"].is_string()) {
+        state->privateKey_ = options["PrivateKey"].get<std::string>();
+    }
+    if (options.contains("ServerConnectToken") && options["ServerConnectToken"].is_string()) {
+        state->sct_ = options["ServerConnectToken"].get<std::string>();
+    }
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_options(NabtoClientConnection* connection, char** json)
+{
+    auto state = connection->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    nlohmann::json options = nlohmann::json::parse(state->options_, nullptr, false);
+    options["ProductId"] = state->productId_;
+    options["DeviceId"] = state->deviceId_;
+    options["ServerUrl"] = state->serverUrl_;
+    options["AppName"] = state->appName_;
+    options["AppVersion"] = state->appVersion_;
+    *json = make_string(options.dump());
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_product_id(NabtoClientConnection* connection, const char* productId)
+{
+    return set_string(connection, &ConnectionState::productId_, productId);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_device_id(NabtoClientConnection* connection, const char* deviceId)
+{
+    return set_string(connection, &ConnectionState::deviceId_, deviceId);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_server_api_key(NabtoClientConnection* connection, const char* serverApiKey)
+{
+    return set_string(connection, &ConnectionState::serverKey_, serverApiKey);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_server_key(NabtoClientConnection* connection, const char* serverKey)
+{
+    return set_string(connection, &ConnectionState::serverKey_, serverKey);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_server_jwt_token(NabtoClientConnection* connection, const char* jwt)
+{
+    return set_string(connection, &ConnectionState::jwt_, jwt);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_server_connect_token(NabtoClientConnection* connection, const char* sct)
+{
+    return set_string(connection, &ConnectionState::sct_, sct);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_application_name(NabtoClientConnection* connection, const char* appName)
+{
+    return set_string(connection, &ConnectionState::appName_, appName);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_application_version(NabtoClientConnection* connection, const char* appVersion)
+{
+    return set_string(connection, &ConnectionState::appVersion_, appVersion);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_server_url(NabtoClientConnection* connection, const char* endpoint)
+{
+    return set_string(connection, &ConnectionState::serverUrl_, endpoint);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_private_key(NabtoClientConnection* connection, const char* privateKey)
+{
+    return set_string(connection, &ConnectionState::privateKey_, privateKey);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_set_certificate(NabtoClientConnection* connection, const char* certificate)
+{
+    (void)connection;
+    (void)certificate;
+    return EC_OK;
+}
+
+static NabtoClientError device_fingerprint(NabtoClientConnection* connection, char** fingerprintHex, size_t length)
+{
+    auto state = connection->state_;
+    std::shared_ptr<Device> device;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex_);
+        if (state->state_ == ConnectionState::CLOSED) {
+            return EC_STOPPED;
+        }
+        if (state->state_ != ConnectionState::CONNECTED) {
+            return EC_NOT_CONNECTED;
+        }
+    }
+    device = state->device();
+    *fingerprintHex = make_string(device->fingerprint().substr(0, length));
+    return EC_OK;
+}
+
+static NabtoClientError client_fingerprint(NabtoClientConnection* connection, char** fingerprintHex, size_t length)
+{
+    auto state = connection->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    if (state->privateKey_.empty()) {
+        return EC_INVALID_STATE;
+    }
+    *fingerprintHex = make_string(fingerprint_of(state->privateKey_).substr(0, length));
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_device_fingerprint(NabtoClientConnection* connection, char** fingerprintHex)
+{
+    return device_fingerprint(connection, fingerprintHex, 64);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_device_fingerprint_hex(NabtoClientConnection* connection, char** fingerprintHex)
+{
+    return device_fingerprint(connection, fingerprintHex, 32);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_device_fingerprint_full_hex(NabtoClientConnection* connection, char** fingerprintHex)
+{
+    return device_fingerprint(connection, fingerprintHex, 64);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_client_fingerprint(NabtoClientConnection* connection, char** fingerprintHex)
+{
+    return client_fingerprint(connection, fingerprintHex, 64);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_client_fingerprint_hex(NabtoClientConnection* connection, char** fingerprintHex)
+{
+    return client_fingerprint(connection, fingerprintHex, 32);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_client_fingerprint_full_hex(NabtoClientConnection* connection, char** fingerprintHex)
+{
+    return client_fingerprint(connection, fingerprintHex, 64);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_type(NabtoClientConnection* connection, NabtoClientConnectionType* type)
+{
+    auto state = connection->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    if (state->state_ == ConnectionState::CLOSED) {
+        return EC_STOPPED;
+    }
+    if (state->state_ != ConnectionState::CONNECTED) {
+        return EC_NOT_CONNECTED;
+    }
+    *type = state->type_;
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_enable_direct_candidates(NabtoClientConnection* connection)
+{
+    STANDIN_SETUP_PHASE(connection);
+    connection->state_->directCandidatesEnabled_ = true;
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_add_direct_candidate(NabtoClientConnection* connection, const char* hostname, uint16_t port)
+{
+    if (hostname == NULL || port == 0) {
+        return EC_INVALID_ARGUMENT;
+    }
+    auto state = connection->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    state->directCandidates_.push_back(std::make_pair(std::string(hostname), port));
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_end_of_direct_candidates(NabtoClientConnection* connection)
+{
+    (void)connection;
+    return EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_connection_connect(NabtoClientConnection* connection, NabtoClientFuture* future)
+{
+    connection->state_->connect(future);
+}
+
+void NABTO_CLIENT_API nabto_client_connection_close(NabtoClientConnection* connection, NabtoClientFuture* future)
+{
+    connection->state_->close(future);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_local_channel_error_code(NabtoClientConnection* connection)
+{
+    std::lock_guard<std::mutex> lock(connection->state_->mutex_);
+    return connection->state_->localError_;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_remote_channel_error_code(NabtoClientConnection* connection)
+{
+    std::lock_guard<std::mutex> lock(connection->state_->mutex_);
+    return connection->state_->remoteError_;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_direct_candidates_channel_error_code(NabtoClientConnection* connection)
+{
+    std::lock_guard<std::mutex> lock(connection->state_->mutex_);
+    return connection->state_->directError_;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_get_info(NabtoClientConnection* connection, char** json)
+{
+    *json = make_string(connection->state_->info());
+    return EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_connection_password_authenticate(NabtoClientConnection* connection, const char* username, const char* password, NabtoClientFuture* future)
+{
+    connection->state_->passwordAuthenticate(username ? username : "", password ? password : "", future);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_connection_events_init_listener(NabtoClientConnection* connection, NabtoClientListener* listener)
+{
+    if (!listener->state_->init(ListenerState::CONNECTION_EVENTS)) {
+        return EC_INVALID_STATE;
+    }
+    connection->state_->addListener(listener->state_);
+    return EC_OK;
+}
+
+NabtoClientStream* NABTO_CLIENT_API nabto_client_stream_new(NabtoClientConnection* connection)
+{
+    NabtoClientStream* stream = new NabtoClientStream_();
+    stream->state_ = std::make_shared<StreamState>(connection->state_);
+    connection->state_->addStream(stream->state_);
+    connection->state_->core_->addStoppable(stream->state_);
+    return stream;
+}
+
+void NABTO_CLIENT_API nabto_client_stream_free(NabtoClientStream* stream)
+{
+    if (stream == NULL) {
+        return;
+    }
+    stream->state_->stop();
+    delete stream;
+}
+
+void NABTO_CLIENT_API nabto_client_stream_abort(NabtoClientStream* stream)
+{
+    stream->state_->stop();
+}
+
+void NABTO_CLIENT_API nabto_client_stream_stop(NabtoClientStream* stream)
+{
+    stream->state_->stop();
+}
+
+void NABTO_CLIENT_API nabto_client_stream_open(NabtoClientStream* stream, NabtoClientFuture* future, uint32_t port)
+{
+    stream->state_->open(future, port);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_read_all(NabtoClientStream* stream, NabtoClientFuture* future, void* buffer, size_t bufferLength, size_t* readLength)
+{
+    stream->state_->read(future, buffer, bufferLength, readLength, true);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_read_some(NabtoClientStream* stream, NabtoClientFuture* future, void* buffer, size_t bufferLength, size_t* readLength)
+{
+    stream->state_->read(future, buffer, bufferLength, readLength, false);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_write(NabtoClientStream* stream, NabtoClientFuture* future, const void* buffer, size_t bufferLength)
+{
+    stream->state_->write(future, buffer, bufferLength);
+}
+
+void NABTO_CLIENT_API nabto_client_stream_close(NabtoClientStream* stream, NabtoClientFuture* future)
+{
+    stream->state_->close(future);
+}
+
+NabtoClientCoap* NABTO_CLIENT_API nabto_client_coap_new(NabtoClientConnection* connection, const char* method, const char* path)
+{
+    if (method == NULL || path == NULL) {
+        return NULL;
+    }
+    NabtoClientCoap* coap = new NabtoClientCoap_();
+    coap->state_ = std::make_shared<CoapState>();
+    coap->state_->connection_ = connection->state_;
+    coap->state_->request_.method_ = method;
+    coap->state_->request_.path_ = path;
+    return coap;
+}
+
+void NABTO_CLIENT_API nabto_client_coap_free(NabtoClientCoap* coap)
+{
+    if (coap == NULL) {
+        return;
+    }
+    nabto_client_coap_stop(coap);
+    delete coap;
+}
+
+void NABTO_CLIENT_API nabto_client_coap_stop(NabtoClientCoap* coap)
+{
+    auto state = coap->state_;
+    NabtoClientFuture* future;
+    uint64_t op;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex_);
+        future = state->future_;
+        op = state->op_;
+        state->future_ = nullptr;
+    }
+    if (future) {
+        state->connection_->core_->resolve(future, op, EC_STOPPED);
+    }
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_set_request_payload(NabtoClientCoap* coap, uint16_t contentFormat, const void* payload, size_t payloadLength)
+{
+    auto state = coap->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    const uint8_t* begin = static_cast<const uint8_t*>(payload);
+    state->request_.contentFormat_ = contentFormat;
+    state->request_.payload_.assign(begin, begin + payloadLength);
+    return EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_coap_execute(NabtoClientCoap* coap, NabtoClientFuture* future)
+{
+    auto state = coap->state_;
+    auto connection = state->connection_;
+    auto core = connection->core_;
+    uint64_t op = core->arm(future);
+    if (!op) {
+        return;
+    }
+    if (!connection->isConnected()) {
+        core->resolve(future, op, EC_NOT_CONNECTED);
+        return;
+    }
+    CoapRequest request;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex_);
+        if (state->future_ != nullptr) {
+            core->resolve(future, op, EC_OPERATION_IN_PROGRESS);
+            return;
+        }
+        state->future_ = future;
+        state->op_ = op;
+        state->hasResponse_ = false;
+        request = state->request_;
+    }
+    core->executor_->post([state, connection, core, request, future, op]() {
+        CoapResponse response = connection->device()->handleCoap(request, connection->clientAuth());
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            if (state->future_ != future || state->op_ != op) {
+                return;
+            }
+            state->future_ = nullptr;
+        }
+        core->resolve(future, op, EC_OK, [state, response]() {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            state->response_ = response;
+            state->hasResponse_ = true;
+        });
+    }, round_trip());
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_get_response_status_code(NabtoClientCoap* coap, uint16_t* statusCode)
+{
+    auto state = coap->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    if (!state->hasResponse_) {
+        return EC_INVALID_STATE;
+    }
+    *statusCode = state->response_.status_;
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_get_response_content_format(NabtoClientCoap* coap, uint16_t* contentType)
+{
+    auto state = coap->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    if (!state->hasResponse_) {
+        return EC_INVALID_STATE;
+    }
+    if (state->response_.contentFormat_ < 0) {
+        return EC_NO_DATA;
+    }
+    *contentType = static_cast<uint16_t>(state->response_.contentFormat_);
+    return EC_OK;
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_coap_get_response_payload(NabtoClientCoap* coap, void** payload, size_t* payloadLength)
+{
+    auto state = coap->state_;
+    std::lock_guard<std::mutex> lock(state->mutex_);
+    if (!state->hasResponse_) {
+        return EC_INVALID_STATE;
+    }
+    if (state->response_.payload_.empty()) {
+        return EC_NO_DATA;
+    }
+    *payload = state->response_.payload_.data();
+    *payloadLength = state->response_.payload_.size();
+    return EC_OK;
+}
+
+} // extern "C"
@@ -0,0 +1,744 @@
+#include "standin.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using json = nlohmann::json;
+using namespace standin;
+
+namespace standin {
+
+static const uint16_t CONTENT_FORMAT_APPLICATION_CBOR = 60;
+
+static const char* defaultProductId = "pr-standin";
+static const char* defaultDeviceId = "de-standin";
+
+static CoapResponse status(uint16_t code)
+{
+    CoapResponse response;
+    response.status_ = code;
+    return response;
+}
+
+static CoapResponse error(uint16_t code, const std::string& reason)
+{
+    CoapResponse response;
+    response.status_ = code;
+    response.contentFormat_ = 0;
+    response.payload_.assign(reason.begin(), reason.end());
+    return response;
+}
+
+static CoapResponse cbor(const json& value)
+{
+    CoapResponse response;
+    response.status_ = 205;
+    response.contentFormat_ = CONTENT_FORMAT_APPLICATION_CBOR;
+    response.payload_ = json::to_cbor(value);
+    return response;
+}
+
+static bool parse_cbor(const CoapRequest& request, json& out)
+{
+    if (request.contentFormat_ != CONTENT_FORMAT_APPLICATION_CBOR) {
+        return false;
+    }
+    out = json::from_cbor(request.payload_, true, false);
+    return !out.is_discarded();
+}
+
+static std::vector<std::string> split_path(const std::string& path)
+{
+    std::vector<std::string> segments;
+    std::stringstream ss(path);
+    std::string segment;
+    while (std::getline(ss, segment, '/')) {
+        if (!segment.empty()) {
+            segments.push_back(segment);
+        }
+    }
+    return segments;
+}
+
+static json user_to_json(const User& user)
+{
+    json j;
+    j["Username"] = user.username_;
+    j["Role"] = user.role_;
+    j["Sct"] = user.sct_;
+    j["Fingerprints"] = json::array();
+    for (auto& f : user.fingerprints_) {
+        j["Fingerprints"].push_back({{"Fingerprint", f}, {"Name", ""}});
+    }
+    if (!user.fingerprints_.empty()) {
+        j["Fingerprint"] = user.fingerprints_.front();
+    }
+    return j;
+}
+
+Device::Device(const std::string& productId, const std::string& deviceId, const std::string& password)
+    : productId_(productId), deviceId_(deviceId), friendlyName_("Tcp Tunnel " + deviceId),
+      passwordOpenPassword_(password), passwordOpenSct_(random_hex(6))
+{
+}
+
+std::string Device::fingerprint() const
+{
+    return fingerprint_of("device:" + productId_ + "." + deviceId_);
+}
+
+CoapResponse Device::handleCoap(const CoapRequest& request, const ClientAuth& client)
+{
+    CoapResponse response;
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        User* me = findUserByFingerprint(client.fingerprint_);
+        if (request.path_.compare(0, 5, "/iam/") == 0) {
+            response = handleIam(request, client, me);
+        } else if (request.path_.compare(0, 13, "/tcp-tunnels/") == 0) {
+            response = me ? handleTunnels(request) : status(403);
+        } else {
+            response = status(404);
+        }
+        changed = changed_;
+        changed_ = false;
+    }
+    // Saving takes the registry lock which is taken before the device lock.
+    if (changed) {
+        Registry::instance().save();
+    }
+    return response;
+}
+
+CoapResponse Device::handleIam(const CoapRequest& request, const ClientAuth& client, User* me)
+{
+    auto path = split_path(request.path_);
+    const std::string& method = request.method_;
+    bool admin = me && me->role_ == "Administrator";
+
+    if (path.size() == 2 && path[1] == "pairing" && method == "GET") {
+        json pairing;
+        json modes = json::array();
+        if (users_.empty()) {
+            modes.push_back("LocalInitial");
+        }
+        if (localOpenPairing_) {
+            modes.push_back("LocalOpen");
+        }
+        if (passwordOpenPairing_) {
+            modes.push_back("PasswordOpen");
+        }
+        for (auto& u : users_) {
+            if (!u.password_.empty()) {
+                modes.push_back("PasswordInvite");
+                break;
+            }
+        }
+        pairing["Modes"] = modes;
+        pairing["NabtoVersion"] = nabto_client_version();
+        pairing["AppName"] = "Tcp Tunnel";
+        pairing["AppVersion"] = "standin";
+        pairing["ProductId"] = productId_;
+        pairing["DeviceId"] = deviceId_;
+        pairing["FriendlyName"] = friendlyName_;
+        return cbor(pairing);
+    }
+
+    if (path.size() == 3 && path[1] == "pairing" && method == "POST") {
+        if (me) {
+            return status(201);
+        }
+        const std::string& mode = path[2];
+        if (mode == "local-initial") {
+            if (!users_.empty()) {
+                return error(403, "The device already has an initial user");
+            }
+            User user = createUser("admin", "Administrator");
+            user.fingerprints_.push_back(client.fingerprint_);
+            users_.push_back(user);
+            changed();
+            return status(201);
+        }
+        if (mode == "password-invite") {
+            if (!client.passwordAuthenticated_ || client.passwordUsername_.empty()) {
+                return error(401, "Password authentication required");
+            }
+            User* user = findUser(client.passwordUsername_);
+            if (!user) {
+                return status(404);
+            }
+            user->fingerprints_.push_back(client.fingerprint_);
+            user->password_.clear();
+            changed();
+            return status(201);
+        }
+        if ((mode == "local-open" && localOpenPairing_) || (mode == "password-open" && passwordOpenPairing_)) {
+            if (mode == "password-open" && (!client.passwordAuthenticated_ || !client.passwordUsername_.empty())) {
+                return error(401, "Password authentication required");
+            }
+            json root;
+            if (!parse_cbor(request, root) || !root.is_object() || !root.contains("Username") || !root["Username"].is_string()) {
+                return error(400, "Missing Username");
+            }
+            std::string username = root["Username"].get<std::string>();
+            if (findUser(username)) {
+                return error(409, "The username is in use");
+            }
+            User user = createUser(username, "Standard");
+            user.fingerprints_.push_back(client.fingerprint_);
+            users_.push_back(user);
+            changed();
+            return status(201);
+        }
+        return status(403);
+    }
+
+    if (path.size() == 2 && path[1] == "me" && method == "GET") {
+        return me ? cbor(user_to_json(*me)) : status(404);
+    }
+
+    if (!admin) {
+        return status(403);
+    }
+
+    if (path.size() == 2 && path[1] == "users") {
+        if (method == "GET") {
+            json users = json::array();
+            for (auto& u : users_) {
+                users.push_back(u.username_);
+            }
+            return cbor(users);
+        }
+        if (method == "POST") {
+            json root;
+            if (!parse_cbor(request, root) || !root.is_object() || !root.contains("Username") || !root["Username"].is_string()) {
+                return error(400, "Missing Username");
+            }
+            std::string username = root["Username"].get<std::string>();
+            if (findUser(username)) {
+                return error(409, "The username is in use");
+            }
+            User user = createUser(username, "");
+            users_.push_back(user);
+            changed();
+            CoapResponse response = cbor(user_to_json(user));
+            response.status_ = 201;
+            return response;
+        }
+    }
+
+    if (path.size() >= 3 && path[1] == "users") {
+        User* user = findUser(path[2]);
+        if (!user) {
+            return status(404);
+        }
+        if (path.size() == 3 && method == "GET") {
+            return cbor(user_to_json(*user));
+        }
+        if (path.size() == 3 && method == "DELETE") {
+            std::string username = user->username_;
+            for (auto it = users_.begin(); it != users_.end(); ++it) {
+                if (it->username_ == username) {
+                    users_.erase(it);
+                    break;
+                }
+            }
+            changed();
+            return status(202);
+        }
+        if (path.size() == 4 && method == "PUT" && (path[3] == "role" || path[3] == "password")) {
+            json root;
+            if (!parse_cbor(request, root) || !root.is_string()) {
+                return status(400);
+            }
+            if (path[3] == "role") {
+                user->role_ = root.get<std::string>();
+            } else {
+                user->password_ = root.get<std::string>();
+            }
+            changed();
+            return status(204);
+        }
+        return status(405);
+    }
+
+    if (path.size() == 2 && path[1] == "roles" && method == "GET") {
+        return cbor(json::array({"Unpaired", "Guest", "Standard", "Administrator"}));
+    }
+
+    if (path.size() == 2 && path[1] == "settings" && method == "GET") {
+        json settings;
+        settings["LocalOpenPairing"] = localOpenPairing_;
+        settings["PasswordOpenPairing"] = passwordOpenPairing_;
+        settings["PasswordOpenPassword"] = passwordOpenPassword_;
+        settings["PasswordOpenSct"] = passwordOpenSct_;
+        return cbor(settings);
+    }
+
+    if (path.size() == 3 && path[1] == "settings" && method == "PUT") {
+        json root;
+        if (!parse_cbor(request, root) || !root.is_boolean()) {
+            return status(400);
+        }
+        if (path[2] == "local-open-pairing") {
+            localOpenPairing_ = root.get<bool>();
+        } else if (path[2] == "password-open-pairing") {
+            passwordOpenPairing_ = root.get<bool>();
+        } else {
+            return status(404);
+        }
+        changed();
+        return status(204);
+    }
+
+    if (path.size() == 3 && path[1] == "device-info" && path[2] == "friendly-name" && method == "PUT") {
+        json root;
+        if (!parse_cbor(request, root) || !root.is_string()) {
+            return status(400);
+        }
+        friendlyName_ = root.get<std::string>();
+        changed();
+        return status(204);
+    }
+
+    return status(404);
+}
+
+CoapResponse Device::handleTunnels(const CoapRequest& request)
+{
+    auto path = split_path(request.path_);
+    if (request.method_ != "GET" || path.size() < 2 || path[1] != "services") {
+        return status(404);
+    }
+    if (path.size() == 2) {
+        json ids = json::array();
+        for (auto& s : services_) {
+            ids.push_back(s.first);
+        }
+        return cbor(ids);
+    }
+    auto it = services_.find(path[2]);
+    if (path.size() != 3 || it == services_.end()) {
+        return status(404);
+    }
+    json service;
+    service["Id"] = it->second.id_;
+    service["Type"] = it->second.type_;
+    service["Host"] = it->second.host_;
+    service["Port"] = it->second.port_;
+    service["StreamPort"] = 0;
+    return cbor(service);
+}
+
+bool Device::passwordAuthenticate(const std::string& username, const std::string& password)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (username.empty()) {
+        return passwordOpenPairing_ && !password.empty() && password == passwordOpenPassword_;
+    }
+    User* user = findUser(username);
+    return user && !user->password_.empty() && user->password_ == password;
+}
+
+bool Device::findService(const std::string& id, Service& service)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = services_.find(id);
+    if (it == services_.end()) {
+        return false;
+    }
+    service = it->second;
+    return true;
+}
+
+bool Device::isPaired(const std::string& fingerprint)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return findUserByFingerprint(fingerprint) != nullptr;
+}
+
+void Device::addService(const Service& service)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    services_[service.id_] = service;
+}
+
+void Device::addUser(const User& user)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    User* existing = findUser(user.username_);
+    if (existing) {
+        *existing = user;
+    } else {
+        users_.push_back(user);
+    }
+}
+
+std::string Device::getFriendlyName()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return friendlyName_;
+}
+
+void Device::setFriendlyName(const std::string& friendlyName)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    friendlyName_ = friendlyName;
+}
+
+void Device::loadState(const std::string& str)
+{
+    json j = json::parse(str, nullptr, false);
+    if (!j.is_object()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    friendlyName_ = j.value("FriendlyName", friendlyName_);
+    localOpenPairing_ = j.value("LocalOpenPairing", localOpenPairing_);
+    passwordOpenPairing_ = j.value("PasswordOpenPairing", passwordOpenPairing_);
+    passwordOpenPassword_ = j.value("PasswordOpenPassword", passwordOpenPassword_);
+    passwordOpenSct_ = j.value("PasswordOpenSct", passwordOpenSct_);
+    users_.clear();
+    if (j.contains("Users") && j["Users"].is_array()) {
+        for (auto& u : j["Users"]) {
+            User user;
+            user.username_ = u.value("Username", "");
+            user.role_ = u.value("Role", "");
+            user.sct_ = u.value("Sct", "");
+            user.password_ = u.value("Password", "");
+            user.fingerprints_ = u.value("Fingerprints", std::vector<std::string>());
+            users_.push_back(user);
+        }
+    }
+}
+
+std::string Device::saveState()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    json j;
+    j["ProductId"] = productId_;
+    j["DeviceId"] = deviceId_;
+    j["FriendlyName"] = friendlyName_;
+    j["LocalOpenPairing"] = localOpenPairing_;
+    j["PasswordOpenPairing"] = passwordOpenPairing_;
+    j["PasswordOpenPassword"] = passwordOpenPassword_;
+    j["PasswordOpenSct"] = passwordOpenSct_;
+    j["Users"] = json::array();
+    for (auto& u : users_) {
+        j["Users"].push_back({
+                {"Username", u.username_},
+                {"Role", u.role_},
+                {"Sct", u.sct_},
+                {"Password", u.password_},
+                {"Fingerprints", u.fingerprints_}});
+    }
+    return j.dump();
+}
+
+User* Device::findUserByFingerprint(const std::string& fingerprint)
+{
+    for (auto& u : users_) {
+        for (auto& f : u.fingerprints_) {
+            if (f == fingerprint) {
+                return &u;
+            }
+        }
+    }
+    return nullptr;
+}
+
+User* Device::findUser(const std::string& username)
+{
+    for (auto& u : users_) {
+        if (u.username_ == username) {
+            return &u;
+        }
+    }
+    return nullptr;
+}
+
+User Device::createUser(const std::string& username, const std::string& role)
+{
+    User user;
+    user.username_ = username;
+    user.role_ = role;
+    user.sct_ = random_hex(6);
+    return user;
+}
+
+// The caller holds the lock, the state is saved when it is released.
+void Device::changed()
+{
+    changed_ = true;
+}
+
+Registry& Registry::instance()
+{
+    static Registry registry;
+    return registry;
+}
+
+Registry::Registry()
+    : latency_(0), pairingPassword_("standin")
+{
+    const char* latency = getenv("NABTO_STANDIN_LATENCY_MS");
+    if (latency) {
+        latency_ = std::chrono::milliseconds(atoi(latency));
+    }
+    const char* password = getenv("NABTO_STANDIN_PASSWORD");
+    if (password) {
+        pairingPassword_ = password;
+    }
+    const char* services = getenv("NABTO_STANDIN_SERVICES");
+    if (services) {
+        // ssh=127.0.0.1:22,http=127.0.0.1:80
+        std::stringstream ss(services);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            size_t eq = item.find('=');
+            size_t colon = item.rfind(':');
+            if (eq == std::string::npos || colon == std::string::npos || colon < eq) {
+                continue;
+            }
+            Service s;
+            s.id_ = item.substr(0, eq);
+            s.type_ = s.id_;
+            s.host_ = item.substr(eq + 1, colon - eq - 1);
+            s.port_ = static_cast<uint16_t>(atoi(item.substr(colon + 1).c_str()));
+            defaultServices_.push_back(s);
+        }
+    }
+    const char* state = getenv("NABTO_STANDIN_STATE");
+    if (state) {
+        statePath_ = state;
+        std::ifstream file(statePath_);
+        json j = json::parse(file, nullptr, false);
+        if (j.is_object() && j.contains("Devices") && j["Devices"].is_array()) {
+            for (auto& d : j["Devices"]) {
+                savedStates_[std::make_pair(d.value("ProductId", ""), d.value("DeviceId", ""))] = d.dump();
+            }
+        }
+    }
+    create(defaultProductId, defaultDeviceId);
+}
+
+std::shared_ptr<Device> Registry::find(const std::string& productId, const std::string& deviceId, bool create)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = devices_.find(std::make_pair(productId, deviceId));
+    if (it != devices_.end()) {
+        return it->second;
+    }
+    if (!create) {
+        return nullptr;
+    }
+    return this->create(productId, deviceId);
+}
+
+std::shared_ptr<Device> Registry::defaultDevice()
+{
+    return find(defaultProductId, defaultDeviceId, true);
+}
+
+std::vector<std::shared_ptr<Device> > Registry::devices()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<Device> > out;
+    for (auto& d : devices_) {
+        out.push_back(d.second);
+    }
+    return out;
+}
+
+void Registry::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto key = std::make_pair(std::string(defaultProductId), std::string(defaultDeviceId));
+    auto device = devices_[key];
+    devices_.clear();
+    devices_[key] = device;
+}
+
+void Registry::save()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (statePath_.empty()) {
+        return;
+    }
+    json root;
+    root["Devices"] = json::array();
+    for (auto& d : devices_) {
+        root["Devices"].push_back(json::parse(d.second->saveState()));
+    }
+    std::ofstream file(statePath_);
+    file << root.dump(2);
+}
+
+std::chrono::milliseconds Registry::latency()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latency_;
+}
+
+void Registry::setLatency(std::chrono::milliseconds latency)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    latency_ = latency;
+}
+
+std::string Registry::pairingPassword()
+{
+    return pairingPassword_;
+}
+
+void Registry::addMdnsListener(std::weak_ptr<ListenerState> listener)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    mdnsListeners_.push_back(listener);
+}
+
+NabtoClientMdnsResult* Registry::mdnsResult(const Device& device, const std::string& friendlyName)
+{
+    NabtoClientMdnsResult* result = new NabtoClientMdnsResult_();
+    result->productId_ = device.productId_;
+    result->deviceId_ = device.deviceId_;
+    result->serviceInstanceName_ = device.productId_ + "-" + device.deviceId_ + "._nabto._udp.local";
+    json txt;
+    txt["productid"] = device.productId_;
+    txt["deviceid"] = device.deviceId_;
+    txt["fn"] = friendlyName;
+    result->txtItems_ = txt.dump();
+    result->action_ = NABTO_CLIENT_MDNS_ACTION_ADD;
+    return result;
+}
+
+// The caller holds the lock.
+std::shared_ptr<Device> Registry::create(const std::string& productId, const std::string& deviceId)
+{
+    auto key = std::make_pair(productId, deviceId);
+    auto device = std::make_shared<Device>(productId, deviceId, pairingPassword_);
+    for (auto& s : defaultServices_) {
+        device->addService(s);
+    }
+    auto saved = savedStates_.find(key);
+    if (saved != savedStates_.end()) {
+        device->loadState(saved->second);
+    }
+    devices_[key] = device;
+
+    std::vector<std::weak_ptr<ListenerState> > alive;
+    for (auto& l : mdnsListeners_) {
+        auto listener = l.lock();
+        if (listener) {
+            listener->pushMdnsResult(mdnsResult(*device, device->getFriendlyName()));
+            alive.push_back(l);
+        }
+    }
+    mdnsListeners_.swap(alive);
+    return device;
+}
+
+} // namespace
+
+extern "C" {
+
+NabtoClientError NABTO_CLIENT_API nabto_client_mdns_resolver_init_listener(NabtoClient* client, NabtoClientListener* listener, const char* subtype)
+{
+    // Every stand-in device is a tcp tunnel device.
+    if (!listener->state_->init(ListenerState::MDNS)) {
+        return EC_INVALID_STATE;
+    }
+    std::string st = subtype ? subtype : "";
+    if (!st.empty() && st != "tcptunnel") {
+        return EC_OK;
+    }
+    auto state = listener->state_;
+    client->core_->executor_->post([state]() {
+        auto& registry = Registry::instance();
+        for (auto& device : registry.devices()) {
+            state->pushMdnsResult(Registry::mdnsResult(*device, device->getFriendlyName()));
+        }
+        registry.addMdnsListener(state);
+    }, Registry::instance().latency());
+    return EC_OK;
+}
+
+void NABTO_CLIENT_API nabto_client_listener_new_mdns_result(NabtoClientListener* listener, NabtoClientFuture* future, NabtoClientMdnsResult** mdnsResult)
+{
+    listener->state_->nextMdnsResult(future, mdnsResult);
+}
+
+void NABTO_CLIENT_API nabto_client_mdns_result_free(NabtoClientMdnsResult* result)
+{
+    delete result;
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_device_id(NabtoClientMdnsResult* result)
+{
+    return result->deviceId_.c_str();
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_product_id(NabtoClientMdnsResult* result)
+{
+    return result->productId_.c_str();
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_service_instance_name(NabtoClientMdnsResult* result)
+{
+    return result->serviceInstanceName_.c_str();
+}
+
+const char* NABTO_CLIENT_API nabto_client_mdns_result_get_txt_items(NabtoClientMdnsResult* result)
+{
+    return result->txtItems_.c_str();
+}
+
+NabtoClientMdnsAction NABTO_CLIENT_API nabto_client_mdns_result_get_action(NabtoClientMdnsResult* result)
+{
+    return result->action_;
+}
+
+void NABTO_CLIENT_API nabto_client_standin_add_device(const char* productId, const char* deviceId, const char* friendlyName)
+{
+    auto device = Registry::instance().find(productId, deviceId, true);
+    if (friendlyName) {
+        device->setFriendlyName(friendlyName);
+    }
+}
+
+void NABTO_CLIENT_API nabto_client_standin_add_service(const char* productId, const char* deviceId, const char* serviceId, const char* host, uint16_t port)
+{
+    Service service;
+    service.id_ = serviceId;
+    service.type_ = serviceId;
+    service.host_ = host;
+    service.port_ = port;
+    Registry::instance().find(productId, deviceId, true)->addService(service);
+}
+
+void NABTO_CLIENT_API nabto_client_standin_add_user(const char* productId, const char* deviceId, const char* username, const char* privateKey)
+{
+    User user;
+    user.username_ = username;
+    user.role_ = "Administrator";
+    user.sct_ = random_hex(6);
+    user.fingerprints_.push_back(fingerprint_of(privateKey));
+    Registry::instance().find(productId, deviceId, true)->addUser(user);
+    Registry::instance().save();
+}
+
+void NABTO_CLIENT_API nabto_client_standin_set_latency(uint32_t milliseconds)
+{
+    Registry::instance().setLatency(std::chrono::milliseconds(milliseconds));
+}
+
+void NABTO_CLIENT_API nabto_client_standin_reset(void)
+{
+    Registry::instance().reset();
+}
+
+} // extern "C"
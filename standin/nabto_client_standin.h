@@ -0,0 +1,74 @@
+#ifndef NABTO_CLIENT_STANDIN_H
+#define NABTO_CLIENT_STANDIN_H
+
+#include <nabto/nabto_client.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Stand-in for the Nabto Edge Client SDK.
+ *
+ * The stand-in implements the nabto_client.h API against fake devices
+ * living in the same process, such that the client and the wrapper
+ * can be built, run and benchmarked without the real SDK, a basestation
+ * or a device. Connections, CoAP requests and streams are handled by
+ * the fake device on the context's own thread, TCP tunnels listen on
+ * loopback and relay the tcp connections to the host and port of the
+ * service like a tcp tunnel device does.
+ *
+ * Every fake device implements the tcptunnel IAM CoAP endpoints and
+ * echoes all data written to streams. A device with the product id
+ * pr-standin and device id de-standin always exists, and any product
+ * id and device id a connection is made to is created on demand.
+ *
+ * Environment variables read when the first device is created:
+ *
+ *   NABTO_STANDIN_SERVICES  Services for all devices, e.g.
+ *                           "ssh=127.0.0.1:22,http=127.0.0.1:80".
+ *   NABTO_STANDIN_LATENCY_MS  One-way latency added to connect, CoAP
+ *                           and stream operations.
+ *   NABTO_STANDIN_PASSWORD  The password for open password pairing.
+ *   NABTO_STANDIN_STATE     File the device IAM state is saved in,
+ *                           such that pairings survive the process.
+ */
+
+/**
+ * Add a device, it is announced through mDNS with the tcptunnel subtype.
+ */
+NABTO_CLIENT_DECL_PREFIX void NABTO_CLIENT_API
+nabto_client_standin_add_device(const char* productId, const char* deviceId, const char* friendlyName);
+
+/**
+ * Add or replace a tcp tunnel service on a device, the device is
+ * created if it does not exist.
+ */
+NABTO_CLIENT_DECL_PREFIX void NABTO_CLIENT_API
+nabto_client_standin_add_service(const char* productId, const char* deviceId, const char* serviceId, const char* host, uint16_t port);
+
+/**
+ * Pair a client private key with a device as an Administrator, such
+ * that connections using the key pass the IAM checks without pairing.
+ */
+NABTO_CLIENT_DECL_PREFIX void NABTO_CLIENT_API
+nabto_client_standin_add_user(const char* productId, const char* deviceId, const char* username, const char* privateKey);
+
+/**
+ * Set the one-way latency in milliseconds of connect, CoAP and stream
+ * operations.
+ */
+NABTO_CLIENT_DECL_PREFIX void NABTO_CLIENT_API
+nabto_client_standin_set_latency(uint32_t milliseconds);
+
+/**
+ * Remove all devices except the default device.
+ */
+NABTO_CLIENT_DECL_PREFIX void NABTO_CLIENT_API
+nabto_client_standin_reset(void);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif
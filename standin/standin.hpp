@@ -0,0 +1,470 @@
+#pragma once
+
+#include <nabto/nabto_client.h>
+#include <nabto/nabto_client_experimental.h>
+#include "nabto_client_standin.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace standin {
+
+enum Error {
+    EC_OK = 0,
+    EC_BAD_RESPONSE,
+    EC_BAD_REQUEST,
+    EC_CLOSED,
+    EC_DNS,
+    EC_EOF,
+    EC_FORBIDDEN,
+    EC_FUTURE_NOT_RESOLVED,
+    EC_INVALID_ARGUMENT,
+    EC_INVALID_STATE,
+    EC_NOT_CONNECTED,
+    EC_NOT_FOUND,
+    EC_NOT_IMPLEMENTED,
+    EC_NO_CHANNELS,
+    EC_NO_DATA,
+    EC_OPERATION_IN_PROGRESS,
+    EC_PARSE,
+    EC_PORT_IN_USE,
+    EC_STOPPED,
+    EC_TIMEOUT,
+    EC_UNKNOWN,
+    EC_NONE,
+    EC_NOT_ATTACHED,
+    EC_TOKEN_REJECTED,
+    EC_COULD_BLOCK,
+    EC_UNAUTHORIZED,
+    EC_TOO_MANY_REQUESTS,
+    EC_UNKNOWN_PRODUCT_ID,
+    EC_UNKNOWN_DEVICE_ID,
+    EC_UNKNOWN_SERVER_KEY,
+    EC_CONNECTION_REFUSED,
+    EC_PRIVILEGED_PORT,
+    EC_DEVICE_INTERNAL_ERROR
+};
+
+enum ConnectionEvent {
+    EVENT_CONNECTED = 0,
+    EVENT_CLOSED = 1,
+    EVENT_CHANNEL_CHANGED = 2
+};
+
+/**
+ * Runs the work of a context, the fake device handling and the
+ * future callbacks on a single thread. Tasks can be delayed to
+ * simulate the latency of the network.
+ */
+class Executor {
+ public:
+    Executor();
+    ~Executor();
+    void post(std::function<void ()> task, std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+    void stop();
+    bool isExecutorThread();
+
+ private:
+    void run();
+
+    class Task {
+     public:
+        std::chrono::steady_clock::time_point due_;
+        uint64_t seq_;
+        std::function<void ()> fn_;
+    };
+    class Later {
+     public:
+        bool operator()(const Task& a, const Task& b) const {
+            return a.due_ > b.due_ || (a.due_ == b.due_ && a.seq_ > b.seq_);
+        }
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::priority_queue<Task, std::vector<Task>, Later> tasks_;
+    uint64_t seq_ = 0;
+    bool stopped_ = false;
+    std::thread thread_;
+};
+
+/**
+ * Objects with async operations which are stopped with the context.
+ */
+class Stoppable {
+ public:
+    virtual ~Stoppable() {}
+    virtual void stop() = 0;
+};
+
+class Core {
+ public:
+    Core();
+    ~Core();
+
+    /**
+     * Start an async operation on a future. Returns the operation id
+     * which is used to resolve it, or 0 if the context is stopped in
+     * which case the future has been resolved with STOPPED.
+     */
+    uint64_t arm(NabtoClientFuture* future);
+
+    /**
+     * Resolve the operation if it is still pending. The output function
+     * is called before the future resolves, such that out parameters
+     * are only written for operations which have not been stopped.
+     */
+    bool resolve(NabtoClientFuture* future, uint64_t op, NabtoClientError ec, const std::function<void ()>& output = nullptr);
+
+    void forget(NabtoClientFuture* future);
+    void addStoppable(std::weak_ptr<Stoppable> stoppable);
+    void stop();
+    bool isStopped();
+
+    void setLogCallback(NabtoClientLogCallback callback, void* data);
+    bool setLogLevel(const std::string& level);
+    void log(NabtoClientLogSeverity severity, const char* module, const std::string& message);
+
+    std::shared_ptr<Executor> executor_;
+
+ private:
+    std::mutex mutex_;
+    std::map<NabtoClientFuture*, uint64_t> pending_;
+    std::vector<std::weak_ptr<Stoppable> > stoppables_;
+    uint64_t nextOp_ = 0;
+    bool stopped_ = false;
+
+    std::mutex logMutex_;
+    NabtoClientLogCallback logCallback_ = nullptr;
+    void* logData_ = nullptr;
+    int logLevel_ = NABTO_CLIENT_LOG_SEVERITY_INFO;
+};
+
+class CoapRequest {
+ public:
+    std::string method_;
+    std::string path_;
+    int contentFormat_ = -1;
+    std::vector<uint8_t> payload_;
+};
+
+class CoapResponse {
+ public:
+    uint16_t status_ = 0;
+    int contentFormat_ = -1;
+    std::vector<uint8_t> payload_;
+};
+
+// What the device knows about the client at the other end of a connection.
+class ClientAuth {
+ public:
+    std::string fingerprint_;
+    bool passwordAuthenticated_ = false;
+    std::string passwordUsername_;
+};
+
+class Service {
+ public:
+    std::string id_;
+    std::string type_;
+    std::string host_;
+    uint16_t port_ = 0;
+};
+
+class User {
+ public:
+    std::string username_;
+    std::string role_;
+    std::string sct_;
+    std::string password_;
+    std::vector<std::string> fingerprints_;
+};
+
+class ListenerState;
+
+class Device {
+ public:
+    Device(const std::string& productId, const std::string& deviceId, const std::string& password);
+
+    std::string fingerprint() const;
+    CoapResponse handleCoap(const CoapRequest& request, const ClientAuth& client);
+    bool passwordAuthenticate(const std::string& username, const std::string& password);
+    bool findService(const std::string& id, Service& service);
+    bool isPaired(const std::string& fingerprint);
+    void addService(const Service& service);
+    void addUser(const User& user);
+    std::string getFriendlyName();
+    void setFriendlyName(const std::string& friendlyName);
+
+    // state file (de)serialization, the registry holds the lock.
+    void loadState(const std::string& json);
+    std::string saveState();
+
+    const std::string productId_;
+    const std::string deviceId_;
+
+ private:
+    CoapResponse handleIam(const CoapRequest& request, const ClientAuth& client, User* me);
+    CoapResponse handleTunnels(const CoapRequest& request);
+    User* findUserByFingerprint(const std::string& fingerprint);
+    User* findUser(const std::string& username);
+    User createUser(const std::string& username, const std::string& role);
+    void changed();
+
+    std::mutex mutex_;
+    bool changed_ = false;
+    std::string friendlyName_;
+    std::map<std::string, Service> services_;
+    std::vector<User> users_;
+    bool localOpenPairing_ = true;
+    bool passwordOpenPairing_ = true;
+    std::string passwordOpenPassword_;
+    std::string passwordOpenSct_;
+};
+
+class Registry {
+ public:
+    static Registry& instance();
+
+    std::shared_ptr<Device> find(const std::string& productId, const std::string& deviceId, bool create);
+    std::shared_ptr<Device> defaultDevice();
+    std::vector<std::shared_ptr<Device> > devices();
+    void reset();
+    void save();
+
+    std::chrono::milliseconds latency();
+    void setLatency(std::chrono::milliseconds latency);
+    std::string pairingPassword();
+
+    // Announce devices created later to an mDNS listener.
+    void addMdnsListener(std::weak_ptr<ListenerState> listener);
+    static NabtoClientMdnsResult* mdnsResult(const Device& device, const std::string& friendlyName);
+
+ private:
+    Registry();
+    std::shared_ptr<Device> create(const std::string& productId, const std::string& deviceId);
+
+    std::mutex mutex_;
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<Device> > devices_;
+    std::vector<Service> defaultServices_;
+    std::chrono::milliseconds latency_;
+    std::string pairingPassword_;
+    std::string statePath_;
+    std::map<std::pair<std::string, std::string>, std::string> savedStates_;
+    std::vector<std::weak_ptr<ListenerState> > mdnsListeners_;
+};
+
+std::string fingerprint_of(const std::string& key);
+std::string random_hex(size_t bytes);
+char* make_string(const std::string& str);
+
+class ConnectionState;
+
+class ListenerState : public Stoppable {
+ public:
+    ListenerState(std::shared_ptr<Core> core);
+    ~ListenerState();
+
+    enum Type { NONE, CONNECTION_EVENTS, MDNS };
+
+    bool init(Type type);
+    void pushEvent(int event);
+    void pushMdnsResult(NabtoClientMdnsResult* result);
+    void nextEvent(NabtoClientFuture* future, NabtoClientConnectionEvent* event);
+    void nextMdnsResult(NabtoClientFuture* future, NabtoClientMdnsResult** result);
+    void stop();
+
+ private:
+    void tryResolve();
+
+    std::shared_ptr<Core> core_;
+    std::mutex mutex_;
+    Type type_ = NONE;
+    bool stopped_ = false;
+    std::deque<int> events_;
+    std::deque<NabtoClientMdnsResult*> mdnsResults_;
+    NabtoClientFuture* future_ = nullptr;
+    uint64_t op_ = 0;
+    NabtoClientConnectionEvent* eventOut_ = nullptr;
+    NabtoClientMdnsResult** mdnsOut_ = nullptr;
+};
+
+class TunnelState;
+class StreamState;
+
+class ConnectionState : public Stoppable, public std::enable_shared_from_this<ConnectionState> {
+ public:
+    ConnectionState(std::shared_ptr<Core> core);
+
+    enum State { SETUP, CONNECTING, CONNECTED, CLOSED };
+
+    void connect(NabtoClientFuture* future);
+    void close(NabtoClientFuture* future);
+    void passwordAuthenticate(const std::string& username, const std::string& password, NabtoClientFuture* future);
+    void addListener(std::weak_ptr<ListenerState> listener);
+    void addTunnel(std::weak_ptr<TunnelState> tunnel);
+    void addStream(std::weak_ptr<StreamState> stream);
+    void stop();
+
+    bool isConnected();
+    std::shared_ptr<Device> device();
+    ClientAuth clientAuth();
+    std::string info();
+
+    std::shared_ptr<Core> core_;
+    std::mutex mutex_;
+    State state_ = SETUP;
+    std::string productId_;
+    std::string deviceId_;
+    std::string privateKey_;
+    std::string serverUrl_;
+    std::string serverKey_;
+    std::string sct_;
+    std::string jwt_;
+    std::string appName_;
+    std::string appVersion_;
+    std::string options_ = "{}";
+    bool directCandidatesEnabled_ = false;
+    std::vector<std::pair<std::string, uint16_t> > directCandidates_;
+    NabtoClientConnectionType type_ = NABTO_CLIENT_CONNECTION_TYPE_DIRECT;
+    NabtoClientError localError_ = EC_NONE;
+    NabtoClientError remoteError_ = EC_NONE;
+    NabtoClientError directError_ = EC_NONE;
+    std::string channel_;
+    std::chrono::steady_clock::time_point connectedAt_;
+
+ private:
+    void pushEvent(int event);
+    void closeChildren();
+
+    std::shared_ptr<Device> device_;
+    bool passwordAuthenticated_ = false;
+    std::string passwordUsername_;
+    std::vector<std::weak_ptr<ListenerState> > listeners_;
+    std::vector<std::weak_ptr<TunnelState> > tunnels_;
+    std::vector<std::weak_ptr<StreamState> > streams_;
+    NabtoClientFuture* future_ = nullptr;
+    uint64_t op_ = 0;
+};
+
+class StreamState : public Stoppable, public std::enable_shared_from_this<StreamState> {
+ public:
+    StreamState(std::shared_ptr<ConnectionState> connection);
+
+    void open(NabtoClientFuture* future, uint32_t port);
+    void read(NabtoClientFuture* future, void* buffer, size_t length, size_t* readLength, bool all);
+    void write(NabtoClientFuture* future, const void* buffer, size_t length);
+    void close(NabtoClientFuture* future);
+    void stop();
+
+ private:
+    void tryRead();
+
+    std::shared_ptr<ConnectionState> connection_;
+    std::shared_ptr<Core> core_;
+    std::mutex mutex_;
+    bool opened_ = false;
+    bool writeClosed_ = false;
+    bool echoClosed_ = false;
+    bool stopped_ = false;
+    std::deque<uint8_t> echo_;
+
+    NabtoClientFuture* readFuture_ = nullptr;
+    uint64_t readOp_ = 0;
+    uint8_t* readBuffer_ = nullptr;
+    size_t readLength_ = 0;
+    size_t* readTransferred_ = nullptr;
+    bool readAll_ = false;
+};
+
+class CoapState {
+ public:
+    std::shared_ptr<ConnectionState> connection_;
+    std::mutex mutex_;
+    CoapRequest request_;
+    bool hasResponse_ = false;
+    CoapResponse response_;
+    NabtoClientFuture* future_ = nullptr;
+    uint64_t op_ = 0;
+};
+
+class TunnelState : public Stoppable, public std::enable_shared_from_this<TunnelState> {
+ public:
+    TunnelState(std::shared_ptr<ConnectionState> connection);
+    ~TunnelState();
+
+    void open(NabtoClientFuture* future, const std::string& service, uint16_t localPort);
+    void close(NabtoClientFuture* future);
+    bool getLocalPort(uint16_t& port);
+    void stop();
+
+ private:
+    NabtoClientError listen(uint16_t localPort);
+    void run();
+    void shutdown();
+
+    std::shared_ptr<ConnectionState> connection_;
+    std::shared_ptr<Core> core_;
+    std::mutex mutex_;
+    bool opened_ = false;
+    Service service_;
+    uint16_t localPort_ = 0;
+    int listenFd_ = -1;
+    int wakeFds_[2] = { -1, -1 };
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+} // namespace
+
+struct NabtoClient_ {
+    std::shared_ptr<standin::Core> core_;
+};
+
+struct NabtoClientFuture_ {
+    std::shared_ptr<standin::Core> core_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool resolved_ = false;
+    NabtoClientError ec_ = standin::EC_FUTURE_NOT_RESOLVED;
+    NabtoClientFutureCallback callback_ = nullptr;
+    void* callbackData_ = nullptr;
+};
+
+struct NabtoClientListener_ {
+    std::shared_ptr<standin::ListenerState> state_;
+};
+
+struct NabtoClientConnection_ {
+    std::shared_ptr<standin::ConnectionState> state_;
+};
+
+struct NabtoClientStream_ {
+    std::shared_ptr<standin::StreamState> state_;
+};
+
+struct NabtoClientTcpTunnel_ {
+    std::shared_ptr<standin::TunnelState> state_;
+};
+
+struct NabtoClientCoap_ {
+    std::shared_ptr<standin::CoapState> state_;
+};
+
+struct NabtoClientMdnsResult_ {
+    std::string productId_;
+    std::string deviceId_;
+    std::string serviceInstanceName_;
+    std::string txtItems_;
+    NabtoClientMdnsAction action_;
+};
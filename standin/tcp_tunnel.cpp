@@ -0,0 +1,386 @@
+#include "standin.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+using namespace standin;
+
+namespace standin {
+
+static const size_t relayBufferSize = 64 * 1024;
+
+// The two tcp connections of a tunnelled connection, side 0 is the
+// client connection accepted on the local port, side 1 the connection
+// to the service.
+class RelayPair {
+ public:
+    int fds_[2] = { -1, -1 };
+    // data read from side i waiting to be written to the other side.
+    std::vector<uint8_t> buffers_[2];
+    bool eof_[2] = { false, false };
+    bool shutdown_[2] = { false, false };
+    bool failed_ = false;
+
+    bool done() const {
+        return failed_ || (eof_[0] && eof_[1] && buffers_[0].empty() && buffers_[1].empty());
+    }
+
+    void close() {
+        for (int i = 0; i < 2; i++) {
+            if (fds_[i] >= 0) {
+                ::close(fds_[i]);
+                fds_[i] = -1;
+            }
+        }
+    }
+};
+
+static void set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int connect_service(const Service& service)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = NULL;
+    std::string port = std::to_string(service.port_);
+    if (getaddrinfo(service.host_.c_str(), port.c_str(), &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        set_nonblocking(fd);
+    }
+    return fd;
+}
+
+TunnelState::TunnelState(std::shared_ptr<ConnectionState> connection)
+    : connection_(connection), core_(connection->core_)
+{
+}
+
+TunnelState::~TunnelState()
+{
+    shutdown();
+}
+
+void TunnelState::open(NabtoClientFuture* future, const std::string& service, uint16_t localPort)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    if (!connection_->isConnected()) {
+        core_->resolve(future, op, EC_NOT_CONNECTED);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (opened_ || stopping_) {
+            core_->resolve(future, op, stopping_ ? EC_STOPPED : EC_INVALID_STATE);
+            return;
+        }
+    }
+    auto self = shared_from_this();
+    core_->executor_->post([self, service, localPort, future, op]() {
+        auto device = self->connection_->device();
+        NabtoClientError ec = EC_OK;
+        Service s;
+        if (!device->isPaired(self->connection_->clientAuth().fingerprint_)) {
+            ec = EC_FORBIDDEN;
+        } else if (!device->findService(service, s)) {
+            ec = EC_NOT_FOUND;
+        } else {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (self->stopping_) {
+                ec = EC_STOPPED;
+            } else {
+                self->service_ = s;
+                ec = self->listen(localPort);
+                if (ec == EC_OK) {
+                    self->opened_ = true;
+                    self->thread_ = std::thread([self]() { self->run(); });
+                }
+            }
+        }
+        self->core_->resolve(future, op, ec);
+    }, Registry::instance().latency() * 2);
+}
+
+void TunnelState::close(NabtoClientFuture* future)
+{
+    uint64_t op = core_->arm(future);
+    if (!op) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!opened_ || stopping_) {
+            core_->resolve(future, op, stopping_ ? EC_STOPPED : EC_INVALID_STATE);
+            return;
+        }
+    }
+    auto self = shared_from_this();
+    core_->executor_->post([self, future, op]() {
+        self->stop();
+        self->core_->resolve(future, op, EC_OK);
+    }, Registry::instance().latency() * 2);
+}
+
+bool TunnelState::getLocalPort(uint16_t& port)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!opened_) {
+        return false;
+    }
+    port = localPort_;
+    return true;
+}
+
+void TunnelState::stop()
+{
+    shutdown();
+}
+
+// The caller holds the lock.
+NabtoClientError TunnelState::listen(uint16_t localPort)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return EC_UNKNOWN;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(localPort);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        NabtoClientError ec = (errno == EACCES) ? EC_PRIVILEGED_PORT : EC_PORT_IN_USE;
+        ::close(fd);
+        return ec;
+    }
+    if (::listen(fd, 64) != 0 || pipe(wakeFds_) != 0) {
+        ::close(fd);
+        return EC_UNKNOWN;
+    }
+    socklen_t length = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &length);
+    localPort_ = ntohs(addr.sin_port);
+    set_nonblocking(fd);
+    listenFd_ = fd;
+    return EC_OK;
+}
+
+void TunnelState::run()
+{
+    std::vector<std::shared_ptr<RelayPair> > pairs;
+    std::vector<struct pollfd> fds;
+    for (;;) {
+        fds.clear();
+        fds.push_back({ wakeFds_[0], POLLIN, 0 });
+        fds.push_back({ listenFd_, POLLIN, 0 });
+        for (auto& p : pairs) {
+            for (int i = 0; i < 2; i++) {
+                short events = 0;
+                if (!p->eof_[i] && p->buffers_[i].size() < relayBufferSize) {
+                    events |= POLLIN;
+                }
+                if (!p->buffers_[1 - i].empty()) {
+                    events |= POLLOUT;
+                }
+                fds.push_back({ p->fds_[i], events, 0 });
+            }
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            int client = accept(listenFd_, NULL, NULL);
+            if (client >= 0) {
+                int one = 1;
+                setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                int service = connect_service(service_);
+                if (service < 0) {
+                    core_->log(NABTO_CLIENT_LOG_SEVERITY_ERROR, "standin", "Could not connect to the service " + service_.id_);
+                    ::close(client);
+                } else {
+                    set_nonblocking(client);
+                    auto p = std::make_shared<RelayPair>();
+                    p->fds_[0] = client;
+                    p->fds_[1] = service;
+                    pairs.push_back(p);
+                }
+            }
+        }
+        size_t index = 2;
+        for (auto& p : pairs) {
+            if (index + 2 > fds.size()) {
+                break;
+            }
+            for (int i = 0; i < 2; i++) {
+                short revents = fds[index + i].revents;
+                if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                    if (!p->eof_[i] && p->buffers_[i].size() < relayBufferSize) {
+                        uint8_t buffer[16384];
+                        size_t space = std::min(sizeof(buffer), relayBufferSize - p->buffers_[i].size());
+                        ssize_t n = recv(p->fds_[i], buffer, space, 0);
+                        if (n > 0) {
+                            p->buffers_[i].insert(p->buffers_[i].end(), buffer, buffer + n);
+                        } else if (n == 0) {
+                            p->eof_[i] = true;
+                        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            p->failed_ = true;
+                        }
+                    } else if (revents & POLLERR) {
+                        p->failed_ = true;
+                    }
+                }
+                std::vector<uint8_t>& out = p->buffers_[1 - i];
+                if ((revents & POLLOUT) && !out.empty()) {
+                    ssize_t n = send(p->fds_[i], out.data(), out.size(), MSG_NOSIGNAL);
+                    if (n > 0) {
+                        out.erase(out.begin(), out.begin() + n);
+                    } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        p->failed_ = true;
+                    }
+                }
+            }
+            // Forward a half close once everything read before it is written.
+            for (int i = 0; i < 2; i++) {
+                if (p->eof_[i] && p->buffers_[i].empty() && !p->shutdown_[i]) {
+                    ::shutdown(p->fds_[1 - i], SHUT_WR);
+                    p->shutdown_[i] = true;
+                }
+            }
+            index += 2;
+        }
+        std::vector<std::shared_ptr<RelayPair> > alive;
+        for (auto& p : pairs) {
+            if (p->done()) {
+                p->close();
+            } else {
+                alive.push_back(p);
+            }
+        }
+        pairs.swap(alive);
+    }
+    for (auto& p : pairs) {
+        p->close();
+    }
+}
+
+void TunnelState::shutdown()
+{
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+        if (wakeFds_[1] >= 0) {
+            char c = 0;
+            if (write(wakeFds_[1], &c, 1) < 0) {
+                // the relay thread is gone already.
+            }
+        }
+        thread.swap(thread_);
+    }
+    if (thread.joinable()) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int* fd : { &listenFd_, &wakeFds_[0], &wakeFds_[1] }) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+} // namespace
+
+extern "C" {
+
+NabtoClientTcpTunnel* NABTO_CLIENT_API nabto_client_tcp_tunnel_new(NabtoClientConnection* connection)
+{
+    NabtoClientTcpTunnel* tunnel = new NabtoClientTcpTunnel_();
+    tunnel->state_ = std::make_shared<TunnelState>(connection->state_);
+    connection->state_->addTunnel(tunnel->state_);
+    connection->state_->core_->addStoppable(tunnel->state_);
+    return tunnel;
+}
+
+void NABTO_CLIENT_API nabto_client_tcp_tunnel_free(NabtoClientTcpTunnel* tunnel)
+{
+    if (tunnel == NULL) {
+        return;
+    }
+    tunnel->state_->stop();
+    delete tunnel;
+}
+
+void NABTO_CLIENT_API nabto_client_tcp_tunnel_stop(NabtoClientTcpTunnel* tunnel)
+{
+    tunnel->state_->stop();
+}
+
+void NABTO_CLIENT_API nabto_client_tcp_tunnel_open(NabtoClientTcpTunnel* tunnel, NabtoClientFuture* future, const char* service, uint16_t localPort)
+{
+    tunnel->state_->open(future, service ? service : "", localPort);
+}
+
+void NABTO_CLIENT_API nabto_client_tcp_tunnel_close(NabtoClientTcpTunnel* tunnel, NabtoClientFuture* future)
+{
+    tunnel->state_->close(future);
+}
+
+NabtoClientError NABTO_CLIENT_API nabto_client_tcp_tunnel_get_local_port(NabtoClientTcpTunnel* tunnel, uint16_t* localPort)
+{
+    if (!tunnel->state_->getLocalPort(*localPort)) {
+        return EC_INVALID_STATE;
+    }
+    return EC_OK;
+}
+
+} // extern "C"
@@ -0,0 +1,185 @@
+#include <nabto_client_reactor.hpp>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * Producers post handlers to the bridge from several threads while an
+ * epoll loop dispatches them. Every handler has to run without the loop
+ * timing out, a timeout with handlers still queued is a lost wakeup.
+ *
+ * Futures watched and connection events listened to through the bridge
+ * are resolved and raised from another thread, as the SDK thread does,
+ * and have to make the fd readable, run their handler on the loop
+ * thread and leave the fd drained.
+ */
+
+static const int rounds = 50;
+static const int producers = 4;
+static const int postsPerProducer = 2000;
+
+// A future resolved by the test in the place of the SDK.
+class ManualFuture : public nabto::client::Future {
+ public:
+    void callback(std::shared_ptr<nabto::client::FutureCallback> cb)
+    {
+        cb_ = cb;
+    }
+    void resolve(int ec)
+    {
+        cb_->run(nabto::client::Status(ec));
+    }
+ private:
+    std::shared_ptr<nabto::client::FutureCallback> cb_;
+};
+
+static bool readable(int fd, int timeoutMs)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, timeoutMs) == 1 && (pfd.revents & POLLIN);
+}
+
+static bool test_post()
+{
+    auto bridge = nabto::client::ReactorBridge::create();
+    if (!bridge) {
+        std::cerr << "Could not create the reactor bridge" << std::endl;
+        return false;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, bridge->fd(), &ev) != 0) {
+        std::cerr << "Could not register the bridge with epoll" << std::endl;
+        return false;
+    }
+
+    // Only touched by handlers, which run on this thread.
+    size_t handled = 0;
+    for (int round = 0; round < rounds; round++) {
+        size_t expected = handled + producers * postsPerProducer;
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; p++) {
+            threads.push_back(std::thread([&bridge, &handled]() {
+                for (int i = 0; i < postsPerProducer; i++) {
+                    bridge->post([&handled]() { handled++; });
+                }
+            }));
+        }
+        while (handled < expected) {
+            epoll_event events[1];
+            int n = epoll_wait(epfd, events, 1, 1000);
+            if (n > 0) {
+                bridge->dispatch();
+            } else if (n == 0) {
+                size_t queued = bridge->dispatch();
+                if (queued > 0) {
+                    std::cerr << "Round " << round << ": the fd was not readable with " << queued << " handlers queued" << std::endl;
+                    for (auto& t : threads) {
+                        t.join();
+                    }
+                    close(epfd);
+                    return false;
+                }
+            }
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+    close(epfd);
+    std::cout << "Dispatched " << handled << " handlers" << std::endl;
+    return true;
+}
+
+static bool test_watch()
+{
+    auto bridge = nabto::client::ReactorBridge::create();
+    auto future = std::make_shared<ManualFuture>();
+    std::thread::id handlerThread;
+    int results = 0;
+    int errorCode = -1;
+    bridge->watch(future, [&](nabto::client::Status status) {
+        handlerThread = std::this_thread::get_id();
+        errorCode = status.getErrorCode();
+        results++;
+    });
+    if (readable(bridge->fd(), 0) || bridge->dispatch() != 0) {
+        std::cerr << "watch: the fd was readable before the future resolved" << std::endl;
+        return false;
+    }
+
+    std::thread sdk([future]() { future->resolve(nabto::client::Status::STOPPED); });
+    sdk.join();
+    if (results != 0) {
+        std::cerr << "watch: the handler ran on the thread resolving the future" << std::endl;
+        return false;
+    }
+    if (!readable(bridge->fd(), 1000)) {
+        std::cerr << "watch: the fd did not become readable when the future resolved" << std::endl;
+        return false;
+    }
+    if (bridge->dispatch() != 1 || results != 1 || errorCode != nabto::client::Status::STOPPED ||
+        handlerThread != std::this_thread::get_id())
+    {
+        std::cerr << "watch: the handler did not run once on the loop thread with the status of the future" << std::endl;
+        return false;
+    }
+    if (readable(bridge->fd(), 0)) {
+        std::cerr << "watch: the fd was not drained by dispatch" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool test_connection_events()
+{
+    typedef nabto::client::ConnectionEventsCallback Events;
+    auto bridge = nabto::client::ReactorBridge::create();
+    std::vector<int> events;
+    auto listener = bridge->connectionEvents([&events](int event) { events.push_back(event); });
+    std::vector<int> raised = { Events::CONNECTED(), Events::CHANNEL_CHANGED(), Events::CLOSED() };
+
+    std::thread sdk([listener, raised]() {
+        for (int event : raised) {
+            listener->onEvent(event);
+        }
+    });
+    sdk.join();
+    if (!events.empty()) {
+        std::cerr << "connectionEvents: the handler ran on the thread raising the events" << std::endl;
+        return false;
+    }
+    if (!readable(bridge->fd(), 1000)) {
+        std::cerr << "connectionEvents: the fd did not become readable on an event" << std::endl;
+        return false;
+    }
+    if (bridge->dispatch() != raised.size() || events != raised) {
+        std::cerr << "connectionEvents: the events were not handled in the order raised" << std::endl;
+        return false;
+    }
+    if (readable(bridge->fd(), 0)) {
+        std::cerr << "connectionEvents: the fd was not drained by dispatch" << std::endl;
+        return false;
+    }
+
+    // The listener outlives the bridge on the connection, events raised
+    // after the bridge is gone are dropped.
+    bridge.reset();
+    listener->onEvent(Events::CLOSED());
+    return events == raised;
+}
+
+int main()
+{
+    if (!test_post() || !test_watch() || !test_connection_events()) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <shaping.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+/**
+ * Sessions of two shaped tunnels each send one chunk before the
+ * forwarder starts, then stay open without sending more. The forwarder
+ * accepts all of them and reads more chunks in one round than it writes
+ * in one, with no socket events to follow. All chunks have to arrive at
+ * the services, a forwarder waiting for socket events after a full
+ * round never sends the rest.
+ */
+
+static const int tunnels = 2;
+static const int sessionsPerTunnel = 48;
+static const size_t chunk = 16384;
+// Longest time without progress before the data is considered stuck.
+static const int stallMs = 5000;
+
+static int listen_loopback(uint16_t& port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0 ||
+        getsockname(fd, (struct sockaddr*)&addr, &length) != 0)
+    {
+        return -1;
+    }
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int connect_loopback(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const std::vector<uint8_t>& data)
+{
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+int main()
+{
+    Shaping::Forwarder forwarder(0);
+    std::vector<int> listenFds;
+    std::vector<int> clients;
+    std::vector<uint8_t> data(chunk, 0x55);
+    for (int t = 0; t < tunnels; t++) {
+        uint16_t servicePort;
+        int listenFd = listen_loopback(servicePort);
+        Shaping::ClassConfig config;
+        config.service_ = "sink" + std::to_string(t);
+        uint16_t port = listenFd < 0 ? 0 : forwarder.addTunnel(config, 0, servicePort);
+        if (port == 0) {
+            std::cerr << "Could not listen for the tunnel " << t << std::endl;
+            return 1;
+        }
+        listenFds.push_back(listenFd);
+        // Queued in the backlog of the forwarder until it starts.
+        for (int i = 0; i < sessionsPerTunnel; i++) {
+            int fd = connect_loopback(port);
+            if (fd < 0 || !send_all(fd, data)) {
+                std::cerr << "Could not send to the forwarder" << std::endl;
+                return 1;
+            }
+            clients.push_back(fd);
+        }
+    }
+    if (!forwarder.start()) {
+        std::cerr << "Could not start the forwarder" << std::endl;
+        return 1;
+    }
+
+    const size_t expected = tunnels * sessionsPerTunnel * chunk;
+    size_t received = 0;
+    std::vector<int> services;
+    std::vector<uint8_t> buffer(65536);
+    while (received < expected) {
+        std::vector<struct pollfd> fds;
+        for (int fd : listenFds) {
+            fds.push_back({ fd, POLLIN, 0 });
+        }
+        for (int fd : services) {
+            fds.push_back({ fd, POLLIN, 0 });
+        }
+        if (poll(fds.data(), fds.size(), stallMs) <= 0) {
+            std::cerr << "Stalled with " << received << " of " << expected << " bytes received" << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            if (i < listenFds.size()) {
+                int fd = accept(fds[i].fd, NULL, NULL);
+                if (fd >= 0) {
+                    services.push_back(fd);
+                }
+                continue;
+            }
+            ssize_t n = recv(fds[i].fd, buffer.data(), buffer.size(), 0);
+            if (n <= 0) {
+                std::cerr << "The forwarder closed a session with " << received << " of " << expected << " bytes received" << std::endl;
+                return 1;
+            }
+            received += n;
+        }
+    }
+    for (int fd : clients) {
+        close(fd);
+    }
+    for (int fd : services) {
+        close(fd);
+    }
+    for (int fd : listenFds) {
+        close(fd);
+    }
+    std::cout << "Forwarded " << received << " bytes over " << clients.size() << " sessions" << std::endl;
+    return 0;
+}